@@ -0,0 +1,510 @@
+// bench/core_bench.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../core/buffer.hpp"
+#include "../core/cache.hpp"
+#include "../core/editor.hpp"
+#include "../core/tree.hpp"
+#include "../core/tree_string.hpp"
+#include "harness.hpp"
+#include "synthetic.hpp"
+
+/* Microbenchmarks of the core data structures, run over synthetic documents of several shapes.
+ * usage: treenote_bench [--format text|csv|json] [--filter STR] [--samples N] [--nodes N] [--seed N] [--list]
+ *
+ * Each benchmark is reported as the time taken per sample, and the time per item (byte, keystroke, lookup, ...).
+ * The csv and json formats are intended to be kept and compared between runs. */
+
+namespace
+{
+    using namespace treenote::core;
+    using namespace treenote::bench;
+    
+    struct settings
+    {
+        std::size_t     node_count{ 20000 };
+        std::uint64_t   seed{ 42 };
+    };
+    
+    struct document
+    {
+        const tree_shape&       shape;
+        std::string             text;
+        std::filesystem::path   path;
+    };
+    
+    
+    /* Editing scripts: precomputed so that generating them is not part of the measurement */
+    
+    enum class action_kind : std::int8_t
+    {
+        go_to,          /* a = cache entry position, b = column */
+        type,           /* text = text to insert */
+        backspace,
+        newline,
+        insert_below,
+        move_higher,
+        move_lower,
+        move_back,
+        move_forward,
+        cut,
+        paste,
+        undo,
+        redo
+    };
+    
+    struct action
+    {
+        action_kind     kind;
+        std::size_t     a{ 0 };
+        std::size_t     b{ 0 };
+        std::string     text{};
+    };
+    
+    std::vector<action> make_typing_script(const std::size_t bursts, const bool multibyte, std::mt19937_64& rng)
+    {
+        /* moves the cursor to a random place and types a few words there, making and correcting the odd mistake */
+        
+        std::vector<action> result{};
+        
+        for (std::size_t i{ 0 }; i < bursts; ++i)
+        {
+            result.push_back({ .kind = action_kind::go_to, .a = rng(), .b = rng() % 80 });
+            
+            const std::string words{ generate_line(1 + (rng() % 4), multibyte, rng()) + ' ' };
+            
+            for (std::size_t pos{ 0 }; pos < words.size();)
+            {
+                /* type one utf-8 character at a time */
+                std::size_t len{ 1 };
+                while (pos + len < words.size() and (words[pos + len] & 0xC0) == 0x80)
+                    ++len;
+                
+                result.push_back({ .kind = action_kind::type, .text = words.substr(pos, len) });
+                pos += len;
+                
+                if (rng() % 16 == 0)
+                {
+                    result.push_back({ .kind = action_kind::type, .text = "x" });
+                    result.push_back({ .kind = action_kind::backspace });
+                }
+            }
+            
+            if (rng() % 8 == 0)
+                result.push_back({ .kind = action_kind::newline });
+        }
+        
+        return result;
+    }
+    
+    std::vector<action> make_restructure_script(const std::size_t count, std::mt19937_64& rng)
+    {
+        /* a mixture of node insertion, movement, cut and paste, and undo and redo at random places */
+        
+        static constexpr action_kind kinds[]{ action_kind::insert_below, action_kind::move_higher, action_kind::move_lower,
+                                              action_kind::move_back, action_kind::move_forward, action_kind::cut,
+                                              action_kind::paste, action_kind::undo, action_kind::redo };
+        
+        std::vector<action> result{};
+        
+        for (std::size_t i{ 0 }; i < count; ++i)
+        {
+            if (rng() % 4 == 0)
+                result.push_back({ .kind = action_kind::go_to, .a = rng(), .b = 0 });
+            
+            result.push_back({ .kind = kinds[rng() % std::size(kinds)] });
+        }
+        
+        return result;
+    }
+    
+    std::size_t replay(editor& ed, const std::vector<action>& script)
+    {
+        std::size_t checksum{ 0 };
+        
+        for (const auto& act : script)
+        {
+            switch (act.kind)
+            {
+                case action_kind::go_to:
+                    ed.cursor_go_to(act.a % ed.cursor_max_y(), act.b);
+                    break;
+                case action_kind::type:
+                    ed.line_insert_text(act.text);
+                    break;
+                case action_kind::backspace:
+                    ed.line_backspace();
+                    break;
+                case action_kind::newline:
+                    ed.line_newline();
+                    break;
+                case action_kind::insert_below:
+                    ed.node_insert_below();
+                    break;
+                case action_kind::move_higher:
+                    checksum += static_cast<std::size_t>(ed.node_move_higher_rec());
+                    break;
+                case action_kind::move_lower:
+                    checksum += static_cast<std::size_t>(ed.node_move_lower_rec());
+                    break;
+                case action_kind::move_back:
+                    checksum += static_cast<std::size_t>(ed.node_move_back_rec());
+                    break;
+                case action_kind::move_forward:
+                    checksum += static_cast<std::size_t>(ed.node_move_forward_rec());
+                    break;
+                case action_kind::cut:
+                    checksum += static_cast<std::size_t>(ed.node_cut());
+                    break;
+                case action_kind::paste:
+                    checksum += static_cast<std::size_t>(ed.node_paste_default());
+                    break;
+                case action_kind::undo:
+                    checksum += static_cast<std::size_t>(ed.undo());
+                    break;
+                case action_kind::redo:
+                    checksum += static_cast<std::size_t>(ed.redo());
+                    break;
+            }
+        }
+        
+        return checksum + ed.cursor_y();
+    }
+    
+    
+    /* Benchmark registration */
+    
+    void add_buffer_benchmarks(harness& h, const settings& set)
+    {
+        for (const bool multibyte : { false, true })
+        {
+            auto lines{ std::make_shared<std::vector<std::string>>() };
+            std::size_t bytes{ 0 };
+            
+            for (std::size_t i{ 0 }; i < set.node_count; ++i)
+            {
+                lines->push_back(generate_line(8, multibyte, set.seed + i));
+                bytes += lines->back().size();
+            }
+            
+            h.add(std::string{ "buffer/append/" } + (multibyte ? "multibyte" : "ascii"), [lines, bytes](sample& s) {
+                const auto buf{ std::make_unique<buffer>() };
+                
+                s.measure([&] {
+                    for (const auto& line : *lines)
+                        s.keep(buf->append(line).first.display_length);
+                });
+                
+                s.set_items(bytes);
+            });
+        }
+    }
+    
+    void add_tree_string_benchmarks(harness& h, const settings& set)
+    {
+        for (const bool multibyte : { false, true })
+        {
+            /* replay typing into a single long line, moving the cursor every few keystrokes */
+            
+            struct keystroke
+            {
+                std::string     text;           /* empty for backspace */
+                std::size_t     move_to;        /* moves the cursor before the keystroke if not npos */
+            };
+            
+            auto script{ std::make_shared<std::vector<keystroke>>() };
+            std::mt19937_64 rng{ set.seed };
+            
+            for (const auto& act : make_typing_script(set.node_count / 8, multibyte, rng))
+            {
+                if (act.kind == action_kind::go_to)
+                    script->push_back({ .text = {}, .move_to = act.a });
+                else if (act.kind == action_kind::type)
+                    script->push_back({ .text = act.text, .move_to = std::string::npos });
+                else if (act.kind == action_kind::backspace)
+                    script->push_back({ .text = {}, .move_to = std::string::npos });
+            }
+            
+            const auto initial{ std::make_shared<std::string>(generate_line(400, multibyte, set.seed)) };
+            
+            h.add(std::string{ "tree_string/typing/" } + (multibyte ? "multibyte" : "ascii"), [script, initial](sample& s) {
+                const auto buf{ std::make_unique<buffer>() };
+                tree_string ts{ buf->append(*initial) };
+                
+                s.measure([&] {
+                    std::size_t pos{ 0 };
+                    
+                    for (const auto& [text, move_to] : *script)
+                    {
+                        if (move_to != std::string::npos)
+                        {
+                            ts.set_no_longer_current();
+                            pos = move_to % (ts.line_length(0) + 1);
+                        }
+                        else if (not text.empty())
+                        {
+                            std::size_t inc{ 0 };
+                            ts.insert_str(0, pos, buf->append(text), inc);
+                            pos += inc;
+                        }
+                        else
+                        {
+                            std::size_t dec{ 0 };
+                            ts.delete_char_before(0, pos, dec);
+                            pos -= dec;
+                        }
+                    }
+                });
+                
+                s.keep(ts.line_length(0));
+                s.set_items(script->size());
+            });
+            
+            /* extract short substrings at random positions of a long line held in a single piece table entry */
+            
+            auto positions{ std::make_shared<std::vector<std::size_t>>() };
+            
+            for (std::size_t i{ 0 }; i < set.node_count; ++i)
+                positions->push_back(rng());
+            
+            h.add(std::string{ "tree_string/substr/" } + (multibyte ? "multibyte" : "ascii"), [positions, initial](sample& s) {
+                const auto buf{ std::make_unique<buffer>() };
+                const tree_string ts{ buf->append(*initial) };
+                const std::size_t length{ ts.line_length(0) };
+                
+                s.measure([&] {
+                    for (const auto pos : *positions)
+                        s.keep(ts.to_substr(0, pos % length, 80).size());
+                });
+                
+                s.set_items(positions->size());
+            });
+        }
+    }
+    
+    void add_tree_benchmarks(harness& h, const document& doc)
+    {
+        const std::string shape{ doc.shape.name };
+        
+        h.add("tree/parse_stream/" + shape, [&doc](sample& s) {
+            const auto buf{ std::make_unique<buffer>() };
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            std::istringstream is{ doc.text };
+            std::optional<tree> result{};
+            
+            s.measure([&] { result.emplace(tree::parse(is, doc.path.string(), *buf, sli)); });
+            s.set_items(doc.text.size());
+        });
+        
+        h.add("tree/parse_mapped/" + shape, [&doc](sample& s) {
+            const auto buf{ std::make_unique<buffer>() };
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            std::optional<tree> result{};
+            
+            s.measure([&] { result.emplace(tree::parse(buf->map_file(doc.path), doc.path.string(), *buf, sli)); });
+            s.set_items(doc.text.size());
+        });
+        
+        h.add("tree/write/" + shape, [&doc](sample& s) {
+            const auto buf{ std::make_unique<buffer>() };
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            const auto tree_root{ tree::parse(buf->map_file(doc.path), doc.path.string(), *buf, sli) };
+            const int fd{ ::open("/dev/null", O_WRONLY) };
+            
+            s.measure([&] { s.keep(tree::write(fd, tree_root, sli)); });
+            s.set_items(doc.text.size());
+            ::close(fd);
+        });
+        
+        h.add("tree/build_index_cache/" + shape, [&doc](sample& s) {
+            const auto buf{ std::make_unique<buffer>() };
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            const auto tree_root{ tree::parse(buf->map_file(doc.path), doc.path.string(), *buf, sli) };
+            std::optional<tree::line_cache> result{};
+            
+            s.measure([&] { result.emplace(tree::build_index_cache(tree_root)); });
+            s.set_items(result->entries.size());
+        });
+        
+        h.add("cache/approx_pos_of_tree_idx/" + shape, [&doc](sample& s) {
+            static constexpr std::size_t lookups{ 100000 };
+            
+            const auto buf{ std::make_unique<buffer>() };
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            const auto tree_root{ tree::parse(buf->map_file(doc.path), doc.path.string(), *buf, sli) };
+            const cache c{ tree_root };
+            
+            std::mt19937_64 rng{ lookups };
+            std::vector<std::pair<std::vector<std::size_t>, std::size_t>> targets{};
+            
+            for (std::size_t i{ 0 }; i < lookups; ++i)
+            {
+                const auto pos{ rng() % c.size() };
+                const auto idx{ c.index(pos) };
+                targets.emplace_back(std::vector<std::size_t>(idx.begin(), idx.end()), c.line_no(pos));
+            }
+            
+            s.measure([&] {
+                for (const auto& [idx, line] : targets)
+                    s.keep(c.approx_pos_of_tree_idx(idx, line));
+            });
+            
+            s.set_items(lookups);
+        });
+    }
+    
+    void add_editor_benchmarks(harness& h, const document& doc, const settings& set)
+    {
+        const std::string shape{ doc.shape.name };
+        std::mt19937_64 rng{ set.seed };
+        
+        auto typing{ std::make_shared<std::vector<action>>(make_typing_script(set.node_count / 8, doc.shape.multibyte, rng)) };
+        auto restructure{ std::make_shared<std::vector<action>>(make_restructure_script(set.node_count / 8, rng)) };
+        
+        for (auto& [name, script] : { std::pair{ "typing", typing }, std::pair{ "restructure", restructure } })
+        {
+            h.add("editor/" + std::string{ name } + '/' + shape, [&doc, script](sample& s) {
+                const auto ed{ std::make_unique<editor>() };
+                static_cast<void>(ed->load_file(doc.path));
+                
+                s.measure([&] { s.keep(replay(*ed, *script)); });
+                s.set_items(script->size());
+                
+                ed->close_file(); /* discard changes, so that they are not saved on destruction */
+            });
+        }
+        
+        h.add("editor/compact/" + shape, [&doc, restructure, typing](sample& s) {
+            const auto ed{ std::make_unique<editor>() };
+            static_cast<void>(ed->load_file(doc.path));
+            static_cast<void>(replay(*ed, *typing));
+            static_cast<void>(replay(*ed, *restructure));
+            
+            s.measure([&] { s.keep(ed->compact_buffer()); });
+            s.set_items(typing->size() + restructure->size());
+            
+            ed->close_file();
+        });
+    }
+    
+    void print_usage()
+    {
+        std::cerr << "usage: treenote_bench [--format text|csv|json] [--filter STR] [--samples N] [--nodes N] "
+                     "[--seed N] [--list]\n";
+    }
+}
+
+int main(const int argc, const char* argv[])
+{
+    std::deque<std::string> args{ argv + 1 , argc + argv };
+    
+    options opts{};
+    settings set{};
+    
+    while (not args.empty())
+    {
+        const std::string arg{ std::move(args.front()) };
+        args.pop_front();
+        
+        if (arg == "--list")
+        {
+            opts.list_only = true;
+            continue;
+        }
+        
+        if (args.empty())
+        {
+            print_usage();
+            return 1;
+        }
+        
+        const std::string value{ std::move(args.front()) };
+        args.pop_front();
+        
+        if (arg == "--format" and value == "text")
+            opts.format = output_format::text;
+        else if (arg == "--format" and value == "csv")
+            opts.format = output_format::csv;
+        else if (arg == "--format" and value == "json")
+            opts.format = output_format::json;
+        else if (arg == "--filter")
+            opts.filter = value;
+        else if (arg == "--samples")
+            opts.samples = std::stoul(value);
+        else if (arg == "--nodes")
+            set.node_count = std::stoul(value);
+        else if (arg == "--seed")
+            set.seed = std::stoull(value);
+        else
+        {
+            print_usage();
+            return 1;
+        }
+    }
+    
+    opts.context = { { "nodes", std::to_string(set.node_count) }, { "seed", std::to_string(set.seed) } };
+    
+    /* documents are generated once and shared by all benchmarks; files are needed for mapping and loading */
+    
+    std::vector<document> documents{};
+    documents.reserve(standard_shapes().size());
+    
+    for (const auto& shape : standard_shapes())
+    {
+        auto& doc{ documents.emplace_back(shape, generate_document(shape, set.node_count, set.seed),
+                                          std::filesystem::temp_directory_path() /
+                                          ("treenote_bench." + std::to_string(::getpid()) + '.' + std::string{ shape.name } + ".txt")) };
+        
+        if (not opts.list_only)
+            std::ofstream{ doc.path, std::ios::binary } << doc.text;
+    }
+    
+    harness h{ opts };
+    
+    add_buffer_benchmarks(h, set);
+    add_tree_string_benchmarks(h, set);
+    
+    for (const auto& doc : documents)
+        add_tree_benchmarks(h, doc);
+    
+    for (const auto& doc : documents)
+        add_editor_benchmarks(h, doc, set);
+    
+    const int result{ h.run(std::cout) };
+    
+    for (const auto& doc : documents)
+        std::filesystem::remove(doc.path);
+    
+    return result;
+}
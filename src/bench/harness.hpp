@@ -0,0 +1,259 @@
+// bench/harness.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* A minimal microbenchmark harness.
+ * Each benchmark is a function which is called once per sample; it performs any setup it needs and then times the
+ * workload with sample::measure. Results are summarised over all samples and printed as a table, CSV, or JSON. */
+
+namespace treenote::bench
+{
+    using clock_type = std::chrono::steady_clock;
+    
+    enum class output_format : std::int8_t
+    {
+        text,
+        csv,
+        json
+    };
+    
+    struct options
+    {
+        output_format   format{ output_format::text };
+        std::string     filter{};           /* only run benchmarks whose name contains this */
+        std::size_t     samples{ 10 };
+        std::size_t     warmup{ 1 };        /* samples run before timing starts, which are discarded */
+        bool            list_only{ false };
+        
+        std::vector<std::pair<std::string, std::string>> context{};    /* parameters of the run, recorded in the output */
+    };
+    
+    class sample
+    {
+    public:
+        /* times a single run of fn; may be called more than once per sample, in which case the times add up */
+        void measure(auto&& fn)
+        {
+            const auto start{ clock_type::now() };
+            fn();
+            elapsed_ += clock_type::now() - start;
+        }
+        
+        /* number of items (bytes, keystrokes, lookups, ...) processed per sample, used to report time per item */
+        void set_items(const std::size_t items) noexcept { items_ = items; }
+        
+        /* prevents the compiler from discarding a result which is otherwise unused */
+        void keep(const std::uint64_t value) noexcept { sink_ = sink_ + value; }
+        
+        [[nodiscard]] clock_type::duration elapsed() const noexcept { return elapsed_; }
+        [[nodiscard]] std::size_t items() const noexcept { return items_; }
+    
+    private:
+        clock_type::duration        elapsed_{ 0 };
+        std::size_t                 items_{ 0 };
+        volatile std::uint64_t      sink_{ 0 };
+    };
+    
+    struct result
+    {
+        std::string     name;
+        std::size_t     samples;
+        std::size_t     items;
+        double          min_ns;
+        double          median_ns;
+        double          mean_ns;
+        double          max_ns;
+    };
+    
+    class harness
+    {
+    public:
+        explicit harness(options opts) :
+                opts_{ std::move(opts) }
+        {
+        }
+        
+        void add(std::string name, std::function<void(sample&)> fn)
+        {
+            benchmarks_.emplace_back(std::move(name), std::move(fn));
+        }
+        
+        int run(std::ostream& os);
+    
+    private:
+        [[nodiscard]] result run_one(const std::string& name, const std::function<void(sample&)>& fn) const;
+        void print_header(std::ostream& os) const;
+        void print_result(std::ostream& os, const result& r, bool first) const;
+        void print_footer(std::ostream& os) const;
+        
+        options                                                         opts_;
+        std::vector<std::pair<std::string, std::function<void(sample&)>>>  benchmarks_;
+    };
+    
+    
+    /* Implementations */
+    
+    namespace detail
+    {
+        inline double per_item(const double ns, const std::size_t items)
+        {
+            return items != 0 ? ns / static_cast<double>(items) : 0.0;
+        }
+        
+        inline std::string json_escape(const std::string_view sv)
+        {
+            std::string result{};
+            result.reserve(sv.size());
+            
+            for (const char c : sv)
+            {
+                if (c == '"' or c == '\\')
+                    result += '\\';
+                result += c;
+            }
+            
+            return result;
+        }
+    }
+    
+    inline int harness::run(std::ostream& os)
+    {
+        if (opts_.list_only)
+        {
+            for (const auto& [name, fn] : benchmarks_)
+                if (name.contains(opts_.filter))
+                    os << name << '\n';
+            return 0;
+        }
+        
+        print_header(os);
+        
+        bool first{ true };
+        
+        for (const auto& [name, fn] : benchmarks_)
+        {
+            if (not name.contains(opts_.filter))
+                continue;
+            
+            print_result(os, run_one(name, fn), first);
+            first = false;
+        }
+        
+        print_footer(os);
+        return 0;
+    }
+    
+    inline result harness::run_one(const std::string& name, const std::function<void(sample&)>& fn) const
+    {
+        for (std::size_t i{ 0 }; i < opts_.warmup; ++i)
+        {
+            sample s{};
+            fn(s);
+        }
+        
+        std::vector<double> times{};
+        std::size_t items{ 0 };
+        times.reserve(opts_.samples);
+        
+        for (std::size_t i{ 0 }; i < std::max<std::size_t>(opts_.samples, 1); ++i)
+        {
+            sample s{};
+            fn(s);
+            times.push_back(std::chrono::duration<double, std::nano>(s.elapsed()).count());
+            items = s.items();
+        }
+        
+        std::ranges::sort(times);
+        
+        const std::size_t n{ times.size() };
+        const double median{ (n % 2 == 1) ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2.0 };
+        const double mean{ std::accumulate(times.begin(), times.end(), 0.0) / static_cast<double>(n) };
+        
+        return { .name = name, .samples = n, .items = items,
+                 .min_ns = times.front(), .median_ns = median, .mean_ns = mean, .max_ns = times.back() };
+    }
+    
+    inline void harness::print_header(std::ostream& os) const
+    {
+        switch (opts_.format)
+        {
+            case output_format::text:
+                for (const auto& [key, value] : opts_.context)
+                    os << key << ": " << value << '\n';
+                os << std::left << std::setw(48) << "benchmark" << std::right
+                   << std::setw(14) << "median (ms)" << std::setw(14) << "min (ms)" << std::setw(14) << "max (ms)"
+                   << std::setw(14) << "ns/item" << '\n';
+                break;
+            case output_format::csv:
+                os << "name,samples,items,min_ns,median_ns,mean_ns,max_ns,median_ns_per_item\n";
+                break;
+            case output_format::json:
+                os << "{\n  \"context\": { \"samples\": \"" << opts_.samples << '"';
+                for (const auto& [key, value] : opts_.context)
+                    os << ", \"" << detail::json_escape(key) << "\": \"" << detail::json_escape(value) << '"';
+                os << " },\n  \"benchmarks\": [";
+                break;
+        }
+    }
+    
+    inline void harness::print_result(std::ostream& os, const result& r, const bool first) const
+    {
+        const double ns_per_item{ detail::per_item(r.median_ns, r.items) };
+        
+        switch (opts_.format)
+        {
+            case output_format::text:
+                os << std::left << std::setw(48) << r.name << std::right << std::fixed << std::setprecision(3)
+                   << std::setw(14) << r.median_ns / 1e6 << std::setw(14) << r.min_ns / 1e6
+                   << std::setw(14) << r.max_ns / 1e6 << std::setw(14) << ns_per_item << std::endl;
+                break;
+            case output_format::csv:
+                os << r.name << ',' << r.samples << ',' << r.items << std::fixed << std::setprecision(1)
+                   << ',' << r.min_ns << ',' << r.median_ns << ',' << r.mean_ns << ',' << r.max_ns
+                   << ',' << std::setprecision(3) << ns_per_item << '\n';
+                break;
+            case output_format::json:
+                os << (first ? "\n" : ",\n") << std::fixed << std::setprecision(1)
+                   << "    { \"name\": \"" << detail::json_escape(r.name) << "\", \"samples\": " << r.samples
+                   << ", \"items\": " << r.items << ", \"min_ns\": " << r.min_ns << ", \"median_ns\": " << r.median_ns
+                   << ", \"mean_ns\": " << r.mean_ns << ", \"max_ns\": " << r.max_ns
+                   << ", \"median_ns_per_item\": " << std::setprecision(3) << ns_per_item << " }";
+                break;
+        }
+    }
+    
+    inline void harness::print_footer(std::ostream& os) const
+    {
+        if (opts_.format == output_format::json)
+            os << "\n  ]\n}\n";
+    }
+}
@@ -0,0 +1,166 @@
+// bench/parse_bench.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+
+#include "../core/buffer.hpp"
+#include "../core/line_scan.hpp"
+#include "../core/tree.hpp"
+
+/* Compares the throughput of the stream parser with the mapped file parser and the line scanner on its own.
+ * usage: treenote_parse_bench [size in MB]...   (default: 1 10 100 1000) */
+
+namespace
+{
+    using namespace treenote::core;
+    using clock_type = std::chrono::steady_clock;
+    
+    void generate_file(const std::filesystem::path& path, const std::size_t target_size)
+    {
+        static constexpr std::string_view words[]{ "note", "tree", "todo", "item", "entry", "paragraph", "für", "élan", "概要", "→" };
+        
+        std::ofstream os{ path, std::ios::binary };
+        std::mt19937_64 rng{ 42 };
+        
+        std::size_t written{ 0 };
+        std::size_t depth{ 0 };
+        std::string line{};
+        
+        while (written < target_size)
+        {
+            line.clear();
+            
+            /* random walk over the depth to produce a mixture of wide and deep subtrees */
+            if (const auto r{ rng() % 8 }; r < 3 and depth < 12)
+                ++depth;
+            else if (r < 5 and depth > 0)
+                --depth;
+            
+            const bool continuation{ rng() % 6 == 0 };
+            
+            for (std::size_t i{ 0 }; i < depth; ++i)
+                line += "│   ";
+            
+            line += continuation ? "│   " : (rng() % 2 == 0 ? "├── " : "└── ");
+            
+            for (auto n{ 1 + rng() % 12 }; n > 0; --n)
+            {
+                line += words[rng() % std::size(words)];
+                line += ' ';
+            }
+            
+            line.back() = '\n';
+            os << line;
+            written += line.size();
+        }
+    }
+    
+    void report(const std::string_view name, const std::size_t bytes, const clock_type::duration elapsed)
+    {
+        const double seconds{ std::chrono::duration<double>(elapsed).count() };
+        const double mb{ static_cast<double>(bytes) / (1024.0 * 1024.0) };
+        std::cout << "  " << name << ": " << seconds * 1000.0 << " ms, " << mb / seconds << " MB/s\n";
+    }
+    
+    void run(const std::size_t size_mb)
+    {
+        const auto path{ std::filesystem::temp_directory_path() / ("treenote_parse_bench." + std::to_string(size_mb) + ".txt") };
+        generate_file(path, size_mb * 1024 * 1024);
+        
+        const std::size_t bytes{ std::filesystem::file_size(path) };
+        std::cout << size_mb << " MB (" << bytes << " bytes)\n";
+        
+        {
+            buffer buf{};
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            std::ifstream is{ path };
+            
+            const auto start{ clock_type::now() };
+            const auto result{ tree::parse(is, path.string(), buf, sli) };
+            report("stream parse", bytes, clock_type::now() - start);
+        }
+        
+        {
+            buffer buf{};
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            
+            const auto start{ clock_type::now() };
+            const auto mapped{ buf.map_file(path) };
+            const auto result{ tree::parse(mapped, path.string(), buf, sli) };
+            report("mapped parse", bytes, clock_type::now() - start);
+        }
+        
+        if (const unsigned int jobs{ std::thread::hardware_concurrency() }; jobs > 1)
+        {
+            buffer buf{};
+            save_load_info sli{ .node_count = 0, .line_count = 0 };
+            
+            const auto start{ clock_type::now() };
+            const auto mapped{ buf.map_file(path) };
+            const auto result{ tree::parse(mapped, path.string(), buf, sli, jobs) };
+            report("mapped parse (" + std::to_string(jobs) + " jobs)", bytes, clock_type::now() - start);
+        }
+        
+        {
+            buffer buf{};
+            const auto mapped{ buf.map_file(path) };
+            
+            std::size_t pos{ 0 };
+            std::size_t indent_level{ 0 };
+            std::uint64_t checksum{ 0 };
+            
+            const auto start{ clock_type::now() };
+            
+            while (pos < mapped.size())
+            {
+                const auto prefix{ line_scan::scan_prefix(mapped, pos, indent_level) };
+                indent_level = prefix.indent_level;
+                pos = line_scan::find_line_end(mapped, prefix.content_pos) + 1;
+                checksum += indent_level;
+            }
+            
+            report("line scan only", bytes, clock_type::now() - start);
+            std::cout << "  (indent checksum " << checksum << ")\n";
+        }
+        
+        std::filesystem::remove(path);
+    }
+}
+
+int main(const int argc, const char* argv[])
+{
+    std::deque<std::string> args{ argv + 1 , argc + argv };
+    
+    if (args.empty())
+        args = { "1", "10", "100", "1000" };
+    
+    for (const auto& arg : args)
+        run(std::stoul(arg));
+    
+    return 0;
+}
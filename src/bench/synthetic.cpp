@@ -0,0 +1,140 @@
+// bench/synthetic.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "synthetic.hpp"
+
+#include <algorithm>
+#include <array>
+#include <random>
+
+namespace treenote::bench
+{
+    namespace detail
+    {
+        namespace
+        {
+            constexpr std::array<std::string_view, 10> ascii_words{ "note", "tree", "todo", "item", "entry", "paragraph",
+                                                                     "the", "of", "section", "reference" };
+            
+            constexpr std::array<std::string_view, 10> multibyte_words{ "für", "élan", "概要", "→", "naïve", "Ωμέγα",
+                                                                         "日本語", "tree", "😀", "Привет" };
+            
+            constexpr std::array<tree_shape, 4> shapes{ {
+                    { .name = "wide",      .fan_out = 64, .depth = 2,   .lines_per_node = 1, .words_per_line = 6,   .multibyte = false },
+                    { .name = "deep",      .fan_out = 1,  .depth = 256, .lines_per_node = 1, .words_per_line = 6,   .multibyte = false },
+                    { .name = "long_line", .fan_out = 8,  .depth = 2,   .lines_per_node = 3, .words_per_line = 200, .multibyte = false },
+                    { .name = "multibyte", .fan_out = 5,  .depth = 3,   .lines_per_node = 2, .words_per_line = 8,   .multibyte = true  },
+            } };
+            
+            constexpr std::string_view marker_mid{ "├── " };
+            constexpr std::string_view marker_end{ "└── " };
+            constexpr std::string_view indent_mid{ "│   " };
+            constexpr std::string_view indent_end{ "    " };
+            constexpr std::string_view v_line{ "│" };
+            
+            void append_words(std::string& out, const std::size_t count, const bool multibyte, std::mt19937_64& rng)
+            {
+                const auto& words{ multibyte ? multibyte_words : ascii_words };
+                
+                for (std::size_t i{ 0 }; i < count; ++i)
+                {
+                    if (i != 0)
+                        out += ' ';
+                    out += words[rng() % words.size()];
+                }
+            }
+            
+            std::size_t subtree_size(const tree_shape& shape, const std::size_t depth)
+            {
+                /* number of nodes in a subtree whose root is at the given depth */
+                
+                std::size_t result{ 1 };
+                
+                for (std::size_t d{ shape.depth }; d > depth; --d)
+                    result = 1 + (shape.fan_out * result);
+                
+                return result;
+            }
+            
+            void emit_node(std::string& out, std::string& prefix, const tree_shape& shape, const std::size_t depth,
+                           const bool has_next, std::mt19937_64& rng)
+            {
+                /* prefix contains the indentation of the continuation lines of the parent node */
+                
+                const std::size_t parent_prefix_size{ prefix.size() };
+                
+                if (depth > 1)
+                {
+                    out += prefix;
+                    out += has_next ? marker_mid : marker_end;
+                    prefix += has_next ? indent_mid : indent_end;
+                }
+                
+                /* continuation lines of top level nodes cannot be told apart from new top level nodes, and neither can
+                 * those indented by spaces alone (as for a last child whose ancestors below the top level are last
+                 * children too), since a top level node may begin with spaces; so such nodes only have one line    */
+                const bool has_v_line{ prefix.find(v_line) != std::string::npos };
+                const std::size_t line_count{ has_v_line ? shape.lines_per_node : 1 };
+                
+                for (std::size_t line{ 0 }; line < line_count; ++line)
+                {
+                    if (line != 0)
+                        out += prefix;
+                    
+                    append_words(out, 1 + (rng() % shape.words_per_line), shape.multibyte, rng);
+                    out += '\n';
+                }
+                
+                if (depth < shape.depth)
+                    for (std::size_t i{ 0 }; i < shape.fan_out; ++i)
+                        emit_node(out, prefix, shape, depth + 1, i + 1 != shape.fan_out, rng);
+                
+                prefix.resize(parent_prefix_size);
+            }
+        }
+    }
+    
+    std::span<const tree_shape> standard_shapes()
+    {
+        return detail::shapes;
+    }
+    
+    std::string generate_document(const tree_shape& shape, const std::size_t node_count, const std::uint64_t seed)
+    {
+        std::mt19937_64 rng{ seed };
+        std::string result{};
+        std::string prefix{};
+        
+        const std::size_t top_level_count{ std::max<std::size_t>(1, node_count / detail::subtree_size(shape, 1)) };
+        
+        for (std::size_t i{ 0 }; i < top_level_count; ++i)
+            detail::emit_node(result, prefix, shape, 1, i + 1 != top_level_count, rng);
+        
+        return result;
+    }
+    
+    std::string generate_line(const std::size_t word_count, const bool multibyte, const std::uint64_t seed)
+    {
+        std::mt19937_64 rng{ seed };
+        std::string result{};
+        detail::append_words(result, word_count, multibyte, rng);
+        return result;
+    }
+}
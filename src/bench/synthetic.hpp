@@ -0,0 +1,54 @@
+// bench/synthetic.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+/* Generators of synthetic documents in the file format written by tree::write */
+
+namespace treenote::bench
+{
+    struct tree_shape
+    {
+        std::string_view    name;
+        std::size_t         fan_out;            /* children of every node above the deepest level */
+        std::size_t         depth;              /* depth of the deepest nodes (top level nodes have depth 1) */
+        std::size_t         lines_per_node;     /* (top level nodes, and those indented by spaces alone, always have one line) */
+        std::size_t         words_per_line;
+        bool                multibyte;          /* whether words are drawn from a mostly non-ascii word list */
+    };
+    
+    /* wide:        few levels with many children each
+     * deep:        long chains of single children
+     * long_line:   few nodes with several very long lines each
+     * multibyte:   a moderately bushy tree of mostly non-ascii text */
+    
+    [[nodiscard]] std::span<const tree_shape> standard_shapes();
+    
+    /* generates a document of approximately node_count nodes; the output is deterministic for a given seed */
+    [[nodiscard]] std::string generate_document(const tree_shape& shape, std::size_t node_count, std::uint64_t seed);
+    
+    /* generates a line of words (without a trailing newline) */
+    [[nodiscard]] std::string generate_line(std::size_t word_count, bool multibyte, std::uint64_t seed);
+}
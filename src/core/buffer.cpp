@@ -20,6 +20,15 @@
 
 #include "buffer.hpp"
 
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "utf8.hpp"
 
 namespace treenote::core
@@ -33,6 +42,12 @@ namespace treenote::core
         blocks_.emplace_back(std::move(victim_block_)); /* bit hacky */
     }
     
+    buffer::~buffer()
+    {
+        for (const auto& region : mapped_regions_)
+            ::munmap(const_cast<char*>(region.data), region.size);
+    }
+    
     
     /* Implementation of append_iter increment and decrement */
     
@@ -77,158 +92,407 @@ namespace treenote::core
     }
     
     
-    /* Buffer reading function implementation */
+    /* Mapped region implementation */
     
-    void buffer::sv_helper(std::vector<std::string_view>& result, sv_helper_info info) const
+    std::span<const char> buffer::map_file(const std::filesystem::path& path)
     {
-        while (info.bytes_to_extract != 0)
+        const int fd{ ::open(path.c_str(), O_RDONLY | O_CLOEXEC) };
+        
+        if (fd < 0)
+            return {};
+        
+        struct stat st{};
+        void* data{ MAP_FAILED };
+        
+        /* note: empty files cannot be mapped; callers fall back to reading through a stream */
+        if (::fstat(fd, &st) == 0 and S_ISREG(st.st_mode) and st.st_size > 0)
+            data = ::mmap(nullptr, static_cast<std::size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        
+        ::close(fd); /* the mapping remains valid after the descriptor is closed */
+        
+        if (data == MAP_FAILED)
+            return {};
+        
+        const std::size_t size{ static_cast<std::size_t>(st.st_size) };
+        const std::size_t start_index{ mapped_regions_.empty() ? mapped_base
+                                                               : mapped_regions_.back().start_index + mapped_regions_.back().size };
+        
+        ::posix_madvise(data, size, POSIX_MADV_SEQUENTIAL); /* the file is about to be parsed front to back */
+        
+        mapped_regions_.emplace_back(static_cast<const char*>(data), size, start_index);
+        return { mapped_regions_.back().data, size };
+    }
+    
+    extended_piece_table_entry buffer::reference_mapped(const std::span<const char> text, const std::size_t display_length)
+    {
+        const auto& region{ mapped_regions_.back() };
+        
+        const piece_table_entry result{ .start_index = region.start_index + static_cast<std::size_t>(text.data() - region.data),
+                                        .display_length = display_length,
+                                        .byte_length = text.size() };
+        
+        return { result, this };
+    }
+    
+    std::optional<std::size_t> buffer::unaltered_display_length(const std::span<const char> text) noexcept
+    {
+        /* mirrors the validation performed by append() */
+        
+        std::size_t display_length{ 0 };
+        
+        for (auto it{ text.begin() }; it != text.end(); ++display_length)
         {
-            const auto& data{ blocks_[info.block_index]->data_};
+            const char c{ *it };
+            ++it;
             
-            const char* begin{ std::ranges::next(std::ranges::cbegin(data), static_cast<std::ptrdiff_t>(info.initial_offset)) };
-            const char* end{ std::ranges::next(begin, static_cast<std::ptrdiff_t>(info.bytes_to_extract), std::ranges::cend(data)) };
-            result.emplace_back(begin, end);
+            if (c == '\n' or c == '\0')
+                return std::nullopt;
             
-            info.initial_offset = 0;
-            info.bytes_to_extract -= result.back().size();
-            ++info.block_index;
+            if ((c & utf8::mask1) == utf8::test1)
+                continue;
+            
+            int char_length{ 1 };
+            
+            if ((c & utf8::mask2) == utf8::test2)
+                char_length = 2;
+            else if ((c & utf8::mask3) == utf8::test3)
+                char_length = 3;
+            else if ((c & utf8::mask4) == utf8::test4)
+                char_length = 4;
+            
+            for (int i{ 1 }; i < char_length; ++i, ++it)
+            {
+                if (it == text.end() or (*it & utf8::mask_cont) != utf8::test_cont)
+                    return std::nullopt;
+            }
+        }
+        
+        return display_length;
+    }
+    
+    std::pair<std::size_t, bool> buffer::append_extent(const std::span<const char> input) noexcept
+    {
+        /* mirrors the extraction loop of append(); note that continuation bytes are consumed even if they are delimiters */
+        
+        std::size_t pos{ 0 };
+        
+        while (pos < input.size())
+        {
+            const char c{ input[pos] };
+            
+            if (c == '\n' or c == '\0')
+                return { pos + 1, true };
+            
+            ++pos;
+            
+            if ((c & utf8::mask1) == utf8::test1)
+                continue;
+            
+            int char_length{ 1 };
+            
+            if ((c & utf8::mask2) == utf8::test2)
+                char_length = 2;
+            else if ((c & utf8::mask3) == utf8::test3)
+                char_length = 3;
+            else if ((c & utf8::mask4) == utf8::test4)
+                char_length = 4;
+            
+            for (int i{ 1 }; i < char_length and pos < input.size(); ++i)
+                ++pos;
         }
+        
+        return { input.size(), false };
+    }
+    
+    const buffer::mapped_region& buffer::region_of(const std::size_t pos) const
+    {
+        return region_of(mapped_regions_, pos);
     }
     
-    [[nodiscard]] std::size_t buffer::sv_char_count_to_byte_count(sv_helper_info info, std::size_t chars_to_count) const
+    const buffer::mapped_region& buffer::region_of(const std::span<const mapped_region> regions, const std::size_t pos)
+    {
+        /* assume: pos >= mapped_base, so at least one region exists */
+        const auto it{ std::ranges::upper_bound(regions, pos, std::ranges::less{}, &mapped_region::start_index) };
+        return *std::ranges::prev(it);
+    }
+    
+    
+    /* Compaction implementation */
+    
+    buffer::relocation buffer::compact(std::vector<live_range> ranges)
     {
-        const char* begin{ std::ranges::next(std::ranges::cbegin(blocks_[info.block_index]->data_), static_cast<std::ptrdiff_t>(info.initial_offset)) };
-        const char* end{ std::ranges::cend(blocks_[info.block_index]->data_) };
-        info.bytes_to_extract = 0;
+        relocation result{};
         
-        int char_length = 1;
+        std::ranges::sort(ranges, std::ranges::less{}, &live_range::start_index);
         
-        while (chars_to_count > 0)
+        /* unmap regions which no range refers to (mapped text is never copied) */
+        
+        std::vector<mapped_region> kept_regions{};
+        
+        for (const auto& region : mapped_regions_)
         {
-            if ((*begin & utf8::mask1) != utf8::test1)
+            const auto it{ std::ranges::lower_bound(ranges, region.start_index, std::ranges::less{}, &live_range::start_index) };
+            
+            if (it != std::ranges::end(ranges) and it->start_index <= region.start_index + region.size)
+            {
+                kept_regions.push_back(region);
+            }
+            else
+            {
+                ::munmap(const_cast<char*>(region.data), region.size);
+                result.bytes_reclaimed_ += region.size;
+            }
+        }
+        
+        mapped_regions_ = std::move(kept_regions);
+        
+        /* copy the text of the ranges within blocks to new blocks, merging ranges which overlap or touch */
+        
+        const std::size_t old_size{ stored_size() };
+        std::vector<std::unique_ptr<block>> new_blocks{};
+        std::size_t new_size{ 0 };
+        
+        const auto write{ [&](std::span<const char> chunk) {
+            while (not chunk.empty())
             {
-                if ((*begin & utf8::mask2) == utf8::test2)
-                    char_length = 2;
-                else if ((*begin & utf8::mask3) == utf8::test3)
-                    char_length = 3;
-                else if ((*begin & utf8::mask4) == utf8::test4)
-                    char_length = 4;
+                if (new_size / buf_size == new_blocks.size())
+                    new_blocks.emplace_back(std::make_unique<block>());
+                
+                const std::size_t offset{ new_size % buf_size };
+                const std::size_t amt{ std::min(chunk.size(), buf_size - offset) };
+                std::ranges::copy(chunk.first(amt), std::ranges::next(std::ranges::begin(new_blocks.back()->data_), static_cast<std::ptrdiff_t>(offset)));
+                
+                chunk = chunk.subspan(amt);
+                new_size += amt;
             }
+        } };
+        
+        for (auto it{ std::ranges::begin(ranges) }; it != std::ranges::end(ranges) and it->start_index < mapped_base;)
+        {
+            const std::size_t start{ it->start_index };
+            std::size_t end{ start + it->byte_length };
             
-            if (char_length == 1)
-                --chars_to_count;
+            for (++it; it != std::ranges::end(ranges) and it->start_index <= end; ++it)
+                end = std::max(end, it->start_index + it->byte_length);
+            
+            result.ranges_.push_back({ .old_start = start, .new_start = new_size });
+            
+            for (const auto chunk : spans(start, end - start))
+                write(chunk);
+            
+            /* leave a gap so that text appended later is not adjacent to this text (unless it would have been before) */
+            if (end != old_size)
+                ++new_size;
+        }
+        
+        if (new_size / buf_size == new_blocks.size())
+            new_blocks.emplace_back(std::make_unique<block>());
+        
+        blocks_ = std::move(new_blocks);
+        victim_block_.reset();
+        append_iter_ = std::ranges::next(std::ranges::begin(blocks_.back()->data_), static_cast<std::ptrdiff_t>(new_size % buf_size));
+        checkpoints_.clear();
+        
+        result.bytes_reclaimed_ += old_size - new_size;
+        return result;
+    }
+    
+    std::size_t buffer::relocation::operator()(const std::size_t start_index) const
+    {
+        if (start_index >= mapped_base)
+            return start_index;
+        
+        const auto it{ std::ranges::upper_bound(ranges_, start_index, std::ranges::less{}, &moved_range::old_start) };
+        
+        if (it == std::ranges::begin(ranges_))
+            throw std::out_of_range("buffer::relocation: start index was not within a range passed to compact()");
+        
+        const auto& range{ *std::ranges::prev(it) };
+        return range.new_start + (start_index - range.old_start);
+    }
+    
+    
+    /* Buffer reading function implementation */
+    
+    void buffer::sv_helper(std::vector<std::string_view>& result, const sv_helper_info info) const
+    {
+        sv_helper(result, info, blocks_, mapped_regions_);
+    }
+    
+    void buffer::sv_helper(std::vector<std::string_view>& result, sv_helper_info info, const auto& blocks,
+                           const std::span<const mapped_region> regions)
+    {
+        /* blocks is either blocks_ or the block pointers held by a reader */
+        
+        const auto block_data{ [&](const std::size_t i) -> const char* {
+            if constexpr (std::is_pointer_v<std::ranges::range_value_t<decltype(blocks)>>)
+                return blocks[i];
             else
-                --char_length;
+                return blocks[i]->data_.data();
+        } };
+        
+        if (info.start_index >= mapped_base)
+        {
+            const auto& region{ region_of(regions, info.start_index) };
+            result.emplace_back(region.data + (info.start_index - region.start_index), info.bytes_to_extract);
+            return;
+        }
+        
+        std::size_t block_index{ info.start_index / buf_size };
+        std::size_t initial_offset{ info.start_index % buf_size };
+        
+        while (info.bytes_to_extract != 0)
+        {
+            const char* data{ block_data(block_index) };
             
-            ++info.bytes_to_extract;
-            begin = std::next(begin);
+            const char* begin{ data + initial_offset };
+            const char* end{ begin + std::min(info.bytes_to_extract, buf_size - initial_offset) };
+            result.emplace_back(begin, end);
             
-            if (begin == end)
-            {
-                ++info.block_index;
-                begin = std::ranges::cbegin(blocks_[info.block_index]->data_);
-                end = std::ranges::cend(blocks_[info.block_index]->data_);
-            }
+            initial_offset = 0;
+            info.bytes_to_extract -= result.back().size();
+            ++block_index;
+        }
+    }
+    
+    void buffer::append_str_view(const piece_table_entry& entry, std::vector<std::string_view>& result) const
+    {
+        sv_helper(result, { .start_index = entry.start_index, .bytes_to_extract = entry.byte_length });
+    }
+    
+    buffer::reader buffer::make_reader() const
+    {
+        reader result{};
+        result.source_ = this;
+        result.blocks_.reserve(blocks_.size());
+        
+        for (const auto& b : blocks_)
+            result.blocks_.push_back(b->data_.data());
+        
+        result.mapped_regions_ = mapped_regions_;
+        return result;
+    }
+    
+    void buffer::reader::append_str_view(const piece_table_entry& entry, std::vector<std::string_view>& result) const
+    {
+        sv_helper(result, { .start_index = entry.start_index, .bytes_to_extract = entry.byte_length }, blocks_, mapped_regions_);
+    }
+    
+    void buffer::span_iterator::load()
+    {
+        /* sets current_ to the longest contiguous span starting at next_index_, or to an empty span if no bytes remain */
+        
+        if (remaining_ == 0)
+        {
+            current_ = {};
+            return;
         }
         
-        return info.bytes_to_extract;
+        std::size_t size;
+        const char* begin;
+        
+        if (next_index_ >= mapped_base)
+        {
+            /* mapped regions are contiguous, so the end of the region is never crossed */
+            const auto& region{ data_->region_of(next_index_) };
+            begin = region.data + (next_index_ - region.start_index);
+            size = std::min(remaining_, region.size - (next_index_ - region.start_index));
+        }
+        else
+        {
+            begin = data_->blocks_[next_index_ / buf_size]->data_.data() + next_index_ % buf_size;
+            size = std::min(remaining_, buf_size - next_index_ % buf_size);
+        }
+        
+        current_ = { begin, size };
+        next_index_ += size;
+        remaining_ -= size;
     }
     
-    [[nodiscard]] std::vector<std::string_view> buffer::to_str_view(const piece_table_line& line) const
+    std::optional<std::size_t> buffer::find(const std::size_t start_index, const std::size_t byte_count, const char c) const
     {
-        std::vector<std::string_view> result;
+        std::size_t offset{ 0 };
         
-        for (const auto& entry : line)
+        for (const auto chunk : spans(start_index, byte_count))
         {
-            sv_helper(result, { .block_index = entry.start_index / buf_size,
-                    .initial_offset = entry.start_index % buf_size,
-                    .bytes_to_extract = entry.byte_length });
+            if (const auto it{ std::ranges::find(chunk, c) }; it != std::ranges::end(chunk))
+                return offset + static_cast<std::size_t>(it - std::ranges::begin(chunk));
+            
+            offset += chunk.size();
         }
         
+        return {};
+    }
+    
+    std::size_t buffer::count_chars(const std::size_t start_index, const std::size_t byte_count) const
+    {
+        std::size_t result{ 0 };
+        
+        for (const auto chunk : spans(start_index, byte_count))
+            result += static_cast<std::size_t>(std::ranges::count_if(chunk, [](const char c) { return (c & utf8::mask_cont) != utf8::test_cont; }));
+        
         return result;
     }
     
-    [[nodiscard]] std::vector<std::string_view> buffer::to_substr_view(const piece_table_line& line, const std::size_t pos, const std::size_t len) const
+    std::size_t buffer::char_count_to_byte_count(const std::size_t start_index, const std::size_t byte_count, std::size_t chars_to_count) const
     {
-        std::vector<std::string_view> result;
+        /* chars are counted at their first byte, so the offset of char chars_to_count is that of the next first byte */
         
-        std::size_t ignored_count{ 0 };
-        std::size_t result_count{ 0 };
+        std::size_t offset{ 0 };
         
-        for (const auto& entry: line)
+        for (const auto chunk : spans(start_index, byte_count))
         {
-            if (ignored_count >= pos)
+            for (const char c : chunk)
             {
-                if (result_count > len)
-                    break; /* don't extract string any further; we're done */
-                
-                if (result_count + entry.display_length <= len)
+                if ((c & utf8::mask_cont) != utf8::test_cont)
                 {
-                    /* extract entire string fragment */
-                    sv_helper(result, { .block_index = entry.start_index / buf_size,
-                                        .initial_offset = entry.start_index % buf_size,
-                                        .bytes_to_extract = entry.byte_length });
-                    
-                    result_count += entry.display_length;
-                }
-                else
-                {
-                    /* extract string fragment until we have len characters in total */
-                    
-                    sv_helper_info info{ .block_index = entry.start_index / buf_size,
-                                         .initial_offset = entry.start_index % buf_size,
-                                         .bytes_to_extract = len - result_count };
-                    
-                    if (not entry_has_no_mb_char(entry))
-                    {
-                        /* string fragment contains multibyte characters: proceed carefully */
-                        info.bytes_to_extract = sv_char_count_to_byte_count(info, len - result_count);
-                    }
+                    if (chars_to_count == 0)
+                        return offset;
                     
-                    sv_helper(result, info);
-                    
-                    result_count += len - result_count;
-                }
-            }
-            else if (ignored_count + entry.display_length > pos)
-            {
-                /* discard string fragment until ignored_count > pos */
-                
-                const std::size_t chars_skipped{ pos - ignored_count };
-                std::size_t bytes_skipped{ chars_skipped };
-                
-                if (not entry_has_no_mb_char(entry))
-                {
-                    /* string fragment contains multibyte characters: proceed carefully */
-                    bytes_skipped = sv_char_count_to_byte_count({ .block_index = entry.start_index / buf_size,
-                                                                  .initial_offset = entry.start_index % buf_size,
-                                                                  .bytes_to_extract = 0 /* this value doesn't matter */
-                                                                }, chars_skipped);
-                }
-                
-                ignored_count = pos;
-                const std::size_t chars_to_extract{ std::min(len - result_count, entry.display_length - chars_skipped) };
-                
-                sv_helper_info info{ .block_index = (entry.start_index + bytes_skipped) / buf_size,
-                                     .initial_offset = (entry.start_index + bytes_skipped) % buf_size,
-                                     .bytes_to_extract = chars_to_extract };
-                
-                if (not entry_has_no_mb_char(entry))
-                {
-                    /* string fragment contains multibyte characters: proceed carefully */
-                    info.bytes_to_extract = sv_char_count_to_byte_count(info, chars_to_extract);
+                    --chars_to_count;
                 }
                 
-                sv_helper(result, info);
-                
-                result_count += chars_to_extract;
-            }
-            else
-            {
-                ignored_count += entry.display_length;
+                ++offset;
             }
         }
         
-        return result;
+        return offset;
+    }
+    
+    std::size_t buffer::byte_offset_of_char(const piece_table_entry& entry, const std::size_t pos_in_entry) const
+    {
+        if (entry_has_no_mb_char(entry))
+            return pos_in_entry;
+        
+        if (pos_in_entry >= entry.display_length)
+            return entry.byte_length;
+        
+        if (pos_in_entry < checkpoint_interval)
+            return char_count_to_byte_count(entry.start_index, entry.byte_length, pos_in_entry);
+        
+        /* string fragment is long and contains multibyte characters: walk from the nearest checkpoint, recording any
+         * checkpoints before it which have not been reached before                                                   */
+        
+        auto& checkpoints{ checkpoints_[entry.start_index] };
+        const std::size_t needed{ pos_in_entry / checkpoint_interval };
+        
+        while (checkpoints.size() < needed)
+        {
+            const std::size_t previous{ checkpoints.empty() ? 0 : checkpoints.back() };
+            checkpoints.push_back(previous + char_count_to_byte_count(entry.start_index + previous, entry.byte_length - previous, checkpoint_interval));
+        }
+        
+        const std::size_t nearest{ checkpoints[needed - 1] };
+        return nearest + char_count_to_byte_count(entry.start_index + nearest, entry.byte_length - nearest, pos_in_entry % checkpoint_interval);
+    }
+    
+    void buffer::append_substr_view(const piece_table_entry& entry, const std::size_t pos_in_entry, const std::size_t len, std::vector<std::string_view>& result) const
+    {
+        /* assume: pos_in_entry + len <= entry.display_length */
+        
+        const std::size_t first_byte{ byte_offset_of_char(entry, pos_in_entry) };
+        const std::size_t last_byte{ byte_offset_of_char(entry, pos_in_entry + len) };
+        
+        sv_helper(result, { .start_index = entry.start_index + first_byte, .bytes_to_extract = last_byte - first_byte });
     }
-}
\ No newline at end of file
+}
@@ -21,8 +21,14 @@
 #pragma once
 
 #include <compare>
+#include <filesystem>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <optional>
+#include <ranges>
+#include <span>
+#include <unordered_map>
 #include <vector>
 
 #include "table.hpp"
@@ -37,6 +43,9 @@ namespace treenote::core
     {
     public:
         struct proxy_index_iterator;
+        struct span_iterator;
+        class reader;
+        class relocation;
         using const_iterator = proxy_index_iterator;
         using const_reverse_iterator = std::reverse_iterator<const_iterator>;
         
@@ -46,14 +55,62 @@ namespace treenote::core
         buffer(buffer&&) = delete;
         buffer& operator=(const buffer&) = delete;
         buffer& operator=(buffer&&) = delete;
-        ~buffer() = default;
+        ~buffer();
         
         extended_piece_table_entry append(std::ranges::input_range auto input_range);
         
+        /* Read-only file regions: the contents of a mapped file are referenced in place and never copied */
+        /* reference_mapped requires text to lie within the most recently mapped region */
+        
+        [[nodiscard]] std::span<const char> map_file(const std::filesystem::path& path);
+        [[nodiscard]] extended_piece_table_entry reference_mapped(std::span<const char> text, std::size_t display_length);
+        
+        /* Functions predicting the behaviour of append() without modifying any buffer; safe to call from any thread */
+        /* unaltered_display_length returns nullopt if append() would alter text (i.e. it is not valid utf-8)    */
+        /* append_extent returns the number of bytes append() consumes, and whether it stopped at a delimiter     */
+        
+        [[nodiscard]] static std::optional<std::size_t> unaltered_display_length(std::span<const char> text) noexcept;
+        [[nodiscard]] static std::pair<std::size_t, bool> append_extent(std::span<const char> input) noexcept;
+        
         [[nodiscard]] char at(std::size_t pos) const;
         
-        [[nodiscard]] std::vector<std::string_view> to_str_view(const piece_table_line& line) const;
-        [[nodiscard]] std::vector<std::string_view> to_substr_view(const piece_table_line& line, std::size_t pos, std::size_t len) const;
+        /* Algorithms over the text of [start_index, start_index + byte_count), processed one span at a time       */
+        /* find returns the offset of the first occurrence of c; char_count_to_byte_count returns the offset of char
+         * chars_to_count (or byte_count if the text has fewer chars)                                              */
+        
+        [[nodiscard]] std::optional<std::size_t> find(std::size_t start_index, std::size_t byte_count, char c) const;
+        [[nodiscard]] std::size_t count_chars(std::size_t start_index, std::size_t byte_count) const;
+        [[nodiscard]] std::size_t char_count_to_byte_count(std::size_t start_index, std::size_t byte_count, std::size_t chars_to_count) const;
+        
+        /* Returns the number of bytes in entry before char pos_in_entry (where pos_in_entry <= entry.display_length) */
+        /* note: this records checkpoints for long entries containing multibyte characters, so is not thread safe     */
+        
+        [[nodiscard]] std::size_t byte_offset_of_char(const piece_table_entry& entry, std::size_t pos_in_entry) const;
+        
+        /* append_substr_view appends a view of the len chars of entry starting from char pos_in_entry */
+        
+        void append_str_view(const piece_table_entry& entry, std::vector<std::string_view>& result) const;
+        void append_substr_view(const piece_table_entry& entry, std::size_t pos_in_entry, std::size_t len, std::vector<std::string_view>& result) const;
+        
+        /* Compaction: copies the text of the given ranges (and nothing else) to new blocks, and unmaps any mapped region
+         * which no range refers to; ranges which overlap or touch remain adjacent, and all other ranges are kept apart */
+        /* note: this invalidates every start index within a block (see relocation) and every reader                    */
+        
+        struct live_range
+        {
+            std::size_t start_index;
+            std::size_t byte_length;
+        };
+        
+        [[nodiscard]] relocation compact(std::vector<live_range> ranges);
+        
+        /* Returns the number of bytes held in blocks (i.e. excluding mapped regions) */
+        
+        [[nodiscard]] std::size_t stored_size() const;
+        
+        /* Returns a view of the current contents which may be read from another thread while appends continue */
+        
+        [[nodiscard]] reader make_reader() const;
         
         [[nodiscard]] const_iterator cbegin() const noexcept;
         [[nodiscard]] const_iterator cend() const;
@@ -110,8 +167,57 @@ namespace treenote::core
         
         static_assert(std::random_access_iterator<proxy_index_iterator>); /* ensure that our proxy iterator is sufficiently valid */
         
+        struct span_iterator
+        {
+            using iterator_concept                      = std::forward_iterator_tag;
+            using difference_type                       = std::ptrdiff_t;
+            using value_type                            = std::span<const char>;
+            
+            span_iterator() noexcept = default;
+            
+            span_iterator(const buffer* data, const std::size_t start_index, const std::size_t byte_count) :
+                    data_{ data }, next_index_{ start_index }, remaining_{ byte_count }
+            {
+                load();
+            }
+            
+            value_type operator*() const noexcept { return current_; }
+            
+            span_iterator& operator++() { load(); return *this; }
+            span_iterator operator++(int) { const auto old{ *this }; operator++(); return old; }
+            
+            [[nodiscard]] bool operator==(const span_iterator& other) const noexcept
+            {
+                return current_.data() == other.current_.data() and remaining_ == other.remaining_;
+            }
+            
+            [[nodiscard]] bool operator==(std::default_sentinel_t) const noexcept { return current_.empty(); }
+            
+        private:
+            void load();
+            
+            const buffer* data_{ nullptr };
+            std::size_t next_index_{ 0 };
+            std::size_t remaining_{ 0 };
+            std::span<const char> current_;
+        };
+        
+        static_assert(std::forward_iterator<span_iterator>);
+        
+        using span_range = std::ranges::subrange<span_iterator, std::default_sentinel_t>;
+        
+        /* Returns the text of [start_index, start_index + byte_count) as contiguous spans (one per block or mapped region) */
+        /* note: prefer this to iterating over chars, as it avoids indexing into blocks for every byte                    */
+        
+        [[nodiscard]] span_range spans(std::size_t start_index, std::size_t byte_count) const;
+        [[nodiscard]] span_range spans(const piece_table_entry& entry) const;
+        
     private:
         static constexpr std::size_t buf_size{ 1024 };
+        static constexpr std::size_t checkpoint_interval{ 64 };
+        
+        /* indices at or above this value refer to mapped regions instead of blocks */
+        static constexpr std::size_t mapped_base{ std::size_t{ 1 } << (std::numeric_limits<std::size_t>::digits - 2) };
         
         class block
         {
@@ -130,15 +236,25 @@ namespace treenote::core
             std::array<char, buf_size> data_{};
         };
         
+        struct mapped_region
+        {
+            const char*     data;
+            std::size_t     size;
+            std::size_t     start_index;    /* index of the first byte of the region within this buffer */
+        };
+        
         struct sv_helper_info
         {
-            std::size_t block_index;
-            std::size_t initial_offset;
+            std::size_t start_index;
             std::size_t bytes_to_extract;
         };
         
+        [[nodiscard]] const mapped_region& region_of(std::size_t pos) const;
+        [[nodiscard]] static const mapped_region& region_of(std::span<const mapped_region> regions, std::size_t pos);
+        
         void sv_helper(std::vector<std::string_view>& result, sv_helper_info info) const;
-        [[nodiscard]] std::size_t sv_char_count_to_byte_count(sv_helper_info info, std::size_t chars_to_count) const;
+        static void sv_helper(std::vector<std::string_view>& result, sv_helper_info info, const auto& blocks,
+                              std::span<const mapped_region> regions);
         
         void increment_append_iter();
         void decrement_append_iter();
@@ -151,6 +267,51 @@ namespace treenote::core
                                                                 /* note: use increment_append_iter and decrement_append_iter
                                                                  *       to move the position                                   */
         
+        std::vector<mapped_region>          mapped_regions_;    /* sorted by start_index; regions are unmapped on destruction   */
+        
+        /* for each start_index of an entry containing multibyte characters, element k is the byte offset of char
+         * (k + 1) * checkpoint_interval of the entry; these stay valid as the text in the buffer never changes  */
+        mutable std::unordered_map<std::size_t, std::vector<std::size_t>> checkpoints_;
+        
+    };
+    
+    class buffer::reader
+    {
+        /* bytes are never modified once appended and blocks are never moved, so copying the block pointers is enough */
+        /* note: the buffer must outlive any reader made from it                                                       */
+        
+    public:
+        void append_str_view(const piece_table_entry& entry, std::vector<std::string_view>& result) const;
+        [[nodiscard]] const buffer* source() const noexcept { return source_; }
+        
+    private:
+        friend class buffer;
+        
+        const buffer*               source_{ nullptr };
+        std::vector<const char*>    blocks_;
+        std::vector<mapped_region>  mapped_regions_;
+    };
+    
+    
+    class buffer::relocation
+    {
+        /* maps each start index within a block from before a compaction to the index of the same text after it */
+        
+    public:
+        [[nodiscard]] std::size_t operator()(std::size_t start_index) const;
+        [[nodiscard]] std::size_t bytes_reclaimed() const noexcept { return bytes_reclaimed_; }
+        
+    private:
+        friend class buffer;
+        
+        struct moved_range
+        {
+            std::size_t old_start;
+            std::size_t new_start;
+        };
+        
+        std::vector<moved_range>    ranges_;            /* sorted by old_start */
+        std::size_t                 bytes_reclaimed_{ 0 };
     };
     
     
@@ -241,9 +402,30 @@ namespace treenote::core
     
     inline char buffer::at(const std::size_t pos) const
     {
+        if (pos >= mapped_base)
+        {
+            const auto& region{ region_of(pos) };
+            return region.data[pos - region.start_index];
+        }
+        
         return blocks_.at(pos / buf_size)->data_.at(pos % buf_size);
     }
     
+    inline std::size_t buffer::stored_size() const
+    {
+        return index_of_append_iter();
+    }
+    
+    inline buffer::span_range buffer::spans(const std::size_t start_index, const std::size_t byte_count) const
+    {
+        return { span_iterator{ this, start_index, byte_count }, std::default_sentinel };
+    }
+    
+    inline buffer::span_range buffer::spans(const piece_table_entry& entry) const
+    {
+        return spans(entry.start_index, entry.byte_length);
+    }
+    
     inline buffer::const_iterator buffer::cbegin() const noexcept
     {
         return proxy_index_iterator{ this , 0 };
@@ -0,0 +1,527 @@
+// core/cache.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "cache.hpp"
+
+#include <iterator>
+#include <stdexcept>
+
+namespace treenote::core
+{
+    /* Implementation helpers */
+
+    namespace detail
+    {
+        namespace
+        {
+            template<typename... Ts>
+            struct overload : Ts ... { using Ts::operator()...; };
+
+            std::uint64_t sibling_bit(const std::size_t depth, const bool has_next)
+            {
+                /* the prefix bit set for entries below a node at depth with a next sibling (see tree::cache_entry) */
+
+                if (has_next and depth >= 2 and depth <= tree::cache_entry::prefix_bits_depth)
+                    return std::uint64_t{ 1 } << (depth - 2);
+                else
+                    return 0;
+            }
+        }
+    }
+
+
+    /* Public member functions */
+
+    void cache::update(const tree& tree_root, const command& cmd, const bool reverse)
+    {
+        /* Applies the change made to the tree by cmd (or by undoing cmd, if reverse is set) as a local patch
+         * to the cache. This function must be called after the tree has been modified, and before any later command
+         * is invoked; cmd must be a single command, not a multi_cmd. */
+
+        std::visit(detail::overload{
+                [&](const cmd::move_node& c) {
+                    if (reverse)
+                        splice_move(tree_root, c.dst, c.src);
+                    else
+                        splice_move(tree_root, c.src, c.dst);
+                },
+                [&](const cmd::edit_contents& c) {
+                    if (is_visible(tree_root, c.pos))
+                        splice_lines(tree_root, c.pos);
+                    refresh_path_refs(tree_root, c.pos);
+                },
+                [&](const cmd::insert_node& c) {
+                    if (reverse)
+                        splice_erase(tree_root, c.pos);
+                    else
+                        splice_insert(tree_root, c.pos);
+                },
+                [&](const cmd::delete_node& c) {
+                    if (reverse)
+                        splice_insert(tree_root, c.pos);
+                    else
+                        splice_erase(tree_root, c.pos);
+                },
+                [&](const cmd::multi_cmd&) {
+                    /* the indices inside a multi_cmd refer to the states of the tree in between its commands, so each
+                     * must be applied as soon as it has been invoked (see operation_stack::undo)                    */
+                    throw std::invalid_argument{ "cache::update: The commands of a multi_cmd must be applied one at a time" };
+                },
+        }, cmd);
+
+        /* erased entries leave their indices behind in the arena */
+        if (tree_index_cache_.index_arena.size() > 2 * arena_live_size_ + 1024)
+            compact_arena();
+
+#ifdef TREENOTE_VERIFY_CACHE
+        verify(tree_root);
+#endif
+    }
+
+
+    void cache::refresh_refs(const tree& tree_root, const index_t pos)
+    {
+        /* must be called if any node on the path to pos has been copied without changing the structure of the tree */
+
+        refresh_path_refs(tree_root, pos);
+    }
+
+
+    void cache::refold(const tree& tree_root, const index_t pos)
+    {
+        /* must be called after the fold state of the node at pos has been changed (see tree::set_folded); only the
+         * entries of that subtree are rebuilt */
+        
+        if (is_visible(tree_root, pos))
+            splice_subtree(tree_root, pos);
+        
+        refresh_path_refs(tree_root, parent_index_of(pos));
+        
+        if (tree_index_cache_.index_arena.size() > 2 * arena_live_size_ + 1024)
+            compact_arena();
+
+#ifdef TREENOTE_VERIFY_CACHE
+        verify(tree_root);
+#endif
+    }
+
+
+    /* Private member functions */
+
+    bool cache::is_visible(const tree& tree_root, const tree_index auto& pos)
+    {
+        /* returns whether the node at pos has entries, i.e. whether none of its ancestors are folded */
+        
+        const tree* node{ &tree_root };
+        
+        for (const auto index: parent_index_of(pos))
+        {
+            if (index >= node->child_count())
+                throw std::out_of_range{ "cache::is_visible: Can not locate node" };
+            
+            node = &(node->get_child_const(index));
+            
+            if (node->is_folded())
+                return false;
+        }
+        
+        return true;
+    }
+
+    std::pair<std::size_t, std::size_t> cache::range_of(const tree_index auto& ti) const
+    {
+        /* Returns the range of cache entries belonging to the subtree at ti. Since the cache is in depth-first
+         * order, comparing only the first size(ti) components of each index keeps the cache partitioned. */
+
+        const auto compare{ [&](const tree::cache_entry& entry) {
+            const auto index{ index_of(entry) };
+            const std::size_t len{ std::min(std::ranges::size(index), std::ranges::size(ti)) };
+            return std::lexicographical_compare_three_way(std::ranges::begin(index),
+                                                          std::ranges::begin(index) + static_cast<std::ptrdiff_t>(len),
+                                                          std::ranges::begin(ti), std::ranges::end(ti));
+        } };
+
+        const auto& entries{ tree_index_cache_.entries };
+        const auto first{ std::ranges::partition_point(entries, [&](const auto& e) { return std::is_lt(compare(e)); }) };
+        const auto last{ std::ranges::partition_point(first, std::ranges::end(entries),
+                                                      [&](const auto& e) { return std::is_eq(compare(e)); }) };
+
+        return { static_cast<std::size_t>(first - std::ranges::begin(entries)),
+                 static_cast<std::size_t>(last - std::ranges::begin(entries)) };
+    }
+
+    void cache::splice_insert(const tree& tree_root, const tree_index auto& pos)
+    {
+        /* a node inserted below a folded node has no entries, and neither do its siblings */
+        
+        if (is_visible(tree_root, pos))
+        {
+            const std::size_t first{ range_of(pos).first };
+            shift_siblings(pos, first, true);
+            insert_subtree(tree_root, pos, first);
+        }
+        
+        refresh_path_refs(tree_root, parent_index_of(pos));
+    }
+
+    void cache::splice_erase(const tree& tree_root, const tree_index auto& pos)
+    {
+        if (const auto [first, last]{ range_of(pos) }; first != last)
+        {
+            erase_subtree(first, last);
+            shift_siblings(pos, first, false);
+        }
+        
+        refresh_path_refs(tree_root, parent_index_of(pos));
+    }
+
+    void cache::splice_move(const tree& tree_root, const tree_index auto& src, const tree_index auto& dst)
+    {
+        /* mirrors tree::move_node: detach the subtree at src, then insert it at dst (which is relative to the
+         * tree after detaching) */
+
+        if (const auto [first, last]{ range_of(src) }; first != last)
+        {
+            erase_subtree(first, last);
+            shift_siblings(src, first, false);
+        }
+
+        if (is_visible(tree_root, dst))
+        {
+            const std::size_t insert_pos{ range_of(dst).first };
+            shift_siblings(dst, insert_pos, true);
+            insert_subtree(tree_root, dst, insert_pos);
+        }
+
+        /* the parent of src may have been shifted by the insertion at dst */
+
+        mti_t src_parent{ make_index_copy_of(parent_index_of(src)) };
+        const std::size_t dst_depth{ std::ranges::size(dst) };
+
+        if (dst_depth <= std::ranges::size(src_parent)
+            and std::ranges::equal(parent_index_of(dst), src_parent | std::views::take(dst_depth - 1))
+            and last_index_of(dst) <= src_parent[dst_depth - 1])
+        {
+            ++src_parent[dst_depth - 1];
+        }
+
+        refresh_path_refs(tree_root, src_parent);
+        refresh_path_refs(tree_root, parent_index_of(dst));
+    }
+
+    void cache::splice_lines(const tree& tree_root, const tree_index auto& pos)
+    {
+        /* updates the entries for the lines of a single node; other entries are not affected */
+
+        constexpr auto npos{ tree::cache_entry::npos };
+
+        const auto node{ get_const_by_index(tree_root, pos) };
+
+        if (not node.has_value())
+            throw std::out_of_range{ "cache::splice_lines: Can not locate edited node" };
+
+        auto& entries{ tree_index_cache_.entries };
+        const std::size_t first{ range_of(pos).first };
+        std::size_t last{ first + 1 };
+
+        while (last < entries.size() and entries[last].line_no != 0)
+            ++last;
+
+        const std::size_t old_count{ last - first };
+        const std::size_t new_count{ std::max(node->get().line_count(), 1uz) };
+
+        if (new_count > old_count)
+        {
+            shift_links(last, last, new_count - old_count, true);
+            const tree::cache_entry tmp{ entries[first] };
+            entries.insert(std::ranges::begin(entries) + static_cast<std::ptrdiff_t>(last), new_count - old_count, tmp);
+        }
+        else if (new_count < old_count)
+        {
+            shift_links(first + new_count, last, old_count - new_count, false);
+            entries.erase(std::ranges::begin(entries) + static_cast<std::ptrdiff_t>(first + new_count),
+                          std::ranges::begin(entries) + static_cast<std::ptrdiff_t>(last));
+        }
+
+        /* the links of the first line are up to date, those of the others are relative to their own position */
+        const std::size_t parent_dist{ entries[first].parent_dist };
+        const std::size_t next_dist{ entries[first].next_dist };
+
+        for (std::size_t line{ 0 }; line < new_count; ++line)
+        {
+            auto& entry{ entries[first + line] };
+            entry.line_no = line;
+            entry.parent_dist = (parent_dist == npos) ? npos : parent_dist + line;
+            entry.next_dist = (next_dist == npos) ? npos : next_dist - line;
+        }
+    }
+
+    void cache::splice_subtree(const tree& tree_root, const tree_index auto& pos)
+    {
+        if (std::ranges::size(pos) == 0)
+        {
+            rebuild(tree_root);
+            return;
+        }
+
+        const auto [first, last]{ range_of(pos) };
+        erase_subtree(first, last);
+        insert_subtree(tree_root, pos, first);
+    }
+
+    void cache::insert_subtree(const tree& tree_root, const tree_index auto& pos, const std::size_t first)
+    {
+        /* inserts the entries for the subtree at pos (which must already exist in the tree) at first,
+         * and links them to the surrounding entries */
+
+        constexpr auto npos{ tree::cache_entry::npos };
+
+        const auto node{ get_const_by_index(tree_root, pos) };
+
+        if (not node.has_value())
+            throw std::out_of_range{ "cache::insert_subtree: Can not locate inserted node" };
+
+        auto subtree{ tree::build_index_cache(node->get(), make_index_copy_of(pos)) };
+        auto& entries{ tree_index_cache_.entries };
+        auto& arena{ tree_index_cache_.index_arena };
+        const std::size_t count{ subtree.entries.size() };
+
+        const auto parent_range{ range_of(parent_index_of(pos)) };
+        const std::size_t parent_pos{ (std::ranges::size(pos) > 1) ? parent_range.first : npos };
+        const bool has_next_sibling{ first < parent_range.second };
+        std::size_t prev_sibling_pos{ npos };
+
+        if (last_index_of(pos) > 0)
+        {
+            mti_t prev_index{ make_index_copy_of(pos) };
+            decrement_last_index_of(prev_index);
+            prev_sibling_pos = range_of(prev_index).first;
+        }
+
+        shift_links(first, first, count, true);
+
+        /* the prefix bits of the subtree do not include those of its parent or itself */
+        const std::uint64_t parent_bits{ (parent_pos != npos) ? entries[parent_pos].prefix_bits : 0 };
+        const std::uint64_t prefix_bits{ parent_bits | detail::sibling_bit(std::ranges::size(pos), has_next_sibling) };
+
+        /* the links within the subtree are relative, so only those of its own lines have to be set */
+        for (std::size_t i{ 0 }; i < count; ++i)
+        {
+            auto& entry{ subtree.entries[i] };
+            entry.prefix_bits |= prefix_bits;
+            entry.index_offset += arena.size();
+
+            if (entry.depth != std::ranges::size(pos))
+                continue;
+
+            entry.parent_dist = (parent_pos == npos) ? npos : first + i - parent_pos;
+            entry.next_dist = has_next_sibling ? count - i : npos;
+        }
+
+        arena_live_size_ += subtree.index_arena.size();
+        std::ranges::copy(subtree.index_arena, std::back_inserter(arena));
+        entries.insert(std::ranges::begin(entries) + static_cast<std::ptrdiff_t>(first),
+                       std::ranges::begin(subtree.entries), std::ranges::end(subtree.entries));
+
+        if (prev_sibling_pos != npos)
+        {
+            for (std::size_t i{ prev_sibling_pos }; i == prev_sibling_pos or entries[i].line_no != 0; ++i)
+                entries[i].next_dist = first - i;
+
+            /* the previous sibling may not have had a next sibling before */
+            for (std::size_t i{ prev_sibling_pos }; i < first; ++i)
+                entries[i].prefix_bits |= detail::sibling_bit(std::ranges::size(pos), true);
+        }
+    }
+
+    void cache::erase_subtree(const std::size_t first, const std::size_t last)
+    {
+        /* erases the entries in [first, last), which must be the entries of exactly one subtree */
+
+        constexpr auto npos{ tree::cache_entry::npos };
+
+        if (first == last)
+            return;
+
+        auto& entries{ tree_index_cache_.entries };
+        const std::size_t count{ last - first };
+        const std::size_t next{ next_sibling_pos(first) };
+        const std::size_t depth{ entries[first].depth };
+        std::size_t prev_sibling_pos{ npos };
+
+        for (std::size_t i{ first }; i < last; ++i)
+            if (entries[i].line_no == 0)
+                arena_live_size_ -= entries[i].depth;
+
+        /* the previous sibling (if any) contains the entry before first, so it is found among the nodes which do */
+        for (std::size_t i{ (first > 0) ? first - 1 - entries[first - 1].line_no : npos };
+             i != npos and entries[i].depth >= depth; i = parent_pos(i))
+        {
+            if (entries[i].depth == depth)
+            {
+                prev_sibling_pos = i;
+                break;
+            }
+        }
+
+        shift_links(first, last, count, false);
+
+        /* the only entries which link into the erased subtree are the lines of its previous sibling */
+        if (prev_sibling_pos != npos)
+        {
+            for (std::size_t i{ prev_sibling_pos }; i == prev_sibling_pos or entries[i].line_no != 0; ++i)
+                entries[i].next_dist = (next == npos) ? npos : next - count - i;
+        }
+
+        entries.erase(std::ranges::begin(entries) + static_cast<std::ptrdiff_t>(first),
+                      std::ranges::begin(entries) + static_cast<std::ptrdiff_t>(last));
+
+        /* if the erased subtree was the last of its siblings, the previous sibling (which ends at first) now is */
+        if (next == npos and prev_sibling_pos != npos)
+        {
+            for (std::size_t i{ prev_sibling_pos }; i < first; ++i)
+                entries[i].prefix_bits &= ~detail::sibling_bit(depth, true);
+        }
+    }
+
+    void cache::shift_links(const std::size_t first, const std::size_t last, const std::size_t amount, const bool increment)
+    {
+        /* adjusts the links which cross [first, last), for when amount entries are about to be inserted at first (with
+         * last == first) or the entries in [first, last) are about to be erased; only the lines of the node containing
+         * the entry before first and of its ancestors can link forward across it, and only the lines of their later
+         * children can link back across it, so the rest of the cache is left alone */
+
+        constexpr auto npos{ tree::cache_entry::npos };
+
+        auto& entries{ tree_index_cache_.entries };
+
+        if (first == 0)
+            return;
+
+        const auto shift{ [&](std::size_t& dist) {
+            dist = increment ? dist + amount : dist - amount;
+        } };
+
+        std::size_t node{ first - 1 - entries[first - 1].line_no };
+        std::size_t child{ (last < entries.size() and parent_pos(last) == node) ? last : npos };
+
+        while (node != npos)
+        {
+            for (; child != npos; child = next_sibling_pos(child))
+                if (child >= last)
+                    for (std::size_t i{ child }; i < entries.size() and (i == child or entries[i].line_no != 0); ++i)
+                        shift(entries[i].parent_dist);
+
+            /* the later siblings of node are the later children of its parent */
+            child = next_sibling_pos(node);
+
+            for (std::size_t i{ node }; i < first and (i == node or entries[i].line_no != 0); ++i)
+                if (entries[i].next_dist != npos and i + entries[i].next_dist >= last)
+                    shift(entries[i].next_dist);
+
+            node = parent_pos(node);
+        }
+    }
+
+    void cache::shift_siblings(const tree_index auto& pos, const std::size_t begin, const bool increment)
+    {
+        /* adjusts the indices of all entries belonging to the siblings after pos (and their descendants),
+         * starting from the entry at begin */
+
+        const std::size_t depth{ std::ranges::size(pos) };
+        const std::size_t end{ range_of(parent_index_of(pos)).second };
+
+        for (std::size_t i{ begin }; i < end; ++i)
+        {
+            const auto& entry{ tree_index_cache_.entries[i] };
+
+            if (entry.line_no != 0)
+                continue;
+
+            auto& component{ tree_index_cache_.index_arena[entry.index_offset + depth - 1] };
+
+            if (increment)
+                ++component;
+            else
+                --component;
+        }
+    }
+
+    void cache::refresh_path_refs(const tree& tree_root, const tree_index auto& pos)
+    {
+        /* modifying a node copies any nodes on the path to it which are shared with a copy of the tree (see
+         * tree::get_node), so the entries of each node on that path must refer to the node now in the tree */
+
+        auto& entries{ tree_index_cache_.entries };
+        const tree* node{ &tree_root };
+        std::size_t depth{ 0 };
+
+        for (const auto index: pos)
+        {
+            /* the descendants of a folded node have no entries */
+            if (node->is_folded())
+                break;
+            
+            if (index >= node->child_count())
+                throw std::out_of_range{ "cache::refresh_path_refs: Can not locate node" };
+
+            node = &(node->get_child_const(index));
+            ++depth;
+
+            const std::size_t first{ range_of(pos | std::views::take(depth)).first };
+
+            for (std::size_t i{ first }; i < entries.size() and (i == first or entries[i].line_no != 0); ++i)
+                entries[i].ref = *node;
+        }
+    }
+
+    void cache::compact_arena()
+    {
+        std::vector<std::size_t> arena{};
+        arena.reserve(arena_live_size_);
+
+        for (auto& entry: tree_index_cache_.entries)
+        {
+            if (entry.line_no == 0)
+                std::ranges::copy(index_of(entry), std::back_inserter(arena));
+
+            entry.index_offset = arena.size() - entry.depth;
+        }
+
+        tree_index_cache_.index_arena = std::move(arena);
+    }
+
+    void cache::verify(const tree& tree_root) const
+    {
+        /* debug check: compare with the result of a full rebuild */
+
+        const auto expected{ tree::build_index_cache(tree_root) };
+
+        const bool same{ std::ranges::equal(tree_index_cache_.entries, expected.entries, [&](const auto& a, const auto& b) {
+            const auto b_index{ std::span{ expected.index_arena }.subspan(b.index_offset, b.depth) };
+            return std::ranges::equal(index_of(a), b_index) and a.line_no == b.line_no and a.parent_dist == b.parent_dist
+                   and a.next_dist == b.next_dist and &(a.ref.get()) == &(b.ref.get())
+                   and a.prefix_bits == b.prefix_bits;
+        }) };
+
+        if (not same)
+            throw std::logic_error{ "cache::verify: Incremental update does not match full rebuild" };
+    }
+}
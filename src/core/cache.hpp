@@ -22,22 +22,35 @@
 
 #include <algorithm>
 #include <compare>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <unordered_map>
 
 #include "tree.hpp"
+#include "tree_op.hpp"
 
 namespace treenote::core
 {
     class cache
     {
     public:
+        using index_t = std::span<const std::size_t>;
+        
         explicit cache(const tree& tree_root);
         void rebuild(const tree& tree_root);
+        void update(const tree& tree_root, const command& cmd, bool reverse = false);
+        void refresh_refs(const tree& tree_root, index_t pos);
+        void refold(const tree& tree_root, index_t pos);
         
         [[nodiscard]] const tree::cache_entry& operator[](std::size_t i) const;
-        [[nodiscard]] const tree::line_cache& operator()() const noexcept;
-        [[nodiscard]] const auto& index(std::size_t i) const;
+        [[nodiscard]] const std::vector<tree::cache_entry>& operator()() const noexcept;
+        [[nodiscard]] index_t index(std::size_t i) const;
+        [[nodiscard]] index_t index_of(const tree::cache_entry& entry) const;
         [[nodiscard]] const auto& line_no(std::size_t i) const;
         [[nodiscard]] std::size_t entry_depth(std::size_t i) const;
+        [[nodiscard]] indent_info entry_prefix(const tree::cache_entry& entry) const;
+        [[nodiscard]] const std::string& entry_prefix_string(const tree::cache_entry& entry) const;
         [[nodiscard]] std::size_t size() const noexcept;
         
         [[nodiscard]] std::size_t entry_line_length(std::size_t i) const;
@@ -49,8 +62,46 @@ namespace treenote::core
         
     private:
         [[nodiscard]] const tree& get_tree_entry(std::size_t i) const;
+        [[nodiscard]] std::size_t parent_pos(std::size_t i) const;
+        [[nodiscard]] std::size_t next_sibling_pos(std::size_t i) const;
+        [[nodiscard]] static bool is_visible(const tree& tree_root, const tree_index auto& pos);
+        
+        [[nodiscard]] std::pair<std::size_t, std::size_t> range_of(const tree_index auto& ti) const;
+        void splice_insert(const tree& tree_root, const tree_index auto& pos);
+        void splice_erase(const tree& tree_root, const tree_index auto& pos);
+        void splice_move(const tree& tree_root, const tree_index auto& src, const tree_index auto& dst);
+        void splice_lines(const tree& tree_root, const tree_index auto& pos);
+        void splice_subtree(const tree& tree_root, const tree_index auto& pos);
+        void insert_subtree(const tree& tree_root, const tree_index auto& pos, std::size_t first);
+        void erase_subtree(std::size_t first, std::size_t last);
+        void shift_links(std::size_t first, std::size_t last, std::size_t amount, bool increment);
+        void shift_siblings(const tree_index auto& pos, std::size_t begin, bool increment);
+        void refresh_path_refs(const tree& tree_root, const tree_index auto& pos);
+        void compact_arena();
+        void verify(const tree& tree_root) const;
+        
+        struct prefix_key
+        {
+            std::uint64_t   bits;
+            std::size_t     depth;
+            bool            first_line;
+            
+            bool operator==(const prefix_key&) const = default;
+        };
+        
+        struct prefix_key_hash
+        {
+            std::size_t operator()(const prefix_key& key) const noexcept;
+        };
+        
+        static constexpr std::size_t max_prefix_strings{ 4096 };
         
         tree::line_cache        tree_index_cache_;
+        std::size_t             arena_live_size_{ 0 };  /* index_arena also contains indices of erased entries */
+        
+        /* rendered line prefixes, interned by the pattern of line_modes they show (see entry_prefix_string) */
+        mutable std::unordered_map<prefix_key, std::string, prefix_key_hash>   prefix_strings_;
+        mutable std::string                                                     deep_prefix_;
     };
     
     
@@ -64,21 +115,27 @@ namespace treenote::core
     inline void cache::rebuild(const tree& tree_root)
     {
         tree_index_cache_ = tree::build_index_cache(tree_root);
+        arena_live_size_ = tree_index_cache_.index_arena.size();
     }
     
     inline const tree::cache_entry& cache::operator[](const std::size_t i) const
     {
-        return tree_index_cache_.at(i);
+        return tree_index_cache_.entries.at(i);
+    }
+    
+    inline const std::vector<tree::cache_entry>& cache::operator()() const noexcept
+    {
+        return tree_index_cache_.entries;
     }
     
-    inline const tree::line_cache& cache::operator()() const noexcept
+    inline cache::index_t cache::index(const std::size_t i) const
     {
-        return tree_index_cache_;
+        return index_of(operator[](i));
     }
     
-    inline const auto& cache::index(const std::size_t i) const
+    inline cache::index_t cache::index_of(const tree::cache_entry& entry) const
     {
-        return operator[](i).index;
+        return index_t{ tree_index_cache_.index_arena }.subspan(entry.index_offset, entry.depth);
     }
     
     inline const auto& cache::line_no(const std::size_t i) const
@@ -88,12 +145,75 @@ namespace treenote::core
     
     inline std::size_t cache::entry_depth(const std::size_t i) const
     {
-        return get_tree_entry_depth(index(i));
+        return operator[](i).depth;
+    }
+    
+    inline indent_info cache::entry_prefix(const tree::cache_entry& entry) const
+    {
+        /* equivalent to get_indent_info_by_index(), but uses the prefix bits (or, beyond the depth they describe, the
+         * parent and sibling links) instead of walking the tree */
+        
+        if (entry.depth < 2)
+            return {};
+        
+        indent_info result(entry.depth - 1);
+        const bool has_next{ entry.next_dist != tree::cache_entry::npos };
+        
+        if (entry.line_no == 0)
+            result.back() = has_next ? line_mode::entry : line_mode::last;
+        else
+            result.back() = has_next ? line_mode::line : line_mode::blank;
+        
+        std::size_t i{ entry.depth - 2 };
+        
+        if (i >= tree::cache_entry::prefix_bits_depth)
+        {
+            std::size_t parent{ parent_pos(static_cast<std::size_t>(&entry - tree_index_cache_.entries.data())) };
+            
+            for (; i >= tree::cache_entry::prefix_bits_depth; --i)
+            {
+                const auto& parent_entry{ tree_index_cache_.entries[parent] };
+                result[i - 1] = (parent_entry.next_dist != tree::cache_entry::npos) ? line_mode::line : line_mode::blank;
+                parent = parent_pos(parent);
+            }
+        }
+        
+        for (; i > 0; --i)
+            result[i - 1] = ((entry.prefix_bits >> (i - 1)) & 1) ? line_mode::line : line_mode::blank;
+        
+        return result;
+    }
+    
+    inline const std::string& cache::entry_prefix_string(const tree::cache_entry& entry) const
+    {
+        /* returns the prefix drawn before the line of entry (see make_line_string_default), rendering it only the first
+         * time its pattern is seen; the result remains valid until the next call                                    */
+        
+        if (entry.depth > tree::cache_entry::prefix_bits_depth)
+        {
+            deep_prefix_ = make_line_string_default(entry_prefix(entry));
+            return deep_prefix_;
+        }
+        
+        const prefix_key key{ .bits = entry.prefix_bits, .depth = entry.depth, .first_line = entry.line_no == 0 };
+        
+        if (const auto it{ prefix_strings_.find(key) }; it != std::ranges::end(prefix_strings_))
+            return it->second;
+        
+        if (prefix_strings_.size() >= max_prefix_strings)
+            prefix_strings_.clear();
+        
+        return prefix_strings_.emplace(key, make_line_string_default(entry_prefix(entry))).first->second;
+    }
+    
+    inline std::size_t cache::prefix_key_hash::operator()(const prefix_key& key) const noexcept
+    {
+        return std::hash<std::uint64_t>{}(key.bits) ^ (std::hash<std::size_t>{}(key.depth * 2 + key.first_line) * 0x9e3779b97f4a7c15);
     }
     
     inline std::size_t cache::size() const noexcept
     {
-        return tree_index_cache_.size();
+        return tree_index_cache_.entries.size();
     }
     
     inline std::size_t cache::entry_line_length(const std::size_t i) const
@@ -121,21 +241,34 @@ namespace treenote::core
         return operator[](i).ref.get();
     }
     
+    inline std::size_t cache::parent_pos(const std::size_t i) const
+    {
+        const std::size_t dist{ tree_index_cache_.entries[i].parent_dist };
+        return (dist == tree::cache_entry::npos) ? tree::cache_entry::npos : i - dist;
+    }
+    
+    inline std::size_t cache::next_sibling_pos(const std::size_t i) const
+    {
+        const std::size_t dist{ tree_index_cache_.entries[i].next_dist };
+        return (dist == tree::cache_entry::npos) ? tree::cache_entry::npos : i + dist;
+    }
+    
     inline std::size_t cache::approx_pos_of_tree_idx(const tree_index auto& ti, const std::size_t line) const
     {
         /* note: if tree_index does not exist, this function returns the pos of the nearest */
         
         std::size_t lo{ 0 };
-        std::size_t hi{ tree_index_cache_.size() };
+        std::size_t hi{ size() };
 
         while (hi - lo > 1)
         {
             const std::size_t mid{ lo + ((hi - lo) / 2) };
-            const auto& mid_entry{ tree_index_cache_.at(mid) };
+            const auto& mid_entry{ operator[](mid) };
+            const auto mid_index{ index_of(mid_entry) };
             
             const auto compare_result{ std::lexicographical_compare_three_way(std::ranges::begin(ti), std::ranges::end(ti),
-                                                                              std::ranges::begin(mid_entry.index),
-                                                                              std::ranges::end(mid_entry.index)) };
+                                                                              std::ranges::begin(mid_index),
+                                                                              std::ranges::end(mid_index)) };
             
             if (std::is_eq(compare_result))
             {
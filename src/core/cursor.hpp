@@ -435,7 +435,8 @@ namespace treenote::core
 
     inline void cursor::set_intended_index(const cache& cache)
     {
-        node_index_intended_ = cache.index(y_);
+        const auto index{ cache.index(y_) };
+        node_index_intended_.assign(std::ranges::begin(index), std::ranges::end(index));
     }
 
     inline std::size_t cursor::get_max_h_pos(const cache& cache) const
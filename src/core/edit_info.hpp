@@ -29,35 +29,31 @@ namespace treenote::core
     class edit_info
     {
     public:
-        tree_string& get(tree& tree_root, const tree_index auto& ti);
+        /* id must be that of the node at ti (ti is only used if it cannot be found by ID; see tree::get_node) */
+        tree_string& get(tree& tree_root, node_id id, const tree_index auto& ti);
         void reset() noexcept;
         
     private:
-        std::optional<std::reference_wrapper<tree_string>>  current_tree_string_ref_;
-        std::vector<std::size_t>                            current_tree_string_node_idx_;
+        /* only the ID is kept: the node found last time may since have been copied (e.g. when it was shared with a
+         * snapshot), leaving the old node owned by the snapshot alone, which may have been destroyed */
+        node_id     current_tree_string_node_id_{ no_node_id };
     };
     
     inline void edit_info::reset() noexcept
     {
         tree_string_token::reset();
-        current_tree_string_ref_.reset();
-        current_tree_string_node_idx_.clear();
+        current_tree_string_node_id_ = no_node_id;
     }
     
-    inline tree_string& edit_info::get(tree& tree_root, const tree_index auto& ti)
+    inline tree_string& edit_info::get(tree& tree_root, const node_id id, const tree_index auto& ti)
     {
-        if (not current_tree_string_ref_.has_value())
+        if (current_tree_string_node_id_ != id)
         {
-            current_tree_string_node_idx_.assign(std::ranges::cbegin(ti), std::ranges::cend(ti));
-            current_tree_string_ref_ = tree::get_editable_tree_string(tree_root, ti);
-        }
-        else if (not std::ranges::equal(current_tree_string_node_idx_, ti))
-        {
-            current_tree_string_ref_->get().set_no_longer_current();
-            current_tree_string_node_idx_.assign(std::ranges::cbegin(ti), std::ranges::cend(ti));
-            current_tree_string_ref_ = tree::get_editable_tree_string(tree_root, ti);
+            tree_string_token::reset();
+            current_tree_string_node_id_ = id;
         }
         
-        return current_tree_string_ref_->get();  // throws error if supplied tree index is invalid
+        /* always look up the node again, since it must be copied if it has been shared since the last call */
+        return tree::get_editable_tree_string(tree_root, id, ti).value();  // throws error if supplied tree index is invalid
     }
 }
\ No newline at end of file
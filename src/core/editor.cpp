@@ -20,27 +20,323 @@
 
 #include "editor.hpp"
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
 #include <fstream>
+#include <random>
+#include <regex>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "tree.hpp"
+#include "utf8.hpp"
 
 namespace treenote::core
 {
+    namespace detail
+    {
+        namespace
+        {
+            editor::file_msg save_path_status(const std::filesystem::file_status& fs)
+            {
+                /* returns file_msg::none if a file with status fs may be saved to */
+                
+                using std::filesystem::perms;
+                
+                if (not std::filesystem::exists(fs))
+                    return editor::file_msg::none;
+                else if (std::filesystem::is_directory(fs))
+                    return editor::file_msg::is_directory;
+                else if (not std::filesystem::is_regular_file(fs))
+                    return editor::file_msg::is_invalid_file;
+                else if (perms::none == (fs.permissions() & perms::owner_write))
+                    return editor::file_msg::is_unwritable;
+                else /* maybe perform more checks? */
+                    return editor::file_msg::none;
+            }
+            
+            struct owned_range
+            {
+                std::size_t start_index;
+                std::size_t end_index;
+                std::size_t owner;
+            };
+            
+            std::unordered_set<std::size_t> shared_owners(std::vector<owned_range>& ranges)
+            {
+                /* returns the owners of ranges which overlap a range with a different owner */
+                
+                std::unordered_set<std::size_t> result{};
+                std::ranges::sort(ranges, std::ranges::less{}, &owned_range::start_index);
+                
+                for (auto first{ std::ranges::begin(ranges) }; first != std::ranges::end(ranges);)
+                {
+                    std::size_t end{ first->end_index };
+                    bool mixed{ false };
+                    auto last{ std::ranges::next(first) };
+                    
+                    for (; last != std::ranges::end(ranges) and last->start_index < end; ++last)
+                    {
+                        end = std::max(end, last->end_index);
+                        mixed = mixed or last->owner != first->owner;
+                    }
+                    
+                    if (mixed)
+                        for (const auto& r : std::ranges::subrange(first, last))
+                            result.insert(r.owner);
+                    
+                    first = last;
+                }
+                
+                return result;
+            }
+            
+            int create_temp_file(const std::filesystem::path& target, std::filesystem::path& tmp_path)
+            {
+                /* creates a new file beside target with a random suffix, trying another suffix if one is left over
+                 * (e.g. from a save that crashed in a process with the same pid); returns -1 on failure */
+                
+                thread_local std::mt19937_64 rng{ std::random_device{}() };
+                static constexpr int max_attempts{ 16 };
+                
+                for (int attempt{ 0 }; attempt < max_attempts; ++attempt)
+                {
+                    tmp_path = target;
+                    tmp_path += "." + std::to_string(getpid()) + "." + std::to_string(rng() & 0xffff'ffff) + ".tmp";
+                    
+                    const int fd{ ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666) };
+                    
+                    if (fd >= 0 or errno != EEXIST)
+                        return fd;
+                }
+                
+                return -1;
+            }
+            
+            bool write_file(const std::filesystem::path& path, const std::filesystem::file_status& fs, const tree& tree_root,
+                            save_load_info& sli, const buffer::reader* reader = nullptr,
+                            std::atomic<std::size_t>* progress = nullptr)
+            {
+                /* write to a temporary file beside the target and rename it into place once complete, so that a failed
+                 * save never leaves a truncated file behind, and files still mapped into the buffer are never modified */
+                /* note: this does not touch the editor, so it may be run on a worker thread */
+                
+                std::error_code ec{};
+                
+                /* note: symlink_status reports an error if path does not exist yet, which is not a problem here */
+                const bool is_symlink{ std::filesystem::is_symlink(std::filesystem::symlink_status(path, ec)) };
+                ec.clear();
+                
+                const auto target{ is_symlink ? std::filesystem::canonical(path, ec) : path };
+                
+                if (ec)
+                    return false;
+                
+                std::filesystem::path tmp_path{};
+                const int fd{ create_temp_file(target, tmp_path) };
+                
+                if (fd < 0)
+                    return false;
+                
+                bool success{ tree::write(fd, tree_root, sli, reader, progress) };
+                
+                if (std::filesystem::exists(fs))
+                    success = success and ::fchmod(fd, static_cast<mode_t>(fs.permissions())) == 0;
+                
+                success = success and ::fsync(fd) == 0;
+                success = (::close(fd) == 0) and success;
+                
+                if (success)
+                    std::filesystem::rename(tmp_path, target, ec);
+                
+                if (not success or ec)
+                {
+                    std::filesystem::remove(tmp_path, ec);
+                    return false;
+                }
+                
+                return true;
+            }
+            
+            std::vector<tree> make_pasted_nodes(std::string_view input, buffer& buf)
+            {
+                /* makes a node for each non-blank line of input, with the more deeply indented lines after it (up to
+                 * the next line indented no more than it) as its descendants; a tab counts as four spaces            */
+                
+                struct open_node
+                {
+                    std::size_t                 indent;
+                    extended_piece_table_entry  entry;
+                    std::vector<tree>           children;
+                };
+                
+                std::vector<tree> result{};
+                std::vector<open_node> stack{};
+                
+                const auto close_top{ [&]() {
+                    open_node top{ std::move(stack.back()) };
+                    stack.pop_back();
+                    (stack.empty() ? result : stack.back().children).push_back(tree::make_node(tree_string{ top.entry }, std::move(top.children)));
+                } };
+                
+                while (not input.empty())
+                {
+                    const std::size_t line_end{ std::min(input.find('\n'), input.size()) };
+                    std::string_view line{ input.substr(0, line_end) };
+                    input.remove_prefix(std::min(line_end + 1, input.size()));
+                    
+                    std::size_t indent{ 0 };
+                    
+                    for (; not line.empty() and (line.front() == ' ' or line.front() == '\t'); line.remove_prefix(1))
+                        indent += (line.front() == '\t') ? 4 : 1;
+                    
+                    if (line.empty())
+                        continue;
+                    
+                    while (not stack.empty() and stack.back().indent >= indent)
+                        close_top();
+                    
+                    stack.push_back(open_node{ .indent = indent, .entry = buf.append(line), .children = {} });
+                }
+                
+                while (not stack.empty())
+                    close_top();
+                
+                return result;
+            }
+            
+            struct node_replacements
+            {
+                struct match
+                {
+                    std::size_t     line;
+                    std::size_t     pos;
+                    std::size_t     len;
+                    std::string     text;       /* the text replacing the match */
+                };
+                
+                mti_t                   index;
+                std::vector<match>      matches;
+            };
+            
+            void find_node_replacements(const tree_string& content, const mti_t& index, const std::regex& pattern,
+                                        const std::string& format, std::vector<node_replacements>& result)
+            {
+                /* appends the matches of pattern in content (of the node at index), if there are any; matches which
+                 * begin or end within a multibyte char are skipped, as they cannot be replaced on their own         */
+                
+                const auto is_boundary{ [](const std::string& text, const std::size_t byte) {
+                    return byte >= text.size() or (text[byte] & utf8::mask_cont) != utf8::test_cont;
+                } };
+                
+                const auto char_count{ [](const std::string& text, const std::size_t begin, const std::size_t end) {
+                    return static_cast<std::size_t>(std::count_if(text.begin() + static_cast<std::ptrdiff_t>(begin),
+                                                                  text.begin() + static_cast<std::ptrdiff_t>(end),
+                                                                  [](const char c) { return (c & utf8::mask_cont) != utf8::test_cont; }));
+                } };
+                
+                node_replacements found{};
+                
+                for (std::size_t line{ 0 }; line < content.line_count(); ++line)
+                {
+                    const std::string text{ content.to_str(line) };
+                    
+                    std::size_t counted_bytes{ 0 };
+                    std::size_t counted_pos{ 0 };
+                    
+                    for (auto it{ std::sregex_iterator{ text.begin(), text.end(), pattern } }; it != std::sregex_iterator{}; ++it)
+                    {
+                        const auto begin{ static_cast<std::size_t>(it->position()) };
+                        const auto end{ begin + static_cast<std::size_t>(it->length()) };
+                        
+                        if (not is_boundary(text, begin) or not is_boundary(text, end))
+                            continue;
+                        
+                        counted_pos += char_count(text, counted_bytes, begin);
+                        counted_bytes = begin;
+                        
+                        found.matches.push_back({ .line = line, .pos = counted_pos, .len = char_count(text, begin, end),
+                                                  .text = it->format(format) });
+                    }
+                }
+                
+                if (not found.matches.empty())
+                {
+                    found.index = index;
+                    result.push_back(std::move(found));
+                }
+            }
+            
+            void find_replacements(const tree& node, mti_t index, const std::regex& pattern, const std::string& format,
+                                   std::vector<node_replacements>& result)
+            {
+                /* as find_node_replacements, for node and then each of its descendants in pre-order */
+                /* note: this only reads the tree and the buffer, so it may be run on a worker thread */
+                
+                std::vector<const tree*> parents{};     /* the ancestors of current, up to node */
+                const tree* current{ &node };
+                
+                for (;;)
+                {
+                    find_node_replacements(current->get_content_const(), index, pattern, format, result);
+                    
+                    /* then move to the next node in pre-order, without recursion (trees may be very deep) */
+                    
+                    if (current->child_count() != 0)
+                    {
+                        parents.push_back(current);
+                        index.push_back(0);
+                        current = &current->get_child_const(0);
+                        continue;
+                    }
+                    
+                    while (not parents.empty() and index.back() + 1 == parents.back()->child_count())
+                    {
+                        parents.pop_back();
+                        index.pop_back();
+                    }
+                    
+                    if (parents.empty())
+                        return;
+                    
+                    ++index.back();
+                    current = &parents.back()->get_child_const(index.back());
+                }
+            }
+        }
+    }
+    
     /* File related public member functions */
 
     void editor::make_empty()
     {
+        static_cast<void>(wait_for_save());
+        journal_.stop(true);
         tree_instance_ = tree::make_empty();
+        
+        if (text_index_)
+            text_index_->clear();
+        
         init();
     }
     
-    editor::return_t editor::load_file(const std::filesystem::path& path)
+    editor::return_t editor::load_file(const std::filesystem::path& path, const unsigned int jobs, const bool lazy)
     {
         using std::filesystem::perms;
         
         auto msg{ file_msg::none };
         save_load_info sli{ .node_count = 0, .line_count = 0 };
         
+        static_cast<void>(wait_for_save());
+        journal_.stop(not modified());
+        
         bool make_empty{ true };
         const auto fs{ std::filesystem::status(path) };
         
@@ -71,9 +367,16 @@ namespace treenote::core
             
             /* maybe perform more checks? */
             
-            std::ifstream file{ path };
-            
-            if (not file)
+            if (const auto mapped{ buffer_.map_file(path) }; not mapped.empty())
+            {
+                if (lazy)
+                    tree_instance_ = tree::parse_lazy(mapped, path.string(), buffer_, sli);
+                else
+                    tree_instance_ = tree::parse(mapped, path.string(), buffer_, sli, jobs);
+
+                make_empty = false;
+            }
+            else if (std::ifstream file{ path }; not file)
             {
                 msg = file_msg::unknown_error;
             }
@@ -87,56 +390,60 @@ namespace treenote::core
         if (make_empty)
             tree_instance_ = tree::make_empty();
         
+        if (text_index_)
+        {
+            /* the index saved with the file refers to its nodes as they were loaded (see text_index::load) */
+            text_index_->clear();
+            
+            if (not make_empty and tree::first_unmaterialized(tree_instance_) == tree_instance_.child_count())
+                static_cast<void>(text_index_->load(path, tree_instance_));
+        }
+        
+        /* recover the changes made since the file was last saved, if the editor was killed before saving them */
+        const bool journalled{ msg == file_msg::none or msg == file_msg::does_not_exist or msg == file_msg::is_unwritable };
+        
+        /* the journal may refer to any node (this is checked first, since replay needs the tree) */
+        if (journalled and std::filesystem::exists(journal::path_for(path)))
+            tree::materialize_all(tree_instance_);
+        
+        const auto recovered{ journalled ? journal::replay(path, tree_instance_, buffer_) : std::nullopt };
+        
         init();
+        
+        if (recovered and recovered->record_count > 0)
+        {
+            recovered_edits_ = recovered->record_count;
+            op_hist_.clear_position_of_save();
+            journal_.start(path, recovered->valid_size);
+        }
+        else if (journalled)
+        {
+            journal_.start(path);
+        }
+        
         return { msg, sli };
     }
     
     editor::return_t editor::save_file(const std::filesystem::path& path)
     {
-        using std::filesystem::perms;
-        
-        auto msg{ file_msg::none };
         save_load_info sli{ .node_count = 0, .line_count = 0 };
         
-        const auto fs{ std::filesystem::status(path) };
-        
-        bool save{ false };
+        static_cast<void>(wait_for_save()); /* a save in progress may be writing to the same file */
+        load_all();
         
-        if (not std::filesystem::exists(fs))
-        {
-            msg = file_msg::none;
-            save = true;
-        }
-        else if (std::filesystem::is_directory(fs))
-        {
-            msg = file_msg::is_directory;
-        }
-        else if (not std::filesystem::is_regular_file(fs))
-        {
-            msg = file_msg::is_invalid_file;
-        }
-        else if (perms::none == (fs.permissions() & perms::owner_write))
-        {
-            msg = file_msg::is_unwritable;
-        }
-        else /* maybe perform more checks? */
-        {
-            save = true;
-        }
+        const auto fs{ std::filesystem::status(path) };
+        auto msg{ detail::save_path_status(fs) };
         
-        if (save)
+        if (msg == file_msg::none)
         {
-            std::ofstream file{ path };
-            
-            if (not file)
+            if (detail::write_file(path, fs, tree_instance_, sli))
             {
-                msg = file_msg::unknown_error;
-            }
-            else
-            {
-                tree::write(file, tree_instance_, sli);
                 op_hist_.set_position_of_save();
+                journal_.rebase(path, journal::prepare_base(path, tree_instance_, sli));
+                save_text_index(path, tree_instance_);
             }
+            else
+                msg = file_msg::unknown_error;
         }
         
         return { msg, sli };
@@ -168,6 +475,172 @@ namespace treenote::core
         return file_msg::unknown_error;
     }
     
+    editor::file_msg editor::save_file_async(const std::filesystem::path& path)
+    {
+        /* returns file_msg::none if the save has been started; its result is obtained from poll_save or wait_for_save */
+        /* note: the snapshot shares its nodes with tree_instance_ until either is modified (see tree::make_copy)      */
+        
+        static_cast<void>(wait_for_save());
+        load_all();
+        
+        const auto fs{ std::filesystem::status(path) };
+        
+        if (const auto msg{ detail::save_path_status(fs) }; msg != file_msg::none)
+            return msg;
+        
+        pending_save_ = std::make_unique<pending_save>(tree::make_copy(tree_instance_, mti_t{}), buffer_.make_reader(), path);
+        op_hist_.begin_save();
+        journal_.mark();
+        
+        pending_save_->worker = std::jthread{ [ps = pending_save_.get(), path, fs] {
+            ps->success = detail::write_file(path, fs, ps->snapshot, ps->info, &ps->reader, &ps->bytes_written);
+            
+            if (ps->success)
+                ps->journal_base = journal::prepare_base(path, ps->snapshot, ps->info, &ps->reader);
+            
+            ps->done.store(true, std::memory_order_release);
+        } };
+        
+        return file_msg::none;
+    }
+    
+    std::optional<editor::return_t> editor::wait_for_save()
+    {
+        /* blocks until a background save has finished, and returns its result (or nullopt if there was none) */
+        
+        if (not pending_save_)
+            return std::nullopt;
+        
+        pending_save_->worker.join();
+        
+        const auto ps{ std::move(pending_save_) };
+        
+        if (not ps->success)
+            return return_t{ file_msg::unknown_error, ps->info };
+        
+        op_hist_.end_save();
+        journal_.rebase(ps->path, ps->journal_base, true);
+        save_text_index(ps->path, ps->snapshot);
+        return return_t{ file_msg::none, ps->info };
+    }
+    
+    void editor::set_history_budget(const std::size_t budget)
+    {
+        history_budget_ = budget;
+        op_hist_.set_memory_budget(tree_instance_, budget);
+    }
+    
+    void editor::set_indexing(const bool enabled)
+    {
+        if (enabled == (text_index_ != nullptr))
+            return;
+        
+        text_index_ = enabled ? std::make_unique<text_index>() : nullptr;
+        op_hist_.set_text_index(text_index_.get());
+    }
+    
+    void editor::save_text_index(const std::filesystem::path& path, const tree& saved)
+    {
+        /* an index which has never been built is not saved, as building it would read the text of every node */
+        
+        if (text_index_ and text_index_->built())
+            static_cast<void>(text_index_->save(path, saved));
+    }
+    
+    std::size_t editor::compact_buffer()
+    {
+        /* a background save reads the current blocks through its reader, so compaction must wait until it is finished */
+        
+        if (pending_save_)
+            return 0;
+        
+        std::unordered_set<tree_string*> strings{};
+        tree::collect_tree_strings(tree_instance_, strings);
+        op_hist_.collect_tree_strings(strings);
+        
+        if (copied_tree_node_buffer_)
+            tree::collect_tree_strings(*copied_tree_node_buffer_, strings);
+        
+        const std::size_t stored_size_before{ buffer_.stored_size() };
+        
+        /* lines made up of several entries are copied to a single entry if no other line or history refers to their text
+         * (otherwise the text would be duplicated); each such line is an owner of its ranges, as is each tree_string */
+        
+        std::vector<detail::owned_range> owned{};
+        std::vector<std::tuple<tree_string*, std::size_t, std::size_t>> candidates{};
+        std::vector<buffer::live_range> ranges{};
+        std::size_t owner{ 0 };
+        
+        const auto add_owned{ [&](const std::size_t id) {
+            for (const auto& r : ranges)
+                owned.push_back({ .start_index = r.start_index, .end_index = r.start_index + r.byte_length, .owner = id });
+            ranges.clear();
+        } };
+        
+        for (auto* s : strings)
+        {
+            const std::size_t string_owner{ owner++ };
+            const auto lines{ s->coalescable_lines() };
+            
+            if (lines.empty())
+            {
+                s->collect_live_ranges(ranges);
+                add_owned(string_owner);
+                continue;
+            }
+            
+            for (std::size_t line{ 0 }, i{ 0 }; line < s->line_count(); ++line)
+            {
+                s->collect_line_ranges(line, ranges);
+                
+                if (i < lines.size() and lines[i] == line)
+                {
+                    candidates.emplace_back(s, line, owner);
+                    add_owned(owner++);
+                    ++i;
+                }
+                else
+                {
+                    add_owned(string_owner);
+                }
+            }
+        }
+        
+        const auto shared{ detail::shared_owners(owned) };
+        
+        for (const auto& [s, line, id] : candidates)
+            if (not shared.contains(id))
+                s->coalesce_line(buffer_, line);
+        
+        for (auto* s : strings)
+            s->collect_live_ranges(ranges);
+        
+        /* the copies made by coalesce_line count towards the bytes freed by compaction, but were not there before */
+        const std::size_t coalesced_size{ buffer_.stored_size() - stored_size_before };
+        tree::collect_lazy_ranges(tree_instance_, ranges);
+        
+        const auto reloc{ buffer_.compact(std::move(ranges)) };
+        
+        for (auto* s : strings)
+            s->relocate(reloc);
+        
+        stored_size_after_compaction_ = buffer_.stored_size();
+        return reloc.bytes_reclaimed() - std::min(reloc.bytes_reclaimed(), coalesced_size);
+    }
+    
+    /* Private helper for line editing functions */
+    
+    tree_string& editor::get_current_tree_string()
+    {
+        auto& result{ editor_.get(tree_instance_, cache_[cursor_y()].ref.get().id(), cursor_current_index()) };
+        
+        /* the node (and the path to it) is copied if it was shared; if so, the cache must refer to the copies */
+        if (&result != &cache_[cursor_y()].ref.get().get_content_const())
+            cache_.refresh_refs(tree_instance_, cursor_current_index());
+        
+        return result;
+    }
+    
     /* Line editing functions */
 
     /* implementation helper: call only from line_delete_char and line_forward_delete_word */
@@ -176,12 +649,13 @@ namespace treenote::core
         /* preconditions:
          * cursor_x() >= cursor_max_x() and cursor_current_line() + 1 < cursor_max_line() */
         
-        auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+        auto& e{ get_current_tree_string() };
         
+        journal_.record_line_join(cursor_current_index(), cursor_current_line());
         if (e.make_line_join(cursor_current_line()))
         {
-            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
-            rebuild_cache();
+            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
+            update_cache(op_hist_.get_current_cmd());
             save_cursor_pos_to_hist();
         }
     }
@@ -192,16 +666,17 @@ namespace treenote::core
         /* preconditions:
          * cursor_x() == 0 and cursor_current_line() > 0 */
         
-        auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+        auto& e{ get_current_tree_string() };
         
         auto cursor_save{ cursor_make_save() };
         cursor_mv_up();
         cursor_to_EOL();
            
+        journal_.record_line_join(cursor_current_index(), cursor_current_line());
         if (e.make_line_join(cursor_current_line()))
         {
-            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, std::move(cursor_save));
-            rebuild_cache();
+            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, std::move(cursor_save));
+            update_cache(op_hist_.get_current_cmd());
             save_cursor_pos_to_hist();
         }
         else
@@ -213,19 +688,77 @@ namespace treenote::core
 
     void editor::line_insert_text(const std::string_view input)
     {
-        auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+        auto& e{ get_current_tree_string() };
         std::size_t cursor_inc_amt{ 0 };
         
         /* maybe validate input string, including preventing input of newline chars
          * however this is not needed with ncurses and so doesn't really matter right now */
         
+        journal_.record_insert_str(cursor_current_index(), cursor_current_line(), cursor_x(), input);
         if (e.insert_str(cursor_current_line(), cursor_x(), buffer_.append(input), cursor_inc_amt))
-            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
+            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
 
         cursor_mv_right(cursor_inc_amt);
         save_cursor_pos_to_hist();
     }
     
+    void editor::line_insert_block(std::string_view input)
+    {
+        if (input.empty())
+            return;
+        
+        /* node moves may leave the cursor past the end of its new line */
+        cursor_clamp_x();
+        
+        auto& e{ get_current_tree_string() };
+        
+        /* the lines are appended to the buffer one after another, so the whole block is held in one contiguous range */
+        
+        std::vector<extended_piece_table_entry> lines{};
+        
+        std::size_t line{ cursor_current_line() };
+        std::size_t pos{ cursor_x() };
+        
+        for (bool loop{ true }; loop;)
+        {
+            const auto [extent, delimited]{ buffer::append_extent(input) };
+            const std::string_view text{ input.substr(0, delimited ? extent - 1 : extent) };
+            
+            if (not lines.empty())
+            {
+                journal_.record_line_break(cursor_current_index(), line, pos);
+                ++line;
+                pos = 0;
+            }
+            
+            lines.push_back(buffer_.append(text));
+            journal_.record_insert_str(cursor_current_index(), line, pos, text);
+            pos += lines.back().first.display_length;
+            
+            input.remove_prefix(extent);
+            loop = delimited;
+        }
+        
+        if (not e.insert_lines(cursor_current_line(), cursor_x(), lines, line, pos))
+            return;
+        
+        op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
+        
+        if (lines.size() > 1)
+        {
+            update_cache(op_hist_.get_current_cmd());
+            cursor_mv_down(lines.size() - 1);
+            cursor_to_SOL();
+        }
+        else
+        {
+            pos -= cursor_x();
+        }
+        
+        cursor_mv_right(pos);
+        save_cursor_pos_to_hist();
+    }
+    
     void editor::line_delete_char()
     {
         if (cursor_x() >= cursor_max_x() and cursor_current_line() + 1 < cursor_max_line())
@@ -235,18 +768,19 @@ namespace treenote::core
         }
         else if (cursor_x() < cursor_max_x())
         {
-            auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+            auto& e{ get_current_tree_string() };
 
             /* delete character */
+            journal_.record_delete_char_current(cursor_current_index(), cursor_current_line(), cursor_x());
             if (e.delete_char_current(cursor_current_line(), cursor_x()))
-                op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
+                op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
             save_cursor_pos_to_hist();
         }
     }
     
     void editor::line_backspace()
     {
-        auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+        auto& e{ get_current_tree_string() };
         
         if (cursor_x() == 0 and cursor_current_line() > 0)
         {
@@ -257,8 +791,9 @@ namespace treenote::core
         {
             /* delete character */
             std::size_t cursor_dec_amt{ 0 };
+            journal_.record_delete_char_before(cursor_current_index(), cursor_current_line(), cursor_x());
             if (e.delete_char_before(cursor_current_line(), cursor_x(), cursor_dec_amt))
-                op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
+                op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
             cursor_mv_left(cursor_dec_amt);
             save_cursor_pos_to_hist();
         }
@@ -266,12 +801,13 @@ namespace treenote::core
     
     void editor::line_newline()
     {
-        auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+        auto& e{ get_current_tree_string() };
         
+        journal_.record_line_break(cursor_current_index(), cursor_current_line(), cursor_x());
         if (e.make_line_break(cursor_current_line(), cursor_x()))
         {
-            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
-            rebuild_cache();
+            op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
+            update_cache(op_hist_.get_current_cmd());
             cursor_mv_down();
             cursor_to_SOL();
             save_cursor_pos_to_hist();
@@ -280,7 +816,7 @@ namespace treenote::core
 
     void editor::line_forward_delete_word()
     {
-        auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+        auto& e{ get_current_tree_string() };
         
         if (cursor_x() >= cursor_max_x() and cursor_current_line() + 1 < cursor_max_line())
         {
@@ -295,8 +831,9 @@ namespace treenote::core
                 const auto cur{ cursor_current_char() };
                 
                 /* delete character */
+                journal_.record_delete_char_current(cursor_current_index(), cursor_current_line(), cursor_x());
                 if (e.delete_char_current(cursor_current_line(), cursor_x()))
-                    op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
+                    op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
                 
                 if (not utf8::is_word_constituent(cur))
                 {
@@ -321,11 +858,12 @@ namespace treenote::core
         {
             /* delete character */
 
-            auto& e{ editor_.get(tree_instance_, cursor_current_index()) };
+            auto& e{ get_current_tree_string() };
 
             std::size_t cursor_dec_amt{ 0 };
+            journal_.record_delete_char_before(cursor_current_index(), cursor_current_line(), cursor_x());
             if (e.delete_char_before(cursor_current_line(), cursor_x(), cursor_dec_amt))
-                op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
+                op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
             cursor_mv_left(cursor_dec_amt);
 
             auto cur{ cursor_previous_char() };
@@ -335,8 +873,9 @@ namespace treenote::core
                 if (cur.empty())
                     break;
                 
+                journal_.record_delete_char_before(cursor_current_index(), cursor_current_line(), cursor_x());
                 if (e.delete_char_before(cursor_current_line(), cursor_x(), cursor_dec_amt))
-                    op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ cursor_current_index() } }, cursor_make_save());
+                    op_hist_.exec(tree_instance_, command{ cmd::edit_contents{ make_index_copy_of(cursor_current_index()) } }, cursor_make_save());
                 cursor_mv_left(cursor_dec_amt);
 
                 auto prev{ cursor_previous_char() };
@@ -363,6 +902,9 @@ namespace treenote::core
         if (std::ranges::size(cursor_current_index()) <= 1)
             return 1;
         
+        /* the later siblings become children of the node, so they must not be hidden */
+        ensure_unfolded(make_index_copy_of(cursor_current_index()));
+        
         mti_t src_parent_index{ make_index_copy_of(parent_index_of(cursor_current_index())) };
         const auto src_parent_tmp{ get_const_by_index(tree_instance_, src_parent_index) };
         
@@ -384,9 +926,10 @@ namespace treenote::core
             mti_t alt_dst_index{ make_index_copy_of(src_index) };
             make_child_index_of(alt_dst_index, src_tree_tmp.child_count());
             
-            while (src_parent_tree_tmp.child_count() > last_index_of(src_index) + 1)
+            /* note: each move may copy the parent node (see tree::get_node), so src_parent_tree_tmp is not reused */
+            for (std::size_t count{ src_parent_tree_tmp.child_count() - (last_index_of(src_index) + 1) }; count > 0; --count)
             {
-                op_hist_.append_multi(tree_instance_, cmd::move_node{ .src = alt_src_index, .dst = alt_dst_index });
+                append_multi(cmd::move_node{ .src = alt_src_index, .dst = alt_dst_index });
                 increment_last_index_of(alt_dst_index);
             }
             
@@ -395,9 +938,9 @@ namespace treenote::core
             mti_t dst_index{ std::move(src_parent_index) };
             increment_last_index_of(dst_index);
             
-            op_hist_.append_multi(tree_instance_, cmd::move_node{ .src = std::move(src_index), .dst = std::move(dst_index) });
+            append_multi(cmd::move_node{ .src = std::move(src_index), .dst = std::move(dst_index) });
     
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
             cursor_.update_intended_pos(cache_);
             cursor_.reset_mnd();
             save_cursor_pos_to_hist();
@@ -416,10 +959,11 @@ namespace treenote::core
         if (last_index_of(cursor_current_index()) == 0)
             return 1;
         
-        const auto src_index{ cursor_current_index() };
+        const mti_t src_index{ make_index_copy_of(cursor_current_index()) };
         
         mti_t dst_index{ make_index_copy_of(cursor_current_index()) };
         decrement_last_index_of(dst_index);
+        ensure_unfolded(dst_index);
     
         const auto dst_parent_tmp{ get_const_by_index(tree_instance_, dst_index) };
     
@@ -432,7 +976,7 @@ namespace treenote::core
     
             op_hist_.exec(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(dst_index) }, cursor_make_save());
 
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
             cursor_.update_intended_pos(cache_);
             cursor_.reset_mnd();
         }
@@ -453,7 +997,7 @@ namespace treenote::core
             return 1;
         
         auto cursor_save{ cursor_make_save() };
-        const auto src_index{ cursor_current_index() };
+        const mti_t src_index{ make_index_copy_of(cursor_current_index()) };
         
         if (last_index_of(src_index) == 0)
         {
@@ -465,7 +1009,7 @@ namespace treenote::core
             
             op_hist_.exec(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(parent_index) }, std::move(cursor_save));
     
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
         }
         else
         {
@@ -476,6 +1020,10 @@ namespace treenote::core
             {
                 /* move node to be a child of the previous node
                  * (previous node is guaranteed to exist by outer if statement) */
+                
+                /* unfolding the previous node moves the cursor */
+                ensure_unfolded(dst_index);
+                cursor_save = cursor_make_save();
     
                 const auto dst_parent_tmp{ get_const_by_index(tree_instance_, dst_index) };
     
@@ -488,7 +1036,7 @@ namespace treenote::core
                     
                     op_hist_.exec(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(dst_index) }, std::move(cursor_save));
                     
-                    rebuild_cache();
+                    update_cache(op_hist_.get_current_cmd());
                     cursor_.update_intended_pos(cache_);
                 }
                 else
@@ -506,7 +1054,7 @@ namespace treenote::core
                 
                 op_hist_.exec(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(dst_index) }, std::move(cursor_save));
     
-                rebuild_cache();
+                update_cache(op_hist_.get_current_cmd());
             }
         }
         
@@ -529,7 +1077,7 @@ namespace treenote::core
         {
             const tree& parent_tree_tmp{ parent_tmp->get() };
     
-            const auto src_index{ cursor_current_index() };
+            const mti_t src_index{ make_index_copy_of(cursor_current_index()) };
             
             if (last_index_of(cursor_current_index()) + 1 >= parent_tree_tmp.child_count())
             {
@@ -540,7 +1088,7 @@ namespace treenote::core
     
                 op_hist_.exec(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(dst_index) }, std::move(cursor_save));
                 
-                rebuild_cache();
+                update_cache(op_hist_.get_current_cmd());
             }
             else
             {
@@ -551,6 +1099,10 @@ namespace treenote::core
                     /* move node to be a child of the next node
                      * (next node is guaranteed to exist by outer if statement) */
                     
+                    mti_t next_index{ src_index };
+                    increment_last_index_of(next_index);
+                    ensure_unfolded(next_index);
+                    
                     make_child_index_of(dst_index, 0uz);
                 }
                 else
@@ -565,7 +1117,7 @@ namespace treenote::core
                 
                 op_hist_.exec(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(dst_index) }, std::move(cursor_save));
                 
-                rebuild_cache();
+                update_cache(op_hist_.get_current_cmd());
                 cursor_.nd_next(cache_);
             }
         }
@@ -586,9 +1138,13 @@ namespace treenote::core
         if (last_index_of(cursor_current_index()) == 0)
             return 1;
         
+        mti_t prev_index{ make_index_copy_of(cursor_current_index()) };
+        decrement_last_index_of(prev_index);
+        ensure_unfolded(prev_index);
+        
         op_hist_.exec(tree_instance_, command{ cmd::multi_cmd{} }, cursor_make_save());
         
-        const auto src_index{ cursor_current_index() };
+        const mti_t src_index{ make_index_copy_of(cursor_current_index()) };
         const auto src_parent_tmp{ get_const_by_index(tree_instance_, cursor_current_index()) };
         
         mti_t dst_index{ make_index_copy_of(cursor_current_index()) };
@@ -606,15 +1162,16 @@ namespace treenote::core
             mti_t src_child_index{ make_index_copy_of(cursor_current_index()) };
             make_child_index_of(src_child_index, 0 /* value unimportant */);
             
-            while (src_parent_tree_tmp.child_count() > 0)
+            /* note: each move may copy the source node (see tree::get_node), so src_parent_tree_tmp is not reused */
+            for (std::size_t count{ src_parent_tree_tmp.child_count() }; count > 0; --count)
             {
-                set_last_index_of(src_child_index, src_parent_tree_tmp.child_count() - 1);
-                op_hist_.append_multi(tree_instance_, cmd::move_node{ .src = src_child_index, .dst = dst_index });
+                set_last_index_of(src_child_index, count - 1);
+                append_multi(cmd::move_node{ .src = src_child_index, .dst = dst_index });
             }
             
-            op_hist_.append_multi(tree_instance_, cmd::move_node{ .src = src_index, .dst = std::move(dst_index) });
+            append_multi(cmd::move_node{ .src = src_index, .dst = std::move(dst_index) });
             
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
             cursor_.update_intended_pos(cache_);
             cursor_.reset_mnd();
         }
@@ -676,11 +1233,11 @@ namespace treenote::core
 
             op_hist_.exec(tree_instance_, command{ cmd::multi_cmd{} }, cursor_make_save());
 
-            const auto deleted_node_index{ cursor_current_index() };
+            const mti_t deleted_node_index{ make_index_copy_of(cursor_current_index()) };
 
             if (last_index_of(cursor_current_index()) > 0)
             {
-                mti_t src_index{ cursor_current_index() };
+                mti_t src_index{ make_index_copy_of(cursor_current_index()) };
                 make_child_index_of(src_index, 0uz);
 
                 mti_t dst_parent_index{ make_index_copy_of(cursor_current_index()) };
@@ -697,9 +1254,10 @@ namespace treenote::core
                     mti_t dst_index{ make_index_copy_of(dst_parent_index) };
                     make_child_index_of(dst_index, dst_parent_tree_tmp.child_count());
 
-                    while (src_parent_tree_tmp.child_count() > 0)
+                    /* note: each move may copy the source node (see tree::get_node), so src_parent_tree_tmp is not reused */
+                    for (std::size_t count{ src_parent_tree_tmp.child_count() }; count > 0; --count)
                     {
-                        op_hist_.append_multi(tree_instance_, cmd::move_node{ .src = src_index, .dst = dst_index });
+                        append_multi(cmd::move_node{ .src = src_index, .dst = dst_index });
                         increment_last_index_of(dst_index);
                     }
                 }
@@ -723,10 +1281,11 @@ namespace treenote::core
                     mti_t src_index{ make_index_copy_of(cursor_current_index())};
                     make_child_index_of(src_index, src_parent_tree_tmp.child_count());
 
-                    while (src_parent_tree_tmp.child_count() > 0)
+                    /* note: each move may copy the source node (see tree::get_node), so src_parent_tree_tmp is not reused */
+                    for (std::size_t count{ src_parent_tree_tmp.child_count() }; count > 0; --count)
                     {
-                        set_last_index_of(src_index, src_parent_tree_tmp.child_count() - 1);
-                        op_hist_.append_multi(tree_instance_, cmd::move_node{ .src = src_index, .dst = dst_index });
+                        set_last_index_of(src_index, count - 1);
+                        append_multi(cmd::move_node{ .src = src_index, .dst = dst_index });
                     }
                 }
                 else
@@ -735,9 +1294,9 @@ namespace treenote::core
                 }
             }
 
-            op_hist_.append_multi(tree_instance_, cmd::delete_node{ .pos = deleted_node_index, .deleted = {} });
+            append_multi(cmd::delete_node{ .pos = deleted_node_index, .deleted = {} });
 
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
             cursor_clamp_x();
             save_cursor_pos_to_hist();
             return 0;
@@ -751,13 +1310,18 @@ namespace treenote::core
         if (tree_instance_.child_count() == 1 and tree_instance_.get_child_const(0).get_content_const().line_length(0) == 0)
             return 1;
         
-        op_hist_.exec(tree_instance_, cmd::delete_node{ .pos = cursor_current_index(), .deleted = {} }, cursor_make_save());
+        const mti_t index{ make_index_copy_of(cursor_current_index()) };
+        op_hist_.exec(tree_instance_, cmd::delete_node{ .pos = index, .deleted = {} }, cursor_make_save());
         
-        /* ensure that tree nodes are not all empty by inserting a blank node if necessary */
+        /* ensure that tree nodes are not all empty by inserting a blank node if necessary (the deletion is patched
+         * into the cache first, as the insertion is patched on its own; see append_multi)                         */
         if (tree_instance_.child_count() == 0)
-            op_hist_.append_multi(tree_instance_, cmd::insert_node{ .pos = cursor_current_index(), .inserted = tree{} });
+        {
+            cache_.update(tree_instance_, *op_hist_.get_current_cmd());
+            append_multi(cmd::insert_node{ .pos = index, .inserted = tree{} });
+        }
         
-        rebuild_cache();
+        update_cache(op_hist_.get_current_cmd());
         cursor_clamp_x();
         save_cursor_pos_to_hist();
         return 0;
@@ -778,13 +1342,18 @@ namespace treenote::core
         if (tree_instance_.child_count() == 1 and tree_instance_.get_child_const(0).get_content_const().line_length(0) == 0)
             return 1;
         
-        op_hist_.exec(tree_instance_, cmd::delete_node{ .pos = cursor_current_index(), .deleted = {}, .is_cut = true }, cursor_make_save());
+        const mti_t index{ make_index_copy_of(cursor_current_index()) };
+        op_hist_.exec(tree_instance_, cmd::delete_node{ .pos = index, .deleted = {}, .is_cut = true }, cursor_make_save());
         
-        /* ensure that tree nodes are not all empty by inserting a blank node if necessary */
+        /* ensure that tree nodes are not all empty by inserting a blank node if necessary (the deletion is patched
+         * into the cache first, as the insertion is patched on its own; see append_multi)                         */
         if (tree_instance_.child_count() == 0)
-            op_hist_.append_multi(tree_instance_, cmd::insert_node{ .pos = cursor_current_index(), .inserted= tree{} });
+        {
+            cache_.update(tree_instance_, *op_hist_.get_current_cmd());
+            append_multi(cmd::insert_node{ .pos = index, .inserted = tree{} });
+        }
         
-        rebuild_cache();
+        update_cache(op_hist_.get_current_cmd());
         cursor_clamp_x();
         save_cursor_pos_to_hist();
         return 0;
@@ -804,7 +1373,7 @@ namespace treenote::core
         if (tree_temp.child_count() == 0 and tree_temp.get_content_const().line_length(0) == 0)
             return 1;
         
-        copied_tree_node_buffer_ = tree::make_copy(tree_temp);
+        copied_tree_node_buffer_ = tree::make_copy(tree_instance_, cursor_current_index());
         return 0;
     }
     
@@ -816,10 +1385,10 @@ namespace treenote::core
         /* the remainder of the function has been copied from node_insert_above(), but modified slightly */
         
         op_hist_.exec(tree_instance_,
-                      cmd::insert_node{ .pos = cursor_current_index(), .inserted = tree::make_copy(*copied_tree_node_buffer_), .is_paste = true },
+                      cmd::insert_node{ .pos = make_index_copy_of(cursor_current_index()), .inserted = tree::make_duplicate(*copied_tree_node_buffer_), .is_paste = true },
                       cursor_make_save());
         
-        rebuild_cache();
+        update_cache(op_hist_.get_current_cmd());
         save_cursor_pos_to_hist();
         return 0;
     }
@@ -837,7 +1406,7 @@ namespace treenote::core
             throw std::runtime_error("node_paste_default: cursor index does not exist");
         
         const tree& tree_temp{ tmp->get() };
-        auto index{ cursor_current_index() };
+        mti_t index{ make_index_copy_of(cursor_current_index()) };
         
         if (tree_temp.child_count() == 0)
         {
@@ -846,24 +1415,468 @@ namespace treenote::core
             
             ++(*std::ranges::rbegin(index));
             op_hist_.exec(tree_instance_,
-                          cmd::insert_node{ .pos=index, .inserted=tree::make_copy(*copied_tree_node_buffer_), .is_paste=true },
+                          cmd::insert_node{ .pos=index, .inserted=tree::make_duplicate(*copied_tree_node_buffer_), .is_paste=true },
                           cursor_make_save());
             
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
             cursor_nd_next();
         }
         else
         {
+            ensure_unfolded(index);
             index.push_back(0uz);
             op_hist_.exec(tree_instance_,
-                          cmd::insert_node{ .pos=index, .inserted=tree::make_copy(*copied_tree_node_buffer_), .is_paste=true },
+                          cmd::insert_node{ .pos=index, .inserted=tree::make_duplicate(*copied_tree_node_buffer_), .is_paste=true },
                           cursor_make_save());
             
-            rebuild_cache();
+            update_cache(op_hist_.get_current_cmd());
             cursor_mv_down();
         }
         
         save_cursor_pos_to_hist();
         return 0;
+    }    
+    
+    int editor::node_paste_text(const std::string_view input)
+    {
+        std::vector<tree> nodes{ detail::make_pasted_nodes(input, buffer_) };
+        
+        if (nodes.empty())
+            return 1;
+        
+        /* the nodes are placed as in node_paste_default(), and inserted in one command */
+        
+        const auto tmp{ get_const_by_index(tree_instance_, cursor_current_index()) };
+        
+        if (not tmp.has_value())
+            throw std::runtime_error("node_paste_text: cursor index does not exist");
+        
+        const bool as_children{ tmp->get().child_count() != 0 };
+        mti_t index{ make_index_copy_of(cursor_current_index()) };
+        
+        if (as_children)
+        {
+            ensure_unfolded(index);
+            index.push_back(0uz);
+        }
+        else if (std::ranges::size(index) == 0)
+        {
+            throw std::runtime_error("node_paste_text: invalid cursor index");
+        }
+        else
+        {
+            ++(*std::ranges::rbegin(index));
+        }
+        
+        op_hist_.exec(tree_instance_, command{ cmd::multi_cmd{} }, cursor_make_save());
+        
+        for (tree& node : nodes)
+        {
+            append_multi(cmd::insert_node{ .pos = index, .inserted = std::move(node), .is_paste = true });
+            increment_last_index_of(index);
+        }
+        
+        update_cache(op_hist_.get_current_cmd());
+        
+        if (as_children)
+            cursor_mv_down();
+        else
+            cursor_nd_next();
+        
+        save_cursor_pos_to_hist();
+        return 0;
+    }
+    
+    /* Folding */
+    
+    int editor::node_fold()
+    {
+        /* folds the current node, or its parent if the current node is already folded or has no children */
+        
+        mti_t index{ make_index_copy_of(cursor_current_index()) };
+        const auto tmp{ get_const_by_index(tree_instance_, index) };
+        
+        if (not tmp.has_value())
+            throw std::runtime_error("node_fold: cursor index does not exist");
+        
+        if (tmp->get().is_folded() or tmp->get().child_count() == 0)
+        {
+            if (std::ranges::size(index) <= 1)
+                return 1;
+            
+            index.pop_back();
+        }
+        
+        set_node_folded(index, true);
+        cursor_.reset_mnd();
+        return 0;
+    }
+    
+    int editor::node_unfold()
+    {
+        const mti_t index{ make_index_copy_of(cursor_current_index()) };
+        const auto tmp{ get_const_by_index(tree_instance_, index) };
+        
+        if (not tmp.has_value())
+            throw std::runtime_error("node_unfold: cursor index does not exist");
+        
+        if (not tmp->get().is_folded())
+            return 1;
+        
+        set_node_folded(index, false);
+        cursor_.reset_mnd();
+        return 0;
+    }
+    
+    int editor::node_toggle_fold()
+    {
+        const auto tmp{ get_const_by_index(tree_instance_, cursor_current_index()) };
+        
+        if (not tmp.has_value())
+            throw std::runtime_error("node_toggle_fold: cursor index does not exist");
+        
+        if (tmp->get().is_folded())
+            return node_unfold();
+        else if (tmp->get().child_count() > 0)
+            return node_fold();
+        else
+            return 1;
+    }
+    
+    void editor::set_node_folded(const mti_t& index, const bool folded)
+    {
+        const mti_t cursor_index{ make_index_copy_of(cursor_current_index()) };
+        const std::size_t cursor_line{ cursor_current_line() };
+        
+        if (not tree::set_folded(tree_instance_, index, folded))
+            throw std::runtime_error("set_node_folded: index does not exist");
+        
+        /* set_folded copies the node (and the path to it) if it was shared, so the node being edited must be looked up again */
+        editor_.reset();
+        cache_.refold(tree_instance_, index);
+        
+        /* the lines before the cursor may have moved, so it is placed again by its tree index
+         * (or on the folded node, if it was inside it) */
+        
+        if (folded and cursor_index.size() > index.size() and longest_common_position_of(cursor_index, index) == index.size())
+            cursor_.restore_pos(cache_, { /* x = */ 0, /* y = */ cache_.approx_pos_of_tree_idx(index, 0) });
+        else
+            cursor_.restore_pos(cache_, { /* x = */ cursor_x(), /* y = */ cache_.approx_pos_of_tree_idx(cursor_index, cursor_line) });
+        
+        load_lazily(cursor_y());
+    }
+    
+    void editor::ensure_unfolded(const mti_t& index)
+    {
+        /* called before a node is inserted or moved into the node at index, so that it stays in view */
+        
+        if (const auto tmp{ get_const_by_index(tree_instance_, index) }; tmp.has_value() and tmp->get().is_folded())
+            set_node_folded(index, false);
+    }
+    
+    void editor::unfold_ancestors(const mti_t& index)
+    {
+        for (std::size_t depth{ 1 }; depth < index.size(); ++depth)
+            ensure_unfolded(mti_t{ index.begin(), index.begin() + static_cast<std::ptrdiff_t>(depth) });
+    }
+    
+    
+    /* Searching */
+    
+    std::optional<editor::text_pos> editor::find_text(const std::string_view text, const text_pos& from, const bool backwards,
+                                                      const bool include_from, const std::function<bool()>& cancelled)
+    {
+        if (text.empty() or from.index.empty() or not get_const_by_index(tree_instance_, from.index).has_value())
+            return std::nullopt;
+        
+        std::string scratch{};
+        std::vector<std::size_t> matches{};
+        std::size_t lines_searched{ 0 };
+        std::size_t nodes_visited{ 0 };
+        
+        /* with an index, only the nodes which may hold the text are searched; nodes which are not yet indexed (or whose
+         * text has changed since) are indexed as the search reaches them                                            */
+        
+        const auto trigrams{ text_index_ ? text_index::trigrams_of(text) : std::vector<text_index::trigram>{} };
+        auto candidates{ text_index_ ? text_index_->candidates(trigrams) : std::nullopt };
+        
+        if (candidates and candidates->empty() and text_index_->complete())
+            return std::nullopt;
+        
+        const auto may_hold{ [&](const tree_string& content) {
+            if (not candidates)
+                return true;
+            
+            if (text_index_->contains(content))
+                return candidates->contains(content.stamp());
+            
+            /* the node may be reached again (e.g. the node at from), so it joins the candidates if it is one */
+            
+            const auto node_trigrams{ text_index::trigrams_of(content) };
+            text_index_->add(content, node_trigrams);
+            
+            if (not std::ranges::includes(node_trigrams, trigrams))
+                return false;
+            
+            candidates->insert(content.stamp());
+            return true;
+        } };
+        
+        /* finds the first occurrence in node in the direction of the search, starting at (line, col) */
+        const auto search_node{ [&](const tree& node, const std::size_t line, const std::size_t col,
+                                    const bool include_start) -> std::optional<std::pair<std::size_t, std::size_t>> {
+            const auto& content{ node.get_content_const() };
+            
+            if (not may_hold(content))
+                return std::nullopt;
+            
+            for (std::size_t i{ 0 }; i <= line or not backwards; ++i)
+            {
+                const std::size_t l{ backwards ? line - i : line + i };
+                
+                if (l >= content.line_count())
+                    break;
+                
+                matches.clear();
+                content.find_all(l, text, scratch, matches);
+                ++lines_searched;
+                
+                if (not backwards)
+                {
+                    const auto it{ std::ranges::find_if(matches, [&](const std::size_t m) {
+                        return l != line or m > col or (include_start and m == col);
+                    }) };
+                    
+                    if (it != std::ranges::end(matches))
+                        return std::pair{ l, *it };
+                }
+                else
+                {
+                    const auto it{ std::ranges::find_if(matches | std::views::reverse, [&](const std::size_t m) {
+                        return l != line or m < col or (include_start and m == col);
+                    }) };
+                    
+                    if (it != std::ranges::end(matches | std::views::reverse))
+                        return std::pair{ l, *it };
+                }
+            }
+            
+            return std::nullopt;
+        } };
+        
+        /* the nodes on the path from the root to the node being searched */
+        std::vector<const tree*> path{ &tree_instance_ };
+        mti_t index{ from.index };
+        
+        for (const auto i: index)
+            path.push_back(&path.back()->get_child_const(i));
+        
+        if (const auto found{ search_node(*path.back(), from.line, from.col, include_from) })
+            return text_pos{ .index = std::move(index), .line = found->first, .col = found->second };
+        
+        /* visit every other node in pre-order (or reverse pre-order), wrapping around at the end (or start) of the tree,
+         * and then the node at from again, where anything found lies before from (or after it, if backwards) or at it */
+        
+        const auto descend_to_last{ [&] {
+            while (path.back()->child_count() != 0)
+            {
+                index.push_back(path.back()->child_count() - 1);
+                path.push_back(&path.back()->get_child_const(index.back()));
+            }
+        } };
+        
+        for (;;)
+        {
+            if (not backwards)
+            {
+                if (path.back()->child_count() != 0)
+                {
+                    index.push_back(0);
+                    path.push_back(&path.back()->get_child_const(0));
+                }
+                else
+                {
+                    while (index.size() > 1 and index.back() + 1 == path[path.size() - 2]->child_count())
+                    {
+                        index.pop_back();
+                        path.pop_back();
+                    }
+                    
+                    path.pop_back();
+                    index.back() = (index.back() + 1 == path.back()->child_count()) ? 0 : index.back() + 1;
+                    
+                    /* the nodes of a lazily loaded file are materialized as the search reaches them */
+                    while (index.size() == 1 and index.back() >= tree::first_unmaterialized(tree_instance_)
+                           and tree::first_unmaterialized(tree_instance_) != tree_instance_.child_count())
+                    {
+                        load_lazily(cache_.size());
+                    }
+                    
+                    path.push_back(&path.back()->get_child_const(index.back()));
+                }
+            }
+            else
+            {
+                if (last_index_of(index) != 0)
+                {
+                    path.pop_back();
+                    --index.back();
+                    path.push_back(&path.back()->get_child_const(index.back()));
+                    descend_to_last();
+                }
+                else if (index.size() > 1)
+                {
+                    index.pop_back();
+                    path.pop_back();
+                }
+                else
+                {
+                    /* wrap around to the last node, which needs the whole of a lazily loaded file */
+                    load_all();
+                    
+                    path.pop_back();
+                    index.back() = tree_instance_.child_count() - 1;
+                    path.push_back(&path.back()->get_child_const(index.back()));
+                    descend_to_last();
+                }
+            }
+            
+            const auto& node{ *path.back() };
+            ++nodes_visited;
+            
+            const std::size_t last_line{ std::max(node.get_content_const().line_count(), 1uz) - 1 };
+            
+            if (const auto found{ backwards ? search_node(node, last_line, std::numeric_limits<std::size_t>::max(), true)
+                                            : search_node(node, 0, 0, true) })
+            {
+                return text_pos{ .index = std::move(index), .line = found->first, .col = found->second };
+            }
+            
+            if (index == from.index)
+            {
+                /* every node has now been indexed */
+                if (candidates and tree::first_unmaterialized(tree_instance_) == tree_instance_.child_count())
+                    text_index_->mark_complete(tree_instance_, nodes_visited);
+                
+                return std::nullopt;
+            }
+            
+            if (lines_searched >= search_poll_interval)
+            {
+                lines_searched = 0;
+                
+                if (cancelled and cancelled())
+                    return std::nullopt;
+            }
+        }
+    }
+    
+    std::optional<std::size_t> editor::replace_text(const std::string_view pattern, const std::string_view replacement,
+                                                    const bool subtree, const unsigned int jobs)
+    {
+        if (pattern.empty() or replacement.contains('\n'))
+            return std::nullopt;
+        
+        std::regex re{};
+        
+        try
+        {
+            re.assign(std::ranges::begin(pattern), std::ranges::end(pattern));
+        }
+        catch (const std::regex_error&)
+        {
+            return std::nullopt;
+        }
+        
+        /* the nodes searched are the top of each subtree (or the node at the cursor, with the top of each of its subtrees
+         * searched after it), and the subtrees are searched on several threads, each taking the next until none remain */
+        
+        if (not subtree)
+            load_all();
+        
+        const mti_t root_index{ subtree ? make_index_copy_of(cursor_current_index()) : mti_t{} };
+        const auto root{ get_const_by_index(tree_instance_, root_index) };
+        
+        if (not root.has_value())
+            throw std::runtime_error("replace_text: cursor index does not exist");
+        
+        const std::string format{ replacement };
+        std::vector<std::vector<detail::node_replacements>> found(root->get().child_count() + 1);
+        
+        if (subtree)
+            detail::find_node_replacements(root->get().get_content_const(), root_index, re, format, found.back());
+        
+        {
+            std::atomic<std::size_t> next{ 0 };
+            
+            const auto work{ [&] {
+                for (std::size_t i{ next++ }; i < root->get().child_count(); i = next++)
+                {
+                    mti_t index{ root_index };
+                    index.push_back(i);
+                    detail::find_replacements(root->get().get_child_const(i), std::move(index), re, format, found[i]);
+                }
+            } };
+            
+            const auto workers_wanted{ std::min<std::size_t>(std::max(jobs, 1u), root->get().child_count()) };
+            std::vector<std::jthread> workers{};
+            
+            for (std::size_t i{ 1 }; i < workers_wanted; ++i)
+                workers.emplace_back(work);
+            
+            work();
+        }
+        
+        /* the node at the cursor is replaced first, as it precedes its descendants */
+        std::ranges::rotate(found, std::ranges::prev(std::ranges::end(found)));
+        
+        std::size_t match_count{ 0 };
+        
+        for (const auto& nodes : found)
+            for (const auto& node : nodes)
+                match_count += node.matches.size();
+        
+        if (match_count == 0)
+            return 0;
+        
+        /* then make every replacement as one command, with a single edit_contents (and piece table command) per node */
+        
+        op_hist_.exec(tree_instance_, command{ cmd::multi_cmd{ .commands = {}, .is_replace = true } }, cursor_make_save());
+        
+        std::vector<tree_string::replacement> edits{};
+        std::string_view last_text{};
+        extended_piece_table_entry last_entry{};
+        bool appended{ false };
+        
+        for (auto& nodes : found)
+        {
+            for (auto& node : nodes)
+            {
+                edits.clear();
+                
+                for (const auto& m : node.matches)
+                {
+                    /* the same text is only appended to the buffer once in a row (e.g. if replacement has no references) */
+                    if (not appended or m.text != last_text)
+                    {
+                        last_entry = buffer_.append(m.text);
+                        last_text = m.text;
+                        appended = true;
+                    }
+                    
+                    edits.push_back({ .line = m.line, .pos = m.pos, .len = m.len, .inserted = last_entry });
+                }
+                
+                const auto content{ tree::get_editable_tree_string(tree_instance_, node.index) };
+                
+                if (content.has_value() and content->get().replace(edits))
+                    append_multi(cmd::edit_contents{ std::move(node.index) });
+            }
+        }
+        
+        update_cache(op_hist_.get_current_cmd());
+        cursor_clamp_x();
+        save_cursor_pos_to_hist();
+        return match_count;
     }
-}
\ No newline at end of file
+}
@@ -19,11 +19,19 @@
 
 #pragma once
 
+#include <atomic>
 #include <filesystem>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <ranges>
+#include <string>
+#include <thread>
 
 #include "cursor.hpp"
 #include "edit_info.hpp"
+#include "journal.hpp"
+#include "text_index.hpp"
 #include "tree.hpp"
 #include "tree_op.hpp"
 
@@ -52,14 +60,49 @@ namespace treenote::core
     
         void make_empty();
         void close_file();
-        [[nodiscard]] return_t load_file(const std::filesystem::path& path);
+        [[nodiscard]] return_t load_file(const std::filesystem::path& path, unsigned int jobs = 1, bool lazy = false);
         [[nodiscard]] return_t save_file(const std::filesystem::path& path);
         file_msg save_to_tmp(std::filesystem::path& path);
         
+        /* background saving: the tree is snapshotted and written on a worker thread while editing continues */
+        
+        [[nodiscard]] file_msg save_file_async(const std::filesystem::path& path);
+        [[nodiscard]] bool save_in_progress() const noexcept;
+        [[nodiscard]] std::size_t save_bytes_written() const noexcept;
+        [[nodiscard]] std::optional<return_t> poll_save();
+        std::optional<return_t> wait_for_save();
+        
         [[nodiscard]] bool modified() const noexcept;
         
+        /* lazy loading: if load_file is given lazy = true, the nodes of the file are only materialized (see
+         * tree::parse_lazy) as the cursor comes near them, or once the whole tree is needed (e.g. to save it);
+         * until then, cursor_max_y only counts the lines materialized so far                                */
+        
+        /* crash recovery: the changes made to a file are journalled until it is saved (see journal.hpp), and recovered
+         * by load_file if the editor was killed before then; recovered_edits returns the number of changes recovered   */
+        
+        [[nodiscard]] std::size_t recovered_edits() const noexcept;
+        
+        /* buffer compaction: frees the text which neither the tree, the history nor the clipboard can refer to, and
+         * returns the number of bytes reclaimed; compaction_due suggests when to do so (e.g. when idle)           */
+        
+        std::size_t compact_buffer();
+        [[nodiscard]] bool compaction_due() const;
+        
+        /* undo history: once its estimated memory use exceeds the budget (in bytes), the oldest commands are discarded */
+        
+        void set_history_budget(std::size_t budget);
+        [[nodiscard]] std::size_t history_memory_usage() const noexcept;
+        
+        /* search index: if enabled, a trigram index (see text_index.hpp) narrows each search to the nodes which may hold
+         * the text; it is loaded with a file from beside it if it was saved with the file as it is now, and saved beside
+         * the file when the file is saved once it has been built (by a search which has looked at every node)         */
+        
+        void set_indexing(bool enabled);
+        
         [[nodiscard]] auto get_lc_range(std::size_t pos, std::size_t size) const;
-        [[nodiscard]] auto get_entry_prefix(const tree::cache_entry& tce) const;
+        [[nodiscard]] const std::string& get_entry_prefix(const tree::cache_entry& tce) const;
+        [[nodiscard]] auto get_entry_index(const tree::cache_entry& tce) const;
         [[nodiscard]] static auto get_entry_prefix_length(const tree::cache_entry& tce);
         [[nodiscard]] static auto get_entry_content(const tree::cache_entry& tce, std::size_t begin, std::size_t len);
         [[nodiscard]] static auto get_entry_line_length(const tree::cache_entry& tce);
@@ -67,6 +110,7 @@ namespace treenote::core
         /* line editing functions */
         
         void line_insert_text(std::string_view input);
+        void line_insert_block(std::string_view input);
         void line_delete_char();
         void line_backspace();
         void line_newline();
@@ -99,6 +143,38 @@ namespace treenote::core
         int node_copy();
         int node_paste_above();
         int node_paste_default();
+        int node_paste_text(std::string_view input);
+        
+        /* folding: a folded node hides its descendants, which are left out of the line cache (so the cursor and view
+         * skip them); fold state is neither written to the file nor recorded in the undo history                    */
+        
+        int node_fold();
+        int node_unfold();
+        int node_toggle_fold();
+        [[nodiscard]] static auto get_entry_folded(const tree::cache_entry& tce);
+        
+        /* search: find_text finds the first occurrence of text after from (or the last before it, if backwards), looking
+         * in folded nodes too and wrapping around the tree; an occurrence at from is only found if include_from is set.
+         * cancelled is polled as the search goes on, and the search gives up (returning nullopt) once it returns true. */
+        
+        struct text_pos
+        {
+            mti_t           index;
+            std::size_t     line;
+            std::size_t     col;
+        };
+        
+        [[nodiscard]] std::optional<text_pos> find_text(std::string_view text, const text_pos& from, bool backwards,
+                                                        bool include_from, const std::function<bool()>& cancelled);
+        
+        /* replace: replace_text replaces every match of the regular expression pattern (in ECMAScript syntax, and never
+         * spanning lines) by replacement (in which $& and $n refer to the match, as in std::regex_replace) in every node,
+         * or only in the node at the cursor and its descendants if subtree is set, as one command which is undone in one
+         * step. The matches are found first (on up to jobs threads), and then each node is changed in one edit. Returns
+         * the number of matches replaced, or nullopt if pattern is invalid or replacement contains a line break.      */
+        
+        [[nodiscard]] std::optional<std::size_t> replace_text(std::string_view pattern, std::string_view replacement,
+                                                              bool subtree, unsigned int jobs = 1);
         
         /* wrapper functions to for cursor */
         
@@ -123,7 +199,7 @@ namespace treenote::core
         [[nodiscard]] std::size_t cursor_y() const noexcept;
         [[nodiscard]] std::size_t cursor_x() const noexcept;
         [[nodiscard]] std::size_t cursor_current_indent_lvl() const;
-        [[nodiscard]] const auto& cursor_current_index() const;
+        [[nodiscard]] auto cursor_current_index() const;
         [[nodiscard]] std::size_t cursor_current_line() const;
         [[nodiscard]] std::size_t cursor_current_child_count() const;
         [[nodiscard]] std::size_t cursor_max_y() const noexcept;
@@ -137,7 +213,12 @@ namespace treenote::core
         
     private:
         void init();
+        void load_lazily(std::size_t line);
+        void load_all();
         void rebuild_cache();
+        void update_cache(const command* cmd);
+        void after_cache_update();
+        void append_multi(command&& cmd);
         void cursor_clamp_x();
         void delete_line_break_forward_impl();
         void delete_line_break_backward_impl();
@@ -146,6 +227,24 @@ namespace treenote::core
         [[nodiscard]] operation_stack::cursor_pos cursor_make_save() const;
         void cursor_restore(const operation_stack::cursor_pos& pos);
         void save_cursor_pos_to_hist();
+        [[nodiscard]] tree_string& get_current_tree_string();
+        void set_node_folded(const mti_t& index, bool folded);
+        void ensure_unfolded(const mti_t& index);
+        void unfold_ancestors(const mti_t& index);
+        void save_text_index(const std::filesystem::path& path, const tree& saved);
+        
+        struct pending_save
+        {
+            tree                        snapshot;
+            buffer::reader              reader;
+            std::filesystem::path       path;
+            std::string                 journal_base{};     /* see journal::prepare_base */
+            save_load_info              info{ .node_count = 0, .line_count = 0 };
+            std::atomic<std::size_t>    bytes_written{ 0 };
+            std::atomic<bool>           done{ false };
+            bool                        success{ false };
+            std::jthread                worker{};           /* declared last so that it is joined first */
+        };
         
         tree                        tree_instance_;
         operation_stack             op_hist_;
@@ -155,6 +254,18 @@ namespace treenote::core
         buffer                 buffer_;
         
         std::optional<tree>         copied_tree_node_buffer_;
+        std::size_t                 stored_size_after_compaction_{ 0 };
+        std::size_t                 history_budget_{ operation_stack::default_memory_budget };
+        
+        static constexpr std::size_t lazy_load_margin{ 4096 };  /* lines kept materialized beyond the cursor */
+        static constexpr std::size_t search_poll_interval{ 4096 }; /* lines searched between polls of cancelled */
+        
+        journal                     journal_;
+        std::size_t                 recovered_edits_{ 0 };
+        
+        std::unique_ptr<text_index> text_index_;            /* only set if indexing is enabled */
+        
+        std::unique_ptr<pending_save> pending_save_;        /* declared last so that the worker stops before buffer_ is destroyed */
         
     };
     
@@ -169,6 +280,8 @@ namespace treenote::core
     
     inline editor::~editor()
     {
+        static_cast<void>(wait_for_save());
+        
         if (modified())
         {
             /* save file as temporary (used in case of crashes) 
@@ -177,6 +290,9 @@ namespace treenote::core
             std::filesystem::path path{ tree_instance_.get_content_const().to_str(0) };
             save_to_tmp(path);
         }
+        
+        /* keep the journal if the changes have not been saved anywhere */
+        journal_.stop(not modified());
     }
     
     inline bool editor::modified() const noexcept
@@ -184,6 +300,44 @@ namespace treenote::core
         return op_hist_.file_is_modified();
     }
     
+    inline std::size_t editor::recovered_edits() const noexcept
+    {
+        return recovered_edits_;
+    }
+    
+    inline std::size_t editor::history_memory_usage() const noexcept
+    {
+        return op_hist_.memory_usage();
+    }
+    
+    inline bool editor::compaction_due() const
+    {
+        /* compaction copies every live byte, so wait until a reasonable amount of text has been appended since the last */
+        static constexpr std::size_t threshold{ std::size_t{ 1 } << 20 };
+        
+        return not pending_save_ and buffer_.stored_size() >= stored_size_after_compaction_ + threshold;
+    }
+    
+    inline bool editor::save_in_progress() const noexcept
+    {
+        return pending_save_ != nullptr;
+    }
+    
+    inline std::size_t editor::save_bytes_written() const noexcept
+    {
+        return pending_save_ ? pending_save_->bytes_written.load(std::memory_order_relaxed) : 0;
+    }
+    
+    inline std::optional<editor::return_t> editor::poll_save()
+    {
+        /* returns the result of a background save once it has finished, and nullopt otherwise */
+        
+        if (pending_save_ and pending_save_->done.load(std::memory_order_acquire))
+            return wait_for_save();
+        
+        return std::nullopt;
+    }
+    
     inline void editor::close_file()
     {
         make_empty();
@@ -199,14 +353,19 @@ namespace treenote::core
         return cache_() | std::views::drop(begin) | std::views::take(count);
     }
     
-    inline auto editor::get_entry_prefix(const tree::cache_entry& tce) const
+    inline const std::string& editor::get_entry_prefix(const tree::cache_entry& tce) const
+    {
+        return cache_.entry_prefix_string(tce);
+    }
+    
+    inline auto editor::get_entry_index(const tree::cache_entry& tce) const
     {
-        return get_indent_info_by_index(tree_instance_, tce.index, tce.line_no != 0);
+        return cache_.index_of(tce);
     }
     
     inline auto editor::get_entry_prefix_length(const tree::cache_entry& tce)
     {
-        return std::ranges::size(tce.index) - 1;
+        return tce.depth - 1;
     }
     
     inline auto editor::get_entry_content(const tree::cache_entry& tce, const std::size_t begin, const std::size_t len)
@@ -219,22 +378,89 @@ namespace treenote::core
         return tce.ref.get().get_content_const().line_length(tce.line_no);
     }
     
+    inline auto editor::get_entry_folded(const tree::cache_entry& tce)
+    {
+        return tce.ref.get().is_folded() and tce.ref.get().child_count() > 0;
+    }
+    
     
     /* Inline private member functions */
     
     inline void editor::init()
     {
         op_hist_ = operation_stack{};
+        op_hist_.set_memory_budget(tree_instance_, history_budget_);
+        op_hist_.set_journal(&journal_);
+        op_hist_.set_text_index(text_index_.get());
+        recovered_edits_ = 0;
         editor_.reset();
         cursor_.reset();
         rebuild_cache();
     }
     
+    inline void editor::load_lazily(const std::size_t line)
+    {
+        /* materializes more of a lazily loaded file once line is within lazy_load_margin lines of the end of the cache,
+         * or once the top-level node after that of the cursor is unmaterialized (as the cursor, and the commands made
+         * at it, may move there); at least as many lines as the cache holds are materialized at once, so scrolling
+         * through the whole file takes linear time in total                                                       */
+        
+        const std::size_t first{ tree::first_unmaterialized(tree_instance_) };
+        
+        if (first == tree_instance_.child_count())
+            return;
+        
+        const std::size_t top_level{ cache_.size() == 0 ? 0 : cache_.index(cursor_y()).front() };
+        
+        if (cache_.size() != 0 and line + lazy_load_margin < cache_.size() and top_level + 1 < first)
+            return;
+        
+        const std::size_t wanted{ line + 2 * lazy_load_margin };
+        tree::materialize(tree_instance_, std::max(wanted - std::min(wanted, cache_.size()), cache_.size()));
+        
+        /* the lines materialized follow every line in the cache, so the cursor is unaffected */
+        cache_.rebuild(tree_instance_);
+    }
+    
+    inline void editor::load_all()
+    {
+        if (tree::first_unmaterialized(tree_instance_) != tree_instance_.child_count())
+        {
+            tree::materialize_all(tree_instance_);
+            cache_.rebuild(tree_instance_);
+        }
+    }
+    
     inline void editor::rebuild_cache()
     {
         cache_.rebuild(tree_instance_);
+        after_cache_update();
+    }
+    
+    /* patches the cache after cmd has been executed; the commands of a multi_cmd are patched one at a time as they
+     * are appended instead (see append_multi), or undone and redone (see undo)                                   */
+    inline void editor::update_cache(const command* cmd)
+    {
+        if (cmd == nullptr)
+            cache_.rebuild(tree_instance_);
+        else if (not std::holds_alternative<cmd::multi_cmd>(*cmd))
+            cache_.update(tree_instance_, *cmd);
+        
+        after_cache_update();
+    }
+    
+    inline void editor::after_cache_update()
+    {
         cursor_.clamp_y(cache_);
         editor_.reset();
+        load_lazily(cursor_y());
+    }
+    
+    /* adds cmd to the current command (see operation_stack::append_multi), and patches the cache for it */
+    inline void editor::append_multi(command&& cmd)
+    {
+        op_hist_.append_multi(tree_instance_, std::move(cmd));
+        cache_.update(tree_instance_, std::get<cmd::multi_cmd>(*op_hist_.get_current_cmd()).commands.back());
     }
     
     inline void editor::cursor_clamp_x()
@@ -284,6 +510,7 @@ namespace treenote::core
     {
         cursor_.mv_right(cache_, amt);
         cursor_.reset_mnd();
+        load_lazily(cursor_y());
     }
 
     inline void editor::cursor_mv_up(const std::size_t amt)
@@ -294,14 +521,17 @@ namespace treenote::core
 
     inline void editor::cursor_mv_down(const std::size_t amt)
     {
+        load_lazily(cursor_y() + amt);
         cursor_.mv_down(cache_, amt);
         cursor_.reset_mnd();
+        load_lazily(cursor_y());
     }
 
     inline void editor::cursor_wd_forward()
     {
         cursor_.wd_forward(cache_);
         cursor_.reset_mnd();
+        load_lazily(cursor_y());
     }
 
     inline void editor::cursor_wd_backward()
@@ -318,6 +548,7 @@ namespace treenote::core
 
     inline void editor::cursor_to_EOF()
     {
+        load_all();
         cursor_.to_EOF(cache_);
         cursor_.reset_mnd();
     }
@@ -346,6 +577,7 @@ namespace treenote::core
         for (std::size_t i{ 0 }; i < amt; ++i)
             cursor_.nd_child(cache_);
         cursor_.reset_mnd();
+        load_lazily(cursor_y());
     }
 
     inline void editor::cursor_nd_prev(const std::size_t amt)
@@ -358,18 +590,34 @@ namespace treenote::core
     inline void editor::cursor_nd_next(const std::size_t amt)
     {
         for (std::size_t i{ 0 }; i < amt; ++i)
+        {
             cursor_.nd_next(cache_);
+            load_lazily(cursor_y());
+        }
         cursor_.reset_mnd();
     }
     
     inline void editor::cursor_go_to(const tree_index auto& idx, std::size_t line, std::size_t col)
     {
+        /* materialize up to (and including) the top-level node after that of idx */
+        while (std::ranges::size(idx) != 0 and *std::ranges::begin(idx) + 1 >= tree::first_unmaterialized(tree_instance_)
+               and tree::first_unmaterialized(tree_instance_) != tree_instance_.child_count())
+        {
+            load_lazily(cache_.size());
+        }
+        
+        if (get_const_by_index(tree_instance_, idx).has_value())
+            unfold_ancestors(make_index_copy_of(idx));
+        
         cursor_.restore_pos(cache_, { /* x = */ col, /* y = */ cache_.approx_pos_of_tree_idx(idx, line) });
+        load_lazily(cursor_y());
     }
     
     inline void editor::cursor_go_to(std::size_t cache_entry_pos, std::size_t col)
     {
+        load_lazily(cache_entry_pos);
         cursor_.restore_pos(cache_, { /* x = */ col, /* y = */ cache_entry_pos });
+        load_lazily(cursor_y());
     }
 
     inline std::size_t editor::cursor_y() const noexcept
@@ -387,7 +635,7 @@ namespace treenote::core
         return std::max(get_tree_entry_depth(cache_.index(cursor_y())), 1uz) - 1;
     }
 
-    inline const auto& editor::cursor_current_index() const
+    inline auto editor::cursor_current_index() const
     {
         return cache_.index(cursor_y());
     }
@@ -423,24 +671,42 @@ namespace treenote::core
     inline cmd_names editor::undo()
     {
         auto ret_val{ op_hist_.get_current_cmd_name(tree_instance_) };
-        const auto [undo_result, saved_cursor_pos]{ op_hist_.undo(tree_instance_) };
-        rebuild_cache();
+        const auto [undo_result, saved_cursor_pos]{ op_hist_.undo(tree_instance_, [this](const command& cmd, const bool reverse) {
+            cache_.update(tree_instance_, cmd, reverse);
+        }) };
         if (undo_result != 0)
+        {
+            rebuild_cache();
             ret_val = cmd_names::error;
-        else if (saved_cursor_pos.has_value())
-            cursor_restore(*saved_cursor_pos);
+        }
+        else
+        {
+            after_cache_update();
+            
+            if (saved_cursor_pos.has_value())
+                cursor_restore(*saved_cursor_pos);
+        }
         return ret_val;
     }
     
     inline cmd_names editor::redo()
     {
-        const auto [redo_rv, saved_cursor_pos]{ op_hist_.redo(tree_instance_) };
+        const auto [redo_rv, saved_cursor_pos]{ op_hist_.redo(tree_instance_, [this](const command& cmd, const bool reverse) {
+            cache_.update(tree_instance_, cmd, reverse);
+        }) };
         auto ret_val{ op_hist_.get_current_cmd_name(tree_instance_) };
-        rebuild_cache();
         if (redo_rv != 0)
+        {
+            rebuild_cache();
             ret_val = cmd_names::error;
-        else if (saved_cursor_pos.has_value())
-            cursor_restore(*saved_cursor_pos);
+        }
+        else
+        {
+            after_cache_update();
+            
+            if (saved_cursor_pos.has_value())
+                cursor_restore(*saved_cursor_pos);
+        }
         return ret_val;
     }
     
@@ -471,9 +737,9 @@ namespace treenote::core
 
     inline void editor::node_insert_above()
     {
-        op_hist_.exec(tree_instance_, cmd::insert_node{ .pos = cursor_current_index(), .inserted = tree{} }, cursor_make_save());
+        op_hist_.exec(tree_instance_, cmd::insert_node{ .pos = make_index_copy_of(cursor_current_index()), .inserted = tree{} }, cursor_make_save());
         
-        rebuild_cache();
+        update_cache(op_hist_.get_current_cmd());
         cursor_mv_down();
         cursor_nd_prev();
         save_cursor_pos_to_hist();
@@ -481,7 +747,7 @@ namespace treenote::core
     
     inline void editor::node_insert_below()
     {
-        auto index{ cursor_current_index() };
+        mti_t index{ make_index_copy_of(cursor_current_index()) };
         
         if (std::ranges::size(index) == 0)
             return;
@@ -489,18 +755,19 @@ namespace treenote::core
         ++(*std::ranges::rbegin(index));
         op_hist_.exec(tree_instance_, cmd::insert_node{ .pos = index, .inserted = tree{} }, cursor_make_save());
     
-        rebuild_cache();
+        update_cache(op_hist_.get_current_cmd());
         cursor_nd_next();
         save_cursor_pos_to_hist();
     }
 
     inline void editor::node_insert_child()
     {
-        auto index{ cursor_current_index() };
+        mti_t index{ make_index_copy_of(cursor_current_index()) };
+        ensure_unfolded(index);
         index.push_back(0uz);
         op_hist_.exec(tree_instance_, cmd::insert_node{ .pos = index, .inserted = tree{} }, cursor_make_save());
     
-        rebuild_cache();
+        update_cache(op_hist_.get_current_cmd());
         cursor_mv_down();
         save_cursor_pos_to_hist();
     }
@@ -0,0 +1,930 @@
+// core/journal.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "journal.hpp"
+
+#include <algorithm>
+#include <array>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "tree_op.hpp"
+
+namespace treenote::core
+{
+    namespace detail
+    {
+        namespace
+        {
+            template<typename... Ts>
+            struct overload : Ts ... { using Ts::operator()...; };
+            
+            /* Layout of a journal: a header, followed by records, each of which is laid out as
+             *
+             *      varint          length of the payload
+             *      payload         record type (1 byte), then its fields as varints and strings (a varint length and
+             *                      the bytes); tree indices are a varint length then the indices, and nodes are their
+             *                      lines (a varint count then each line as a string) then their children (likewise)
+             *      4 bytes         checksum of the payload
+             *
+             * A record which is cut short or fails its checksum (e.g. as it was being written when the editor was killed)
+             * ends the journal.                                                                                        */
+            
+            constexpr std::array<char, 4> journal_magic{ 'T', 'N', 'J', '1' };
+            constexpr std::size_t header_size{ journal_magic.size() + 24 };
+            constexpr std::uint64_t no_file_size{ std::numeric_limits<std::uint64_t>::max() };
+            
+            struct file_identity
+            {
+                std::uint64_t   size;       /* no_file_size if the file does not exist */
+                std::int64_t    mtime;      /* in nanoseconds */
+                std::uint64_t   hash;       /* of the contents (see content_hash), or 0 if the file does not exist */
+                
+                bool operator==(const file_identity&) const = default;
+            };
+            
+            file_identity identity_of(const std::filesystem::path& file)
+            {
+                /* a journal belongs to the file with the identity in its header; if the file is saved (or modified by
+                 * anything else) after the journal was begun, its identity changes and the journal no longer applies */
+                /* note: the hash is left as 0, since it is only worth reading the file for once the rest matches      */
+                
+                struct stat st{};
+                
+                if (::stat(file.c_str(), &st) != 0)
+                    return { .size = no_file_size, .mtime = 0, .hash = 0 };
+                
+                return { .size = static_cast<std::uint64_t>(st.st_size),
+                         .mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec,
+                         .hash = 0 };
+            }
+            
+            std::optional<std::uint64_t> hash_of(const std::filesystem::path& file)
+            {
+                const int fd{ ::open(file.c_str(), O_RDONLY | O_CLOEXEC) };
+                
+                if (fd < 0)
+                    return std::nullopt;
+                
+                std::array<char, 64 * 1024> block{};
+                std::uint64_t result{ content_hash_init };
+                ssize_t count{};
+                
+                while ((count = ::read(fd, block.data(), block.size())) > 0)
+                    result = content_hash({ block.data(), static_cast<std::size_t>(count) }, result);
+                
+                ::close(fd);
+                
+                if (count < 0)
+                    return std::nullopt;
+                
+                return result;
+            }
+            
+            bool is_identity_of(const file_identity& id, const std::filesystem::path& file)
+            {
+                auto current{ identity_of(file) };
+                current.hash = id.hash;
+                
+                return current == id and (id.size == no_file_size or hash_of(file) == id.hash);
+            }
+            
+            void append_fixed(std::string& out, const std::uint64_t value, const std::size_t bytes)
+            {
+                for (std::size_t i{ 0 }; i < bytes; ++i)
+                    out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+            }
+            
+            std::uint64_t read_fixed(const std::string_view in, const std::size_t pos, const std::size_t bytes)
+            {
+                std::uint64_t result{ 0 };
+                
+                for (std::size_t i{ 0 }; i < bytes; ++i)
+                    result |= std::uint64_t{ static_cast<unsigned char>(in[pos + i]) } << (8 * i);
+                
+                return result;
+            }
+            
+            void append_varint(std::string& out, std::uint64_t value)
+            {
+                while (value >= 0x80)
+                {
+                    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                    value >>= 7;
+                }
+                
+                out.push_back(static_cast<char>(value));
+            }
+            
+            void append_string(std::string& out, const std::string_view str)
+            {
+                append_varint(out, str.size());
+                out.append(str);
+            }
+            
+            void append_contents(std::string& out, const tree_string& contents, const buffer::reader* reader = nullptr)
+            {
+                append_varint(out, contents.line_count());
+                
+                for (std::size_t i{ 0 }; i < contents.line_count(); ++i)
+                {
+                    if (reader)
+                    {
+                        std::vector<std::string_view> parts{};
+                        contents.append_str_view(i, *reader, parts);
+                        
+                        std::size_t length{ 0 };
+                        for (const auto& part : parts)
+                            length += part.size();
+                        
+                        append_varint(out, length);
+                        for (const auto& part : parts)
+                            out.append(part);
+                    }
+                    else
+                    {
+                        append_string(out, contents.to_str(i));
+                    }
+                }
+            }
+            
+            void append_node(std::string& out, const tree& node, const buffer::reader* reader = nullptr)
+            {
+                append_contents(out, node.get_content_const(), reader);
+                append_varint(out, node.child_count());
+                
+                for (std::size_t i{ 0 }; i < node.child_count(); ++i)
+                    append_node(out, node.get_child_const(i), reader);
+            }
+            
+            std::uint32_t checksum(const std::string_view payload)
+            {
+                /* FNV-1a */
+                
+                std::uint32_t result{ 2166136261u };
+                
+                for (const char c : payload)
+                    result = (result ^ static_cast<unsigned char>(c)) * 16777619u;
+                
+                return result;
+            }
+            
+            void append_frame(std::string& out, const std::string_view payload)
+            {
+                append_varint(out, payload.size());
+                out.append(payload);
+                append_fixed(out, checksum(payload), 4);
+            }
+            
+            std::string make_header(const file_identity& id)
+            {
+                std::string result{ journal_magic.data(), journal_magic.size() };
+                append_fixed(result, id.size, 8);
+                append_fixed(result, static_cast<std::uint64_t>(id.mtime), 8);
+                append_fixed(result, id.hash, 8);
+                return result;
+            }
+            
+            file_identity read_header(const std::string_view header)
+            {
+                return { .size = read_fixed(header, journal_magic.size(), 8),
+                         .mtime = static_cast<std::int64_t>(read_fixed(header, journal_magic.size() + 8, 8)),
+                         .hash = read_fixed(header, journal_magic.size() + 16, 8) };
+            }
+            
+            bool write_all(const int fd, std::string_view data)
+            {
+                while (not data.empty())
+                {
+                    const auto written{ ::write(fd, data.data(), data.size()) };
+                    
+                    if (written < 0)
+                        return false;
+                    
+                    data.remove_prefix(static_cast<std::size_t>(written));
+                }
+                
+                return true;
+            }
+            
+            void sync_parent_directory(const std::filesystem::path& path)
+            {
+                /* so that a rename into the directory survives a crash */
+                
+                const auto dir{ path.has_parent_path() ? path.parent_path() : std::filesystem::path{ "." } };
+                
+                if (const int dir_fd{ ::open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC) }; dir_fd >= 0)
+                {
+                    static_cast<void>(::fsync(dir_fd));
+                    ::close(dir_fd);
+                }
+            }
+            
+            bool write_synced(const std::filesystem::path& path, const std::string_view contents, const int flags)
+            {
+                const int fd{ ::open(path.c_str(), O_WRONLY | O_CLOEXEC | flags, 0600) };
+                
+                if (fd < 0)
+                    return false;
+                
+                const bool success{ write_all(fd, contents) and ::fsync(fd) == 0 };
+                return (::close(fd) == 0) and success;
+            }
+            
+            int install_journal(const std::filesystem::path& tmp_path, const std::filesystem::path& path)
+            {
+                /* renames the journal at tmp_path (which has been synced) over path, so that a journal is never left half
+                 * written; returns a descriptor to append to it, or -1 on failure                                       */
+                
+                std::error_code ec{};
+                std::filesystem::rename(tmp_path, path, ec);
+                
+                if (ec)
+                {
+                    std::filesystem::remove(tmp_path, ec);
+                    return -1;
+                }
+                
+                sync_parent_directory(path);
+                return ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            }
+            
+            std::filesystem::path tmp_path_for(const std::filesystem::path& path)
+            {
+                auto result{ path };
+                result += ".tmp";
+                return result;
+            }
+            
+            class record_reader
+            {
+            public:
+                explicit record_reader(const std::string_view data) :
+                        data_{ data }
+                {
+                }
+                
+                [[nodiscard]] std::uint8_t get_byte()
+                {
+                    if (pos_ >= data_.size())
+                        throw std::runtime_error{ "journal: record is cut short" };
+                    
+                    return static_cast<std::uint8_t>(data_[pos_++]);
+                }
+                
+                [[nodiscard]] std::uint64_t get_varint()
+                {
+                    std::uint64_t result{ 0 };
+                    
+                    for (unsigned int shift{ 0 }; shift < 64; shift += 7)
+                    {
+                        const std::uint8_t byte{ get_byte() };
+                        result |= std::uint64_t{ byte & 0x7fu } << shift;
+                        
+                        if ((byte & 0x80) == 0)
+                            return result;
+                    }
+                    
+                    throw std::runtime_error{ "journal: invalid varint" };
+                }
+                
+                [[nodiscard]] std::size_t get_size()
+                {
+                    /* sizes can never exceed the length of the data, which also stops huge allocations */
+                    
+                    const auto result{ get_varint() };
+                    
+                    if (result > data_.size())
+                        throw std::runtime_error{ "journal: invalid size" };
+                    
+                    return static_cast<std::size_t>(result);
+                }
+                
+                [[nodiscard]] mti_t get_index()
+                {
+                    mti_t result(get_size());
+                    
+                    for (auto& i : result)
+                        i = static_cast<std::size_t>(get_varint());
+                    
+                    return result;
+                }
+                
+                [[nodiscard]] std::string_view get_string()
+                {
+                    const std::size_t size{ get_size() };
+                    
+                    if (size > data_.size() - pos_)
+                        throw std::runtime_error{ "journal: record is cut short" };
+                    
+                    const auto result{ data_.substr(pos_, size) };
+                    pos_ += size;
+                    return result;
+                }
+                
+                [[nodiscard]] tree_string get_contents(buffer& buf)
+                {
+                    const std::size_t line_count{ get_size() };
+                    
+                    if (line_count == 0)
+                        throw std::runtime_error{ "journal: node has no lines" };
+                    
+                    tree_string result{ buf.append(get_string()) };
+                    
+                    for (std::size_t i{ 1 }; i < line_count; ++i)
+                        result.add_line(buf.append(get_string()));
+                    
+                    return result;
+                }
+                
+                [[nodiscard]] tree get_node(buffer& buf)
+                {
+                    auto contents{ get_contents(buf) };
+                    std::vector<tree> children(get_size());
+                    
+                    for (auto& child : children)
+                        child = get_node(buf);
+                    
+                    return tree::make_node(std::move(contents), std::move(children));
+                }
+                
+                [[nodiscard]] std::size_t position() const noexcept
+                {
+                    return pos_;
+                }
+                
+            private:
+                std::string_view    data_;
+                std::size_t         pos_{ 0 };
+            };
+            
+            tree_string& editable_contents(tree& tree_root, const mti_t& pos)
+            {
+                if (pos.empty())
+                    throw std::out_of_range{ "journal: invalid tree index" };
+                
+                if (auto result{ tree::get_editable_tree_string(tree_root, pos) })
+                    return result->get();
+                
+                throw std::out_of_range{ "journal: invalid tree index" };
+            }
+            
+            void check_node_exists(const tree& tree_root, const mti_t& pos)
+            {
+                if (pos.empty() or not get_const_by_index(tree_root, pos).has_value())
+                    throw std::out_of_range{ "journal: invalid tree index" };
+            }
+            
+            void check_insert_pos(const tree& tree_root, const mti_t& pos)
+            {
+                if (pos.empty())
+                    throw std::out_of_range{ "journal: invalid tree index" };
+                
+                const auto parent{ get_const_by_index(tree_root, parent_index_of(pos)) };
+                
+                if (not parent.has_value() or last_index_of(pos) > parent->get().child_count())
+                    throw std::out_of_range{ "journal: invalid tree index" };
+            }
+            
+            void check_line(const tree_string& contents, const std::size_t line)
+            {
+                /* positions past the end of a line are left to tree_string (as the editor may pass them too) */
+                
+                if (line >= contents.line_count())
+                    throw std::out_of_range{ "journal: invalid line" };
+            }
+        }
+    }
+    
+    journal::~journal()
+    {
+        close_writer();
+    }
+    
+    std::filesystem::path journal::path_for(const std::filesystem::path& file)
+    {
+        /* e.g. notes/.todo.txt.journal for notes/todo.txt */
+        
+        auto result{ file.parent_path() };
+        result /= "." + file.filename().string() + ".journal";
+        return result;
+    }
+    
+    std::optional<journal::replay_info> journal::replay(const std::filesystem::path& file, tree& tree_root, buffer& buf)
+    {
+        std::ifstream is{ path_for(file), std::ios::binary };
+        
+        if (not is)
+            return std::nullopt;
+        
+        const std::string data{ std::istreambuf_iterator<char>{ is }, std::istreambuf_iterator<char>{} };
+        const std::string_view view{ data };
+        
+        if (data.size() < detail::header_size or not std::ranges::equal(view.substr(0, detail::journal_magic.size()), detail::journal_magic))
+            return std::nullopt;
+        
+        if (not detail::is_identity_of(detail::read_header(view), file))
+            return std::nullopt;
+        
+        replay_info result{ .record_count = 0, .valid_size = detail::header_size };
+        
+        try
+        {
+            while (result.valid_size < data.size())
+            {
+                detail::record_reader frame{ view.substr(result.valid_size) };
+                const auto payload{ frame.get_string() };
+                const std::size_t frame_size{ frame.position() };
+                
+                if (result.valid_size + frame_size + 4 > data.size()
+                    or detail::read_fixed(view, result.valid_size + frame_size, 4) != detail::checksum(payload))
+                    break;
+                
+                apply(payload, tree_root, buf);
+                
+                ++result.record_count;
+                result.valid_size += frame_size + 4;
+            }
+        }
+        catch (const std::exception&)
+        {
+            /* the rest of the journal is unusable, but the records applied so far are still recovered */
+        }
+        
+        /* the commands made by replaying records cannot be undone, since there are no commands in the tree's history
+         * which refer to them, so they are discarded                                                              */
+        
+        std::unordered_set<tree_string*> strings{};
+        tree::collect_tree_strings(tree_root, strings);
+        
+        for (auto* s : strings)
+            s->discard_history_through(tree_string::last_serial());
+        
+        return result;
+    }
+    
+    void journal::apply(const std::string_view payload, tree& tree_root, buffer& buf)
+    {
+        detail::record_reader reader{ payload };
+        std::size_t amt{ 0 };
+        
+        switch (static_cast<record_type>(reader.get_byte()))
+        {
+            case record_type::insert_str:
+            {
+                const auto pos{ reader.get_index() };
+                const auto line{ reader.get_varint() };
+                const auto col{ reader.get_varint() };
+                const auto text{ reader.get_string() };
+                auto& contents{ detail::editable_contents(tree_root, pos) };
+                
+                detail::check_line(contents, line);
+                contents.insert_str(line, col, buf.append(text), amt);
+                break;
+            }
+            case record_type::delete_char_before:
+            {
+                const auto pos{ reader.get_index() };
+                const auto line{ reader.get_varint() };
+                const auto col{ reader.get_varint() };
+                auto& contents{ detail::editable_contents(tree_root, pos) };
+                
+                detail::check_line(contents, line);
+                contents.delete_char_before(line, col, amt);
+                break;
+            }
+            case record_type::delete_char_current:
+            {
+                const auto pos{ reader.get_index() };
+                const auto line{ reader.get_varint() };
+                const auto col{ reader.get_varint() };
+                auto& contents{ detail::editable_contents(tree_root, pos) };
+                
+                detail::check_line(contents, line);
+                contents.delete_char_current(line, col);
+                break;
+            }
+            case record_type::line_break:
+            {
+                const auto pos{ reader.get_index() };
+                const auto line{ reader.get_varint() };
+                const auto col{ reader.get_varint() };
+                detail::editable_contents(tree_root, pos).make_line_break(line, col);
+                break;
+            }
+            case record_type::line_join:
+            {
+                const auto pos{ reader.get_index() };
+                const auto line{ reader.get_varint() };
+                detail::editable_contents(tree_root, pos).make_line_join(line);
+                break;
+            }
+            case record_type::set_contents:
+            {
+                const auto pos{ reader.get_index() };
+                auto contents{ reader.get_contents(buf) };
+                detail::editable_contents(tree_root, pos) = std::move(contents);
+                break;
+            }
+            case record_type::insert_node:
+            {
+                auto pos{ reader.get_index() };
+                auto node{ reader.get_node(buf) };
+                detail::check_insert_pos(tree_root, pos);
+                
+                command cmd{ cmd::insert_node{ .pos = std::move(pos), .inserted = std::move(node) } };
+                tree::invoke(tree_root, cmd);
+                break;
+            }
+            case record_type::delete_node:
+            {
+                auto pos{ reader.get_index() };
+                detail::check_node_exists(tree_root, pos);
+                
+                command cmd{ cmd::delete_node{ .pos = std::move(pos), .deleted = std::nullopt } };
+                tree::invoke(tree_root, cmd);
+                break;
+            }
+            case record_type::move_node:
+            {
+                auto src{ reader.get_index() };
+                auto dst{ reader.get_index() };
+                detail::check_node_exists(tree_root, src);
+                detail::check_insert_pos(tree_root, dst);
+                
+                command cmd{ cmd::move_node{ .src = std::move(src), .dst = std::move(dst) } };
+                tree::invoke(tree_root, cmd);
+                break;
+            }
+            case record_type::replace_tree:
+            {
+                std::vector<tree> nodes(reader.get_size());
+                
+                for (auto& node : nodes)
+                    node = reader.get_node(buf);
+                
+                for (std::size_t i{ tree_root.child_count() }; i > 0; --i)
+                {
+                    command cmd{ cmd::delete_node{ .pos = mti_t{ i - 1 }, .deleted = std::nullopt } };
+                    tree::invoke(tree_root, cmd);
+                }
+                
+                for (std::size_t i{ 0 }; i < nodes.size(); ++i)
+                {
+                    command cmd{ cmd::insert_node{ .pos = mti_t{ i }, .inserted = std::move(nodes[i]) } };
+                    tree::invoke(tree_root, cmd);
+                }
+                
+                break;
+            }
+            default:
+                throw std::runtime_error{ "journal: unknown record type" };
+        }
+    }
+    
+    void journal::start(const std::filesystem::path& file, const std::size_t keep_size)
+    {
+        close_writer();
+        path_.clear();
+        file_.clear();
+        header_.clear();
+        since_mark_.reset();
+        
+        const auto path{ path_for(file) };
+        int fd{ -1 };
+        
+        if (keep_size != 0)
+        {
+            /* drop anything after the last intact record, so that new records are not appended after a broken one */
+            fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+            
+            if (fd < 0)
+                return;
+            
+            if (::ftruncate(fd, static_cast<off_t>(keep_size)) != 0 or ::fsync(fd) != 0)
+            {
+                ::close(fd);
+                return;
+            }
+        }
+        else
+        {
+            /* the journal is created with the first records made (see create), as the file is then hashed */
+            file_ = file;
+            header_ = detail::make_header(detail::identity_of(file));
+        }
+        
+        path_ = path;
+        open_writer(fd);
+    }
+    
+    void journal::stop(const bool remove)
+    {
+        close_writer();
+        
+        if (remove and not path_.empty())
+        {
+            std::error_code ec{};
+            std::filesystem::remove(path_, ec);
+        }
+        
+        path_.clear();
+        file_.clear();
+        header_.clear();
+        since_mark_.reset();
+    }
+    
+    void journal::mark()
+    {
+        if (active())
+            since_mark_.emplace();
+    }
+    
+    std::string journal::prepare_base(const std::filesystem::path& file, const tree& saved, const save_load_info& write_info,
+                                      const buffer::reader* reader)
+    {
+        /* the new journal applies to the file as it was just saved, so unlike one made by start, the hash of its
+         * contents is already known                                                                               */
+        
+        auto id{ detail::identity_of(file) };
+        
+        if (id.size == detail::no_file_size)
+            return {};
+        
+        id.hash = write_info.content_hash;
+        auto result{ detail::make_header(id) };
+        
+        if (write_info.ambiguous)
+        {
+            /* the records which follow refer to the tree saved, which reading the file would not give back */
+            
+            std::string payload{ static_cast<char>(record_type::replace_tree) };
+            detail::append_varint(payload, saved.child_count());
+            
+            for (std::size_t i{ 0 }; i < saved.child_count(); ++i)
+                detail::append_node(payload, saved.get_child_const(i), reader);
+            
+            detail::append_frame(result, payload);
+        }
+        
+        return result;
+    }
+    
+    void journal::rebase(const std::filesystem::path& file, const std::string_view base, const bool since_mark)
+    {
+        /* the records made since mark are kept for this, rather than read back from the old journal, which may not have
+         * been created yet (and can no longer be once the file has been saved)                                        */
+        const std::string tail{ since_mark and since_mark_ ? std::move(*since_mark_) : std::string{} };
+        
+        /* the old journal no longer applies once the file has been saved, whether or not the new one can be made */
+        stop(true);
+        
+        if (base.size() < detail::header_size)
+            return;
+        
+        path_ = path_for(file);
+        header_ = base.substr(0, detail::header_size);
+        open_writer(-1);
+        
+        /* if there is nothing after the header, the journal is not created until a record is made */
+        enqueue(base.substr(detail::header_size));
+        enqueue(tail);
+    }
+    
+    void journal::flush()
+    {
+        if (not active())
+            return;
+        
+        std::unique_lock lock{ mutex_ };
+        flush_requested_ = true;
+        queued_cv_.notify_one();
+        written_cv_.wait(lock, [this] { return written_count_ == queued_count_; });
+        flush_requested_ = false;
+    }
+    
+    void journal::record_command(const tree& tree_root, const command& cmd, const bool reverse)
+    {
+        if (not active())
+            return;
+        
+        const auto record_insert{ [this](const mti_t& pos, const std::optional<tree>& node) {
+            begin_record(record_type::insert_node);
+            put_index(pos);
+            if (node)
+                detail::append_node(record_, *node);
+            else
+                detail::append_node(record_, tree{});
+            end_record();
+        } };
+        
+        const auto record_delete{ [this](const mti_t& pos) {
+            begin_record(record_type::delete_node);
+            put_index(pos);
+            end_record();
+        } };
+        
+        std::visit(detail::overload{
+                [&](const cmd::move_node& c)
+                {
+                    begin_record(record_type::move_node);
+                    put_index(reverse ? c.dst : c.src);
+                    put_index(reverse ? c.src : c.dst);
+                    end_record();
+                },
+                [&](const cmd::edit_contents& c)
+                {
+                    if (const auto node{ get_const_by_index(tree_root, c.pos) })
+                    {
+                        begin_record(record_type::set_contents);
+                        put_index(c.pos);
+                        detail::append_contents(record_, node->get().get_content_const());
+                        end_record();
+                    }
+                },
+                [&](const cmd::insert_node& c) { reverse ? record_delete(c.pos) : record_insert(c.pos, c.inserted); },
+                [&](const cmd::delete_node& c) { reverse ? record_insert(c.pos, c.deleted) : record_delete(c.pos); },
+                [&](const cmd::multi_cmd&)
+                {
+                    throw std::logic_error{ "journal::record_command(): multi_cmd must be recorded one command at a time" };
+                }
+        }, cmd);
+    }
+    
+    void journal::begin_record(const record_type type)
+    {
+        record_.clear();
+        record_.push_back(static_cast<char>(type));
+    }
+    
+    void journal::put_varint(const std::uint64_t value)
+    {
+        detail::append_varint(record_, value);
+    }
+    
+    void journal::put_string(const std::string_view str)
+    {
+        detail::append_string(record_, str);
+    }
+    
+    void journal::end_record()
+    {
+        std::string frame{};
+        detail::append_frame(frame, record_);
+        
+        if (since_mark_)
+            since_mark_->append(frame);
+        
+        enqueue(frame);
+    }
+    
+    void journal::enqueue(const std::string_view frames)
+    {
+        if (frames.empty())
+            return;
+        
+        {
+            const std::lock_guard lock{ mutex_ };
+            queue_.append(frames);
+            ++queued_count_;
+        }
+        
+        queued_cv_.notify_one();
+    }
+    
+    void journal::open_writer(const int fd)
+    {
+        /* fd is the journal to append to, or -1 if it is yet to be created */
+        
+        fd_ = fd;
+        stopping_ = false;
+        queued_count_ = 0;
+        written_count_ = 0;
+        writer_ = std::jthread{ [this] { write_loop(); } };
+    }
+    
+    void journal::close_writer()
+    {
+        /* the worker writes out any records still queued before it finishes */
+        
+        if (not active())
+            return;
+        
+        {
+            const std::lock_guard lock{ mutex_ };
+            stopping_ = true;
+        }
+        
+        queued_cv_.notify_one();
+        writer_.join();
+        writer_ = std::jthread{};
+        
+        if (fd_ >= 0)
+            ::close(fd_);
+        
+        fd_ = -1;
+    }
+    
+    void journal::write_loop()
+    {
+        std::unique_lock lock{ mutex_ };
+        
+        while (true)
+        {
+            queued_cv_.wait(lock, [this] { return stopping_ or not queue_.empty(); });
+            
+            if (queue_.empty())
+                return;
+            
+            /* group commit: records made in quick succession (e.g. while typing) are written and synced together */
+            queued_cv_.wait_for(lock, group_commit_delay, [this] { return stopping_ or flush_requested_; });
+            
+            const std::string batch{ std::exchange(queue_, std::string{}) };
+            const std::size_t count{ queued_count_ };
+            
+            lock.unlock();
+            
+            /* a failed write cannot be reported anywhere useful; the journal is only a fallback, so carry on */
+            if (fd_ >= 0)
+            {
+                if (detail::write_all(fd_, batch))
+                    static_cast<void>(::fdatasync(fd_));
+            }
+            else if (not header_.empty())
+            {
+                /* if the journal cannot be created, the records are dropped (and so is the header, to not try again) */
+                fd_ = create(batch);
+                
+                if (fd_ < 0)
+                    header_.clear();
+            }
+            
+            lock.lock();
+            
+            written_count_ = count;
+            written_cv_.notify_all();
+        }
+    }
+    
+    int journal::create(const std::string_view records)
+    {
+        /* creates the journal with its header and first records (on the worker), returning a descriptor to append to
+         * it, or -1 on failure; if the file has been changed since start (when its identity was taken), the journal
+         * would not apply to it                                                                                    */
+        
+        if (not file_.empty())
+        {
+            auto id{ detail::read_header(header_) };
+            
+            if (detail::identity_of(file_) != id)
+                return -1;
+            
+            if (id.size != detail::no_file_size)
+            {
+                const auto hash{ detail::hash_of(file_) };
+                
+                if (not hash or detail::identity_of(file_) != id)
+                    return -1;
+                
+                id.hash = *hash;
+                header_ = detail::make_header(id);
+            }
+        }
+        
+        std::string contents{ header_ };
+        contents.append(records);
+        
+        const auto tmp_path{ detail::tmp_path_for(path_) };
+        
+        if (not detail::write_synced(tmp_path, contents, O_CREAT | O_TRUNC))
+            return -1;
+        
+        return detail::install_journal(tmp_path, path_);
+    }
+}
@@ -0,0 +1,230 @@
+// core/journal.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "tree.hpp"
+#include "tree_cmd.hpp"
+#include "tree_index.hpp"
+
+namespace treenote::core
+{
+    /* An append-only log of the changes made to a file since it was last saved, from which they are recovered when the
+     * file is next loaded if the editor was killed first (editor::~editor only writes a copy if it gets to run).
+     *
+     * Each change is recorded as a short binary record describing its effect on the tree (so undo and redo are recorded
+     * as the changes they make), and queued; a worker thread writes out the queue and syncs the file, so one fsync
+     * commits every record made since the last, and making a record never waits on the disk. The journal is only
+     * created (by the worker) along with its first records, so there is none for a file which has not been changed. */
+    
+    class journal
+    {
+    public:
+        struct replay_info
+        {
+            std::size_t record_count;
+            std::size_t valid_size;     /* the size of the journal up to the end of its last intact record */
+        };
+        
+        journal() = default;
+        ~journal();
+        
+        journal(const journal&) = delete;
+        journal(journal&&) = delete;
+        journal& operator=(const journal&) = delete;
+        journal& operator=(journal&&) = delete;
+        
+        [[nodiscard]] static std::filesystem::path path_for(const std::filesystem::path& file);
+        
+        /* applies the journal of file to tree_root, which must hold the file as it was just loaded; returns nullopt if
+         * there is no journal, or if it was made for a different version of the file (e.g. one saved since)          */
+        [[nodiscard]] static std::optional<replay_info> replay(const std::filesystem::path& file, tree& tree_root, buffer& buf);
+        
+        /* start begins a new journal for file as it is now (which need not exist yet), or continues the existing one if
+         * keep_size is not 0 (after truncating it to keep_size); stop ends the journal, and deletes it if remove is true */
+        
+        void start(const std::filesystem::path& file, std::size_t keep_size = 0);
+        void stop(bool remove);
+        [[nodiscard]] bool active() const noexcept;
+        
+        /* once the tree saved has been written to file by tree::write (which set write_info), prepare_base makes the
+         * start of its new journal (on any thread if given a reader to read the text through), or returns an empty
+         * string on failure: a header with the size, time and hash of the file, which is enough unless the file may not
+         * be read back as the same tree, in which case a copy of the tree follows. rebase then replaces the journal by
+         * it, keeping the records made since the last call to mark if since_mark is true (for when saved was a snapshot
+         * taken then)                                                                                                  */
+        
+        [[nodiscard]] static std::string prepare_base(const std::filesystem::path& file, const tree& saved,
+                                                      const save_load_info& write_info, const buffer::reader* reader = nullptr);
+        void mark();
+        void rebase(const std::filesystem::path& file, std::string_view base, bool since_mark = false);
+        
+        /* blocks until every record made so far has been written and synced */
+        void flush();
+        
+        /* functions to record changes (which do nothing unless the journal is active): */
+        
+        void record_insert_str(const tree_index auto& pos, std::size_t line, std::size_t col, std::string_view text);
+        void record_delete_char_before(const tree_index auto& pos, std::size_t line, std::size_t col);
+        void record_delete_char_current(const tree_index auto& pos, std::size_t line, std::size_t col);
+        void record_line_break(const tree_index auto& pos, std::size_t line, std::size_t col);
+        void record_line_join(const tree_index auto& pos, std::size_t line);
+        
+        /* cmd must be a single command (not a multi_cmd); node commands must be recorded before they are invoked, since
+         * they hold the node they insert until then, and edit_contents commands after, since the new contents are used */
+        void record_command(const tree& tree_root, const command& cmd, bool reverse);
+    
+    private:
+        enum class record_type : std::uint8_t
+        {
+            insert_str = 1,
+            delete_char_before,
+            delete_char_current,
+            line_break,
+            line_join,
+            set_contents,
+            insert_node,
+            delete_node,
+            move_node,
+            replace_tree,
+        };
+        
+        static constexpr std::chrono::milliseconds group_commit_delay{ 20 };
+        
+        static void apply(std::string_view payload, tree& tree_root, buffer& buf);
+        
+        void begin_record(record_type type);
+        void put_varint(std::uint64_t value);
+        void put_index(const tree_index auto& pos);
+        void put_string(std::string_view str);
+        void end_record();
+        void enqueue(std::string_view frames);
+        
+        void open_writer(int fd);
+        void close_writer();
+        void write_loop();
+        [[nodiscard]] int create(std::string_view records);
+        
+        std::filesystem::path           path_;
+        std::filesystem::path           file_;                  /* the file to hash once the journal is created, if any */
+        std::string                     header_;                /* the header to create the journal with */
+        int                             fd_{ -1 };              /* only used by the worker while it runs */
+        std::optional<std::string>      since_mark_{};          /* the records made since mark was called */
+        
+        std::string                     record_;                /* the record being made */
+        
+        std::mutex                      mutex_;                 /* guards the members below */
+        std::condition_variable         queued_cv_;
+        std::condition_variable         written_cv_;
+        std::string                     queue_;
+        std::size_t                     queued_count_{ 0 };
+        std::size_t                     written_count_{ 0 };
+        bool                            flush_requested_{ false };
+        bool                            stopping_{ false };
+        
+        std::jthread                    writer_{};              /* declared last so that it is joined first */
+    };
+    
+    
+    /* Inline function implementations */
+    
+    inline bool journal::active() const noexcept
+    {
+        return writer_.joinable();
+    }
+    
+    inline void journal::record_insert_str(const tree_index auto& pos, const std::size_t line, const std::size_t col, const std::string_view text)
+    {
+        if (not active())
+            return;
+        
+        begin_record(record_type::insert_str);
+        put_index(pos);
+        put_varint(line);
+        put_varint(col);
+        put_string(text);
+        end_record();
+    }
+    
+    inline void journal::record_delete_char_before(const tree_index auto& pos, const std::size_t line, const std::size_t col)
+    {
+        if (not active())
+            return;
+        
+        begin_record(record_type::delete_char_before);
+        put_index(pos);
+        put_varint(line);
+        put_varint(col);
+        end_record();
+    }
+    
+    inline void journal::record_delete_char_current(const tree_index auto& pos, const std::size_t line, const std::size_t col)
+    {
+        if (not active())
+            return;
+        
+        begin_record(record_type::delete_char_current);
+        put_index(pos);
+        put_varint(line);
+        put_varint(col);
+        end_record();
+    }
+    
+    inline void journal::record_line_break(const tree_index auto& pos, const std::size_t line, const std::size_t col)
+    {
+        if (not active())
+            return;
+        
+        begin_record(record_type::line_break);
+        put_index(pos);
+        put_varint(line);
+        put_varint(col);
+        end_record();
+    }
+    
+    inline void journal::record_line_join(const tree_index auto& pos, const std::size_t line)
+    {
+        if (not active())
+            return;
+        
+        begin_record(record_type::line_join);
+        put_index(pos);
+        put_varint(line);
+        end_record();
+    }
+    
+    inline void journal::put_index(const tree_index auto& pos)
+    {
+        put_varint(std::ranges::size(pos));
+        
+        for (const std::size_t i : pos)
+            put_varint(i);
+    }
+}
@@ -0,0 +1,402 @@
+// core/line_scan.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "line_scan.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "utf8.hpp"
+
+namespace treenote::core::line_scan
+{
+    namespace detail
+    {
+        namespace
+        {
+            /* Thin wrappers around the widest available vector instructions; selected at compile time */
+            
+#if defined(__AVX2__)
+            #define TREENOTE_LINE_SCAN_SIMD
+            
+            using vec_t = __m256i;
+            constexpr std::size_t vec_size{ 32 };
+            
+            inline vec_t vec_load(const char* p) noexcept { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+            inline vec_t vec_splat(const char c) noexcept { return _mm256_set1_epi8(c); }
+            inline vec_t vec_eq(const vec_t a, const vec_t b) noexcept { return _mm256_cmpeq_epi8(a, b); }
+            inline vec_t vec_or(const vec_t a, const vec_t b) noexcept { return _mm256_or_si256(a, b); }
+            inline vec_t vec_and(const vec_t a, const vec_t b) noexcept { return _mm256_and_si256(a, b); }
+            inline std::uint32_t vec_mask(const vec_t v) noexcept { return static_cast<std::uint32_t>(_mm256_movemask_epi8(v)); }
+#elif defined(__SSE2__)
+            #define TREENOTE_LINE_SCAN_SIMD
+            
+            using vec_t = __m128i;
+            constexpr std::size_t vec_size{ 16 };
+            
+            inline vec_t vec_load(const char* p) noexcept { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+            inline vec_t vec_splat(const char c) noexcept { return _mm_set1_epi8(c); }
+            inline vec_t vec_eq(const vec_t a, const vec_t b) noexcept { return _mm_cmpeq_epi8(a, b); }
+            inline vec_t vec_or(const vec_t a, const vec_t b) noexcept { return _mm_or_si128(a, b); }
+            inline vec_t vec_and(const vec_t a, const vec_t b) noexcept { return _mm_and_si128(a, b); }
+            inline std::uint32_t vec_mask(const vec_t v) noexcept { return static_cast<std::uint32_t>(_mm_movemask_epi8(v)); }
+#endif
+            
+            /* every byte that can occur in " ", NO-BREAK SPACE, "│", "├", "└" or "─" */
+            constexpr char prefix_bytes[]{ '\x20', '\xC2', '\xA0', '\xE2', '\x94', '\x82', '\x9C', '\x80' };
+            
+            constexpr bool is_prefix_byte(const char c) noexcept
+            {
+                for (const char p : prefix_bytes)
+                {
+                    if (c == p)
+                        return true;
+                }
+                
+                return false;
+            }
+            
+            enum class token : std::int8_t
+            {
+                space,          /* " " or NO-BREAK SPACE */
+                v_line,         /* "│" */
+                v_and_right,    /* "├" or "└" */
+                h_line,         /* "─" */
+                other,
+            };
+            
+            constexpr token classify(const char* begin, const std::size_t length) noexcept
+            {
+                if (length == 1 and begin[0] == ' ')
+                    return token::space;
+                
+                if (length == 2 and begin[0] == '\xC2' and begin[1] == '\xA0')
+                    return token::space;
+                
+                if (length == 3 and begin[0] == '\xE2' and begin[1] == '\x94')
+                {
+                    switch (begin[2])
+                    {
+                        case '\x82':
+                            return token::v_line;
+                        case '\x9C':
+                        case '\x94':
+                            return token::v_and_right;
+                        case '\x80':
+                            return token::h_line;
+                        default:
+                            break;
+                    }
+                }
+                
+                return token::other;
+            }
+            
+            /* equivalent to utf8::get_ext on a stream positioned at pos; returns false if the end was reached */
+            inline bool get(const std::span<const char> data, std::size_t& pos, token& c) noexcept
+            {
+                if (pos >= data.size())
+                    return false;
+                
+                const std::size_t begin{ pos };
+                const char lead{ data[pos++] };
+                
+                int counter{ 0 };
+                bool invalid{ false };
+                
+                if ((lead & utf8::mask1) != utf8::test1)
+                {
+                    if ((lead & utf8::mask2) == utf8::test2)
+                        counter = 1;
+                    else if ((lead & utf8::mask3) == utf8::test3)
+                        counter = 2;
+                    else if ((lead & utf8::mask4) == utf8::test4)
+                        counter = 3;
+                }
+                
+                for (; counter > 0; --counter)
+                {
+                    if (pos >= data.size())
+                        return false;
+                    
+                    if ((data[pos++] & utf8::mask_cont) != utf8::test_cont)
+                        invalid = true;
+                }
+                
+                c = invalid ? token::other : classify(data.data() + begin, pos - begin);
+                return true;
+            }
+            
+            /* equivalent to utf8::unget, except that it never rewinds past the start of the line */
+            inline void unget(const std::span<const char> data, std::size_t& pos, const std::size_t line_begin) noexcept
+            {
+                while (pos > line_begin)
+                {
+                    --pos;
+                    
+                    if ((data[pos] & utf8::mask_cont) != utf8::test_cont)
+                        break;
+                }
+            }
+        }
+    }
+    
+    std::size_t find_line_end(const std::span<const char> data, std::size_t pos) noexcept
+    {
+#ifdef TREENOTE_LINE_SCAN_SIMD
+        const auto newline{ detail::vec_splat('\n') };
+        const auto null{ detail::vec_splat('\0') };
+        
+        for (; pos + detail::vec_size <= data.size(); pos += detail::vec_size)
+        {
+            const auto v{ detail::vec_load(data.data() + pos) };
+            
+            if (const auto m{ detail::vec_mask(detail::vec_or(detail::vec_eq(v, newline), detail::vec_eq(v, null))) }; m != 0)
+                return pos + static_cast<std::size_t>(std::countr_zero(m));
+        }
+#endif
+        
+        for (; pos < data.size(); ++pos)
+        {
+            if (data[pos] == '\n' or data[pos] == '\0')
+                return pos;
+        }
+        
+        return data.size();
+    }
+    
+    std::size_t find_substr(const std::span<const char> data, const std::string_view needle, std::size_t pos) noexcept
+    {
+        const std::size_t n{ needle.size() };
+        
+        if (pos > data.size() or n > data.size() - pos)
+            return data.size();
+        
+#ifdef TREENOTE_LINE_SCAN_SIMD
+        /* compare the first and last bytes of needle against a block of candidate positions at once, and only compare
+         * the rest of needle at the candidates where both match                                                      */
+        
+        const auto first{ detail::vec_splat(needle.front()) };
+        const auto last{ detail::vec_splat(needle.back()) };
+        
+        for (; pos + (n - 1) + detail::vec_size <= data.size(); pos += detail::vec_size)
+        {
+            const auto v_first{ detail::vec_load(data.data() + pos) };
+            const auto v_last{ detail::vec_load(data.data() + pos + (n - 1)) };
+            
+            for (auto m{ detail::vec_mask(detail::vec_and(detail::vec_eq(v_first, first), detail::vec_eq(v_last, last))) }; m != 0; m &= m - 1)
+            {
+                const std::size_t candidate{ pos + static_cast<std::size_t>(std::countr_zero(m)) };
+                
+                if (std::memcmp(data.data() + candidate + 1, needle.data() + 1, n - 1) == 0)
+                    return candidate;
+            }
+        }
+#endif
+        
+        for (; pos + n <= data.size(); ++pos)
+        {
+            if (data[pos] == needle.front() and std::memcmp(data.data() + pos + 1, needle.data() + 1, n - 1) == 0)
+                return pos;
+        }
+        
+        return data.size();
+    }
+    
+    std::size_t prefix_run_length(const std::span<const char> data, const std::size_t pos) noexcept
+    {
+        std::size_t end{ pos };
+        
+#ifdef TREENOTE_LINE_SCAN_SIMD
+        for (; end + detail::vec_size <= data.size(); end += detail::vec_size)
+        {
+            const auto v{ detail::vec_load(data.data() + end) };
+            auto matches{ detail::vec_eq(v, detail::vec_splat(detail::prefix_bytes[0])) };
+            
+            for (std::size_t i{ 1 }; i < std::size(detail::prefix_bytes); ++i)
+                matches = detail::vec_or(matches, detail::vec_eq(v, detail::vec_splat(detail::prefix_bytes[i])));
+            
+            if (const auto m{ ~detail::vec_mask(matches) }; m != 0)
+                return end - pos + static_cast<std::size_t>(std::countr_zero(m));
+        }
+#endif
+        
+        while (end < data.size() and detail::is_prefix_byte(data[end]))
+            ++end;
+        
+        return end - pos;
+    }
+    
+    prefix_info scan_prefix(const std::span<const char> data, const std::size_t pos, const std::size_t last_col) noexcept
+    {
+        /* mirrors detail::parse_helper_v2 in tree.cpp, operating on tokens instead of decoded strings */
+        
+        using detail::token;
+        
+        constexpr std::size_t tab_size{ 4 };
+        
+        /* fast path: the line has no prefix and starts with an ascii character */
+        if (pos < data.size() and prefix_run_length(data, pos) == 0 and (data[pos] & utf8::mask1) == utf8::test1)
+            return { .indent_level = 0, .marker = false, .content_pos = pos, .at_eof = false };
+        
+        enum class states : std::int8_t
+        {
+            start,
+            v_line,
+            v_line_cont,
+            v_and_right,
+            h_line,
+            
+            unwind_all,
+            unwind_one,
+            unwind_partial,
+            
+            end,
+            error,
+        };
+        
+        prefix_info result{ .indent_level = 0, .marker = false, .content_pos = pos, .at_eof = false };
+        
+        std::size_t& cur{ result.content_pos };
+        std::size_t column{ 0 };
+        token c{ token::other };
+        
+        auto state{ states::start };
+        
+        while (state != states::end)
+        {
+            switch (state)
+            {
+                case states::start:
+                case states::v_line:
+                case states::v_line_cont:
+                case states::v_and_right:
+                case states::h_line:
+                    if (not detail::get(data, cur, c))
+                    {
+                        state = states::end; /* reached eof */
+                        cur = data.size();
+                        result.at_eof = true;
+                    }
+                    else
+                    {
+                        ++column;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            
+            if (state == states::v_line and column > last_col * tab_size)
+                state = states::v_line_cont;
+            
+            switch (state)
+            {
+                case states::start:
+                    if (c == token::space)
+                        break; /* don't transition state */
+                    else if (c == token::v_line)
+                        state = states::v_line;
+                    else if (c == token::v_and_right)
+                        state = states::v_and_right;
+                    else if (c == token::h_line)
+                        state = states::error;
+                    else
+                        state = states::unwind_all;
+                    break;
+                
+                case states::v_line:
+                    if (c == token::space or c == token::v_line)
+                        break; /* don't transition state */
+                    else if (c == token::v_and_right)
+                        state = states::v_and_right;
+                    else
+                        state = states::error;
+                    break;
+                
+                case states::v_line_cont:
+                    if (c == token::space)
+                        break; /* don't transition state */
+                    else if (c == token::v_and_right)
+                        state = states::v_and_right;
+                    else
+                        state = states::unwind_partial;
+                    break;
+                
+                case states::v_and_right:
+                    result.marker = true;
+                    if (c == token::h_line)
+                        state = states::h_line;
+                    else if (c == token::space)
+                        state = states::end;
+                    else
+                        state = states::error;
+                    break;
+                
+                case states::h_line:
+                    result.marker = true;
+                    if (c == token::h_line)
+                        break; /* don't transition state */
+                    else if (c == token::space)
+                        state = states::end;
+                    else if (c == token::v_and_right)
+                        state = states::error;
+                    else
+                        state = states::unwind_one;
+                    break;
+                
+                case states::unwind_all:
+                    for (; column > 0; --column)
+                        detail::unget(data, cur, pos);
+                    state = states::end;
+                    break;
+                
+                case states::unwind_one:
+                    detail::unget(data, cur, pos);
+                    --column;
+                    state = states::end;
+                    break;
+                
+                case states::unwind_partial:
+                    for (; column > (last_col * tab_size); --column)
+                        detail::unget(data, cur, pos);
+                    state = states::end;
+                    break;
+                
+                case states::end:
+                    break;
+                
+                case states::error:
+                    state = states::unwind_all;
+                    break;
+            }
+        }
+        
+        result.indent_level = (column + tab_size / 2) / tab_size;
+        return result;
+    }
+}
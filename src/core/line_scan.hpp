@@ -0,0 +1,52 @@
+// core/line_scan.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+
+namespace treenote::core::line_scan
+{
+    /* Scanning functions for tree files held in contiguous memory (e.g. a mapped file) */
+    /* These produce exactly the same results as reading the same bytes through tree::parse's stream path */
+    
+    struct prefix_info
+    {
+        std::size_t indent_level;
+        bool        marker;         /* the prefix ends in a tree-drawing marker (├── or └──)           */
+        std::size_t content_pos;    /* position of the first byte after the prefix                      */
+        bool        at_eof;         /* the end of the data was reached while reading the prefix        */
+    };
+    
+    /* returns the position of the first '\n' or '\0' at or after pos, or data.size() if there is none */
+    [[nodiscard]] std::size_t find_line_end(std::span<const char> data, std::size_t pos) noexcept;
+    
+    /* returns the position of the first occurrence of needle (which must not be empty) at or after pos, or data.size()
+     * if there is none; this is also used to search the text of nodes (see tree_string::find_all)                  */
+    [[nodiscard]] std::size_t find_substr(std::span<const char> data, std::string_view needle, std::size_t pos) noexcept;
+    
+    /* returns the number of bytes from pos onwards which could belong to a tree-drawing prefix */
+    [[nodiscard]] std::size_t prefix_run_length(std::span<const char> data, std::size_t pos) noexcept;
+    
+    /* parses the indentation prefix of the line starting at pos; last_col is the indent level of the previous line */
+    [[nodiscard]] prefix_info scan_prefix(std::span<const char> data, std::size_t pos, std::size_t last_col) noexcept;
+}
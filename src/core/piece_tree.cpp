@@ -0,0 +1,484 @@
+// core/piece_tree.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "piece_tree.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+
+namespace treenote::core
+{
+    /* Implementation helpers */
+
+    namespace detail
+    {
+        namespace
+        {
+            template<typename T>
+            bool rebalance_items(std::vector<T>& left, std::vector<T>& right, const std::size_t max_size)
+            {
+                /* moves all items into left if they fit (returning true), otherwise shares them evenly between both */
+
+                if (left.size() + right.size() <= max_size)
+                {
+                    left.reserve(left.size() + right.size());
+                    std::ranges::move(right, std::back_inserter(left));
+                    right.clear();
+                    return true;
+                }
+
+                const std::size_t total{ left.size() + right.size() };
+                const std::size_t left_target{ total / 2 };
+
+                if (left.size() < left_target)
+                {
+                    const auto moved_end{ std::ranges::begin(right) + static_cast<std::ptrdiff_t>(left_target - left.size()) };
+                    std::move(std::ranges::begin(right), moved_end, std::back_inserter(left));
+                    right.erase(std::ranges::begin(right), moved_end);
+                }
+                else if (left.size() > left_target)
+                {
+                    const auto moved_begin{ std::ranges::begin(left) + static_cast<std::ptrdiff_t>(left_target) };
+                    right.insert(std::ranges::begin(right), std::make_move_iterator(moved_begin), std::make_move_iterator(std::ranges::end(left)));
+                    left.erase(moved_begin, std::ranges::end(left));
+                }
+
+                return false;
+            }
+
+            template<typename T>
+            std::vector<T> split_items(std::vector<T>& items)
+            {
+                /* moves the upper half of items into the returned vector */
+
+                const auto mid{ std::ranges::begin(items) + static_cast<std::ptrdiff_t>(items.size() / 2) };
+                std::vector<T> result{ std::make_move_iterator(mid), std::make_move_iterator(std::ranges::end(items)) };
+                items.erase(mid, std::ranges::end(items));
+                return result;
+            }
+
+            std::size_t chunk_count(const std::size_t item_count, const std::size_t max_size)
+            {
+                /* the number of nodes needed to hold item_count items, filling each node to about three quarters */
+
+                const std::size_t target{ max_size * 3 / 4 };
+                return std::max((item_count + target - 1) / target, 1uz);
+            }
+        }
+    }
+
+
+    /* Constructor implementation */
+
+    piece_tree::piece_tree(const piece_tree& other) :
+            display_length_{ other.display_length_ },
+            byte_length_{ other.byte_length_ }
+    {
+        root_.entries = other.root_.entries;
+        root_.children.reserve(other.root_.children.size());
+
+        for (const auto& c : other.root_.children)
+            root_.children.emplace_back(clone(*c.ptr), c.sum);
+    }
+
+    piece_tree& piece_tree::operator=(const piece_tree& other)
+    {
+        if (this != &other)
+        {
+            piece_tree tmp{ other };
+            *this = std::move(tmp);
+        }
+
+        return *this;
+    }
+
+
+    /* Public function implementations */
+
+    const piece_table_entry& piece_tree::at(std::size_t index) const
+    {
+        const node* n{ &root_ };
+
+        while (not n->is_leaf())
+        {
+            const node* next{ nullptr };
+
+            for (const auto& c : n->children)
+            {
+                if (index < c.sum.count)
+                {
+                    next = c.ptr.get();
+                    break;
+                }
+
+                index -= c.sum.count;
+            }
+
+            if (not next)
+                throw std::out_of_range("piece_tree::at(): index out of range");
+
+            n = next;
+        }
+
+        return n->entries.at(index);
+    }
+
+    piece_tree::opt_idx_pair piece_tree::find(std::size_t pos) const
+    {
+        const node* n{ &root_ };
+        std::size_t base_index{ 0 };
+
+        while (not n->is_leaf())
+        {
+            const node* next{ nullptr };
+
+            for (const auto& c : n->children)
+            {
+                if (pos < c.sum.display_length)
+                {
+                    next = c.ptr.get();
+                    break;
+                }
+
+                pos -= c.sum.display_length;
+                base_index += c.sum.count;
+            }
+
+            if (not next)
+                return {}; /* pos probably refers to the space at the end of line */
+
+            n = next;
+        }
+
+        for (std::size_t i{ 0 }; i < n->entries.size(); ++i)
+        {
+            if (pos < n->entries[i].display_length)
+                return std::make_optional<opt_idx_pair::value_type>(base_index + i, pos);
+
+            pos -= n->entries[i].display_length;
+        }
+
+        return {};
+    }
+
+    void piece_tree::insert(const std::size_t index, const piece_table_entry& entry)
+    {
+        if (index > size())
+            throw std::out_of_range("piece_tree::insert(): index out of range");
+
+        if (auto sibling{ insert_impl(root_, index, entry) })
+        {
+            /* root was split: grow the tree by one level */
+            auto old_root{ std::make_unique<node>(std::move(root_)) };
+            const summary old_sum{ summarise(*old_root) };
+
+            root_ = node{};
+            root_.children.reserve(2);
+            root_.children.emplace_back(std::move(old_root), old_sum);
+            root_.children.push_back(std::move(*sibling));
+        }
+
+        display_length_ += entry.display_length;
+        byte_length_ += entry.byte_length;
+    }
+
+    void piece_tree::replace(std::size_t index, const piece_table_entry& entry)
+    {
+        /* sums are updated by subtracting the old lengths before adding the new ones (this relies on unsigned wraparound) */
+
+        const piece_table_entry old{ at(index) };
+        node* n{ &root_ };
+
+        while (not n->is_leaf())
+        {
+            for (auto& c : n->children)
+            {
+                if (index < c.sum.count)
+                {
+                    c.sum.display_length = c.sum.display_length - old.display_length + entry.display_length;
+                    c.sum.byte_length = c.sum.byte_length - old.byte_length + entry.byte_length;
+                    n = c.ptr.get();
+                    break;
+                }
+
+                index -= c.sum.count;
+            }
+        }
+
+        n->entries[index] = entry;
+        display_length_ = display_length_ - old.display_length + entry.display_length;
+        byte_length_ = byte_length_ - old.byte_length + entry.byte_length;
+    }
+
+    void piece_tree::erase(const std::size_t index)
+    {
+        if (index >= size())
+            throw std::out_of_range("piece_tree::erase(): index out of range");
+
+        const piece_table_entry erased{ erase_impl(root_, index) };
+
+        if (not root_.is_leaf() and root_.children.size() == 1)
+        {
+            /* shrink the tree by one level */
+            node tmp{ std::move(*root_.children.front().ptr) };
+            root_ = std::move(tmp);
+        }
+
+        display_length_ -= erased.display_length;
+        byte_length_ -= erased.byte_length;
+    }
+
+    piece_tree piece_tree::split_off(const std::size_t index)
+    {
+        const auto entries{ to_vector() };
+        const std::size_t mid{ std::min(index, entries.size()) };
+        const std::span all{ entries };
+
+        piece_tree result{};
+        result.root_ = build(all.subspan(mid));
+        const summary moved{ summarise(result.root_) };
+        result.display_length_ = moved.display_length;
+        result.byte_length_ = moved.byte_length;
+
+        root_ = build(all.first(mid));
+        display_length_ -= result.display_length_;
+        byte_length_ -= result.byte_length_;
+
+        return result;
+    }
+
+    void piece_tree::append(piece_tree&& other)
+    {
+        if (other.empty())
+            return;
+
+        if (empty())
+        {
+            *this = std::move(other);
+            return;
+        }
+
+        auto entries{ to_vector() };
+        other.for_each([&](const piece_table_entry& e) { entries.push_back(e); return true; });
+
+        root_ = build(entries);
+        display_length_ += other.display_length_;
+        byte_length_ += other.byte_length_;
+        other = piece_tree{};
+    }
+
+
+    /* Private member functions */
+
+    piece_tree::summary piece_tree::summarise(const node& n)
+    {
+        summary result{};
+
+        if (n.is_leaf())
+        {
+            result.count = n.entries.size();
+
+            for (const auto& e : n.entries)
+            {
+                result.display_length += e.display_length;
+                result.byte_length += e.byte_length;
+            }
+        }
+        else
+        {
+            for (const auto& c : n.children)
+            {
+                result.count += c.sum.count;
+                result.display_length += c.sum.display_length;
+                result.byte_length += c.sum.byte_length;
+            }
+        }
+
+        return result;
+    }
+
+    std::unique_ptr<piece_tree::node> piece_tree::clone(const node& n)
+    {
+        auto result{ std::make_unique<node>() };
+        result->entries = n.entries;
+        result->children.reserve(n.children.size());
+
+        for (const auto& c : n.children)
+            result->children.emplace_back(clone(*c.ptr), c.sum);
+
+        return result;
+    }
+
+    piece_tree::node piece_tree::build(const std::span<const piece_table_entry> entries)
+    {
+        /* bulk loads entries bottom up, sharing the items of each level evenly between its nodes */
+
+        node result{};
+
+        if (entries.size() <= max_items)
+        {
+            result.entries.assign(std::ranges::begin(entries), std::ranges::end(entries));
+            return result;
+        }
+
+        std::vector<child> level{};
+
+        {
+            const std::size_t count{ detail::chunk_count(entries.size(), max_items) };
+            level.reserve(count);
+
+            for (std::size_t i{ 0 }; i < count; ++i)
+            {
+                const auto chunk{ entries.subspan(i * entries.size() / count, (i + 1) * entries.size() / count - i * entries.size() / count) };
+                auto leaf{ std::make_unique<node>() };
+                leaf->entries.assign(std::ranges::begin(chunk), std::ranges::end(chunk));
+                const summary sum{ summarise(*leaf) };
+                level.emplace_back(std::move(leaf), sum);
+            }
+        }
+
+        while (level.size() > max_items)
+        {
+            const std::size_t count{ detail::chunk_count(level.size(), max_items) };
+            std::vector<child> next_level{};
+            next_level.reserve(count);
+
+            for (std::size_t i{ 0 }; i < count; ++i)
+            {
+                auto internal{ std::make_unique<node>() };
+                const auto first{ std::ranges::begin(level) + static_cast<std::ptrdiff_t>(i * level.size() / count) };
+                const auto last{ std::ranges::begin(level) + static_cast<std::ptrdiff_t>((i + 1) * level.size() / count) };
+                internal->children.assign(std::make_move_iterator(first), std::make_move_iterator(last));
+                const summary sum{ summarise(*internal) };
+                next_level.emplace_back(std::move(internal), sum);
+            }
+
+            level = std::move(next_level);
+        }
+
+        result.children = std::move(level);
+        return result;
+    }
+
+    std::optional<piece_tree::child> piece_tree::insert_impl(node& n, std::size_t index, const piece_table_entry& entry)
+    {
+        /* returns the new right sibling of n if n was split */
+
+        if (n.is_leaf())
+        {
+            n.entries.insert(std::ranges::begin(n.entries) + static_cast<std::ptrdiff_t>(index), entry);
+
+            if (n.entries.size() <= max_items)
+                return {};
+
+            auto sibling{ std::make_unique<node>() };
+            sibling->entries = detail::split_items(n.entries);
+            const summary sum{ summarise(*sibling) };
+            return std::make_optional<child>(std::move(sibling), sum);
+        }
+
+        /* an index at the boundary of two children is inserted at the end of the first */
+        std::size_t i{ 0 };
+        for (; i + 1 < n.children.size() and index > n.children[i].sum.count; ++i)
+            index -= n.children[i].sum.count;
+
+        auto& c{ n.children[i] };
+
+        if (auto sibling{ insert_impl(*c.ptr, index, entry) })
+        {
+            c.sum = summarise(*c.ptr);
+            n.children.insert(std::ranges::begin(n.children) + static_cast<std::ptrdiff_t>(i) + 1, std::move(*sibling));
+        }
+        else
+        {
+            c.sum.count += 1;
+            c.sum.display_length += entry.display_length;
+            c.sum.byte_length += entry.byte_length;
+        }
+
+        if (n.children.size() <= max_items)
+            return {};
+
+        auto sibling{ std::make_unique<node>() };
+        sibling->children = detail::split_items(n.children);
+        const summary sum{ summarise(*sibling) };
+        return std::make_optional<child>(std::move(sibling), sum);
+    }
+
+    piece_table_entry piece_tree::erase_impl(node& n, std::size_t index)
+    {
+        /* returns the erased entry */
+
+        if (n.is_leaf())
+        {
+            const piece_table_entry result{ n.entries[index] };
+            n.entries.erase(std::ranges::begin(n.entries) + static_cast<std::ptrdiff_t>(index));
+            return result;
+        }
+
+        std::size_t i{ 0 };
+        for (; index >= n.children[i].sum.count; ++i)
+            index -= n.children[i].sum.count;
+
+        auto& c{ n.children[i] };
+        const piece_table_entry result{ erase_impl(*c.ptr, index) };
+
+        c.sum.count -= 1;
+        c.sum.display_length -= result.display_length;
+        c.sum.byte_length -= result.byte_length;
+
+        if (c.ptr->item_count() < min_items)
+            rebalance(n, i);
+
+        return result;
+    }
+
+    void piece_tree::rebalance(node& parent, const std::size_t index)
+    {
+        /* merges the underfull child at index with a neighbour, or shares items between them if both would not fit */
+
+        if (parent.children.size() < 2)
+            return;
+
+        const std::size_t left_index{ index > 0 ? index - 1 : index };
+        auto& left{ *parent.children[left_index].ptr };
+        auto& right{ *parent.children[left_index + 1].ptr };
+
+        const bool merged{ left.is_leaf() ? detail::rebalance_items(left.entries, right.entries, max_items)
+                                          : detail::rebalance_items(left.children, right.children, max_items) };
+
+        parent.children[left_index].sum = summarise(left);
+
+        if (merged)
+            parent.children.erase(std::ranges::begin(parent.children) + static_cast<std::ptrdiff_t>(left_index) + 1);
+        else
+            parent.children[left_index + 1].sum = summarise(right);
+    }
+
+    std::vector<piece_table_entry> piece_tree::to_vector() const
+    {
+        std::vector<piece_table_entry> result{};
+        result.reserve(size());
+        for_each([&](const piece_table_entry& e) { result.push_back(e); return true; });
+        return result;
+    }
+}
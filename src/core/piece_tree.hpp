@@ -0,0 +1,220 @@
+// core/piece_tree.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#include "table.hpp"
+
+namespace treenote::core
+{
+    class piece_tree
+    {
+        /* The piece table entries of a single line, held in a B+ tree whose internal nodes record the number of entries,
+         * display length and byte length below each child. Entries are addressed by their index within the line (as in
+         * pt_cmd), and lookup by index or display position, insertion, erasure and replacement take O(log n) time.
+         * A line of up to max_items entries (i.e. nearly every line) is a single leaf, which is stored inline.        */
+
+    public:
+        using opt_idx_pair = std::optional<std::pair<std::size_t, std::size_t>>;
+
+        piece_tree() = default;
+
+        piece_tree(const piece_tree& other);
+        piece_tree(piece_tree&&) noexcept = default;
+        piece_tree& operator=(const piece_tree& other);
+        piece_tree& operator=(piece_tree&&) noexcept = default;
+        ~piece_tree() = default;
+
+        [[nodiscard]] std::size_t size() const noexcept;
+        [[nodiscard]] bool empty() const noexcept;
+        [[nodiscard]] std::size_t display_length() const noexcept;
+        [[nodiscard]] std::size_t byte_length() const noexcept;
+
+        [[nodiscard]] const piece_table_entry& at(std::size_t index) const;
+        [[nodiscard]] const piece_table_entry& front() const;
+        [[nodiscard]] const piece_table_entry& back() const;
+
+        /* returns the index of the entry containing the char at pos, and the position of that char within the entry */
+        [[nodiscard]] opt_idx_pair find(std::size_t pos) const;
+
+        void insert(std::size_t index, const piece_table_entry& entry);
+        void push_back(const piece_table_entry& entry);
+        void replace(std::size_t index, const piece_table_entry& entry);
+        void erase(std::size_t index);
+
+        /* moves the entries from index onwards into a new piece_tree, and the reverse (both take linear time) */
+        [[nodiscard]] piece_tree split_off(std::size_t index);
+        void append(piece_tree&& other);
+
+        /* calls fn(entry) for each entry in order from index first, until fn returns false */
+        void for_each(std::size_t first, auto&& fn) const;
+        void for_each(auto&& fn) const;
+
+        /* replaces the start index of each entry with fn(start_index) (which leaves the lengths, and so the tree, intact) */
+        void remap_start_indices(auto&& fn);
+
+    private:
+        static constexpr std::size_t max_items{ 32 };               /* maximum entries per leaf and children per node */
+        static constexpr std::size_t min_items{ max_items / 4 };    /* nodes other than the root are merged below this */
+
+        struct node;
+
+        struct summary
+        {
+            std::size_t count{ 0 };
+            std::size_t display_length{ 0 };
+            std::size_t byte_length{ 0 };
+        };
+
+        struct child
+        {
+            std::unique_ptr<node>   ptr;
+            summary                 sum;
+        };
+
+        struct node
+        {
+            std::vector<piece_table_entry>  entries;    /* leaf nodes only */
+            std::vector<child>              children;   /* internal nodes only: a node is a leaf iff this is empty */
+
+            [[nodiscard]] bool is_leaf() const noexcept { return children.empty(); }
+            [[nodiscard]] std::size_t item_count() const noexcept { return is_leaf() ? entries.size() : children.size(); }
+        };
+
+        [[nodiscard]] static summary summarise(const node& n);
+        [[nodiscard]] static std::unique_ptr<node> clone(const node& n);
+        [[nodiscard]] static node build(std::span<const piece_table_entry> entries);
+
+        static std::optional<child> insert_impl(node& n, std::size_t index, const piece_table_entry& entry);
+        static piece_table_entry erase_impl(node& n, std::size_t index);
+        static void rebalance(node& parent, std::size_t index);
+
+        static bool for_each_impl(const node& n, std::size_t first, auto&& fn);
+        static void remap_impl(node& n, auto&& fn);
+
+        [[nodiscard]] std::vector<piece_table_entry> to_vector() const;
+
+        node            root_;
+        std::size_t     display_length_{ 0 };
+        std::size_t     byte_length_{ 0 };
+    };
+
+
+    /* Inline function implementations */
+
+    inline std::size_t piece_tree::size() const noexcept
+    {
+        if (root_.is_leaf())
+            return root_.entries.size();
+
+        std::size_t result{ 0 };
+        for (const auto& c : root_.children)
+            result += c.sum.count;
+        return result;
+    }
+
+    inline bool piece_tree::empty() const noexcept
+    {
+        return root_.is_leaf() and root_.entries.empty();
+    }
+
+    inline std::size_t piece_tree::display_length() const noexcept
+    {
+        return display_length_;
+    }
+
+    inline std::size_t piece_tree::byte_length() const noexcept
+    {
+        return byte_length_;
+    }
+
+    inline const piece_table_entry& piece_tree::front() const
+    {
+        return at(0);
+    }
+
+    inline const piece_table_entry& piece_tree::back() const
+    {
+        return at(size() - 1);
+    }
+
+    inline void piece_tree::push_back(const piece_table_entry& entry)
+    {
+        insert(size(), entry);
+    }
+
+    inline void piece_tree::for_each(const std::size_t first, auto&& fn) const
+    {
+        for_each_impl(root_, first, fn);
+    }
+
+    inline void piece_tree::for_each(auto&& fn) const
+    {
+        for_each_impl(root_, 0, fn);
+    }
+
+    inline bool piece_tree::for_each_impl(const node& n, std::size_t first, auto&& fn)
+    {
+        /* returns false once fn has returned false */
+
+        if (n.is_leaf())
+        {
+            for (std::size_t i{ first }; i < n.entries.size(); ++i)
+                if (not fn(n.entries[i]))
+                    return false;
+            return true;
+        }
+
+        for (const auto& c : n.children)
+        {
+            if (first >= c.sum.count)
+            {
+                first -= c.sum.count;
+            }
+            else
+            {
+                if (not for_each_impl(*c.ptr, first, fn))
+                    return false;
+                first = 0;
+            }
+        }
+
+        return true;
+    }
+
+    inline void piece_tree::remap_start_indices(auto&& fn)
+    {
+        remap_impl(root_, fn);
+    }
+
+    inline void piece_tree::remap_impl(node& n, auto&& fn)
+    {
+        for (auto& entry : n.entries)
+            entry.start_index = fn(entry.start_index);
+
+        for (auto& c : n.children)
+            remap_impl(*c.ptr, fn);
+    }
+}
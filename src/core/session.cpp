@@ -0,0 +1,207 @@
+// core/session.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "session.hpp"
+
+#include <stdexcept>
+
+#include "editor.hpp"
+
+namespace treenote::core
+{
+    namespace detail
+    {
+        namespace
+        {
+            session::file_result make_file_result(const editor::return_t& result)
+            {
+                auto status{ session::file_status::unknown_error };
+
+                switch (result.first)
+                {
+                    case editor::file_msg::none:
+                        status = session::file_status::ok;
+                        break;
+                    case editor::file_msg::does_not_exist:
+                        status = session::file_status::does_not_exist;
+                        break;
+                    case editor::file_msg::is_directory:
+                        status = session::file_status::is_directory;
+                        break;
+                    case editor::file_msg::is_device_file:
+                        status = session::file_status::is_device_file;
+                        break;
+                    case editor::file_msg::is_invalid_file:
+                        status = session::file_status::is_invalid_file;
+                        break;
+                    case editor::file_msg::is_unreadable:
+                        status = session::file_status::is_unreadable;
+                        break;
+                    case editor::file_msg::is_unwritable:
+                        status = session::file_status::is_unwritable;
+                        break;
+                    case editor::file_msg::unknown_error:
+                        status = session::file_status::unknown_error;
+                        break;
+                }
+
+                return { .status = status, .node_count = result.second.node_count, .line_count = result.second.line_count };
+            }
+        }
+    }
+
+    session::session() :
+            editor_{ std::make_unique<editor>() }
+    {
+    }
+
+    session::~session() = default;
+    session::session(session&&) noexcept = default;
+    session& session::operator=(session&&) noexcept = default;
+
+    session::file_result session::load(const std::filesystem::path& path, const unsigned int jobs)
+    {
+        return detail::make_file_result(editor_->load_file(path, jobs));
+    }
+
+    session::file_result session::save(const std::filesystem::path& path)
+    {
+        return detail::make_file_result(editor_->save_file(path));
+    }
+
+    void session::clear()
+    {
+        editor_->close_file();
+    }
+
+    bool session::modified() const noexcept
+    {
+        return editor_->modified();
+    }
+
+    int session::apply(const action act, const std::string_view text)
+    {
+        editor& ed{ *editor_ };
+
+        switch (act)
+        {
+            case action::insert_text:               ed.line_insert_text(text);          return 0;
+            case action::delete_char:               ed.line_delete_char();              return 0;
+            case action::backspace:                 ed.line_backspace();                return 0;
+            case action::newline:                   ed.line_newline();                  return 0;
+            case action::delete_word_forward:       ed.line_forward_delete_word();      return 0;
+            case action::delete_word_backward:      ed.line_backward_delete_word();     return 0;
+
+            case action::node_move_higher:          return ed.node_move_higher_rec();
+            case action::node_move_lower:           return ed.node_move_lower_rec();
+            case action::node_move_back:            return ed.node_move_back_rec();
+            case action::node_move_forward:         return ed.node_move_forward_rec();
+            case action::node_move_lower_indent:    return ed.node_move_lower_indent();
+            case action::node_insert_default:       ed.node_insert_default();           return 0;
+            case action::node_insert_enter:         ed.node_insert_enter();             return 0;
+            case action::node_insert_above:         ed.node_insert_above();             return 0;
+            case action::node_insert_below:         ed.node_insert_below();             return 0;
+            case action::node_insert_child:         ed.node_insert_child();             return 0;
+            case action::node_delete_check:         return ed.node_delete_check();
+            case action::node_delete_special:       return ed.node_delete_special();
+            case action::node_delete_rec:           return ed.node_delete_rec();
+            case action::node_cut:                  return ed.node_cut();
+            case action::node_copy:                 return ed.node_copy();
+            case action::node_paste_above:          return ed.node_paste_above();
+            case action::node_paste_default:        return ed.node_paste_default();
+
+            case action::cursor_left:               ed.cursor_mv_left();                return 0;
+            case action::cursor_right:              ed.cursor_mv_right();               return 0;
+            case action::cursor_up:                 ed.cursor_mv_up();                  return 0;
+            case action::cursor_down:               ed.cursor_mv_down();                return 0;
+            case action::cursor_word_forward:       ed.cursor_wd_forward();             return 0;
+            case action::cursor_word_backward:      ed.cursor_wd_backward();            return 0;
+            case action::cursor_to_start_of_file:   ed.cursor_to_SOF();                 return 0;
+            case action::cursor_to_end_of_file:     ed.cursor_to_EOF();                 return 0;
+            case action::cursor_to_start_of_line:   ed.cursor_to_SOL();                 return 0;
+            case action::cursor_to_end_of_line:     ed.cursor_to_EOL();                 return 0;
+            case action::cursor_to_parent:          ed.cursor_nd_parent();              return 0;
+            case action::cursor_to_child:           ed.cursor_nd_child();               return 0;
+            case action::cursor_to_prev_node:       ed.cursor_nd_prev();                return 0;
+            case action::cursor_to_next_node:       ed.cursor_nd_next();                return 0;
+        }
+
+        throw std::invalid_argument("session::apply: unknown action");
+    }
+
+    bool session::undo()
+    {
+        return editor_->undo() != cmd_names::error;
+    }
+
+    bool session::redo()
+    {
+        return editor_->redo() != cmd_names::error;
+    }
+
+    session::position session::cursor() const
+    {
+        return { .line = editor_->cursor_y(), .column = editor_->cursor_x() };
+    }
+
+    void session::go_to(const position pos)
+    {
+        editor_->cursor_go_to(pos.line, pos.column);
+    }
+
+    void session::go_to(const std::span<const std::size_t> node_index, const std::size_t node_line, const std::size_t column)
+    {
+        editor_->cursor_go_to(node_index, node_line, column);
+    }
+
+    std::size_t session::line_count() const noexcept
+    {
+        return editor_->cursor_max_y();
+    }
+
+    session::line_info session::line(const std::size_t pos) const
+    {
+        if (pos >= line_count())
+            throw std::out_of_range("session::line: line does not exist");
+
+        const tree::cache_entry& entry{ *std::ranges::begin(editor_->get_lc_range(pos, 1)) };
+        const auto index{ editor_->get_entry_index(entry) };
+
+        return { .node_index = { std::ranges::begin(index), std::ranges::end(index) },
+                 .node_line = entry.line_no,
+                 .prefix = editor_->get_entry_prefix(entry),
+                 .contents = editor::get_entry_content(entry, 0, editor::get_entry_line_length(entry)) };
+    }
+
+    std::size_t session::compact()
+    {
+        return editor_->compact_buffer();
+    }
+    
+    void session::set_history_budget(const std::size_t budget)
+    {
+        editor_->set_history_budget(budget);
+    }
+    
+    std::size_t session::history_memory() const noexcept
+    {
+        return editor_->history_memory_usage();
+    }
+}
@@ -0,0 +1,168 @@
+// core/session.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/* Headless interface to the editor, for programs which use treenote_core without a terminal.
+ * Only standard library types appear here, so that programs using it are unaffected by changes to the editor. */
+
+namespace treenote::core
+{
+    class editor;
+
+    class session
+    {
+    public:
+        enum class file_status : std::int8_t
+        {
+            ok,
+            does_not_exist,
+            is_directory,
+            is_device_file,
+            is_invalid_file,
+            is_unreadable,
+            is_unwritable,
+
+            unknown_error
+        };
+
+        struct file_result
+        {
+            file_status     status;
+            std::size_t     node_count;
+            std::size_t     line_count;
+        };
+
+        enum class action : std::int8_t
+        {
+            /* line editing; insert_text uses the text argument of apply() */
+
+            insert_text,
+            delete_char,
+            backspace,
+            newline,
+            delete_word_forward,
+            delete_word_backward,
+
+            /* tree editing */
+
+            node_move_higher,
+            node_move_lower,
+            node_move_back,
+            node_move_forward,
+            node_move_lower_indent,
+            node_insert_default,
+            node_insert_enter,
+            node_insert_above,
+            node_insert_below,
+            node_insert_child,
+            node_delete_check,
+            node_delete_special,
+            node_delete_rec,
+            node_cut,
+            node_copy,
+            node_paste_above,
+            node_paste_default,
+
+            /* cursor movement */
+
+            cursor_left,
+            cursor_right,
+            cursor_up,
+            cursor_down,
+            cursor_word_forward,
+            cursor_word_backward,
+            cursor_to_start_of_file,
+            cursor_to_end_of_file,
+            cursor_to_start_of_line,
+            cursor_to_end_of_line,
+            cursor_to_parent,
+            cursor_to_child,
+            cursor_to_prev_node,
+            cursor_to_next_node,
+        };
+
+        struct position
+        {
+            std::size_t     line;       /* line of the document (as displayed) */
+            std::size_t     column;     /* column within the contents of the line */
+        };
+
+        struct line_info
+        {
+            std::vector<std::size_t>    node_index;     /* path from the root to the node containing the line */
+            std::size_t                 node_line;      /* line within that node */
+            std::string                 prefix;         /* indentation and tree markers, as written to file */
+            std::string                 contents;
+        };
+
+        session();
+        ~session();
+
+        session(const session&) = delete;
+        session(session&&) noexcept;
+        session& operator=(const session&) = delete;
+        session& operator=(session&&) noexcept;
+
+        /* files */
+
+        [[nodiscard]] file_result load(const std::filesystem::path& path, unsigned int jobs = 1);
+        [[nodiscard]] file_result save(const std::filesystem::path& path);
+        void clear();
+        [[nodiscard]] bool modified() const noexcept;
+
+        /* editing; apply returns 0 on success, and nonzero if the action could not be performed at the cursor */
+
+        int apply(action act, std::string_view text = {});
+        bool undo();
+        bool redo();
+
+        /* cursor */
+
+        [[nodiscard]] position cursor() const;
+        void go_to(position pos);
+        void go_to(std::span<const std::size_t> node_index, std::size_t node_line, std::size_t column);
+
+        /* queries of the displayed lines */
+
+        [[nodiscard]] std::size_t line_count() const noexcept;
+        [[nodiscard]] line_info line(std::size_t pos) const;
+        
+        /* memory; compact frees text which can no longer be reached (even by undo), and returns the number of bytes freed */
+        
+        std::size_t compact();
+        
+        /* undo history; once it uses more than budget bytes (estimated), the oldest commands are discarded */
+        
+        void set_history_budget(std::size_t budget);
+        [[nodiscard]] std::size_t history_memory() const noexcept;
+
+    private:
+        std::unique_ptr<editor> editor_;
+    };
+}
@@ -0,0 +1,664 @@
+// core/text_index.cpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#include "text_index.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <utility>
+#include <variant>
+
+#include <sys/stat.h>
+
+namespace treenote::core
+{
+    namespace detail
+    {
+        namespace
+        {
+            template<typename... Ts>
+            struct overload : Ts ... { using Ts::operator()...; };
+            
+            /* Layout of a saved index:
+             *
+             *      4 bytes         magic
+             *      16 bytes        identity of the file (as in journal.cpp)
+             *      8 bytes         hash of the text of every node, as the file may not be read back as the same tree
+             *                      (see journal::prepare_base), in which case the index does not apply to it
+             *      varint          number of nodes in the file
+             *      varint          number of trigrams
+             *      for each trigram, in ascending order: the difference from the previous trigram, the number of nodes
+             *      containing it, and the difference of the pre-order position of each of these from the previous one
+             *      (all as varints)
+             *      4 bytes         checksum of everything after the magic                                           */
+            
+            constexpr std::array<char, 4> index_magic{ 'T', 'N', 'X', '1' };
+            constexpr std::size_t header_size{ index_magic.size() + 24 };
+            
+            struct file_identity
+            {
+                std::uint64_t   size;
+                std::int64_t    mtime;      /* in nanoseconds */
+                
+                bool operator==(const file_identity&) const = default;
+            };
+            
+            file_identity identity_of(const std::filesystem::path& file)
+            {
+                struct stat st{};
+                
+                if (::stat(file.c_str(), &st) != 0)
+                    return { .size = std::numeric_limits<std::uint64_t>::max(), .mtime = 0 };
+                
+                return { .size = static_cast<std::uint64_t>(st.st_size),
+                         .mtime = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec };
+            }
+            
+            void append_fixed(std::string& out, const std::uint64_t value, const std::size_t bytes)
+            {
+                for (std::size_t i{ 0 }; i < bytes; ++i)
+                    out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+            }
+            
+            std::uint64_t read_fixed(const std::string_view in, const std::size_t pos, const std::size_t bytes)
+            {
+                std::uint64_t result{ 0 };
+                
+                for (std::size_t i{ 0 }; i < bytes; ++i)
+                    result |= std::uint64_t{ static_cast<unsigned char>(in[pos + i]) } << (8 * i);
+                
+                return result;
+            }
+            
+            void append_varint(std::string& out, std::uint64_t value)
+            {
+                while (value >= 0x80)
+                {
+                    out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+                    value >>= 7;
+                }
+                
+                out.push_back(static_cast<char>(value));
+            }
+            
+            std::uint64_t read_varint(const std::string_view in, std::size_t& pos)
+            {
+                std::uint64_t result{ 0 };
+                
+                for (unsigned int shift{ 0 }; shift < 64; shift += 7)
+                {
+                    if (pos >= in.size())
+                        throw std::out_of_range("text_index::load(): unexpected end of index");
+                    
+                    const auto byte{ static_cast<unsigned char>(in[pos++]) };
+                    result |= std::uint64_t{ byte & 0x7fu } << shift;
+                    
+                    if ((byte & 0x80) == 0)
+                        return result;
+                }
+                
+                throw std::out_of_range("text_index::load(): invalid varint");
+            }
+            
+            std::uint64_t hash_bytes(std::uint64_t seed, const std::string_view bytes)
+            {
+                /* reads eight bytes at a time (as the texts hashed can be large), mixing each word into seed, and then the
+                 * length, so that hashing several texts in turn gives a different result for each way of splitting them */
+                
+                constexpr std::uint64_t multiplier{ 0x9e3779b97f4a7c15u };
+                
+                const auto mix{ [&](const std::uint64_t word) {
+                    seed = (seed ^ word) * multiplier;
+                    seed ^= seed >> 29;
+                } };
+                
+                std::size_t pos{ 0 };
+                
+                for (; pos + 8 <= bytes.size(); pos += 8)
+                {
+                    std::uint64_t word{};
+                    std::memcpy(&word, bytes.data() + pos, 8);
+                    mix(word);
+                }
+                
+                std::uint64_t tail{ 0 };
+                
+                for (std::size_t shift{ 0 }; pos < bytes.size(); ++pos, shift += 8)
+                    tail |= std::uint64_t{ static_cast<unsigned char>(bytes[pos]) } << shift;
+                
+                mix(tail);
+                mix(bytes.size());
+                return seed;
+            }
+            
+            std::uint32_t checksum(const std::string_view payload)
+            {
+                return static_cast<std::uint32_t>(hash_bytes(0, payload));
+            }
+            
+            void append_trigrams(const std::string_view text, std::vector<std::uint32_t>& result)
+            {
+                for (std::size_t i{ 0 }; i + 2 < text.size(); ++i)
+                {
+                    result.push_back(std::uint32_t{ static_cast<unsigned char>(text[i]) } << 16
+                                     | std::uint32_t{ static_cast<unsigned char>(text[i + 1]) } << 8
+                                     | std::uint32_t{ static_cast<unsigned char>(text[i + 2]) });
+                }
+            }
+            
+            void sort_unique(std::vector<std::uint32_t>& trigrams)
+            {
+                std::ranges::sort(trigrams);
+                const auto [first, last]{ std::ranges::unique(trigrams) };
+                trigrams.erase(first, last);
+            }
+            
+            void for_each_node(const tree& node, auto&& fn)
+            {
+                /* visits the descendants of node in pre-order, without recursion (trees may be very deep); the root of
+                 * the tree is never visited, as its text is not part of the file (see editor::find_text)             */
+                
+                std::vector<std::pair<const tree*, std::size_t>> stack{ { &node, 0 } };
+                
+                while (not stack.empty())
+                {
+                    auto& [parent, next]{ stack.back() };
+                    
+                    if (next == parent->child_count())
+                    {
+                        stack.pop_back();
+                        continue;
+                    }
+                    
+                    const tree& child{ parent->get_child_const(next++) };
+                    fn(child);
+                    stack.emplace_back(&child, 0);
+                }
+            }
+            
+            std::uint64_t text_hash(const tree& tree_root)
+            {
+                /* hashes the line count and then each line of each node in pre-order; lines held in several pieces are
+                 * joined first, as the same text may be split differently in another tree                          */
+                
+                std::uint64_t result{ 0 };
+                std::vector<std::string_view> parts{};
+                std::string joined{};
+                
+                for_each_node(tree_root, [&](const tree& node) {
+                    const auto& content{ node.get_content_const() };
+                    const std::uint64_t line_count{ content.line_count() };
+                    result = hash_bytes(result, std::string_view{ reinterpret_cast<const char*>(&line_count), 8 });
+                    
+                    for (std::size_t line{ 0 }; line < content.line_count(); ++line)
+                    {
+                        parts.clear();
+                        content.append_str_view(line, parts);
+                        
+                        if (parts.size() == 1)
+                        {
+                            result = hash_bytes(result, parts.front());
+                        }
+                        else
+                        {
+                            joined.clear();
+                            
+                            for (const auto& part : parts)
+                                joined.append(part);
+                            
+                            result = hash_bytes(result, joined);
+                        }
+                    }
+                });
+                
+                return result;
+            }
+        }
+    }
+    
+    
+    std::filesystem::path text_index::path_for(const std::filesystem::path& file)
+    {
+        /* e.g. notes/.todo.txt.index for notes/todo.txt */
+        
+        auto result{ file.parent_path() };
+        result /= "." + file.filename().string() + ".index";
+        return result;
+    }
+    
+    std::vector<text_index::trigram> text_index::trigrams_of(const std::string_view text)
+    {
+        std::vector<trigram> result{};
+        detail::append_trigrams(text, result);
+        detail::sort_unique(result);
+        return result;
+    }
+    
+    std::vector<text_index::trigram> text_index::trigrams_of(const tree_string& content)
+    {
+        /* trigrams never span lines, as searches do not (see editor::find_text) */
+        
+        std::vector<trigram> result{};
+        std::vector<std::string_view> parts{};
+        std::string line_text{};
+        
+        for (std::size_t line{ 0 }; line < content.line_count(); ++line)
+        {
+            parts.clear();
+            content.append_str_view(line, parts);
+            
+            if (parts.size() == 1)
+            {
+                detail::append_trigrams(parts.front(), result);
+            }
+            else
+            {
+                line_text.clear();
+                for (const auto& part : parts)
+                    line_text.append(part);
+                
+                detail::append_trigrams(line_text, result);
+            }
+        }
+        
+        detail::sort_unique(result);
+        return result;
+    }
+    
+    void text_index::add_all(const tree& node)
+    {
+        add(node.get_content_const());
+        detail::for_each_node(node, [this](const tree& n) { add(n.get_content_const()); });
+    }
+    
+    void text_index::clear()
+    {
+        ids_.clear();
+        stamps_.clear();
+        postings_.clear();
+        complete_at_.reset();
+    }
+    
+    std::optional<std::unordered_set<std::uint64_t>> text_index::candidates(const std::vector<trigram>& text) const
+    {
+        if (text.empty())
+            return std::nullopt;
+        
+        std::vector<const std::vector<std::uint32_t>*> lists{};
+        lists.reserve(text.size());
+        
+        for (const auto t : text)
+        {
+            const auto it{ postings_.find(t) };
+            
+            if (it == postings_.end())
+                return std::unordered_set<std::uint64_t>{};
+            
+            lists.push_back(&it->second);
+        }
+        
+        /* intersect the shortest lists first, so that the intermediate results stay short */
+        
+        std::ranges::sort(lists, {}, [](const auto* list) { return list->size(); });
+        
+        std::vector<std::uint32_t> ids{ *lists.front() };
+        std::vector<std::uint32_t> scratch{};
+        
+        for (const auto* list : lists | std::views::drop(1))
+        {
+            if (ids.empty())
+                break;
+            
+            scratch.clear();
+            std::ranges::set_intersection(ids, *list, std::back_inserter(scratch));
+            std::swap(ids, scratch);
+        }
+        
+        std::unordered_set<std::uint64_t> result{};
+        result.reserve(ids.size());
+        
+        for (const auto id : ids)
+            result.insert(stamps_[id]);
+        
+        return result;
+    }
+    
+    void text_index::mark_complete(const tree& tree_root, const std::size_t node_count)
+    {
+        if (ids_.size() > 2 * node_count)
+            drop_absent(tree_root);
+        
+        complete_at_ = tree_string::last_stamp();
+    }
+    
+    void text_index::update(const tree& tree_root, const command& cmd, const bool reverse, const bool was_complete)
+    {
+        /* only commands which insert nodes or change the text of one can add text to the tree; any other strings copied
+         * while invoking cmd keep their stamps (see tree_string::make_copy), so the index stays complete if it was    */
+        
+        const auto node_at{ [&](const std::vector<std::size_t>& pos) { return get_const_by_index(tree_root, pos); } };
+        
+        std::visit(detail::overload{
+                [&](const cmd::edit_contents& c)
+                {
+                    if (const auto node{ node_at(c.pos) })
+                        add(node->get().get_content_const());
+                },
+                [&](const cmd::insert_node& c)
+                {
+                    if (const auto node{ node_at(c.pos) }; node and not reverse)
+                        add_all(node->get());
+                },
+                [&](const cmd::delete_node& c)
+                {
+                    if (const auto node{ node_at(c.pos) }; node and reverse)
+                        add_all(node->get());
+                },
+                [](const auto&) {}
+        }, cmd);
+        
+        if (was_complete)
+            complete_at_ = tree_string::last_stamp();
+    }
+    
+    bool text_index::save(const std::filesystem::path& file, const tree& tree_root)
+    {
+        /* the positions in pre-order of the nodes holding each indexed text (several nodes may share a text, but are
+         * read back as nodes with texts of their own); those of the text with id i are in node_ids from node_begin[i]
+         * up to node_begin[i + 1]                                                                                     */
+        
+        std::vector<std::pair<std::uint32_t, std::uint32_t>> node_ids{};
+        std::uint64_t node_count{ 0 };
+        
+        detail::for_each_node(tree_root, [&](const tree& node) {
+            const auto& content{ node.get_content_const() };
+            add(content);
+            
+            if (content.stamp() != 0)
+                node_ids.emplace_back(ids_.at(content.stamp()), static_cast<std::uint32_t>(node_count));
+            
+            ++node_count;
+        });
+        
+        std::ranges::sort(node_ids);
+        
+        std::vector<std::uint32_t> node_begin(stamps_.size() + 1, 0);
+        
+        for (const auto& [id, node] : node_ids)
+            ++node_begin[id + 1];
+        
+        for (std::size_t i{ 1 }; i < node_begin.size(); ++i)
+            node_begin[i] += node_begin[i - 1];
+        
+        std::vector<trigram> trigrams{};
+        trigrams.reserve(postings_.size());
+        
+        for (const auto& [t, ids] : postings_)
+            trigrams.push_back(t);
+        
+        std::ranges::sort(trigrams);
+        
+        std::string body{};
+        std::size_t list_count{ 0 };
+        trigram prev_trigram{ 0 };
+        std::vector<std::uint32_t> nodes{};
+        
+        for (const auto t : trigrams)
+        {
+            nodes.clear();
+            
+            for (const auto id : postings_.at(t))
+                for (std::uint32_t i{ node_begin[id] }; i < node_begin[id + 1]; ++i)
+                    nodes.push_back(node_ids[i].second);
+            
+            if (nodes.empty())
+                continue;
+            
+            std::ranges::sort(nodes);
+            
+            detail::append_varint(body, t - prev_trigram);
+            detail::append_varint(body, nodes.size());
+            
+            std::uint32_t prev_node{ 0 };
+            
+            for (const auto n : nodes)
+            {
+                detail::append_varint(body, n - prev_node);
+                prev_node = n;
+            }
+            
+            prev_trigram = t;
+            ++list_count;
+        }
+        
+        const auto id{ detail::identity_of(file) };
+        
+        std::string contents{ detail::index_magic.data(), detail::index_magic.size() };
+        detail::append_fixed(contents, id.size, 8);
+        detail::append_fixed(contents, static_cast<std::uint64_t>(id.mtime), 8);
+        detail::append_fixed(contents, detail::text_hash(tree_root), 8);
+        detail::append_varint(contents, node_count);
+        detail::append_varint(contents, list_count);
+        contents.append(body);
+        detail::append_fixed(contents, detail::checksum(std::string_view{ contents }.substr(detail::index_magic.size())), 4);
+        
+        /* written beside the index and renamed over it, so that an index is never left half written */
+        
+        auto tmp_path{ path_for(file) };
+        tmp_path += ".tmp";
+        
+        {
+            std::ofstream os{ tmp_path, std::ios::binary | std::ios::trunc };
+            os.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+            
+            if (not os.flush())
+            {
+                std::error_code ec{};
+                std::filesystem::remove(tmp_path, ec);
+                return false;
+            }
+        }
+        
+        std::error_code ec{};
+        std::filesystem::rename(tmp_path, path_for(file), ec);
+        
+        if (ec)
+        {
+            std::filesystem::remove(tmp_path, ec);
+            return false;
+        }
+        
+        return true;
+    }
+    
+    bool text_index::load(const std::filesystem::path& file, const tree& tree_root)
+    {
+        std::ifstream is{ path_for(file), std::ios::binary | std::ios::ate };
+        
+        if (not is)
+            return false;
+        
+        /* read in one go, as an index may be about as large as the file */
+        
+        std::string data(static_cast<std::size_t>(std::max(std::streamoff{ 0 }, std::streamoff{ is.tellg() })), '\0');
+        
+        if (not is.seekg(0) or not is.read(data.data(), static_cast<std::streamsize>(data.size())))
+            return false;
+        
+        const std::string_view view{ data };
+        
+        if (data.size() < detail::header_size + 4 or not std::ranges::equal(view.substr(0, detail::index_magic.size()), detail::index_magic))
+            return false;
+        
+        const detail::file_identity id{ .size = detail::read_fixed(view, detail::index_magic.size(), 8),
+                                        .mtime = static_cast<std::int64_t>(detail::read_fixed(view, detail::index_magic.size() + 8, 8)) };
+        
+        if (id != detail::identity_of(file))
+            return false;
+        
+        const auto payload{ view.substr(detail::index_magic.size(), data.size() - detail::index_magic.size() - 4) };
+        
+        if (detail::checksum(payload) != detail::read_fixed(view, data.size() - 4, 4))
+            return false;
+        
+        if (detail::text_hash(tree_root) != detail::read_fixed(view, detail::index_magic.size() + 16, 8))
+            return false;
+        
+        /* the texts are given ids in pre-order, so that the lists (which are in pre-order) are in ascending order of id */
+        
+        std::vector<std::uint64_t> node_stamps{};
+        detail::for_each_node(tree_root, [&](const tree& node) { node_stamps.push_back(node.get_content_const().stamp()); });
+        
+        std::unordered_map<std::uint64_t, std::uint32_t> ids{};
+        std::vector<std::uint64_t> stamps{};
+        std::vector<std::uint32_t> id_of_node{};
+        
+        ids.reserve(node_stamps.size());
+        stamps.reserve(node_stamps.size());
+        id_of_node.reserve(node_stamps.size());
+        
+        for (const auto stamp : node_stamps)
+        {
+            if (stamp != 0 and ids.try_emplace(stamp, static_cast<std::uint32_t>(stamps.size())).second)
+            {
+                id_of_node.push_back(static_cast<std::uint32_t>(stamps.size()));
+                stamps.push_back(stamp);
+            }
+            else
+            {
+                id_of_node.push_back(no_id);
+            }
+        }
+        
+        std::unordered_map<trigram, std::vector<std::uint32_t>> postings{};
+        
+        try
+        {
+            std::size_t pos{ detail::header_size };
+            const auto body{ view.substr(0, data.size() - 4) };
+            
+            if (detail::read_varint(body, pos) != id_of_node.size())
+                return false;
+            
+            const std::uint64_t list_count{ detail::read_varint(body, pos) };
+            std::uint64_t t{ 0 };
+            
+            if (list_count > 0x1000000)
+                return false;
+            
+            postings.reserve(list_count);
+            
+            for (std::uint64_t i{ 0 }; i < list_count; ++i)
+            {
+                t += detail::read_varint(body, pos);
+                const std::uint64_t count{ detail::read_varint(body, pos) };
+                
+                if (t > 0xffffff or count > id_of_node.size())
+                    return false;
+                
+                auto& list{ postings[static_cast<trigram>(t)] };
+                list.reserve(count);
+                
+                std::uint64_t node{ 0 };
+                
+                for (std::uint64_t j{ 0 }; j < count; ++j)
+                {
+                    node += detail::read_varint(body, pos);
+                    
+                    if (node >= id_of_node.size() or id_of_node[node] == no_id)
+                        return false;
+                    
+                    list.push_back(id_of_node[node]);
+                }
+            }
+            
+            if (pos != body.size())
+                return false;
+        }
+        catch (const std::out_of_range&)
+        {
+            return false;
+        }
+        
+        ids_ = std::move(ids);
+        stamps_ = std::move(stamps);
+        postings_ = std::move(postings);
+        complete_at_ = tree_string::last_stamp();
+        return true;
+    }
+    
+    void text_index::insert(const std::uint64_t stamp, const std::vector<trigram>& trigrams)
+    {
+        const auto id{ static_cast<std::uint32_t>(stamps_.size()) };
+        
+        ids_.emplace(stamp, id);
+        stamps_.push_back(stamp);
+        
+        for (const auto t : trigrams)
+            postings_[t].push_back(id);
+    }
+    
+    void text_index::drop_absent(const tree& tree_root)
+    {
+        /* keeps only the texts in the tree, renumbering them in the same order so that every list stays in order */
+        
+        std::unordered_set<std::uint64_t> present{};
+        detail::for_each_node(tree_root, [&](const tree& node) { present.insert(node.get_content_const().stamp()); });
+        
+        std::vector<std::uint32_t> new_id(stamps_.size(), no_id);
+        std::vector<std::uint64_t> stamps{};
+        
+        for (std::uint32_t id{ 0 }; id < stamps_.size(); ++id)
+        {
+            if (present.contains(stamps_[id]))
+            {
+                new_id[id] = static_cast<std::uint32_t>(stamps.size());
+                stamps.push_back(stamps_[id]);
+            }
+            else
+            {
+                ids_.erase(stamps_[id]);
+            }
+        }
+        
+        for (auto it{ postings_.begin() }; it != postings_.end();)
+        {
+            std::erase_if(it->second, [&](const std::uint32_t id) { return new_id[id] == no_id; });
+            
+            for (auto& id : it->second)
+                id = new_id[id];
+            
+            if (it->second.empty())
+                it = postings_.erase(it);
+            else
+                ++it;
+        }
+        
+        for (auto& [stamp, id] : ids_)
+            id = new_id[id];
+        
+        stamps_ = std::move(stamps);
+    }
+}
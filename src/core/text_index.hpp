@@ -0,0 +1,136 @@
+// core/text_index.hpp
+//
+// Copyright (C) 2025 Peter Wild
+//
+// This file is part of Treenote.
+//
+// Treenote is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Treenote is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
+
+
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "tree.hpp"
+#include "tree_op.hpp"
+#include "tree_string.hpp"
+
+namespace treenote::core
+{
+    /* An optional index of the trigrams (the runs of three bytes within a line) in the text of each node, from which the
+     * nodes which may contain some text are found without reading the text of any node; editor::find_text then only
+     * searches these candidates.
+     *
+     * The text of a node is identified by the stamp of its tree_string (see tree_string::stamp), so the index stays
+     * valid as nodes are moved, copied or shared, and a node whose text has changed since it was indexed is simply one
+     * whose stamp is not in the index. Nodes are indexed as searches reach them, and as commands insert them or change
+     * their text (see operation_stack::set_text_index); the index is complete once every node in the tree is indexed.
+     *
+     * The index of a file can be saved next to it (see path_for), to be loaded with the file the next time it is opened
+     * instead of being rebuilt by the first search.                                                                   */
+    
+    class text_index
+    {
+    public:
+        using trigram = std::uint32_t;
+        
+        [[nodiscard]] static std::filesystem::path path_for(const std::filesystem::path& file);
+        
+        /* returns the trigrams of text (or of the text of content) in ascending order, without duplicates */
+        [[nodiscard]] static std::vector<trigram> trigrams_of(std::string_view text);
+        [[nodiscard]] static std::vector<trigram> trigrams_of(const tree_string& content);
+        
+        /* add indexes content unless it is indexed already; trigrams must be trigrams_of(content) if given */
+        
+        [[nodiscard]] bool contains(const tree_string& content) const;
+        void add(const tree_string& content);
+        void add(const tree_string& content, const std::vector<trigram>& trigrams);
+        void add_all(const tree& node);
+        void clear();
+        
+        /* returns the stamps of the indexed texts which contain every trigram of text (which must be given as returned by
+         * trigrams_of), or nullopt if text has no trigrams (as then every text may contain it)                        */
+        [[nodiscard]] std::optional<std::unordered_set<std::uint64_t>> candidates(const std::vector<trigram>& text) const;
+        
+        /* complete returns true if every node in the tree was indexed when mark_complete was last called, and no text has
+         * changed since (other than through commands, which update the index), and built returns true if it has ever
+         * been complete; mark_complete also drops the texts which are no longer in the tree once they outnumber those
+         * which are (node_count being the number of nodes in it)                                                     */
+        
+        [[nodiscard]] bool complete() const noexcept;
+        [[nodiscard]] bool built() const noexcept;
+        void mark_complete(const tree& tree_root, std::size_t node_count);
+        
+        /* updates the index after cmd (a single command, not a multi_cmd) has been invoked on tree_root; was_complete is
+         * the value of complete() just before                                                                          */
+        void update(const tree& tree_root, const command& cmd, bool reverse, bool was_complete);
+        
+        /* save writes the index of every node in tree_root (indexing any which are not yet indexed) for the file, which
+         * must have just been written from tree_root; load reads it back if it was saved for the file as it is now, and
+         * tree_root holds the file as it was just loaded; both return false on failure (leaving the index unchanged)   */
+        
+        [[nodiscard]] bool save(const std::filesystem::path& file, const tree& tree_root);
+        [[nodiscard]] bool load(const std::filesystem::path& file, const tree& tree_root);
+    
+    private:
+        static constexpr std::uint32_t  no_id{ std::numeric_limits<std::uint32_t>::max() };
+        
+        void insert(std::uint64_t stamp, const std::vector<trigram>& trigrams);
+        void drop_absent(const tree& tree_root);
+        
+        std::unordered_map<std::uint64_t, std::uint32_t>    ids_;       /* the id of each indexed text, by its stamp */
+        std::vector<std::uint64_t>                          stamps_;    /* the stamp of each id */
+        std::unordered_map<trigram, std::vector<std::uint32_t>> postings_;  /* the ids of the texts containing each
+                                                                             * trigram, in ascending order */
+        std::optional<std::uint64_t>                        complete_at_{};     /* tree_string::last_stamp() then */
+    };
+    
+    
+    /* Implementation of inline functions */
+    
+    inline bool text_index::contains(const tree_string& content) const
+    {
+        return content.stamp() == 0 or ids_.contains(content.stamp());
+    }
+    
+    inline void text_index::add(const tree_string& content)
+    {
+        if (not contains(content))
+            insert(content.stamp(), trigrams_of(content));
+    }
+    
+    inline void text_index::add(const tree_string& content, const std::vector<trigram>& trigrams)
+    {
+        if (not contains(content))
+            insert(content.stamp(), trigrams);
+    }
+    
+    inline bool text_index::complete() const noexcept
+    {
+        return complete_at_ == tree_string::last_stamp();
+    }
+    
+    inline bool text_index::built() const noexcept
+    {
+        return complete_at_.has_value();
+    }
+}
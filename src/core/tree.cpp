@@ -21,9 +21,16 @@
 #include "tree.hpp"
 
 #include <algorithm>
+#include <cerrno>
+#include <cstring>
 #include <iostream>
+#include <memory>
 #include <stack>
+#include <thread>
 
+#include <unistd.h>
+
+#include "line_scan.hpp"
 #include "tree_op.hpp"
 #include "utf8.hpp"
 
@@ -218,34 +225,175 @@ namespace treenote::core
                 return (column + tab_size / 2) / tab_size;
             }
             
-            inline void write_helper(std::ostream& os, const tree& te, const std::vector<bool>& line_markers)
+            [[nodiscard]] inline bool starts_like_prefix(const std::vector<std::string_view>& parts, const bool v_line)
             {
-                for (std::size_t line{ 0 }; line < te.line_count() or line == 0; ++line)
+                /* whether a line of text (in parts) begins, after any spaces, with a character which parse_helper_v2
+                 * may take for part of a prefix: "├" or "└", or "│" as well if v_line is set                        */
+
+                for (auto sv : parts)
+                {
+                    while (sv.starts_with(" ") or sv.starts_with("\N{NO-BREAK SPACE}"))
+                        sv.remove_prefix(sv.starts_with(" ") ? 1 : std::string_view{ "\N{NO-BREAK SPACE}" }.size());
+
+                    if (not sv.empty())
+                        return sv.starts_with("├") or sv.starts_with("└") or (v_line and sv.starts_with("│"));
+                }
+
+                return false;
+            }
+
+            struct parsed_line
+            {
+                std::size_t                 indent_level;
+                bool                        marker;
+                extended_piece_table_entry  content;
+            };
+            
+            struct scanned_line
+            {
+                /* result of scanning one line of a mapped file; computed without touching the buffer */
+                
+                std::size_t                 begin;              /* position of the start of the prefix          */
+                std::size_t                 last_col;           /* indent level the prefix was scanned with     */
+                line_scan::prefix_info      prefix;
+                std::size_t                 content_end;
+                std::optional<std::size_t>  display_length;     /* nullopt if append() must copy the contents   */
+                bool                        last;               /* no further lines follow this one             */
+            };
+            
+            [[nodiscard]] inline scanned_line scan_line(const std::span<const char> mapped, const std::size_t pos, const std::size_t last_col)
+            {
+                scanned_line result{ .begin = pos,
+                                     .last_col = last_col,
+                                     .prefix = line_scan::scan_prefix(mapped, pos, last_col),
+                                     .content_end = mapped.size(),
+                                     .display_length = std::nullopt,
+                                     .last = true };
+                
+                if (result.prefix.at_eof)
+                    return result;
+                
+                const std::size_t content_pos{ result.prefix.content_pos };
+                const std::size_t line_end{ line_scan::find_line_end(mapped, content_pos) };
+                
+                result.display_length = buffer::unaltered_display_length(mapped.subspan(content_pos, line_end - content_pos));
+                
+                if (result.display_length)
                 {
-                    for (std::size_t pos{ 0 }; pos < line_markers.size(); ++pos)
+                    result.content_end = line_end;
+                    result.last = (line_end == mapped.size());
+                }
+                else
+                {
+                    /* line is not valid utf-8: append() will substitute replacement characters, possibly consuming
+                     * a delimiter as part of an invalid multibyte character */
+                    const auto [byte_count, delimited]{ buffer::append_extent(mapped.subspan(content_pos)) };
+                    result.content_end = content_pos + byte_count;
+                    result.last = not delimited;
+                }
+                
+                return result;
+            }
+            
+            [[nodiscard]] inline std::size_t next_line_pos(const scanned_line& line)
+            {
+                /* invalid lines already include their delimiter in content_end */
+                return line.display_length ? line.content_end + 1 : line.content_end;
+            }
+            
+            [[nodiscard]] inline parsed_line make_parsed_line(const std::span<const char> mapped, buffer& buf, const scanned_line& line)
+            {
+                const std::size_t content_pos{ line.prefix.content_pos };
+                const auto contents{ mapped.subspan(content_pos, line.content_end - content_pos) };
+                
+                if (line.prefix.at_eof)
+                    return { line.prefix.indent_level, line.prefix.marker, buf.append(std::string_view{}) };
+                else if (line.display_length)
+                    return { line.prefix.indent_level, line.prefix.marker, buf.reference_mapped(contents, *line.display_length) };
+                else
+                    return { line.prefix.indent_level, line.prefix.marker, buf.append(contents) };
+            }
+            
+            [[nodiscard]] inline std::vector<scanned_line> scan_chunk(const std::span<const char> mapped, const std::size_t begin, const std::size_t end)
+            {
+                /* scans every line starting in [begin, end); as the indent level of the line before begin is unknown,
+                 * the first line is scanned with a guess, so results may need correcting when chunks are joined */
+                
+                std::vector<scanned_line> result{};
+                
+                for (std::size_t pos{ begin }, last_col{ 0 }; pos < end or end == mapped.size();)
+                {
+                    result.push_back(scan_line(mapped, pos, last_col));
+                    
+                    if (result.back().last)
+                        break;
+                    
+                    pos = next_line_pos(result.back());
+                    last_col = result.back().prefix.indent_level;
+                }
+                
+                return result;
+            }
+            
+            class output_buffer
+            {
+                /* collects small fragments of output and writes them to a file descriptor in large blocks */
+                
+            public:
+                explicit output_buffer(const int fd, std::atomic<std::size_t>* progress = nullptr) :
+                    fd_{ fd }, progress_{ progress }, data_{ std::make_unique_for_overwrite<char[]>(capacity) }
+                {
+                }
+                
+                void append(const std::string_view sv)
+                {
+                    if (sv.size() > capacity - size_)
                     {
-                        if (pos + 1 == line_markers.size() and line == 0)
+                        flush();
+                        
+                        if (sv.size() >= capacity)
                         {
-                            if (line_markers[pos])
-                                os << "├── ";
-                            else
-                                os << "└── ";
+                            write_all(sv); /* too large to be worth copying */
+                            return;
                         }
-                        else
+                    }
+                    
+                    std::memcpy(data_.get() + size_, sv.data(), sv.size());
+                    size_ += sv.size();
+                }
+                
+                bool flush()
+                {
+                    write_all({ data_.get(), size_ });
+                    size_ = 0;
+                    return ok_;
+                }
+                
+            private:
+                static constexpr std::size_t capacity{ 1024 * 1024 };
+                
+                void write_all(std::string_view sv)
+                {
+                    while (ok_ and not sv.empty())
+                    {
+                        if (const auto written{ ::write(fd_, sv.data(), sv.size()) }; written >= 0)
                         {
-                            if (line_markers[pos])
-                                os << "│   ";
-                            else
-                                os << "    ";
+                            sv.remove_prefix(static_cast<std::size_t>(written));
+                            
+                            if (progress_)
+                                progress_->fetch_add(static_cast<std::size_t>(written), std::memory_order_relaxed);
                         }
+                        else if (errno != EINTR)
+                            ok_ = false;
                     }
-                    
-                    if (te.line_count() == 0)
-                        os << '\n';
-                    else
-                        os << te.get_content_const().to_str(line) << '\n';
                 }
-            }
+                
+                int                         fd_;
+                std::atomic<std::size_t>*   progress_;
+                std::unique_ptr<char[]>     data_;
+                std::size_t                 size_{ 0 };
+                bool                        ok_{ true };
+            };
             
             template<typename T>
             inline void vec_reorder(std::vector<T>& container, std::size_t src, std::size_t dst)
@@ -338,6 +486,165 @@ namespace treenote::core
             
             template<typename... Ts>
             struct overload : Ts ... { using Ts::operator()...; };
+            
+            std::size_t visible_child_count(const tree& node)
+            {
+                /* the descendants of a folded node are left out of the line cache */
+                
+                return node.is_folded() ? 0 : node.child_count();
+            }
+            
+            void count_descendant_entries(const tree& tree_root, const std::size_t root_depth,
+                                          std::size_t& entry_count, std::size_t& arena_size,
+                                          const std::size_t child_end = std::numeric_limits<std::size_t>::max())
+            {
+                /* only the children of tree_root before child_end are counted */
+                
+                traverse_stack stack{};
+                
+                for (std::size_t i{ 0 }; i < std::min(visible_child_count(tree_root), child_end); ++i)
+                {
+                    stack.emplace(tree_root.get_child_const(i), 0);
+                    
+                    while (not stack.empty())
+                    {
+                        entry_count += std::max(stack.top_tree().line_count(), 1uz);
+                        arena_size += root_depth + stack.size();
+                        
+                        for (bool loop{ true }; loop;)
+                        {
+                            if (stack.top_index() < visible_child_count(stack.top_tree()))
+                            {
+                                stack.emplace(stack.top_tree().get_child_const(stack.top_index()), 0);
+                                loop = false;
+                            }
+                            else
+                            {
+                                stack.pop();
+                                
+                                if (not stack.empty())
+                                    ++(stack.top_index());
+                                else
+                                    loop = false;
+                            }
+                        }
+                    }
+                }
+            }
+            
+            std::uint64_t make_prefix_bits(const std::uint64_t parent_bits, const std::size_t depth, const bool has_next)
+            {
+                /* adds the bit for a node at depth to the prefix bits of its parent (see tree::cache_entry) */
+                
+                if (has_next and depth >= 2 and depth <= tree::cache_entry::prefix_bits_depth)
+                    return parent_bits | (std::uint64_t{ 1 } << (depth - 2));
+                else
+                    return parent_bits;
+            }
+            
+            void append_cache_entries(tree::line_cache& cache, const tree& node, const mti_t& index,
+                                      const std::size_t parent, const std::uint64_t prefix_bits,
+                                      std::vector<std::size_t>& last_pos_at_depth)
+            {
+                /* adds the lines of a single node to the cache and links the previous sibling to it */
+                
+                constexpr auto npos{ tree::cache_entry::npos };
+                
+                const std::size_t depth{ std::ranges::size(index) };
+                const std::size_t pos{ cache.entries.size() };
+                const std::size_t offset{ cache.index_arena.size() };
+                
+                cache.index_arena.insert(std::ranges::end(cache.index_arena), std::ranges::begin(index), std::ranges::end(index));
+                
+                if (last_pos_at_depth.size() <= depth)
+                    last_pos_at_depth.resize(depth + 1, npos);
+                
+                const auto parent_of{ [&](const std::size_t i) {
+                    const auto parent_dist{ cache.entries[i].parent_dist };
+                    return (parent_dist == npos) ? npos : i - parent_dist;
+                } };
+                
+                if (const auto prev{ last_pos_at_depth[depth] }; prev != npos and parent_of(prev) == parent)
+                {
+                    for (std::size_t i{ prev }; i < pos and (i == prev or cache.entries[i].line_no != 0); ++i)
+                        cache.entries[i].next_dist = pos - i;
+                }
+                
+                last_pos_at_depth[depth] = pos;
+                
+                for (std::size_t line{ 0 }; line < std::max(node.line_count(), 1uz); ++line)
+                    cache.entries.emplace_back(offset, depth, line, (parent == npos) ? npos : pos + line - parent, npos,
+                                               node, prefix_bits);
+            }
+            
+            void append_descendant_entries(tree::line_cache& cache, const tree& tree_root, mti_t& current_pos,
+                                           const std::size_t root_pos,
+                                           const std::size_t child_end = std::numeric_limits<std::size_t>::max())
+            {
+                /* current_pos must be the index of tree_root, and root_pos the position of its first line;
+                 * only the children of tree_root before child_end are added */
+                /* note: the prefix bits of the entries added do not include those of tree_root or its ancestors */
+                
+                traverse_stack              stack{};
+                std::vector<std::size_t>    pos_stack{ root_pos };  /* positions of the nodes in stack */
+                std::vector<std::uint64_t>  bits_stack{ 0 };        /* prefix bits of the nodes in stack */
+                std::vector<std::size_t>    last_pos_at_depth{};
+                
+                const std::size_t end{ std::min(visible_child_count(tree_root), child_end) };
+                bool has_next{ false };
+                
+                current_pos.push_back(0);
+                
+                for (std::size_t i{ 0 }; i < end; ++i)
+                {
+                    stack.emplace(tree_root.get_child_const(i), 0);
+                    has_next = i + 1 < end;
+                    
+                    while (not stack.empty())
+                    {
+                        /* add tree index to cache */
+                        const std::size_t parent{ pos_stack.back() };
+                        const std::uint64_t bits{ make_prefix_bits(bits_stack.back(), current_pos.size(), has_next) };
+                        pos_stack.push_back(cache.entries.size());
+                        bits_stack.push_back(bits);
+                        append_cache_entries(cache, stack.top_tree(), current_pos, parent, bits, last_pos_at_depth);
+                        
+                        /* find next node */
+                        for (bool loop{ true }; loop;)
+                        {
+                            if (stack.top_index() < visible_child_count(stack.top_tree()))
+                            {
+                                /* child tree entry found; traverse deeper */
+                                has_next = stack.top_index() + 1 < stack.top_tree().child_count();
+                                current_pos.push_back(stack.top_index());
+                                stack.emplace(stack.top_tree().get_child_const(stack.top_index()), 0);
+                                loop = false;
+                            }
+                            else
+                            {
+                                /* cannot go deeper; unwind stack and repeat
+                                 * until stack empty or next tree entry found */
+                                stack.pop();
+                                pos_stack.pop_back();
+                                bits_stack.pop_back();
+                                
+                                if (not stack.empty())
+                                {
+                                    current_pos.pop_back();
+                                    ++(stack.top_index());
+                                }
+                                else
+                                {
+                                    loop = false;
+                                }
+                            }
+                        }
+                    }
+                    ++(current_pos.back());
+                }
+                
+                current_pos.pop_back();
+            }
         }
     }
     
@@ -350,81 +657,79 @@ namespace treenote::core
         return root_node;
     }
     
-    tree tree::make_copy(const tree& tree_entry)
+    tree tree::make_duplicate(const tree& tree_entry)
     {
-        tree copy{};
-        copy.content_ = tree_entry.content_.make_copy();
+        /* unlike make_copy, copies every descendant as well, so that the duplicate can be inserted into the same tree as
+         * tree_entry (e.g. when pasting) without two nodes having the same ID                                       */
         
-        detail::traverse_stack                      stack{};
-        std::stack<std::reference_wrapper<tree>>    result_stack{};
+        tree result{};
+        result.content_ = tree_entry.content_.make_copy();
+        result.folded_ = tree_entry.folded_;
+        result.children_.reserve(tree_entry.child_count());
         
-        result_stack.emplace(copy);
+        for (const auto& child : tree_entry.children_)
+            result.add_child(make_duplicate(*child));
         
-        for (const auto& c: tree_entry.children_)
-        {
-            stack.emplace(c, 0);
-            
-            while (not stack.empty())
-            {
-                /* copy tree entry content */
-                tree tmp{};
-                tmp.content_ = stack.top().ref.get().content_.make_copy();
-                result_stack.top().get().add_child(std::move(tmp));
-                result_stack.emplace(result_stack.top().get().children_.back());
-                
-                /* find next node */
-                for (bool loop{ true }; loop;)
-                {
-                    if (stack.top_index() < stack.top_tree().child_count())
-                    {
-                        /* child tree entry found; traverse deeper */
-                        stack.emplace(stack.top_tree().get_child_const(stack.top_index()), 0);
-                        loop = false;
-                    }
-                    else
-                    {
-                        /* cannot go deeper; unwind stack and repeat
-                         * until stack empty or next tree entry found */
-                        stack.pop();
-                        result_stack.pop();
-                        
-                        if (not stack.empty())
-                        {
-                            ++(stack.top_index());
-                        }
-                        else
-                        {
-                            loop = false;
-                        }
-                    }
-                }
-            }
-        }
+        return result;
+    }
+    
+    tree tree::make_node(tree_string&& content, std::vector<tree>&& children)
+    {
+        tree node{};
+        node.content_ = std::move(content);
         
-        return copy;
+        for (auto& child : children)
+            node.add_child(std::move(child));
+        
+        return node;
     }
     
-    tree tree::parse(std::istream& is, const std::string_view filename, buffer& buf, save_load_info& read_info)
+    void tree::collect_tree_strings(tree& tree_root, std::unordered_set<tree_string*>& result)
     {
-        std::noskipws(is); /* important! without this, only one line is produced */
-        std::stack<std::reference_wrapper<tree>> tree_stack{};
+        /* nodes shared with copies are reached more than once, but their subtrees need only be visited once */
+        
+        if (not result.insert(&tree_root.content_).second)
+            return;
+        
+        for (const auto& child : tree_root.children_)
+            collect_tree_strings(*child, result);
+    }
+    
+    std::size_t tree::memory_usage(const tree& tree_root)
+    {
+        std::size_t result{ tree_root.content_.memory_usage() + tree_root.children_.capacity() * sizeof(std::shared_ptr<tree>) };
+        
+        for (const auto& child : tree_root.children_)
+            result += sizeof(tree) + memory_usage(*child);
         
+        return result;
+    }
+    
+    tree tree::parse_impl(const std::string_view filename, buffer& buf, save_load_info& read_info, auto&& next_line)
+    {
         tree root_node{ buf.append(filename) };
+        parse_lines(root_node, read_info, next_line);
+        remove_trailing_empty(root_node);
+        return root_node;
+    }
+    
+    void tree::parse_lines(tree& root_node, save_load_info& read_info, auto&& next_line)
+    {
+        /* next_line(prev_indent_level) returns the next detail::parsed_line, or nullopt once the input is exhausted */
+        
+        std::stack<std::reference_wrapper<tree>> tree_stack{};
         tree_stack.emplace(root_node);
         
         std::size_t prev_indent_level{ 0 };
         
-        while (not is.eof())
+        while (auto line{ next_line(prev_indent_level) })
         {
-            bool marker{ false };
-            
-            /* parse lines */
-            const std::size_t indent_level{ detail::parse_helper_v2(is, marker, prev_indent_level) };
+            const std::size_t indent_level{ line->indent_level };
             
-            if (!marker and indent_level != 0)
+            if (not line->marker and indent_level != 0)
             {
                 /* add line to existing tree entry instead of making new tree entry */
-                tree_stack.top().get().add_line(buf.append(std::views::istream<char>(is)));
+                tree_stack.top().get().add_line(line->content);
             }
             else
             {
@@ -440,51 +745,366 @@ namespace treenote::core
                     {
                         auto& tmp{ tree_stack.top().get() };
                         const std::size_t index{ tmp.add_child(tree{}) };
-                        tree_stack.emplace(tmp.children_[index]);
+                        tree_stack.emplace(*tmp.children_[index]);
                         ++read_info.node_count;
                     }
                 }
                 
                 /* add new entry to tree and push to top of stack */
                 auto& tmp{ tree_stack.top().get() };
-                const std::size_t index{ tmp.add_child(tree{ buf.append(std::views::istream<char>(is)) }) };
-                tree_stack.emplace(tmp.children_[index]);
+                const std::size_t index{ tmp.add_child(tree{ line->content }) };
+                tree_stack.emplace(*tmp.children_[index]);
                 ++read_info.node_count;
             }
             ++read_info.line_count;
             prev_indent_level = indent_level;
         }
-        
+    }
+    
+    void tree::remove_trailing_empty(tree& root_node)
+    {
         /* remove trailing new lines */
         
         for (bool done{ false }; not root_node.children_.empty() and not done;)
         {
-            if (auto& tmp{ root_node.children_.back() }; not (tmp.children_.empty() and tmp.content_.empty()))
+            if (const auto& tmp{ *root_node.children_.back() }; tmp.lazy_ or not (tmp.children_.empty() and tmp.content_.empty()))
                 done = true;
             else
                 root_node.children_.pop_back();
         }
 
         if (root_node.children_.empty())
-            root_node.children_.emplace_back();
+            root_node.add_child(tree{});
+    }
+    
+    tree tree::parse(std::istream& is, const std::string_view filename, buffer& buf, save_load_info& read_info)
+    {
+        std::noskipws(is); /* important! without this, only one line is produced */
+        
+        return parse_impl(filename, buf, read_info, [&](const std::size_t prev_indent_level) -> std::optional<detail::parsed_line> {
+            if (is.eof())
+                return std::nullopt;
+            
+            bool marker{ false };
+            const std::size_t indent_level{ detail::parse_helper_v2(is, marker, prev_indent_level) };
+            
+            return detail::parsed_line{ indent_level, marker, buf.append(std::views::istream<char>(is)) };
+        });
+    }
+    
+    tree tree::parse(const std::span<const char> mapped, const std::string_view filename, buffer& buf, save_load_info& read_info, unsigned int jobs)
+    {
+        /* mapped must have been returned by buf.map_file; line contents are referenced in place where possible */
+        
+        /* The input is split at newlines into one chunk per job, and each chunk's lines are scanned on its own thread.
+         * A scanned line only depends on its starting position and on the indent level of the line before it, so when
+         * the results are joined, the speculative results of each chunk are used from the first line whose position
+         * and previous indent level agree with the sequential parse; lines before that point are rescanned. */
+        
+        constexpr std::size_t min_chunk_size{ 1024 * 1024 };
+        
+        jobs = static_cast<unsigned int>(std::clamp<std::size_t>(mapped.size() / min_chunk_size, 1, std::max(jobs, 1u)));
+        
+        std::vector<std::vector<detail::scanned_line>> chunks(jobs);
+        
+        if (jobs > 1)
+        {
+            std::vector<std::size_t> bounds{ 0 };
+            
+            for (std::size_t i{ 1 }; i < jobs; ++i)
+                bounds.push_back(std::min(line_scan::find_line_end(mapped, std::max(bounds.back(), i * mapped.size() / jobs)) + 1, mapped.size()));
+            
+            bounds.push_back(mapped.size());
+            
+            std::vector<std::jthread> workers{};
+            
+            for (std::size_t i{ 0 }; i < jobs; ++i)
+            {
+                workers.emplace_back([&, i]() {
+                    chunks[i] = detail::scan_chunk(mapped, bounds[i], bounds[i + 1]);
+                });
+            }
+        }
+        
+        std::size_t pos{ 0 };
+        bool eof{ false };
+        
+        std::size_t chunk_index{ 0 };
+        std::size_t line_index{ 0 };
+        
+        return parse_impl(filename, buf, read_info, [&](const std::size_t prev_indent_level) -> std::optional<detail::parsed_line> {
+            if (eof)
+                return std::nullopt;
+            
+            /* find the first speculatively scanned line at or after pos */
+            for (; chunk_index < chunks.size(); ++chunk_index, line_index = 0)
+            {
+                const auto& lines{ chunks[chunk_index] };
+                
+                while (line_index < lines.size() and lines[line_index].begin < pos)
+                    ++line_index;
+                
+                if (line_index < lines.size())
+                    break;
+            }
+            
+            const auto line{ [&]() -> detail::scanned_line {
+                if (chunk_index < chunks.size())
+                {
+                    if (const auto& l{ chunks[chunk_index][line_index] }; l.begin == pos and l.last_col == prev_indent_level)
+                        return l;
+                }
+                
+                return detail::scan_line(mapped, pos, prev_indent_level);
+            }() };
+            
+            pos = detail::next_line_pos(line);
+            eof = line.last;
+            
+            return detail::make_parsed_line(mapped, buf, line);
+        });
+    }
+    
+    tree tree::parse_lazy(const std::span<const char> mapped, const std::string_view filename, buffer& buf, save_load_info& read_info)
+    {
+        /* mapped must have been returned by buf.map_file, and must remain mapped until every node is materialized */
         
+        /* Each line with an indent level of 0 begins a new top-level node, so the extent of each top-level node is
+         * found by scanning the prefix of every line (as parse does, but without touching the buffer); no contents
+         * or piece tables are made. Trailing empty nodes are removed as parse_impl would, so a node which consists
+         * only of empty lines is noted while scanning.                                                            */
+        
+        constexpr auto npos{ std::numeric_limits<std::size_t>::max() };
+        
+        tree root_node{ buf.append(filename) };
+        std::vector<bool> empty_nodes{};
+        
+        std::size_t pos{ 0 };
+        std::size_t last_col{ 0 };
+        bool eof{ false };
+        
+        /* any lines before the first line of indent level 0 are parsed as usual (they are not part of a top-level node
+         * which begins at such a line, as they are either added to the root or make nodes for skipped indent levels) */
+        
+        parse_lines(root_node, read_info, [&](std::size_t) -> std::optional<detail::parsed_line> {
+            if (eof)
+                return std::nullopt;
+            
+            const auto line{ detail::scan_line(mapped, pos, last_col) };
+            
+            if (line.prefix.indent_level == 0)
+                return std::nullopt;
+            
+            pos = detail::next_line_pos(line);
+            last_col = line.prefix.indent_level;
+            eof = line.last;
+            
+            return detail::make_parsed_line(mapped, buf, line);
+        });
+        
+        std::size_t depth{ 1 };     /* size of the stack of parse_lines (the first line scanned below resets it) */
+        
+        while (not eof)
+        {
+            const auto line{ detail::scan_line(mapped, pos, last_col) };
+            const auto& prefix{ line.prefix };
+            const bool is_empty{ prefix.at_eof or line.content_end == prefix.content_pos };
+            
+            if (prefix.indent_level == 0)
+            {
+                if (not empty_nodes.empty())
+                    root_node.children_.back()->lazy_->end = pos;
+                
+                tree node{};
+                node.lazy_ = std::make_unique<lazy_range>(mapped, &buf, pos, npos, last_col);
+                root_node.add_child(std::move(node));
+                empty_nodes.push_back(is_empty);
+            }
+            else if (not empty_nodes.empty())
+            {
+                empty_nodes.back() = empty_nodes.back() and is_empty and not prefix.marker;
+            }
+            
+            /* count nodes as parse_lines makes them (including any inserted for skipped indent levels) */
+            if (prefix.marker or prefix.indent_level == 0)
+            {
+                depth = std::min(depth, prefix.indent_level + 1);
+                read_info.node_count += prefix.indent_level + 1 - depth + 1;
+                depth = prefix.indent_level + 2;
+            }
+            
+            ++read_info.line_count;
+            
+            pos = detail::next_line_pos(line);
+            last_col = prefix.indent_level;
+            eof = line.last;
+        }
+        
+        while (not empty_nodes.empty() and empty_nodes.back())
+        {
+            root_node.children_.pop_back();
+            empty_nodes.pop_back();
+        }
+        
+        remove_trailing_empty(root_node);
         return root_node;
     }
     
-    void tree::write(std::ostream& os, const tree& tree_root, save_load_info& write_info)
+    std::size_t tree::first_unmaterialized(const tree& tree_root)
     {
-        detail::traverse_stack  stack{};
-        std::vector<bool>       line_markers{};
+        const auto it{ std::ranges::partition_point(tree_root.children_, [](const auto& c) { return not c->lazy_; }) };
+        return static_cast<std::size_t>(it - std::ranges::begin(tree_root.children_));
+    }
     
-        for (const auto& c: tree_root.children_)
+    void tree::materialize(tree& tree_root, const std::size_t min_lines)
+    {
+        /* materializes unmaterialized nodes in order until they hold at least min_lines lines, or none are left
+         * (and always materializes at least one, if any are left) */
+        
+        std::size_t lines{ 0 };
+        
+        for (auto i{ first_unmaterialized(tree_root) }; i < tree_root.child_count() and (lines == 0 or lines < min_lines); ++i)
+            lines += materialize_node(*tree_root.children_[i]);
+    }
+    
+    void tree::materialize_all(tree& tree_root)
+    {
+        for (auto i{ first_unmaterialized(tree_root) }; i < tree_root.child_count(); ++i)
+            static_cast<void>(materialize_node(*tree_root.children_[i]));
+    }
+    
+    void tree::collect_lazy_ranges(const tree& tree_root, std::vector<buffer::live_range>& result)
+    {
+        /* unmaterialized nodes refer to the rest of the mapped file (which must not be unmapped by compaction) */
+        
+        if (const auto i{ first_unmaterialized(tree_root) }; i < tree_root.child_count())
         {
-            stack.emplace(c, 0);
+            const auto& range{ *tree_root.children_[i]->lazy_ };
+            const auto rest{ range.mapped.subspan(range.begin) };
+            
+            if (not rest.empty())
+                result.push_back({ .start_index = range.buf->reference_mapped(rest, 0).first.start_index, .byte_length = rest.size() });
+        }
+    }
+    
+    std::size_t tree::materialize_node(tree& node)
+    {
+        /* parses the extent of an unmaterialized node (see parse_lazy) into node, and returns its number of lines */
+        
+        const auto range{ std::move(node.lazy_) };
+        
+        std::size_t pos{ range->begin };
+        std::size_t last_col{ range->last_col };
+        bool eof{ false };
+        
+        tree holder{};
+        save_load_info info{ .node_count = 0, .line_count = 0 };
+        
+        parse_lines(holder, info, [&](std::size_t) -> std::optional<detail::parsed_line> {
+            if (eof or pos >= range->end)
+                return std::nullopt;
+            
+            const auto line{ detail::scan_line(range->mapped, pos, last_col) };
+            pos = detail::next_line_pos(line);
+            last_col = line.prefix.indent_level;
+            eof = line.last;
+            
+            return detail::make_parsed_line(range->mapped, *range->buf, line);
+        });
+        
+        /* the extent begins with a line of indent level 0 and contains no other, so it is read as one node */
+        node = take(holder.children_.front());
+        
+        std::size_t entry_count{ std::max(node.line_count(), 1uz) };
+        std::size_t arena_size{ 0 };
+        detail::count_descendant_entries(node, 1, entry_count, arena_size);
+        return entry_count;
+    }
     
+    void tree::write_impl(const tree& tree_root, save_load_info& write_info, const buffer::reader* reader, auto&& emit)
+    {
+        /* emit(std::string_view) is called with consecutive fragments of the output */
+        /* if reader is not null, contents are read through it instead of the buffer directly */
+        /* note: the lines found to be ambiguous are those parse_helper_v2 might read differently, erring on the side of
+         *       caution: every continuation line of a top-level node, or of a node with no "│" in its prefix (as the
+         *       prefix is then only spaces), and any line whose text could be taken for (part of) a prefix          */
+        
+        static constexpr std::string_view marker_mid{ "├── " };
+        static constexpr std::string_view marker_end{ "└── " };
+        static constexpr std::string_view indent_mid{ "│   " };
+        static constexpr std::string_view indent_end{ "    " };
+        
+        detail::traverse_stack          stack{};
+        std::vector<bool>               line_markers{};
+        
+        std::string                     prefix{};           /* prefix of every line of the current node except the first */
+        std::vector<std::size_t>        prefix_ends{};      /* byte length of prefix at each depth                        */
+        std::vector<std::string_view>   contents{};
+        
+        if (first_unmaterialized(tree_root) != tree_root.child_count())
+            throw std::logic_error{ "tree::write: Every node must be materialized before writing" };
+        
+        const auto put{ [&](const std::string_view sv) {
+            write_info.content_hash = content_hash(sv, write_info.content_hash);
+            emit(sv);
+        } };
+        
+        write_info.content_hash = content_hash_init;
+        write_info.ambiguous = false;
+        bool last_blank{ false };  /* whether the last top-level node written is empty (and so dropped when read) */
+        
+        for (const auto& c: tree_root.children_)
+        {
+            stack.emplace(*c, 0);
+            
             while (not stack.empty())
             {
-                /* write to stream */
-                detail::write_helper(os, stack.top_tree(), line_markers);
-                write_info.line_count += stack.top_tree().line_count();
+                /* write node */
+                const tree& te{ stack.top_tree() };
+                
+                for (std::size_t line{ 0 }; line < te.line_count() or line == 0; ++line)
+                {
+                    if (line == 0 and not line_markers.empty())
+                    {
+                        put(std::string_view{ prefix }.substr(0, prefix_ends.size() > 1 ? prefix_ends[prefix_ends.size() - 2] : 0));
+                        put(line_markers.back() ? marker_mid : marker_end);
+                    }
+                    else
+                    {
+                        put(std::string_view{ prefix });
+                    }
+                    
+                    contents.clear();
+                    if (te.line_count() != 0)
+                    {
+                        if (reader)
+                            te.content_.append_str_view(line, *reader, contents);
+                        else
+                            te.content_.append_str_view(line, contents);
+                        
+                        for (const auto& sv : contents)
+                            put(sv);
+                    }
+                    
+                    if (not write_info.ambiguous)
+                    {
+                        const bool top_level{ line_markers.empty() };
+                        
+                        if (line == 0)
+                            write_info.ambiguous = top_level and detail::starts_like_prefix(contents, true);
+                        else
+                            write_info.ambiguous = top_level or std::ranges::find(line_markers, true) == line_markers.end()
+                                                   or detail::starts_like_prefix(contents, false);
+                    }
+                    
+                    if (line_markers.empty())
+                        last_blank = te.line_count() <= 1 and te.child_count() == 0
+                                     and std::ranges::all_of(contents, [](const auto& sv) { return sv.empty(); });
+                    
+                    put(std::string_view{ "\n" });
+                }
+                
+                write_info.line_count += te.line_count();
                 ++write_info.node_count;
                 
                 /* find next node */
@@ -494,11 +1114,11 @@ namespace treenote::core
                     {
                         /* child tree entry found; traverse deeper */
                         
-                        if (stack.top_index() + 1 == stack.top_tree().child_count())
-                            line_markers.push_back(false);
-                        else
-                            line_markers.push_back(true);
-                
+                        const bool has_next{ stack.top_index() + 1 != stack.top_tree().child_count() };
+                        line_markers.push_back(has_next);
+                        prefix += has_next ? indent_mid : indent_end;
+                        prefix_ends.push_back(prefix.size());
+                        
                         stack.emplace(stack.top_tree().get_child_const(stack.top_index()), 0);
                         loop = false;
                     }
@@ -507,10 +1127,14 @@ namespace treenote::core
                         /* cannot go deeper; unwind stack and repeat
                          * until stack empty or next tree entry found */
                         stack.pop();
-                
+                        
                         if (not line_markers.empty())
+                        {
                             line_markers.pop_back();
-                
+                            prefix_ends.pop_back();
+                            prefix.resize(prefix_ends.empty() ? 0 : prefix_ends.back());
+                        }
+                        
                         if (not stack.empty())
                             ++(stack.top_index());
                         else
@@ -519,15 +1143,41 @@ namespace treenote::core
                 }
             }
         }
+        
+        /* trailing empty nodes are dropped when read (see remove_trailing_empty) */
+        if (last_blank and tree_root.child_count() > 1)
+            write_info.ambiguous = true;
+    }
+    
+    void tree::write(std::ostream& os, const tree& tree_root, save_load_info& write_info)
+    {
+        write_impl(tree_root, write_info, nullptr, [&](const std::string_view sv) {
+            os.write(sv.data(), static_cast<std::streamsize>(sv.size()));
+        });
+    }
+    
+    bool tree::write(const int fd, const tree& tree_root, save_load_info& write_info,
+                     const buffer::reader* reader, std::atomic<std::size_t>* progress)
+    {
+        /* writes through a large reusable buffer instead of a stream; returns false if any write failed */
+        /* if progress is not null, it is updated with the number of bytes written after each block      */
+        
+        detail::output_buffer out{ fd, progress };
+        
+        write_impl(tree_root, write_info, reader, [&](const std::string_view sv) {
+            out.append(sv);
+        });
+        
+        return out.flush();
     }
     
     void tree::invoke(tree& tree_root, command& cmd)
     {
         std::visit(detail::overload{
-                [&](const cmd::move_node& c) { move_node(tree_root, c.src, c.dst); },
-                [&](const cmd::edit_contents& c) { redo_edit_contents(tree_root, c.pos); },
-                [&](cmd::insert_node& c) { insert_node(tree_root, c.pos, c.inserted); },
-                [&](cmd::delete_node& c) { delete_node(tree_root, c.pos, c.deleted); },
+                [&](cmd::move_node& c) { move_node(tree_root, c.src, c.src_parent, c.dst, c.dst_parent); },
+                [&](cmd::edit_contents& c) { redo_edit_contents(tree_root, c.pos, c.id); },
+                [&](cmd::insert_node& c) { insert_node(tree_root, c.pos, c.parent, c.inserted); },
+                [&](cmd::delete_node& c) { delete_node(tree_root, c.pos, c.parent, c.deleted); },
                 [&](cmd::multi_cmd& cs) { for (auto& c : cs.commands) invoke(tree_root, c); },
         }, cmd);
     }
@@ -535,62 +1185,52 @@ namespace treenote::core
     void tree::invoke_reverse(tree& tree_root, command& cmd)
     {
         std::visit(detail::overload{
-                [&](const cmd::move_node& c) { unmove_node(tree_root, c.dst, c.src); },
-                [&](const cmd::edit_contents& c) { undo_edit_contents(tree_root, c.pos); },
-                [&](cmd::insert_node& c) { delete_node(tree_root, c.pos, c.inserted); },
-                [&](cmd::delete_node& c) { insert_node(tree_root, c.pos, c.deleted); },
+                [&](cmd::move_node& c) { move_node(tree_root, c.dst, c.dst_parent, c.src, c.src_parent); },
+                [&](cmd::edit_contents& c) { undo_edit_contents(tree_root, c.pos, c.id); },
+                [&](cmd::insert_node& c) { delete_node(tree_root, c.pos, c.parent, c.inserted); },
+                [&](cmd::delete_node& c) { insert_node(tree_root, c.pos, c.parent, c.deleted); },
                 [&](cmd::multi_cmd& cs) { for (auto& c : cs.commands | std::views::reverse) invoke_reverse(tree_root, c); },
         }, cmd);
     }
     
     tree::line_cache tree::build_index_cache(const tree& tree_root)
     {
+        /* unmaterialized nodes are left out (see parse_lazy) */
+        
         line_cache cache{};
+        mti_t current_pos{};
+        const std::size_t child_end{ first_unmaterialized(tree_root) };
+        
+        /* count first, so that the cache is allocated once instead of once per line */
+        std::size_t entry_count{ 0 };
+        std::size_t arena_size{ 0 };
+        detail::count_descendant_entries(tree_root, 0, entry_count, arena_size, child_end);
+        
+        cache.entries.reserve(entry_count);
+        cache.index_arena.reserve(arena_size);
+        
+        detail::append_descendant_entries(cache, tree_root, current_pos, cache_entry::npos, child_end);
+        return cache;
+    }
     
-        detail::traverse_stack      stack{};
-        std::vector<std::size_t>    current_pos{ 0 };
-    
-        for (const auto& c: tree_root.children_)
-        {
-            stack.emplace(c, 0);
-            
-            while (not stack.empty())
-            {
-                /* add tree index to cache */
-                for (std::size_t line{ 0 }; line < std::max(stack.top().ref.get().line_count(), 1uz); line++)
-                    cache.emplace_back(current_pos, line, stack.top().ref.get());
-                
-                /* find next node */
-                for (bool loop{ true }; loop;)
-                {
-                    if (stack.top_index() < stack.top_tree().child_count())
-                    {
-                        /* child tree entry found; traverse deeper */
-                        current_pos.push_back(stack.top_index());
-                        stack.emplace(stack.top_tree().get_child_const(stack.top_index()), 0);
-                        loop = false;
-                    }
-                    else
-                    {
-                        /* cannot go deeper; unwind stack and repeat
-                         * until stack empty or next tree entry found */
-                        stack.pop();
-                        
-                        if (not stack.empty())
-                        {
-                            current_pos.pop_back();
-                            ++(stack.top_index());
-                        }
-                        else
-                        {
-                            loop = false;
-                        }
-                    }
-                }
-            }
-            ++(current_pos.back());
-        }
+    tree::line_cache tree::build_index_cache(const tree& node, const mti_t& node_index)
+    {
+        /* builds the cache for a subtree only, including the lines of node itself,
+         * so that it can be spliced into an existing cache (positions and prefix bits are relative to the subtree) */
         
+        line_cache cache{};
+        mti_t current_pos{ node_index };
+        
+        std::size_t entry_count{ std::max(node.line_count(), 1uz) };
+        std::size_t arena_size{ std::ranges::size(node_index) };
+        detail::count_descendant_entries(node, std::ranges::size(node_index), entry_count, arena_size);
+        
+        cache.entries.reserve(entry_count);
+        cache.index_arena.reserve(arena_size);
+        
+        std::vector<std::size_t> last_pos_at_depth{};
+        detail::append_cache_entries(cache, node, current_pos, cache_entry::npos, 0, last_pos_at_depth);
+        detail::append_descendant_entries(cache, node, current_pos, 0);
         return cache;
     }
     
@@ -599,7 +1239,7 @@ namespace treenote::core
     
     std::size_t tree::add_child(tree&& te)
     {
-        children_.push_back(std::move(te));
+        children_.push_back(std::make_shared<tree>(std::move(te)));
         return children_.size() - 1;
     }
     
@@ -610,49 +1250,150 @@ namespace treenote::core
     
     void tree::insert_child(tree&& te, const std::size_t index)
     {
-        detail::vec_insert(children_, std::move(te), index);
+        detail::vec_insert(children_, std::make_shared<tree>(std::move(te)), index);
     }
     
     tree tree::detach_child(const std::size_t index)
     {
-        return detail::vec_detach(children_, index);
+        auto node{ detail::vec_detach(children_, index) };
+        return take(node);
     }
     
     
     /* Private static functions */
     
-    void tree::move_node(tree& tree_root, const tree_index auto& src, const tree_index auto& dst)
+    tree& tree::unshare(std::shared_ptr<tree>& node)
+    {
+        /* replaces node with a copy of itself if it is shared, so that it can be modified */
+        
+        if (node.use_count() > 1)
+        {
+            tree copy{};
+            copy.content_ = node->content_.make_copy_with_history();
+            copy.children_ = node->children_;
+            copy.id_ = node->id_;
+            copy.folded_ = node->folded_;
+            node = std::make_shared<tree>(std::move(copy));
+        }
+        
+        return *node;
+    }
+    
+    tree tree::take(std::shared_ptr<tree>& node)
+    {
+        /* moves the contents out of node, or copies them if node is shared */
+        
+        return std::move(unshare(node));
+    }
+    
+    tree tree::make_copy(const tree& tree_entry)
+    {
+        /* the copy shares its descendants with tree_entry; they are only copied once either tree modifies them */
+        
+        tree copy{};
+        copy.content_ = tree_entry.content_.make_copy();
+        copy.children_ = tree_entry.children_;
+        copy.id_ = tree_entry.id_;
+        copy.folded_ = tree_entry.folded_;
+        return copy;
+    }
+    
+    tree* tree::find_handle(tree& tree_root, const node_id id)
+    {
+        if (tree_root.handles_ == nullptr)
+            return nullptr;
+        
+        const auto it{ tree_root.handles_->nodes.find(id) };
+        return it != std::ranges::end(tree_root.handles_->nodes) ? it->second : nullptr;
+    }
+    
+    void tree::set_handle(tree& tree_root, tree& node)
     {
+        /* node must have been found by its tree index (which unshares the path to it), or been inserted since */
+        
+        if (&node == &tree_root)
+            return;
+        
+        if (tree_root.handles_ == nullptr)
+            tree_root.handles_ = std::make_unique<handle_table>();
+        
+        tree_root.handles_->nodes.insert_or_assign(node.id_, &node);
+    }
+    
+    void tree::drop_handle(tree& tree_root, const node_id id)
+    {
+        if (tree_root.handles_ != nullptr)
+            tree_root.handles_->nodes.erase(id);
+    }
+    
+    void tree::drop_handles(tree& tree_root, const tree& node)
+    {
+        /* drops the entries of node and all of its descendants, e.g. once they have been detached from the tree */
+        
+        if (tree_root.handles_ == nullptr or tree_root.handles_->nodes.empty())
+            return;
+        
+        tree_root.handles_->nodes.erase(node.id_);
+        drop_descendant_handles(tree_root, node);
+    }
+    
+    void tree::drop_descendant_handles(tree& tree_root, const tree& node)
+    {
+        /* the entries of every node in the tree are dropped at once when node is the root */
+        
+        if (tree_root.handles_ == nullptr or tree_root.handles_->nodes.empty())
+            return;
+        else if (&node == &tree_root)
+            tree_root.handles_->nodes.clear();
+        else
+            for (const auto& child : node.children_)
+                drop_handles(tree_root, *child);
+    }
+    
+    void tree::move_node(tree& tree_root, const tree_index auto& src, node_id& src_parent,
+                         const tree_index auto& dst, node_id& dst_parent)
+    {
+        /* the moved node is copied into a new allocation unless src and dst have the same parent, so it is given a new
+         * entry in the handle table; its descendants are not, so their entries remain valid */
+        
         auto lci{ longest_common_index_of(src, dst) };
         bool error{ false };
     
         if (std::ranges::size(lci) + 1 == std::ranges::size(src) and std::ranges::size(lci) + 1 == std::ranges::size(dst))
         {
             /* src and dst have the same parent; use reorder instead of detach + insert */
-            auto common_parent{ get_node(tree_root, lci) };
+            auto common_parent{ get_node(tree_root, src_parent, lci) };
         
             if (common_parent)
+            {
+                dst_parent = src_parent;
                 common_parent->get().reorder_children(last_index_of(src), last_index_of(dst));
+            }
             else
+            {
                 error = true;
+            }
         }
         else
         {
-            auto src_parent{ get_node(tree_root, parent_index_of(src)) };
+            auto src_parent_node{ get_node(tree_root, src_parent, parent_index_of(src)) };
         
-            if (src_parent)
+            if (src_parent_node)
             {
-                tree tmp{ src_parent->get().detach_child(last_index_of(src)) };
-                auto dst_parent{ get_node(tree_root, parent_index_of(dst)) };
+                tree tmp{ src_parent_node->get().detach_child(last_index_of(src)) };
+                drop_handle(tree_root, tmp.id_);
+                
+                auto dst_parent_node{ get_node(tree_root, dst_parent, parent_index_of(dst)) };
             
-                if (dst_parent)
+                if (dst_parent_node)
                 {
-                    dst_parent->get().insert_child(std::move(tmp), last_index_of(dst));
+                    dst_parent_node->get().insert_child(std::move(tmp), last_index_of(dst));
+                    set_handle(tree_root, *dst_parent_node->get().children_[last_index_of(dst)]);
                 }
                 else
                 {
                     /* revert change and throw error */
-                    src_parent->get().insert_child(std::move(tmp), last_index_of(src));
+                    src_parent_node->get().insert_child(std::move(tmp), last_index_of(src));
                     error = true;
                 }
             }
@@ -668,9 +1409,9 @@ namespace treenote::core
         }
     }
     
-    void tree::insert_node(tree& tree_root, const tree_index auto& pos, std::optional<tree>& ins)
+    void tree::insert_node(tree& tree_root, const tree_index auto& pos, node_id& parent, std::optional<tree>& ins)
     {
-        auto target{ get_node(tree_root, parent_index_of(pos)) };
+        auto target{ get_node(tree_root, parent, parent_index_of(pos)) };
         
         if (target)
         {
@@ -678,6 +1419,8 @@ namespace treenote::core
                 target->get().insert_child(std::move(*ins), last_index_of(pos));
             else
                 target->get().insert_child(tree{}, last_index_of(pos));
+            
+            set_handle(tree_root, *target->get().children_[last_index_of(pos)]);
         }
         else
         {
@@ -685,13 +1428,14 @@ namespace treenote::core
         }
     }
     
-    void tree::delete_node(tree& tree_root, const tree_index auto& pos, std::optional<tree>& del)
+    void tree::delete_node(tree& tree_root, const tree_index auto& pos, node_id& parent, std::optional<tree>& del)
     {
-        auto target{ get_node(tree_root, parent_index_of(pos)) };
+        auto target{ get_node(tree_root, parent, parent_index_of(pos)) };
         
         if (target)
         {
             del = target->get().detach_child(last_index_of(pos));
+            drop_handles(tree_root, *del);
         }
         else
         {
@@ -699,9 +1443,9 @@ namespace treenote::core
         }
     }
     
-    void tree::redo_edit_contents(tree& tree_root, const tree_index auto& pos)
+    void tree::redo_edit_contents(tree& tree_root, const tree_index auto& pos, node_id& id)
     {
-        auto target{ get_node(tree_root, pos) };
+        auto target{ get_node(tree_root, id, pos) };
         
         if (target)
         {
@@ -713,9 +1457,9 @@ namespace treenote::core
         }
     }
     
-    void tree::undo_edit_contents(tree& tree_root, const tree_index auto& pos)
+    void tree::undo_edit_contents(tree& tree_root, const tree_index auto& pos, node_id& id)
     {
-        auto target{ get_node(tree_root, pos) };
+        auto target{ get_node(tree_root, id, pos) };
         
         if (target)
         {
@@ -726,5 +1470,4 @@ namespace treenote::core
             throw std::out_of_range{ "tree::undo_edit_contents: Can not locate node to undo edit" };
         }
     }
-
-}
\ No newline at end of file
+}
@@ -20,12 +20,19 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <iosfwd>
+#include <limits>
+#include <memory>
 #include <optional>
 #include <ranges>
+#include <span>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "buffer.hpp"
@@ -35,10 +42,19 @@
 
 namespace treenote::core
 {
+    using node_id = std::uint64_t;
+    
+    inline constexpr node_id no_node_id{ 0 };
+    
+    inline constexpr std::uint64_t content_hash_init{ 14695981039346656037u };
+    
     struct save_load_info
     {
-        std::size_t node_count;
-        std::size_t line_count;
+        std::size_t     node_count;
+        std::size_t     line_count;
+        std::uint64_t   content_hash{ content_hash_init };  /* only set by write: the hash of the output (see content_hash) */
+        bool            ambiguous{ false };                 /* only set by write: the output may not be read back as the
+                                                             * same tree (e.g. a top-level node with several lines)     */
     };
     
     class tree
@@ -48,12 +64,25 @@ namespace treenote::core
         
         struct cache_entry
         {
-            std::vector<std::size_t>              index;
+            static constexpr std::size_t npos{ std::numeric_limits<std::size_t>::max() };
+            
+            std::size_t                           index_offset;   /* position of the tree index in index_arena */
+            std::size_t                           depth;          /* length of the tree index */
             std::size_t                           line_no;
+            std::size_t                           parent_dist;    /* distance back to the first line of the parent (or npos) */
+            std::size_t                           next_dist;      /* distance on to the first line of the next sibling (or npos) */
             std::reference_wrapper<const tree>    ref;
+            std::uint64_t                         prefix_bits{ 0 };   /* bit i is set if the node at depth i + 2 on the path
+                                                                       * to this entry has a next sibling (see cache::entry_prefix) */
+            
+            static constexpr std::size_t prefix_bits_depth{ 65 };   /* prefix_bits only describes entries up to this depth */
         };
         
-        using line_cache = std::vector<cache_entry>;
+        struct line_cache
+        {
+            std::vector<cache_entry>    entries;
+            std::vector<std::size_t>    index_arena;    /* tree indices of all nodes; shared by all lines of a node */
+        };
     
         tree() = default;
         
@@ -67,21 +96,78 @@ namespace treenote::core
         [[nodiscard]] const auto& get_child_const(std::size_t i) const;
         [[nodiscard]] std::size_t line_count() const;
         [[nodiscard]] std::size_t child_count() const;
+        [[nodiscard]] bool is_folded() const noexcept;
+        [[nodiscard]] node_id id() const noexcept;
         
         static void invoke(tree& tree_root, command& cmd);
         static void invoke_reverse(tree& tree_root, command& cmd);
         
         [[nodiscard]] static tree make_empty();
-        [[nodiscard]] static tree make_copy(const tree& tree_entry);
+        [[nodiscard]] static tree make_copy(tree& tree_root, const tree_index auto& ti);
+        [[nodiscard]] static tree make_duplicate(const tree& tree_entry);
+        [[nodiscard]] static tree make_node(tree_string&& content, std::vector<tree>&& children);
         [[nodiscard]] static tree parse(std::istream& is, std::string_view filename, buffer& buf, save_load_info& read_info);
+        [[nodiscard]] static tree parse(std::span<const char> mapped, std::string_view filename, buffer& buf, save_load_info& read_info, unsigned int jobs = 1);
+        [[nodiscard]] static tree parse_lazy(std::span<const char> mapped, std::string_view filename, buffer& buf, save_load_info& read_info);
         static void write(std::ostream& os, const tree& tree_root, save_load_info& write_info);
+        [[nodiscard]] static bool write(int fd, const tree& tree_root, save_load_info& write_info,
+                                        const buffer::reader* reader = nullptr, std::atomic<std::size_t>* progress = nullptr);
         
         [[nodiscard]] static line_cache build_index_cache(const tree& tree_root);
+        [[nodiscard]] static line_cache build_index_cache(const tree& node, const mti_t& node_index);
         
         [[nodiscard]] static auto get_editable_tree_string(tree& tree_root, const tree_index auto& ti)
                 -> std::optional<std::reference_wrapper<tree_string>>;
+        [[nodiscard]] static auto get_editable_tree_string(tree& tree_root, node_id id, const tree_index auto& ti)
+                -> std::optional<std::reference_wrapper<tree_string>>;
+        
+        /* a folded node hides its descendants from the line cache; returns false if ti does not exist */
+        static bool set_folded(tree& tree_root, const tree_index auto& ti, bool folded);
+        
+        /* adds the content of every node to result (without unsharing any); used to compact the buffer */
+        static void collect_tree_strings(tree& tree_root, std::unordered_set<tree_string*>& result);
+        
+        /* estimates the memory used by tree_root and its descendants (including any shared with copies) */
+        [[nodiscard]] static std::size_t memory_usage(const tree& tree_root);
+        
+        /* Lazy loading: parse_lazy only finds the extent of each top-level node in the file, and leaves the nodes
+         * unmaterialized (with no contents or children) until materialize is called for them. Unmaterialized nodes
+         * always follow every materialized node, and nothing else (including build_index_cache) looks past the
+         * first of them, so they must be materialized before anything else can refer to them.                     */
+        
+        [[nodiscard]] static std::size_t first_unmaterialized(const tree& tree_root);
+        static void materialize(tree& tree_root, std::size_t min_lines);
+        static void materialize_all(tree& tree_root);
+        static void collect_lazy_ranges(const tree& tree_root, std::vector<buffer::live_range>& result);
+        
+        /* Node IDs: every node has an ID, which its copies made by make_copy keep (as they stand for the same node, e.g.
+         * in a snapshot being saved) but those made by make_duplicate do not, so no two nodes in a tree have the same ID.
+         * Commands and edit_info address nodes by ID as well as by tree index: the root holds a table from ID to node,
+         * so that a node can be found without walking the path to it. Since make_copy shares the descendants of the
+         * node copied, which must be unshared along the path before being modified (see get_node), their entries are
+         * dropped from the table of that tree when it is called, and they are found by their tree index until looked up
+         * again; the rest of the table, and the tables of other trees, are kept.                                     */
         
     private:
+        struct lazy_range
+        {
+            /* the extent of an unmaterialized top-level node within the mapped file (see parse_lazy) */
+            
+            std::span<const char>   mapped;
+            buffer*                 buf;            /* non owning */
+            std::size_t             begin;
+            std::size_t             end;            /* position of the next top-level node, or npos for the last */
+            std::size_t             last_col;       /* indent level of the line before begin */
+        };
+        
+        struct handle_table
+        {
+            /* the nodes found by ID whose path from the root is not shared with a copy (see get_node) */
+            
+            std::unordered_map<node_id, tree*>  nodes;  /* non owning */
+        };
+        
+
         explicit tree(const extended_piece_table_entry& input);
         
         void add_line(const extended_piece_table_entry& input);
@@ -91,18 +177,44 @@ namespace treenote::core
         void insert_child(tree&& te, std::size_t index);
         [[nodiscard]] tree detach_child(std::size_t index);
         
-        static void move_node(tree& tree_root, const tree_index auto& src, const tree_index auto& dst);
-        static void unmove_node(tree& tree_root, const tree_index auto& dst, const tree_index auto& src);
-        static void insert_node(tree& tree_root, const tree_index auto& pos, std::optional<tree>& ins);
-        static void delete_node(tree& tree_root, const tree_index auto& pos, std::optional<tree>& del);
-        static void redo_edit_contents(tree& tree_root, const tree_index auto& pos);
-        static void undo_edit_contents(tree& tree_root, const tree_index auto& pos);
+        [[nodiscard]] static tree make_copy(const tree& tree_entry);
+        [[nodiscard]] static tree& unshare(std::shared_ptr<tree>& node);
+        [[nodiscard]] static tree take(std::shared_ptr<tree>& node);
+        
+        static void move_node(tree& tree_root, const tree_index auto& src, node_id& src_parent,
+                              const tree_index auto& dst, node_id& dst_parent);
+        static void insert_node(tree& tree_root, const tree_index auto& pos, node_id& parent, std::optional<tree>& ins);
+        static void delete_node(tree& tree_root, const tree_index auto& pos, node_id& parent, std::optional<tree>& del);
+        static void redo_edit_contents(tree& tree_root, const tree_index auto& pos, node_id& id);
+        static void undo_edit_contents(tree& tree_root, const tree_index auto& pos, node_id& id);
+        
+        [[nodiscard]] static tree parse_impl(std::string_view filename, buffer& buf, save_load_info& read_info, auto&& next_line);
+        static void parse_lines(tree& root_node, save_load_info& read_info, auto&& next_line);
+        static void remove_trailing_empty(tree& root_node);
+        static std::size_t materialize_node(tree& node);
+        static void write_impl(const tree& tree_root, save_load_info& write_info, const buffer::reader* reader, auto&& emit);
     
         [[nodiscard]] static auto get_node(tree& tree_root, const tree_index auto& ti)
                 -> std::optional<std::reference_wrapper<tree>>;
+        [[nodiscard]] static auto get_node(tree& tree_root, node_id& id, const tree_index auto& ti)
+                -> std::optional<std::reference_wrapper<tree>>;
+        
+        [[nodiscard]] static node_id next_id() noexcept;
+        [[nodiscard]] static tree* find_handle(tree& tree_root, node_id id);
+        static void set_handle(tree& tree_root, tree& node);
+        static void drop_handle(tree& tree_root, node_id id);
+        static void drop_handles(tree& tree_root, const tree& node);
+        static void drop_descendant_handles(tree& tree_root, const tree& node);
+        
+        inline static std::atomic<node_id>          id_counter_{ no_node_id };
         
-        tree_string       content_;
-        std::vector<tree> children_;
+        tree_string                         content_;
+        std::vector<std::shared_ptr<tree>>  children_;  /* children may be shared with copies made by make_copy, so they
+                                                         * must be unshared before being modified (see get_node) */
+        std::unique_ptr<lazy_range>         lazy_;      /* only set for unmaterialized nodes */
+        std::unique_ptr<handle_table>       handles_;   /* only set for the root, once a node has been found by ID */
+        node_id                             id_{ next_id() };
+        bool                                folded_{ false };
     };
     
     
@@ -124,6 +236,9 @@ namespace treenote::core
     [[nodiscard]] indent_info get_indent_info_by_index(const tree& tree_root, const tree_index auto& ti, bool cont = false);
     [[nodiscard]] std::size_t get_tree_entry_depth(const tree_index auto& ti);
     
+    /* FNV-1a of data, continuing from hash; identifies the contents of a file written by tree::write */
+    [[nodiscard]] std::uint64_t content_hash(std::string_view data, std::uint64_t hash = content_hash_init) noexcept;
+    
     
     /* Implementation of inline functions */
     
@@ -139,7 +254,7 @@ namespace treenote::core
     
     [[nodiscard]] inline const auto& tree::get_child_const(const std::size_t i) const
     {
-        return children_[i];
+        return *children_[i];
     }
     
     [[nodiscard]] inline std::size_t tree::line_count() const
@@ -152,30 +267,81 @@ namespace treenote::core
         return children_.size();
     }
     
+    [[nodiscard]] inline bool tree::is_folded() const noexcept
+    {
+        return folded_;
+    }
+    
+    [[nodiscard]] inline node_id tree::id() const noexcept
+    {
+        return id_;
+    }
+    
+    [[nodiscard]] inline node_id tree::next_id() noexcept
+    {
+        return id_counter_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    
     inline void tree::add_line(const extended_piece_table_entry& input)
     {
         content_.add_line(input);
     }
     
-    inline void tree::unmove_node(tree& tree_root, const tree_index auto& dst, const tree_index auto& src)
+    [[nodiscard]] inline tree tree::make_copy(tree& tree_root, const tree_index auto& ti)
     {
-        tree::move_node(tree_root, dst, src);
+        /* copies the node at ti, which then shares its descendants with the copy (see make_copy(const tree&)) */
+        
+        const auto node{ get_const_by_index(tree_root, ti) };
+        
+        if (not node.has_value())
+            throw std::out_of_range{ "tree::make_copy: Can not locate node to copy" };
+        
+        drop_descendant_handles(tree_root, node->get());
+        return make_copy(node->get());
     }
     
     [[nodiscard]] inline auto tree::get_node(tree& tree_root, const tree_index auto& ti)
     -> std::optional<std::reference_wrapper<tree>>
     {
+        /* note: nodes on the path to ti which are shared with a copy are replaced by their own copies (which only
+         *       copies the path, since their children remain shared), so references to those nodes are invalidated */
+        
         tree* current{ &tree_root };
         for (const auto& index: ti)
         {
             if (index >= current->child_count())
                 return std::nullopt;
             else
-                current = &(current->children_[index]);
+                current = &unshare(current->children_[index]);
         }
         return { *current };
     }
     
+    [[nodiscard]] inline auto tree::get_node(tree& tree_root, node_id& id, const tree_index auto& ti)
+    -> std::optional<std::reference_wrapper<tree>>
+    {
+        /* finds the node with the given ID in the handle table, or else at ti (as above), in which case it is added to
+         * the table; if id is no_node_id, it is set to the ID of the node at ti, so that it can be found by ID later */
+        
+        if (id == tree_root.id_)
+            return { tree_root };
+        else if (tree* node{ find_handle(tree_root, id) }; node != nullptr)
+            return { *node };
+        
+        auto result{ get_node(tree_root, ti) };
+        
+        if (result.has_value())
+        {
+            if (id == no_node_id)
+                id = result->get().id_;
+            else if (id != result->get().id_)
+                return std::nullopt;
+            
+            set_handle(tree_root, result->get());
+        }
+        return result;
+    }
+    
     [[nodiscard]] inline auto tree::get_editable_tree_string(tree& tree_root, const tree_index auto& ti)
             -> std::optional<std::reference_wrapper<tree_string>>
     {
@@ -186,6 +352,24 @@ namespace treenote::core
             return {};
     }
     
+    [[nodiscard]] inline auto tree::get_editable_tree_string(tree& tree_root, node_id id, const tree_index auto& ti)
+            -> std::optional<std::reference_wrapper<tree_string>>
+    {
+        auto tmp{ tree::get_node(tree_root, id, ti) };
+        if (tmp.has_value())
+            return { tmp->get().content_ };
+        else
+            return {};
+    }
+    
+    inline bool tree::set_folded(tree& tree_root, const tree_index auto& ti, const bool folded)
+    {
+        auto tmp{ tree::get_node(tree_root, ti) };
+        if (tmp.has_value())
+            tmp->get().folded_ = folded;
+        return tmp.has_value();
+    }
+    
     
     
     
@@ -287,4 +471,12 @@ namespace treenote::core
     {
         return std::ranges::size(ti);
     }
+    
+    inline std::uint64_t content_hash(const std::string_view data, std::uint64_t hash) noexcept
+    {
+        for (const char c : data)
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211u;
+        
+        return hash;
+    }
 }
\ No newline at end of file
@@ -37,6 +37,7 @@ namespace treenote::core
         delete_text,
         line_break,
         line_join,
+        replace_text,
         
         error
     };
@@ -23,6 +23,9 @@
 #include <algorithm>
 #include <limits>
 
+#include "journal.hpp"
+#include "text_index.hpp"
+
 namespace treenote::core
 {
     namespace detail
@@ -33,16 +36,122 @@ namespace treenote::core
             struct overload : Ts ... { using Ts::operator()...; };
             
             constexpr std::size_t max_hist_size_{ std::numeric_limits<std::ptrdiff_t>::max() };
+            
+            std::size_t command_memory(const tree& tree_root, const command& cmd, const std::uint64_t serial)
+            {
+                /* estimates the memory held by cmd just after it has been executed, including the nodes it holds (or will
+                 * hold once undone) and the commands made by tree_strings after serial                                   */
+                
+                const auto index_memory{ [](const std::vector<std::size_t>& index) {
+                    return index.capacity() * sizeof(std::size_t);
+                } };
+                
+                const auto node_memory{ [&](const std::vector<std::size_t>& pos) {
+                    return get_const_by_index(tree_root, pos).transform([](const tree& t) { return tree::memory_usage(t); }).value_or(0);
+                } };
+                
+                return std::visit(overload{
+                        [&](const cmd::move_node& c) { return index_memory(c.src) + index_memory(c.dst); },
+                        [&](const cmd::edit_contents& c)
+                        {
+                            return index_memory(c.pos) + get_const_by_index(tree_root, c.pos).transform([&](const tree& t) {
+                                return t.get_content_const().history_memory_since(serial);
+                            }).value_or(0);
+                        },
+                        [&](const cmd::insert_node& c)
+                        {
+                            return index_memory(c.pos) + (c.inserted ? tree::memory_usage(*c.inserted) : node_memory(c.pos));
+                        },
+                        [&](const cmd::delete_node& c)
+                        {
+                            return index_memory(c.pos) + (c.deleted ? tree::memory_usage(*c.deleted) : 0);
+                        },
+                        [&](const cmd::multi_cmd& cs)
+                        {
+                            std::size_t result{ cs.commands.capacity() * sizeof(command) };
+                            for (const auto& c : cs.commands)
+                                result += command_memory(tree_root, c, serial);
+                            return result;
+                        }
+                }, cmd);
+            }
+            
+            void collect_tree_strings(command& cmd, std::unordered_set<tree_string*>& result)
+            {
+                /* nodes are held by insert_node and delete_node while they are not part of the tree */
+                
+                std::visit(overload{
+                        [&](cmd::insert_node& c) { if (c.inserted) tree::collect_tree_strings(*c.inserted, result); },
+                        [&](cmd::delete_node& c) { if (c.deleted) tree::collect_tree_strings(*c.deleted, result); },
+                        [&](cmd::multi_cmd& cs) { for (auto& c : cs.commands) collect_tree_strings(c, result); },
+                        [](auto&) { }
+                }, cmd);
+            }
         }
     }
     
     
-    operation_stack::return_t operation_stack::undo(tree& tree_root)
+    void operation_stack::invoke(tree& tree_root, command& cmd, const bool reverse, const invoke_hook& hook)
+    {
+        if (journal_ == nullptr and text_index_ == nullptr and not hook)
+        {
+            if (reverse)
+                tree::invoke_reverse(tree_root, cmd);
+            else
+                tree::invoke(tree_root, cmd);
+        }
+        else if (auto* multi{ std::get_if<cmd::multi_cmd>(&cmd) })
+        {
+            /* the commands are recorded one at a time, as each may change the nodes which the next refers to */
+            
+            if (reverse)
+                for (auto& c : multi->commands | std::views::reverse)
+                    invoke(tree_root, c, reverse, hook);
+            else
+                for (auto& c : multi->commands)
+                    invoke(tree_root, c, reverse, hook);
+        }
+        else
+        {
+            const bool is_edit{ std::holds_alternative<cmd::edit_contents>(cmd) };
+            const bool was_complete{ text_index_ != nullptr and text_index_->complete() };
+            
+            if (journal_ != nullptr and not is_edit)
+                journal_->record_command(tree_root, cmd, reverse);
+            
+            if (reverse)
+                tree::invoke_reverse(tree_root, cmd);
+            else
+                tree::invoke(tree_root, cmd);
+            
+            if (journal_ != nullptr and is_edit)
+                journal_->record_command(tree_root, cmd, reverse);
+            
+            if (text_index_ != nullptr)
+                text_index_->update(tree_root, cmd, reverse, was_complete);
+            
+            if (hook)
+                hook(cmd, reverse);
+        }
+    }
+    
+    void operation_stack::record_edit(const tree& tree_root, const command& cmd)
+    {
+        /* the text has changed already, so the index is no longer complete (until a search has looked at every node) */
+        
+        if (journal_ != nullptr)
+            journal_->record_command(tree_root, cmd, false);
+        
+        if (text_index_ != nullptr)
+            text_index_->update(tree_root, cmd, false, false);
+    }
+    
+    operation_stack::return_t operation_stack::undo(tree& tree_root, const invoke_hook& hook)
     {
         if (position_ != 0)
         {
             --position_;
-            tree::invoke_reverse(tree_root, cmd_hist_[position_].cmd);
+            invoke(tree_root, cmd_hist_[position_].cmd, true, hook);
             return { 0, cmd_hist_[position_].before };
         }
         else
@@ -51,11 +160,11 @@ namespace treenote::core
         }
     }
     
-    operation_stack::return_t operation_stack::redo(tree& tree_root)
+    operation_stack::return_t operation_stack::redo(tree& tree_root, const invoke_hook& hook)
     {
         if (position_ < cmd_hist_.size())
         {
-            tree::invoke(tree_root, cmd_hist_[position_].cmd);
+            invoke(tree_root, cmd_hist_[position_].cmd, false, hook);
             ++position_;
             return { 0, cmd_hist_[position_ - 1].after };
         }
@@ -69,6 +178,7 @@ namespace treenote::core
     {
         clean();
         
+        const std::uint64_t prev_serial{ cmd_hist_.empty() ? 0 : cmd_hist_.back().serial };
         cmd_hist_.emplace_back(std::move(cmd), std::make_optional(std::move(pos_before)), std::nullopt);
         
         /* since edit_contents is a placeholder command to tell a specific tree_string to undo/redo a pt_cmd,
@@ -78,12 +188,27 @@ namespace treenote::core
             ++position_;
         else
             redo(tree_root);
+        
+        auto& elem{ cmd_hist_.back() };
+        elem.serial = tree_string::last_serial();
+        elem.memory = sizeof(stack_elem) + detail::command_memory(tree_root, elem.cmd, prev_serial);
+        memory_usage_ += elem.memory;
+        
+        enforce_memory_budget(tree_root);
     }
     
     void operation_stack::append_multi(tree& tree_root, command&& cmd)
     {
         clean();
-        tree::invoke(tree_root, cmd);
+        
+        /* as in exec, the edit denoted by edit_contents has been executed already, so it is only recorded */
+        
+        if (not std::holds_alternative<cmd::edit_contents>(cmd))
+            invoke(tree_root, cmd, false);
+        else if (journal_ != nullptr or text_index_ != nullptr)
+            record_edit(tree_root, cmd);
+        
+        const std::size_t memory{ detail::command_memory(tree_root, cmd, cmd_hist_.back().serial) };
         
         if (std::holds_alternative<cmd::multi_cmd>(cmd_hist_.back().cmd))
         {
@@ -97,10 +222,25 @@ namespace treenote::core
             multi.commands.push_back(std::move(cmd));
             
             cursor_pos_opt before{ std::move(cmd_hist_.back().before )};
+            const std::uint64_t serial{ cmd_hist_.back().serial };
+            const std::size_t prev_memory{ cmd_hist_.back().memory };
             
             cmd_hist_.pop_back();
-            cmd_hist_.emplace_back(std::move(multi), std::move(before), std::nullopt);
+            cmd_hist_.emplace_back(std::move(multi), std::move(before), std::nullopt, serial, prev_memory);
         }
+        
+        auto& elem{ cmd_hist_.back() };
+        elem.serial = tree_string::last_serial();
+        elem.memory += memory;
+        memory_usage_ += memory;
+        
+        enforce_memory_budget(tree_root);
+    }
+    
+    void operation_stack::set_memory_budget(tree& tree_root, const std::size_t budget)
+    {
+        memory_budget_ = budget;
+        enforce_memory_budget(tree_root);
     }
     
     cmd_names operation_stack::get_current_cmd_name(const tree& tree_root) const
@@ -110,6 +250,9 @@ namespace treenote::core
         
         const command* cmd_ptr{ &(cmd_hist_[position_ - 1].cmd) };
         
+        if (const auto* multi{ std::get_if<cmd::multi_cmd>(cmd_ptr) }; multi != nullptr and multi->is_replace)
+            return cmd_names::replace_text;
+        
         while (std::holds_alternative<cmd::multi_cmd>(*cmd_ptr))
         {
              const cmd::multi_cmd& multi{ std::get<cmd::multi_cmd>(*cmd_ptr) };
@@ -152,13 +295,29 @@ namespace treenote::core
         }, *cmd_ptr);
     }
     
+    void operation_stack::collect_tree_strings(std::unordered_set<tree_string*>& result)
+    {
+        for (auto& elem : cmd_hist_)
+            detail::collect_tree_strings(elem.cmd, result);
+    }
+    
     void operation_stack::clean()
     {
         if (position_ < cmd_hist_.size())
         {
             /* clear commands in cmd_hist_ after current */
+            for (const auto& elem : cmd_hist_ | std::views::drop(position_))
+                memory_usage_ -= elem.memory;
+            
             cmd_hist_.erase(std::ranges::begin(cmd_hist_) + static_cast<std::ptrdiff_t>(position_), std::ranges::end(cmd_hist_));
             cmd_hist_.shrink_to_fit();
+            
+            /* saved positions after current can no longer be reached */
+            for (auto* pos : { &position_at_last_save_, &position_of_pending_save_ })
+            {
+                if (*pos != no_position and *pos > position_)
+                    *pos = no_position;
+            }
         }
         else if (position_ == cmd_hist_.size())
         {
@@ -167,11 +326,7 @@ namespace treenote::core
             if (position_ == detail::max_hist_size_)
             {
                 /* cmd_hist_ is too big, reduce size of cmd_hist_ by 50% */
-                std::vector<stack_elem> tmp{};
-                auto range{ cmd_hist_ | std::views::drop(position_ / 2) };
-                tmp.reserve(std::ranges::size(range));
-                std::ranges::move(range, std::back_inserter(tmp));
-                cmd_hist_ = std::move(tmp);
+                drop_oldest(position_ / 2);
             }
         }
         else
@@ -179,4 +334,56 @@ namespace treenote::core
             throw std::runtime_error("Illegal position in tree_op");
         }
     }
+    
+    void operation_stack::drop_oldest(const std::size_t count)
+    {
+        /* assume: count <= position_ */
+        
+        for (const auto& elem : cmd_hist_ | std::views::take(count))
+            memory_usage_ -= elem.memory;
+        
+        std::vector<stack_elem> tmp{};
+        auto range{ cmd_hist_ | std::views::drop(count) };
+        tmp.reserve(std::ranges::size(range));
+        std::ranges::move(range, std::back_inserter(tmp));
+        cmd_hist_ = std::move(tmp);
+        
+        /* positions are relative to the start of cmd_hist_, so they must be shifted too */
+        position_ -= count;
+        
+        for (auto* pos : { &position_at_last_save_, &position_of_pending_save_ })
+        {
+            if (*pos != no_position)
+                *pos = (*pos >= count) ? *pos - count : no_position;
+        }
+    }
+    
+    void operation_stack::enforce_memory_budget(tree& tree_root)
+    {
+        if (memory_usage_ <= memory_budget_)
+            return;
+        
+        /* discarding the history of each tree_string visits every node, so discard enough for a quarter of the budget */
+        
+        const std::size_t target{ memory_budget_ / 4 * 3 };
+        std::size_t count{ 0 };
+        std::size_t remaining{ memory_usage_ };
+        
+        /* the most recent command done is always kept, as text input may still be added to it */
+        while (count + 1 < position_ and remaining > target)
+            remaining -= cmd_hist_[count++].memory;
+        
+        if (count == 0)
+            return;
+        
+        const std::uint64_t serial{ cmd_hist_[count - 1].serial };
+        drop_oldest(count);
+        
+        std::unordered_set<tree_string*> strings{};
+        tree::collect_tree_strings(tree_root, strings);
+        collect_tree_strings(strings);
+        
+        for (auto* s : strings)
+            s->discard_history_through(serial);
+    }
 }
\ No newline at end of file
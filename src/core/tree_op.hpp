@@ -20,6 +20,9 @@
 
 #pragma once
 
+#include <cstdint>
+#include <functional>
+#include <limits>
 #include <vector>
 
 #include "tree.hpp"
@@ -27,17 +30,28 @@
 
 namespace treenote::core
 {
+    class journal;
+    class text_index;
+    
     namespace cmd
     {
+        /* Each command stores the tree index of the nodes it refers to (for the cache, journal and text index), and
+         * also their IDs, so that they can be found from the handle table of tree_root when the command is undone
+         * or redone (see tree::get_node). The IDs are left as no_node_id when making a command, and are filled in
+         * the first time it is invoked.                                                                          */
+        
         struct move_node
         {
             std::vector<std::size_t>    src;
             std::vector<std::size_t>    dst;
+            node_id                     src_parent{ no_node_id };
+            node_id                     dst_parent{ no_node_id };
         };
         
         struct edit_contents
         {
             std::vector<std::size_t>    pos;
+            node_id                     id{ no_node_id };
             /* the actual edit command is stored and executed in tree_string
              * this command just stores the location of the node containing that tree_string */
         };
@@ -47,6 +61,7 @@ namespace treenote::core
             std::vector<std::size_t>    pos;
             std::optional<tree>         inserted;
             bool                        is_paste{ false };
+            node_id                     parent{ no_node_id };
         };
         
         struct delete_node
@@ -54,11 +69,13 @@ namespace treenote::core
             std::vector<std::size_t>    pos;
             std::optional<tree>         deleted;
             bool                        is_cut{ false };
+            node_id                     parent{ no_node_id };
         };
         
         struct multi_cmd
         {
             std::vector<command>        commands;
+            bool                        is_replace{ false };
         };
     }
     
@@ -68,31 +85,71 @@ namespace treenote::core
         using cursor_pos = std::pair<std::size_t, std::size_t>;
         using cursor_pos_opt = std::optional<cursor_pos>;
         using return_t = std::pair<int, const cursor_pos_opt&>;
+        using invoke_hook = std::function<void(const command&, bool)>;
         
         struct stack_elem
         {
             command         cmd;
             cursor_pos_opt  before;
             cursor_pos_opt  after;
+            std::uint64_t   serial{ 0 };    /* tree_string::last_serial() once cmd was made */
+            std::size_t     memory{ 0 };    /* estimated when cmd was made (see command_memory in tree_op.cpp) */
         };
+        
+        static constexpr std::size_t default_memory_budget{ std::size_t{ 64 } << 20 };
     
         constexpr operation_stack() = default;
-        return_t undo(tree& tree_root);
-        return_t redo(tree& tree_root);
+        /* hook (if set) is called after each single command (rather than a multi_cmd) has been undone or redone, as
+         * the tree indices of the commands in a multi_cmd refer to the state of the tree in between them            */
+        return_t undo(tree& tree_root, const invoke_hook& hook = {});
+        return_t redo(tree& tree_root, const invoke_hook& hook = {});
         void exec(tree& tree_root, command&& cmd, cursor_pos&& pos_before);
-        void append_multi(tree& tree_root, command&& cmd);
+        void append_multi(tree& tree_root, command&& cmd);     /* an edit_contents must already be executed, as for exec */
         void set_after_pos(cursor_pos&& pos_after);
         void set_position_of_save() noexcept;
+        void clear_position_of_save() noexcept;
+        void begin_save() noexcept;
+        void end_save() noexcept;
         
         [[nodiscard]] bool file_is_modified() const noexcept;
         [[nodiscard]] cmd_names get_current_cmd_name(const tree& tree_root) const;
+        [[nodiscard]] const command* get_current_cmd() const noexcept;
+        [[nodiscard]] const command* get_next_cmd() const noexcept;
+        
+        /* adds the content of every node held by a command in the history to result (see tree::collect_tree_strings) */
+        void collect_tree_strings(std::unordered_set<tree_string*>& result);
+        
+        /* memory budget: once the estimated memory used by the history (including the history of each tree_string)
+         * exceeds the budget, the oldest commands which have been done are discarded                               */
+        
+        void set_memory_budget(tree& tree_root, std::size_t budget);
+        [[nodiscard]] std::size_t memory_usage() const noexcept;
+        
+        /* every command invoked (including by undo and redo) is recorded in the journal, if it is not null */
+        void set_journal(journal* j) noexcept;
+        
+        /* likewise, the text of every node inserted or changed by a command is added to the index, if it is not null */
+        void set_text_index(text_index* ti) noexcept;
         
     private:
+        void invoke(tree& tree_root, command& cmd, bool reverse, const invoke_hook& hook = {});
+        void record_edit(const tree& tree_root, const command& cmd);
         void clean();
+        void drop_oldest(std::size_t count);
+        void enforce_memory_budget(tree& tree_root);
         
         std::vector<stack_elem>             cmd_hist_;
+        static constexpr std::size_t        no_position{ std::numeric_limits<std::size_t>::max() };
+        
         std::size_t                         position_{ 0 }; /* defined as (index of the current command position in tree_ref_) + 1 */
         std::size_t                         position_at_last_save_{ 0 };
+        std::size_t                         position_of_pending_save_{ no_position };
+        
+        std::size_t                         memory_budget_{ default_memory_budget };
+        std::size_t                         memory_usage_{ 0 };
+        
+        journal*                            journal_{ nullptr };    /* non owning */
+        text_index*                         text_index_{ nullptr }; /* non owning */
         
         static constexpr cursor_pos_opt     empty_cursor_pos{};
     };
@@ -106,6 +163,21 @@ namespace treenote::core
             cmd_hist_.back().after.emplace(std::move(pos_after));
     }
     
+    inline std::size_t operation_stack::memory_usage() const noexcept
+    {
+        return memory_usage_;
+    }
+    
+    inline void operation_stack::set_journal(journal* j) noexcept
+    {
+        journal_ = j;
+    }
+    
+    inline void operation_stack::set_text_index(text_index* ti) noexcept
+    {
+        text_index_ = ti;
+    }
+    
     inline bool operation_stack::file_is_modified() const noexcept
     {
         return position_ != position_at_last_save_;
@@ -115,4 +187,42 @@ namespace treenote::core
     {
         position_at_last_save_ = position_;
     }
+    
+    /* marks the file as modified at every position (e.g. as the tree differs from the file as loaded) */
+    inline void operation_stack::clear_position_of_save() noexcept
+    {
+        position_at_last_save_ = no_position;
+    }
+    
+    /* records the current position as the one being written by a save that completes later (see end_save) */
+    inline void operation_stack::begin_save() noexcept
+    {
+        position_of_pending_save_ = position_;
+    }
+    
+    /* marks the position recorded by begin_save as saved; if the history has since been discarded past that
+     * position, the file will be treated as modified until the next save */
+    inline void operation_stack::end_save() noexcept
+    {
+        position_at_last_save_ = position_of_pending_save_;
+        position_of_pending_save_ = no_position;
+    }
+    
+    /* returns the command most recently executed or redone (or nullptr if there is none) */
+    inline const command* operation_stack::get_current_cmd() const noexcept
+    {
+        if (position_ != 0)
+            return &(cmd_hist_[position_ - 1].cmd);
+        else
+            return nullptr;
+    }
+    
+    /* returns the command most recently undone (or nullptr if there is none) */
+    inline const command* operation_stack::get_next_cmd() const noexcept
+    {
+        if (position_ < cmd_hist_.size())
+            return &(cmd_hist_[position_].cmd);
+        else
+            return nullptr;
+    }
 }
\ No newline at end of file
@@ -23,10 +23,12 @@
 #include <algorithm>
 #include <functional>
 #include <limits>
-#include <numeric>
 #include <ranges>
 #include <stdexcept>
 
+#include "line_scan.hpp"
+#include "utf8.hpp"
+
 namespace treenote::core
 {
     /* Implementation helpers */
@@ -40,36 +42,30 @@ namespace treenote::core
             
             constexpr std::size_t max_hist_size_{ std::numeric_limits<std::ptrdiff_t>::max() };
             
-            inline piece_table_entry& get_entry(piece_table_t& pt, const std::size_t line, const std::size_t entry_index)
-            {
-                /* assume: line < pt.size() and entry_index < pt[line].size() */
-                
-                return pt.at(line).at(entry_index);
-            }
+            using line_table = std::vector<piece_tree>;
             
-            tree_string::opt_idx_pair entry_index_within_table_line(const piece_table_line& line, const std::size_t pos)
+            void update_entry(line_table& pt, const std::size_t line, const std::size_t entry_index, const auto& fn,
+                              const std::size_t display_amt, const std::size_t byte_amt)
             {
-                for (std::size_t i{ 0 }, accumulated_len{ 0 }; i < line.size(); ++i)
-                {
-                    if (pos >= accumulated_len and pos < accumulated_len + line[i].display_length)
-                        return std::make_optional<tree_string::opt_idx_pair::value_type>(i, pos - accumulated_len);
-                    
-                    accumulated_len += line[i].display_length;
-                }
+                /* applies fn(entry, display_amt, byte_amt) to a copy of the entry, then writes it back so that sums are updated
+                 * assume: line < pt.size() and entry_index < pt[line].size()                                                    */
                 
-                return {}; /* pos probably refers to the space at the end of line */
+                auto& table_line{ pt.at(line) };
+                piece_table_entry entry{ table_line.at(entry_index) };
+                fn(entry, display_amt, byte_amt);
+                table_line.replace(entry_index, entry);
             }
             
-            inline pt_cmd::delete_entry::merge_info make_merge_info(piece_table_t& pt, const std::size_t line, const std::size_t entry_index)
+            inline pt_cmd::delete_entry::merge_info make_merge_info(line_table& pt, const std::size_t line, const std::size_t entry_index)
             {
-                auto& table_line{ pt.at(line) };
+                const auto& table_line{ pt.at(line) };
                 
                 /* check if entry to be deleted is at start or end of line (where no merging is possible) */
                 if (entry_index == 0 or entry_index == table_line.size() - 1)
                     return {};
                 
-                auto& before{ table_line[entry_index - 1] };
-                auto& after{ table_line[entry_index + 1] };
+                const auto& before{ table_line.at(entry_index - 1) };
+                const auto& after{ table_line.at(entry_index + 1) };
                 
                 /* check if merging will take place */
                 if (before.start_index + before.byte_length == after.start_index)
@@ -110,151 +106,97 @@ namespace treenote::core
                 entry.byte_length += byte_amt;
             }
             
-            void insert_entry_naive(piece_table_t& pt, const std::size_t line, const std::size_t entry_index, const piece_table_entry& entry)
+            void insert_entry_naive(line_table& pt, const std::size_t line, const std::size_t entry_index, const piece_table_entry& entry)
             {
-                auto& table_line{ pt.at(line) };
-                table_line.insert(std::ranges::begin(table_line) + static_cast<ptrdiff_t>(entry_index), entry);
+                pt.at(line).insert(entry_index, entry);
             }
             
-            void delete_entry_and_merge(piece_table_t& pt, const std::size_t line, const std::size_t entry_index)
+            void delete_entry_and_merge(line_table& pt, const std::size_t line, const std::size_t entry_index)
             {
                 auto& table_line{ pt.at(line) };
-                bool erase_entry_after_pos{ false };
                 
                 /* attempt to merge entries from before */
                 if (entry_index > 0 and entry_index + 1 < table_line.size())
                 {
-                    auto& before{ table_line[entry_index - 1] };
-                    auto& after{ table_line[entry_index + 1] };
+                    const piece_table_entry before{ table_line.at(entry_index - 1) };
+                    const piece_table_entry after{ table_line.at(entry_index + 1) };
                     
                     if (before.start_index + before.byte_length == after.start_index)
                     {
                         /* merge back table_entry of first line and front table entry of second line if adjacent */
-                        before.display_length += after.display_length;
-                        before.byte_length += after.byte_length;
-                        erase_entry_after_pos = true;
+                        table_line.replace(entry_index - 1, { .start_index = before.start_index,
+                                                              .display_length = before.display_length + after.display_length,
+                                                              .byte_length = before.byte_length + after.byte_length });
+                        table_line.erase(entry_index + 1);
                     }
                 }
-
-                const auto erase_pos{ std::ranges::begin(table_line) + static_cast<ptrdiff_t>(entry_index) };
                 
-                if (erase_entry_after_pos)
-                    table_line.erase(erase_pos, erase_pos + 2);
-                else
-                    table_line.erase(erase_pos);
+                table_line.erase(entry_index);
             }
             
-            void split_entry_remove_inside(piece_table_t& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t original_entry_index, const std::size_t l_boundary_pos, const std::size_t r_boundary_pos)
+            void split_entry_remove_inside(line_table& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t original_entry_index, const std::size_t l_boundary_pos, const std::size_t r_boundary_pos)
             {
                 /* assume: l_boundary_pos <= r_boundary_pos and r_boundary_pos < pt.at(line).at(original_entry_index).display_length
                  * note: if l_boundary_pos == 0, then shrink_lhs should be called instead of this                                   */
                 
                 auto& table_line{ pt.at(line) };
-                auto& original{ table_line.at(original_entry_index) };
-                
-                std::size_t left_bytes{ l_boundary_pos };
-                std::size_t skipped_bytes{ r_boundary_pos };
+                const piece_table_entry original{ table_line.at(original_entry_index) };
                 
-                if (not entry_has_no_mb_char(original))
-                {
-                    /* string fragment contains multibyte characters: proceed carefully */
-                    
-                    auto buf_begin{ std::ranges::cbegin(*buffer_ptr) + static_cast<std::ptrdiff_t>(original.start_index) };
-                    const auto buf_end{ buf_begin + static_cast<std::ptrdiff_t>(original.byte_length) };
-                    
-                    std::string tmp{};
-                    std::size_t skipped{ 0 };
-                    left_bytes = 0;
-                    
-                    for (; skipped < l_boundary_pos; ++skipped)
-                    {
-                        utf8::str_it_get_ext(buf_begin, buf_end, tmp);
-                        left_bytes += tmp.size();
-                    }
-                    
-                    skipped_bytes = left_bytes;
-                    
-                    for (; skipped < r_boundary_pos; ++skipped)
-                    {
-                        utf8::str_it_get_ext(buf_begin, buf_end, tmp);
-                        skipped_bytes += tmp.size();
-                    }
-                }
+                const std::size_t left_bytes{ buffer_ptr->byte_offset_of_char(original, l_boundary_pos) };
+                const std::size_t skipped_bytes{ buffer_ptr->byte_offset_of_char(original, r_boundary_pos) };
                 
                 const piece_table_entry right{ .start_index = original.start_index + skipped_bytes,
                                                .display_length = original.display_length - r_boundary_pos,
                                                .byte_length = original.byte_length - skipped_bytes };
                 
-                original.display_length = l_boundary_pos;
-                original.byte_length = left_bytes;
-
-                const auto insert_pos{ std::ranges::begin(table_line) + static_cast<ptrdiff_t>(original_entry_index) + 1 };
-                table_line.insert(insert_pos, right);
+                table_line.replace(original_entry_index, { .start_index = original.start_index,
+                                                           .display_length = l_boundary_pos,
+                                                           .byte_length = left_bytes });
+                table_line.insert(original_entry_index + 1, right);
             }
             
-            void undo_split_entry_remove_inside(piece_table_t& pt, const std::size_t line, const std::size_t original_entry_index, const std::size_t r_boundary_pos)
+            void undo_split_entry_remove_inside(line_table& pt, const std::size_t line, const std::size_t original_entry_index, const std::size_t r_boundary_pos)
             {
                 /* assume: pt.at(line).size() > 1 and original_entry_index < (pt.at(line).size() - 1) */
                 
                 auto& table_line{ pt.at(line) };
-                auto& original{ table_line.at(original_entry_index) };
-                auto& snd_half{ table_line.at(original_entry_index + 1) };
+                const piece_table_entry original{ table_line.at(original_entry_index) };
+                const piece_table_entry snd_half{ table_line.at(original_entry_index + 1) };
                 
                 /* assume: original.start_index + original.byte_length == snd_half.start_index
                  * this should be true since this function should only be called to undo a spit_entry_and_insert */
                 
-                original.display_length = r_boundary_pos + snd_half.display_length;
-                original.byte_length = (snd_half.start_index - original.start_index) + snd_half.byte_length;
-                
-                table_line.erase(std::ranges::begin(table_line) + static_cast<std::ptrdiff_t>(original_entry_index) + 1);
+                table_line.replace(original_entry_index, { .start_index = original.start_index,
+                                                           .display_length = r_boundary_pos + snd_half.display_length,
+                                                           .byte_length = (snd_half.start_index - original.start_index) + snd_half.byte_length });
+                table_line.erase(original_entry_index + 1);
             }
             
-            void split_entry_and_insert(piece_table_t& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t original_entry_index, const std::size_t pos_in_entry, const piece_table_entry& entry)
+            void split_entry_and_insert(line_table& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t original_entry_index, const std::size_t pos_in_entry, const piece_table_entry& entry)
             {
                 /* assume: pos_in_entry < pt.at(line).at(original_entry_index).display_length
                  * note: if pos_in_entry == 0 ,then insert_entry_naive should be called instead of this */
 
                 auto& table_line{ pt.at(line) };
-                auto& original{ table_line.at(original_entry_index) };
-                
-                std::size_t left_bytes{ 0 };
-                
-                if (entry_has_no_mb_char(original))
-                {
-                    left_bytes = pos_in_entry;
-                }
-                else
-                {
-                    /* string fragment contains multibyte characters: proceed carefully */
-                    
-                    auto buf_begin{ std::ranges::cbegin(*buffer_ptr) + static_cast<std::ptrdiff_t>(original.start_index) };
-                    const auto buf_end{ buf_begin + static_cast<std::ptrdiff_t>(original.byte_length) };
-                    
-                    std::string tmp{};
-                    
-                    for (std::size_t skipped{ 0 }; skipped < pos_in_entry; ++skipped)
-                    {
-                        utf8::str_it_get_ext(buf_begin, buf_end, tmp);
-                        left_bytes += tmp.size();
-                    }
-                }
+                const piece_table_entry original{ table_line.at(original_entry_index) };
+                const std::size_t left_bytes{ buffer_ptr->byte_offset_of_char(original, pos_in_entry) };
                 
-                std::vector to_insert{ entry };
-                to_insert.emplace_back(original.start_index + left_bytes, original.display_length - pos_in_entry, original.byte_length - left_bytes);
-                original.display_length = pos_in_entry;
-                original.byte_length = left_bytes;
-                
-                const auto insert_pos{ std::ranges::begin(table_line) + static_cast<ptrdiff_t>(original_entry_index) + 1 };
-                table_line.insert(insert_pos, std::ranges::begin(to_insert), std::ranges::end(to_insert));
+                table_line.replace(original_entry_index, { .start_index = original.start_index,
+                                                           .display_length = pos_in_entry,
+                                                           .byte_length = left_bytes });
+                table_line.insert(original_entry_index + 1, entry);
+                table_line.insert(original_entry_index + 2, { .start_index = original.start_index + left_bytes,
+                                                              .display_length = original.display_length - pos_in_entry,
+                                                              .byte_length = original.byte_length - left_bytes });
             }
             
-            void undo_split_entry_and_insert(piece_table_t& pt, const std::size_t line, const std::size_t original_entry_index)
+            void undo_split_entry_and_insert(line_table& pt, const std::size_t line, const std::size_t original_entry_index)
             {
                 /* basically a modified version of delete_entry, performing: delete_entry(pt, line, original_entry_index + 1) */
                 delete_entry_and_merge(pt, line, original_entry_index + 1);
             }
             
-            void undo_delete_entry_and_merge(piece_table_t& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t idx, const piece_table_entry& entry, const pt_cmd::delete_entry::merge_info& merge_pos)
+            void undo_delete_entry_and_merge(line_table& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t idx, const piece_table_entry& entry, const pt_cmd::delete_entry::merge_info& merge_pos)
             {
                 if (idx == 0 or not merge_pos.has_value())
                     insert_entry_naive(pt, line, idx, entry);
@@ -262,7 +204,7 @@ namespace treenote::core
                     split_entry_and_insert(pt, buffer_ptr, line, idx - 1, *merge_pos, entry);
             }
             
-            void split_lines(piece_table_t& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t pos)
+            void split_lines(line_table& pt, const buffer* buffer_ptr, const std::size_t line, const std::size_t pos)
             {
                 /* assume: line + 1 != 0 and line + 1 < pt.size()
                  * (no assumptions required on pos being valid)  */
@@ -278,75 +220,34 @@ namespace treenote::core
                     auto& fst{ pt.at(line) };
                     auto& snd{ pt.at(line + 1) };
                     
-                    if (not fst.empty())
+                    /* if pos is at or beyond the end of fst, nothing is moved */
+                    if (const auto split_point{ fst.find(pos) })
                     {
-                        std::size_t ignored_count{ 0 };
+                        auto [entry_index, pos_in_entry]{ *split_point };
                         
-                        auto fst_begin{ std::ranges::begin(fst) };
-                        const auto fst_end{ std::ranges::end(fst) };
-                        for (; fst_begin != fst_end; ++fst_begin)
+                        if (pos_in_entry > 0)
                         {
-                            if (ignored_count >= pos)
-                            {
-                                break;
-                            }
-                            else if (ignored_count + fst_begin->display_length > pos)
-                            {
-                                /* discard string fragment until we reach pos */
-                                
-                                std::size_t ignored_bytes{ 0 };
-                                std::size_t ignored_current{ 0 };
-                                
-                                if (fst_begin->display_length == fst_begin->byte_length)
-                                {
-                                    ignored_current = pos - ignored_count;
-                                    ignored_bytes = ignored_current;
-                                }
-                                else
-                                {
-                                    /* string fragment contains multibyte characters: proceed carefully */
-                                    
-                                    auto buf_begin{ std::ranges::cbegin(*buffer_ptr) + static_cast<std::ptrdiff_t>(fst_begin->start_index) };
-                                    const auto buf_end{buf_begin + static_cast<std::ptrdiff_t>(fst_begin->byte_length) };
-                                    
-                                    std::string tmp{};
-                                    const std::size_t to_ignore{ pos - ignored_count };
-                                    
-                                    while (ignored_current < to_ignore)
-                                    {
-                                        utf8::str_it_get_ext(buf_begin, buf_end, tmp);
-                                        ++ignored_current;
-                                        ignored_bytes += tmp.size();
-                                    }
-                                }
-                                
-                                /* now split final piece table entry into two */
-                                snd.emplace_back(fst_begin->start_index + ignored_bytes,
-                                                 fst_begin->display_length - ignored_current,
-                                                 fst_begin->byte_length - ignored_bytes);
-                                
-                                fst_begin->display_length = ignored_current;
-                                fst_begin->byte_length = ignored_bytes;
-                                
-                                
-                                ++fst_begin;
-                                break; /* otherwise set ignore_count to pos */
-                            }
-                            else
-                            {
-                                ignored_count += fst_begin->display_length;
-                            }
+                            /* split the piece table entry containing pos into two */
+                            
+                            const piece_table_entry original{ fst.at(entry_index) };
+                            const std::size_t left_bytes{ buffer_ptr->byte_offset_of_char(original, pos_in_entry) };
+                            
+                            fst.replace(entry_index, { .start_index = original.start_index,
+                                                       .display_length = pos_in_entry,
+                                                       .byte_length = left_bytes });
+                            fst.insert(entry_index + 1, { .start_index = original.start_index + left_bytes,
+                                                          .display_length = original.display_length - pos_in_entry,
+                                                          .byte_length = original.byte_length - left_bytes });
+                            ++entry_index;
                         }
                         
                         /* now move remainder of fst into snd */
-                        snd.reserve(snd.size() + std::ranges::distance(fst_begin, fst_end));
-                        std::move(fst_begin, fst_end, std::back_inserter(snd));
-                        fst.erase(fst_begin, fst_end);
+                        snd = fst.split_off(entry_index);
                     }
                 }
             }
             
-            void join_lines(piece_table_t& pt, const std::size_t line_after)
+            void join_lines(line_table& pt, const std::size_t line_after)
             {
                 /* line_after is the index of the joined line
                  * assume: line_after + 1 != 0 and line_after + 1 < pt.size() */
@@ -358,23 +259,19 @@ namespace treenote::core
                 {
                     if (not fst.empty())
                     {
-                        if (fst.back().start_index + fst.back().byte_length == snd.front().start_index)
+                        const piece_table_entry back{ fst.back() };
+                        const piece_table_entry front{ snd.front() };
+                        
+                        if (back.start_index + back.byte_length == front.start_index)
                         {
                             /* merge back table_entry of first line and front table entry of second line if adjacent */
-                            fst.back().display_length += snd.front().display_length;
-                            fst.back().byte_length += snd.front().byte_length;
-                            
-                            if (snd.size() > 1)
-                            {
-                                fst.reserve(fst.size() + std::ranges::size(snd) - 1);
-                                std::ranges::move(snd | std::views::drop(1), std::back_inserter(fst));
-                            }
-                        }
-                        else
-                        {
-                            fst.reserve(fst.size() + std::ranges::size(snd));
-                            std::ranges::move(snd, std::back_inserter(fst));
+                            fst.replace(fst.size() - 1, { .start_index = back.start_index,
+                                                          .display_length = back.display_length + front.display_length,
+                                                          .byte_length = back.byte_length + front.byte_length });
+                            snd.erase(0);
                         }
+                        
+                        fst.append(std::move(snd));
                     }
                     else
                     {
@@ -385,6 +282,69 @@ namespace treenote::core
                 pt.erase(std::ranges::begin(pt) + static_cast<std::ptrdiff_t>(line_after) + 1);
             }
             
+            void for_each_leaf_cmd(const table_command& tc, auto&& fn)
+            {
+                /* calls fn(c) for each command c within tc which is not a multi_cmd, in order of execution */
+                
+                if (const auto* multi{ std::get_if<pt_cmd::multi_cmd>(&tc) })
+                {
+                    for (const auto& c : multi->commands)
+                        for_each_leaf_cmd(c, fn);
+                }
+                else
+                {
+                    fn(tc);
+                }
+            }
+            
+            void for_each_changed_line(const table_command& tc, auto&& fn)
+            {
+                /* calls fn(line) for each line that may differ after tc is invoked (tc must not be a multi_cmd) */
+                
+                using namespace pt_cmd;
+                
+                std::visit(overload{
+                        [&](const line_break& c) { fn(c.line_before); fn(c.line_before + 1); },
+                        [&](const line_join& c) { fn(c.line_after); },
+                        [](const multi_cmd&) { throw std::logic_error("for_each_changed_line(): multi_cmd must be expanded"); },
+                        [&](const auto& c) { fn(c.line); }
+                }, tc);
+            }
+            
+            std::size_t command_memory(const table_command& tc)
+            {
+                /* the text removed by a command is included, since the history keeps it in the buffer */
+                
+                using namespace pt_cmd;
+                
+                return sizeof(table_command) + std::visit(overload{
+                        [](const split_delete& c) { return c.r_boundary_pos - c.l_boundary_pos; },
+                        [](const shrink_rhs& c) { return c.byte_amt; },
+                        [](const shrink_lhs& c) { return c.byte_amt; },
+                        [](const delete_entry& c) { return c.deleted.byte_length; },
+                        [](const multi_cmd& cs)
+                        {
+                            std::size_t result{ 0 };
+                            for (const auto& c : cs.commands)
+                                result += command_memory(c);
+                            return result;
+                        },
+                        [](const auto&) { return std::size_t{ 0 }; }
+                }, tc);
+            }
+            
+            void relocate_cmd(table_command& tc, const buffer::relocation& reloc)
+            {
+                using namespace pt_cmd;
+                
+                std::visit(overload{
+                        [&](split_insert& c) { c.inserted.start_index = reloc(c.inserted.start_index); },
+                        [&](insert_entry& c) { c.inserted.start_index = reloc(c.inserted.start_index); },
+                        [&](delete_entry& c) { c.deleted.start_index = reloc(c.deleted.start_index); },
+                        [&](multi_cmd& cs) { for (auto& c : cs.commands) relocate_cmd(c, reloc); },
+                        [](auto&) { /* refers to entries only by position */ }
+                }, tc);
+            }
         }
     }
     
@@ -400,10 +360,11 @@ namespace treenote::core
     tree_string::tree_string(const extended_piece_table_entry& input) :
             buffer_ptr_{ input.second }
     {
+        restamp();
         piece_table_vec_.emplace_back();
         
         if (input.first.display_length > 0)
-            piece_table_vec_.back().emplace_back(input.first);
+            piece_table_vec_.back().push_back(input.first);
     }
     
     
@@ -416,10 +377,11 @@ namespace treenote::core
         else if (buffer_ptr_ != more_input.second)
             throw std::logic_error("table_string cannot contain entries from more than one note_buffer");
         
+        restamp();
         piece_table_vec_.emplace_back();
         
         if (more_input.first.display_length > 0)
-            piece_table_vec_.back().emplace_back(more_input.first);
+            piece_table_vec_.back().push_back(more_input.first);
     }
     
     
@@ -431,6 +393,18 @@ namespace treenote::core
         tree_string result{};
         result.piece_table_vec_ = piece_table_vec_;
         result.buffer_ptr_ = buffer_ptr_;
+        result.stamp_ = stamp_;
+        return result;
+    }
+    
+    tree_string tree_string::make_copy_with_history() const
+    {
+        /* like make_copy, but the copy can undo and redo the same edits (the copy is never current, however) */
+        
+        tree_string result{ make_copy() };
+        result.piece_table_hist_ = piece_table_hist_;
+        result.piece_table_hist_serials_ = piece_table_hist_serials_;
+        result.piece_table_hist_pos_ = piece_table_hist_pos_;
         return result;
     }
     
@@ -444,6 +418,9 @@ namespace treenote::core
         else if (buffer_ptr_ != ext_inserted.second)
             throw std::logic_error("tree_string::insert_str(): table_string cannot contain entries from more than one note_buffer");
         
+        /* edits merged into the last command change the text without invoking one, so the stamp is replaced here too */
+        restamp();
+        
         const auto& inserted{ ext_inserted.first };
         
         /* precondition: str does not contain newlines */
@@ -471,23 +448,18 @@ namespace treenote::core
         
         if (token_.check(pt_cmd_type::insertion, line, pos) and not piece_table_hist_.empty())
         {
-            /* identify previously inserted-into piece table entry */
+            /* identify previously inserted-into piece table entry (i.e. the entry ending at pos) */
             
-            for (std::size_t entry_idx{ 0 }, sum_pos{ 0 }; entry_idx < piece_table_vec_[line].size(); ++entry_idx)
+            if (pos > 0)
             {
-                const auto& entry{ piece_table_vec_[line][entry_idx] };
-                
-                sum_pos += entry.display_length;
+                const auto& table_line{ piece_table_vec_[line] };
                 
-                if (pos < sum_pos)
+                if (const auto before_pos{ table_line.find(pos - 1) })
                 {
-                    break;
-                }
-                else if (pos == sum_pos)
-                {
-                    if (entry.start_index + entry.byte_length == inserted.start_index)
-                        merge_insert_entry_idx = entry_idx;
-                    break;
+                    const auto& entry{ table_line.at(before_pos->first) };
+                    
+                    if (before_pos->second + 1 == entry.display_length and entry.start_index + entry.byte_length == inserted.start_index)
+                        merge_insert_entry_idx = before_pos->first;
                 }
             }
             
@@ -549,8 +521,7 @@ namespace treenote::core
         if (merge_insert_entry_idx)
         {
             /* alter piece table entry and hist */
-            auto& entry{ piece_table_vec_[line][*merge_insert_entry_idx] };
-            detail::grow_entry_rhs(entry, inserted.display_length, inserted.byte_length);
+            detail::update_entry(piece_table_vec_, line, *merge_insert_entry_idx, detail::grow_entry_rhs, inserted.display_length, inserted.byte_length);
         }
         else if (pos == 0)
         {
@@ -559,44 +530,37 @@ namespace treenote::core
                                                       .entry_index = 0,
                                                       .inserted = inserted } });
         }
-        else
+        else if (const auto& table_line{ piece_table_vec_[line] }; not table_line.empty())
         {
-            const auto& table_line{ piece_table_vec_[line] };
+            /* find the entry containing the char before pos; if pos is past the end of the line, we append the string to the
+             * last entry regardless of the value of pos                                                                       */
+            const auto before_pos{ table_line.find(pos - 1) };
+            const std::size_t i{ before_pos ? before_pos->first : table_line.size() - 1 };
+            const auto& entry{ table_line.at(i) };
             
-            for (std::size_t i{ 0 }, accumulated_len{ 0 }; i < table_line.size(); ++i)
+            if (before_pos and before_pos->second + 1 < entry.display_length)
             {
-                if (pos < accumulated_len + table_line[i].display_length)
-                {
-                    /* inserted position lies within table entry i, make a split. */
-                    exec(table_command{ pt_cmd::split_insert{ .line = line,
-                                                              .original_entry_index = i,
-                                                              .pos_in_entry = pos - accumulated_len,
-                                                              .inserted = inserted } });
-                    break;
-                }
-                else if (pos == accumulated_len + table_line[i].display_length or i + 1 == table_line.size())
-                {
-                    /* inserted position is immediately after table entry i; check if possible to grow_rhs instead of insert
-                     * if piece_table_vec_[i] is the last entry in table_line, we append the string regardless of the value of pos */
-                    if (table_line[i].start_index + table_line[i].byte_length == inserted.start_index)
-                    {
-                        /* piece table entry points to last string fragment in buffer; grow rhs of entry */
-                        exec(table_command{ pt_cmd::grow_rhs{ .line = line,
-                                                              .entry_index = i,
-                                                              .display_amt = inserted.display_length,
-                                                              .byte_amt = inserted.byte_length } });
-                    }
-                    else
-                    {
-                        /* unable to grow table entry; insert new entry afterwards instead */
-                        exec(table_command{ pt_cmd::insert_entry{ .line = line,
-                                                                  .entry_index = i + 1,
-                                                                  .inserted = inserted } });
-                    }
-                    break;
-                }
-                
-                accumulated_len += table_line[i].display_length;
+                /* inserted position lies within table entry i, make a split. */
+                exec(table_command{ pt_cmd::split_insert{ .line = line,
+                                                          .original_entry_index = i,
+                                                          .pos_in_entry = before_pos->second + 1,
+                                                          .inserted = inserted } });
+            }
+            else if (entry.start_index + entry.byte_length == inserted.start_index)
+            {
+                /* inserted position is immediately after table entry i, which points to last string fragment in buffer;
+                 * grow rhs of entry                                                                                   */
+                exec(table_command{ pt_cmd::grow_rhs{ .line = line,
+                                                      .entry_index = i,
+                                                      .display_amt = inserted.display_length,
+                                                      .byte_amt = inserted.byte_length } });
+            }
+            else
+            {
+                /* unable to grow table entry; insert new entry afterwards instead */
+                exec(table_command{ pt_cmd::insert_entry{ .line = line,
+                                                          .entry_index = i + 1,
+                                                          .inserted = inserted } });
             }
         }
         
@@ -608,6 +572,8 @@ namespace treenote::core
     bool tree_string::delete_char_before(std::size_t line, const std::size_t pos, std::size_t& cursor_dec_amt)
     {
         /* generate and exec command, or extend top command to update piece table */
+        
+        restamp();
 
         cursor_dec_amt = 0;
         
@@ -627,7 +593,7 @@ namespace treenote::core
         
         if (token_.check(pt_cmd_type::deletion_b, line, pos) and not piece_table_hist_.empty() and pos > 0)
         {
-            const auto eiwtl{ detail::entry_index_within_table_line(table_line, pos - 1) };
+            const auto eiwtl{ table_line.find(pos - 1) };
             
             if (eiwtl.has_value())
             {
@@ -651,14 +617,14 @@ namespace treenote::core
                 
                 if (std::holds_alternative<pt_cmd::split_delete>(last_sub_cmd.get()))
                 {
-                    if (table_line[entry_idx].display_length == 1)
+                    if (table_line.at(entry_idx).display_length == 1)
                     {
                         if (entry_idx + 1 < table_line.size())
                         {
                             /* replace split_delete command with shrink_lhs */
-                            const piece_table_entry before_copy{ table_line[entry_idx + 1] };
+                            const piece_table_entry before_copy{ table_line.at(entry_idx + 1) };
                             invoke_reverse(last_sub_cmd.get());
-                            const piece_table_entry after_copy{ table_line[entry_idx] };
+                            const piece_table_entry after_copy{ table_line.at(entry_idx) };
                             last_sub_cmd.get().emplace<pt_cmd::shrink_lhs>(line, entry_idx,
                                                                            after_copy.display_length - before_copy.display_length,
                                                                            after_copy.byte_length - before_copy.byte_length);
@@ -673,38 +639,38 @@ namespace treenote::core
                     else
                     {
                         /* shrink rhs of entry further */
-                        auto& entry{ table_line[entry_idx] };
+                        const auto& entry{ table_line.at(entry_idx) };
                         pt_cmd::split_delete& hist_top{ std::get<pt_cmd::split_delete>(last_sub_cmd.get()) };
                         std::size_t byte_amt{ 1 };
 
                         if (not entry_has_no_mb_char(entry))
                             byte_amt = entry_last_char_len(entry);
 
-                        detail::shrink_entry_rhs(entry, 1, byte_amt);
+                        detail::update_entry(piece_table_vec_, line, entry_idx, detail::shrink_entry_rhs, 1, byte_amt);
                         hist_top.l_boundary_pos -= 1;
                     }
                 }
                 else if (std::holds_alternative<pt_cmd::shrink_rhs>(last_sub_cmd.get()))
                 {
-                    if (table_line[entry_idx].display_length == 1)
+                    if (table_line.at(entry_idx).display_length == 1)
                     {
                         /* replace shrink_rhs command with delete_entry */
                         invoke_reverse(last_sub_cmd.get());
-                        last_sub_cmd.get().emplace<pt_cmd::delete_entry>(line, entry_idx, table_line[entry_idx],
+                        last_sub_cmd.get().emplace<pt_cmd::delete_entry>(line, entry_idx, table_line.at(entry_idx),
                                                                          detail::make_merge_info(piece_table_vec_, line, entry_idx));
                         invoke(last_sub_cmd.get());
                     }
                     else
                     {
                         /* shrink rhs of entry further */
-                        auto& entry{ table_line[entry_idx] };
+                        const auto& entry{ table_line.at(entry_idx) };
                         pt_cmd::shrink_rhs& hist_top{ std::get<pt_cmd::shrink_rhs>(last_sub_cmd.get()) };
                         std::size_t byte_amt{ 1 };
                         
                         if (not entry_has_no_mb_char(entry))
                             byte_amt = entry_last_char_len(entry);
                         
-                        detail::shrink_entry_rhs(entry, 1, byte_amt);
+                        detail::update_entry(piece_table_vec_, line, entry_idx, detail::shrink_entry_rhs, 1, byte_amt);
                         hist_top.display_amt += 1;
                         hist_top.byte_amt += byte_amt;
                     }
@@ -722,12 +688,12 @@ namespace treenote::core
                     
                     pt_cmd::multi_cmd& cmd_vec{ std::get<pt_cmd::multi_cmd>(piece_table_hist_.back()) };
                     
-                    if (table_line[entry_idx].display_length == 1)
+                    if (table_line.at(entry_idx).display_length == 1)
                     {
                         /* add command to delete table entry */
                         cmd_vec.commands.emplace_back(pt_cmd::delete_entry{ .line = line,
                                                                             .entry_index = entry_idx,
-                                                                            .deleted = table_line[entry_idx],
+                                                                            .deleted = table_line.at(entry_idx),
                                                                             .merge_pos_in_prev = detail::make_merge_info(piece_table_vec_, line, entry_idx) });
                         invoke(cmd_vec.commands.back());
                     }
@@ -736,8 +702,8 @@ namespace treenote::core
                         /* no merging happened; add command to shrink_lhs table entry */
                         std::size_t byte_amt{ 1 };
                         
-                        if (not entry_has_no_mb_char(table_line[entry_idx]))
-                            byte_amt = entry_first_char_len(table_line[entry_idx]);
+                        if (not entry_has_no_mb_char(table_line.at(entry_idx)))
+                            byte_amt = entry_first_char_len(table_line.at(entry_idx));
                         
                         cmd_vec.commands.emplace_back(pt_cmd::shrink_lhs{ .line = line,
                                                                           .entry_index = entry_idx,
@@ -745,7 +711,7 @@ namespace treenote::core
                                                                           .byte_amt = byte_amt });
                         invoke(cmd_vec.commands.back());
                     }
-                    else if (pos_in_entry + 1 < table_line[entry_idx].display_length)
+                    else if (pos_in_entry + 1 < table_line.at(entry_idx).display_length)
                     {
                         /* merge happened; insert split command and then shrink lhs */
                         cmd_vec.commands.emplace_back(pt_cmd::split_delete{ .line = line,
@@ -754,13 +720,13 @@ namespace treenote::core
                                                                             .r_boundary_pos = pos_in_entry + 1 });
                         invoke(cmd_vec.commands.back());
                     }
-                    else if (pos_in_entry + 1 == table_line[entry_idx].display_length)
+                    else if (pos_in_entry + 1 == table_line.at(entry_idx).display_length)
                     {
                         /* merge happened, but pos is now at end of table entry; shrink rhs */
                         cmd_vec.commands.emplace_back(pt_cmd::shrink_rhs{ .line = line,
                                                                           .entry_index = entry_idx,
                                                                           .display_amt = 1,
-                                                                          .byte_amt = entry_last_char_len(table_line[entry_idx]) });
+                                                                          .byte_amt = entry_last_char_len(table_line.at(entry_idx)) });
                         invoke(cmd_vec.commands.back());
                     }
                     else
@@ -786,70 +752,50 @@ namespace treenote::core
         
         /* then, generate command to update piece table depending on the location of the input */
         
-        for (std::size_t i{ 0 }, accumulated_len{ 0 }; not new_command_issued and i < table_line.size(); ++i)
+        if (const auto before_pos{ table_line.find(pos - 1) }; before_pos and not new_command_issued)
         {
-            if (table_line[i].display_length > 0)
+            const std::size_t i{ before_pos->first };
+            const std::size_t pos_in_entry{ before_pos->second };
+            const piece_table_entry entry{ table_line.at(i) };
+            
+            if (pos_in_entry + 1 == entry.display_length)
             {
-                if (pos == accumulated_len + table_line[i].display_length)
+                if (entry.display_length == 1)
                 {
-                    /* delete last char from pt entry by shrinking rhs of entry */
-                    if (table_line[i].display_length == 1)
-                    {
-                        /* delete table entry instead of shrinking */
-                        exec(table_command{ pt_cmd::delete_entry{ .line = line,
-                                                                  .entry_index = i,
-                                                                  .deleted = table_line[i],
-                                                                  .merge_pos_in_prev = detail::make_merge_info(piece_table_vec_, line, i) } });
-                    }
-                    else
-                    {
-                        /* delete last char from pt entry by shrinking rhs of entry */
-                        if (not entry_has_no_mb_char(table_line[i]))
-                            exec(table_command{ pt_cmd::shrink_rhs{ .line = line,
-                                                                    .entry_index = i,
-                                                                    .display_amt = 1,
-                                                                    .byte_amt = 1 } });
-                        else
-                            exec(table_command{ pt_cmd::shrink_rhs{ .line = line,
-                                                                    .entry_index = i,
-                                                                    .display_amt = 1,
-                                                                    .byte_amt = entry_last_char_len(table_line[i]) } });
-                    }
-                    
-                    cursor_dec_amt = 1;
-                    new_command_issued = true;
-                }
-                else if (pos == accumulated_len + 1)
-                {
-                    /* delete first char from pt entry by shrinking lhs of entry */
-                    if (not entry_has_no_mb_char(table_line[i]))
-                        exec(table_command{ pt_cmd::shrink_lhs{ .line = line,
-                                                                .entry_index = i,
-                                                                .display_amt = 1,
-                                                                .byte_amt = 1 } });
-                    else
-                        exec(table_command{ pt_cmd::shrink_lhs{ .line = line,
-                                                                .entry_index = i,
-                                                                .display_amt = 1,
-                                                                .byte_amt = entry_first_char_len(table_line[i]) } });
-                    
-                    cursor_dec_amt = 1;
-                    new_command_issued = true;
+                    /* delete table entry instead of shrinking */
+                    exec(table_command{ pt_cmd::delete_entry{ .line = line,
+                                                              .entry_index = i,
+                                                              .deleted = entry,
+                                                              .merge_pos_in_prev = detail::make_merge_info(piece_table_vec_, line, i) } });
                 }
-                else if (pos < accumulated_len + table_line[i].display_length)
+                else
                 {
-                    /* perform split operation and shrink rhs of left side */
-                    exec(table_command{ pt_cmd::split_delete{ .line = line,
-                                                              .original_entry_index = i,
-                                                              .l_boundary_pos = pos - 1 - accumulated_len,
-                                                              .r_boundary_pos = pos - accumulated_len } });
-                    
-                    cursor_dec_amt = 1;
-                    new_command_issued = true;
+                    /* delete last char from pt entry by shrinking rhs of entry */
+                    exec(table_command{ pt_cmd::shrink_rhs{ .line = line,
+                                                            .entry_index = i,
+                                                            .display_amt = 1,
+                                                            .byte_amt = entry_last_char_len(entry) } });
                 }
-                
-                accumulated_len += table_line[i].display_length;
             }
+            else if (pos_in_entry == 0)
+            {
+                /* delete first char from pt entry by shrinking lhs of entry */
+                exec(table_command{ pt_cmd::shrink_lhs{ .line = line,
+                                                        .entry_index = i,
+                                                        .display_amt = 1,
+                                                        .byte_amt = entry_first_char_len(entry) } });
+            }
+            else
+            {
+                /* perform split operation and shrink rhs of left side */
+                exec(table_command{ pt_cmd::split_delete{ .line = line,
+                                                          .original_entry_index = i,
+                                                          .l_boundary_pos = pos_in_entry,
+                                                          .r_boundary_pos = pos_in_entry + 1 } });
+            }
+            
+            cursor_dec_amt = 1;
+            new_command_issued = true;
         }
         
         token_.acquire(pt_cmd_type::deletion_b, line, pos - cursor_dec_amt);
@@ -860,6 +806,8 @@ namespace treenote::core
     {
         /* generate and exec command, or extend top command to update piece table */
         
+        restamp();
+        
         bool command_merged{ false };
         bool new_command_issued{ false };
         
@@ -871,7 +819,7 @@ namespace treenote::core
         
         if (token_.check(pt_cmd_type::deletion_c, line, pos) and not piece_table_hist_.empty())
         {
-            const auto eiwtl{ detail::entry_index_within_table_line(table_line, pos) };
+            const auto eiwtl{ table_line.find(pos) };
             
             if (eiwtl.has_value())
             {
@@ -895,15 +843,15 @@ namespace treenote::core
                 
                 if (std::holds_alternative<pt_cmd::split_delete>(last_sub_cmd.get()))
                 {
-                    if (table_line[entry_idx].display_length == 1)
+                    if (table_line.at(entry_idx).display_length == 1)
                     {
                         if (entry_idx > 0)
                         {
-                            const piece_table_entry before_copy{ table_line[entry_idx - 1] };
+                            const piece_table_entry before_copy{ table_line.at(entry_idx - 1) };
                             
                             /* replace split_delete command with shrink_rhs */
                             invoke_reverse(last_sub_cmd.get());
-                            const piece_table_entry after_copy{ table_line[entry_idx - 1] };
+                            const piece_table_entry after_copy{ table_line.at(entry_idx - 1) };
                             last_sub_cmd.get().emplace<pt_cmd::shrink_rhs>(line, entry_idx - 1,
                                                                            after_copy.display_length - before_copy.display_length,
                                                                            after_copy.byte_length - before_copy.byte_length);
@@ -918,39 +866,39 @@ namespace treenote::core
                     else
                     {
                         /* shrink lhs of entry further */
-                        auto& entry{ table_line[entry_idx] };
+                        const auto& entry{ table_line.at(entry_idx) };
                         pt_cmd::split_delete& hist_top{ std::get<pt_cmd::split_delete>(last_sub_cmd.get()) };
                         std::size_t byte_amt{ 1 };
                         
                         if (not entry_has_no_mb_char(entry))
                             byte_amt = entry_first_char_len(entry);
                         
-                        detail::shrink_entry_lhs(entry, 1, byte_amt);
+                        detail::update_entry(piece_table_vec_, line, entry_idx, detail::shrink_entry_lhs, 1, byte_amt);
                         hist_top.r_boundary_pos += 1;
                     }
                     
                 }
                 else if (std::holds_alternative<pt_cmd::shrink_lhs>(last_sub_cmd.get()))
                 {
-                    if (table_line[entry_idx].display_length == 1)
+                    if (table_line.at(entry_idx).display_length == 1)
                     {
                         /* replace shrink_lhs command with delete_entry */
                         invoke_reverse(last_sub_cmd.get());
-                        last_sub_cmd.get().emplace<pt_cmd::delete_entry>(line, entry_idx, table_line[entry_idx],
+                        last_sub_cmd.get().emplace<pt_cmd::delete_entry>(line, entry_idx, table_line.at(entry_idx),
                                                                          detail::make_merge_info(piece_table_vec_, line, entry_idx));
                         invoke(last_sub_cmd.get());
                     }
                     else
                     {
                         /* shrink lhs of entry further */
-                        auto& entry{ table_line[entry_idx] };
+                        const auto& entry{ table_line.at(entry_idx) };
                         pt_cmd::shrink_lhs& hist_top{ std::get<pt_cmd::shrink_lhs>(last_sub_cmd.get()) };
                         std::size_t byte_amt{ 1 };
                         
                         if (not entry_has_no_mb_char(entry))
                             byte_amt = entry_first_char_len(entry);
                         
-                        detail::shrink_entry_lhs(entry, 1, byte_amt);
+                        detail::update_entry(piece_table_vec_, line, entry_idx, detail::shrink_entry_lhs, 1, byte_amt);
                         hist_top.display_amt += 1;
                         hist_top.byte_amt += byte_amt;
                     }
@@ -968,12 +916,12 @@ namespace treenote::core
                     
                     pt_cmd::multi_cmd& cmd_vec{ std::get<pt_cmd::multi_cmd>(piece_table_hist_.back()) };
                     
-                    if (table_line[entry_idx].display_length == 1)
+                    if (table_line.at(entry_idx).display_length == 1)
                     {
                         /* add command to delete table entry */
                         cmd_vec.commands.emplace_back(pt_cmd::delete_entry{ .line = line,
                                                                             .entry_index = entry_idx,
-                                                                            .deleted = table_line[entry_idx],
+                                                                            .deleted = table_line.at(entry_idx),
                                                                             .merge_pos_in_prev=detail::make_merge_info(piece_table_vec_, line, entry_idx) });
                         invoke(cmd_vec.commands.back());
                     }
@@ -982,8 +930,8 @@ namespace treenote::core
                         /* no merging happened; add command to shrink_lhs table entry */
                         std::size_t byte_amt{ 1 };
                         
-                        if (not entry_has_no_mb_char(table_line[entry_idx]))
-                            byte_amt = entry_first_char_len(table_line[entry_idx]);
+                        if (not entry_has_no_mb_char(table_line.at(entry_idx)))
+                            byte_amt = entry_first_char_len(table_line.at(entry_idx));
                         
                         cmd_vec.commands.emplace_back(pt_cmd::shrink_lhs{ .line = line,
                                                                           .entry_index = entry_idx,
@@ -991,7 +939,7 @@ namespace treenote::core
                                                                           .byte_amt = byte_amt });
                         invoke(cmd_vec.commands.back());
                     }
-                    else if (pos_in_entry + 1 < table_line[entry_idx].display_length)
+                    else if (pos_in_entry + 1 < table_line.at(entry_idx).display_length)
                     {
                         /* merge happened; insert split command and then shrink lhs */
                         cmd_vec.commands.emplace_back(pt_cmd::split_delete{ .line = line,
@@ -1000,13 +948,13 @@ namespace treenote::core
                                                                             .r_boundary_pos = pos_in_entry + 1 });
                         invoke(cmd_vec.commands.back());
                     }
-                    else if (pos_in_entry + 1 == table_line[entry_idx].display_length)
+                    else if (pos_in_entry + 1 == table_line.at(entry_idx).display_length)
                     {
                         /* merge happened, but pos is now at end of table entry; shrink rhs */
                         cmd_vec.commands.emplace_back(pt_cmd::shrink_rhs{ .line = line,
                                                                           .entry_index = entry_idx,
                                                                           .display_amt = 1,
-                                                                          .byte_amt = entry_last_char_len(table_line[entry_idx]) });
+                                                                          .byte_amt = entry_last_char_len(table_line.at(entry_idx)) });
                         invoke(cmd_vec.commands.back());
                     }
                     else
@@ -1031,65 +979,49 @@ namespace treenote::core
         
         /* then, generate command to update piece table depending on the location of the input */
         
-        for (std::size_t i{ 0 }, accumulated_len{ 0 }; not new_command_issued and i < table_line.size(); ++i)
+        if (const auto current_pos{ table_line.find(pos) }; current_pos and not new_command_issued)
         {
-            if (table_line[i].display_length > 0)
+            const std::size_t i{ current_pos->first };
+            const std::size_t pos_in_entry{ current_pos->second };
+            const piece_table_entry entry{ table_line.at(i) };
+            
+            if (pos_in_entry == 0)
             {
-                if (pos == accumulated_len)
-                {
-                    if (table_line[i].display_length == 1)
-                    {
-                        /* delete table entry instead of shrinking */
-                        exec(table_command{ pt_cmd::delete_entry{ .line = line,
-                                                                  .entry_index = i,
-                                                                  .deleted = table_line[i],
-                                                                  .merge_pos_in_prev = detail::make_merge_info(piece_table_vec_, line, i) } });
-                    }
-                    else
-                    {
-                        /* delete first char from pt entry by shrinking lhs of entry */
-                        if (entry_has_no_mb_char(table_line[i]))
-                            exec(table_command{ pt_cmd::shrink_lhs{ .line = line,
-                                                                    .entry_index = i,
-                                                                    .display_amt = 1,
-                                                                    .byte_amt = 1 } });
-                        else
-                            exec(table_command{ pt_cmd::shrink_lhs{ .line = line,
-                                                                    .entry_index = i,
-                                                                    .display_amt = 1,
-                                                                    .byte_amt = entry_first_char_len(table_line[i]) } });
-                    }
-                    
-                    new_command_issued = true;
-                }
-                else if (pos == accumulated_len + table_line[i].display_length - 1)
+                if (entry.display_length == 1)
                 {
-                    /* delete last char from pt entry by shrinking rhs of entry */
-                    if (entry_has_no_mb_char(table_line[i]))
-                        exec(table_command{ pt_cmd::shrink_rhs{ .line = line,
-                                                                .entry_index = i,
-                                                                .display_amt = 1,
-                                                                .byte_amt = 1 } });
-                    else
-                        exec(table_command{ pt_cmd::shrink_rhs{ .line = line,
-                                                                .entry_index = i ,
-                                                                .display_amt = 1,
-                                                                .byte_amt = entry_last_char_len(table_line[i]) } });
-                        
-                    new_command_issued = true;
+                    /* delete table entry instead of shrinking */
+                    exec(table_command{ pt_cmd::delete_entry{ .line = line,
+                                                              .entry_index = i,
+                                                              .deleted = entry,
+                                                              .merge_pos_in_prev = detail::make_merge_info(piece_table_vec_, line, i) } });
                 }
-                else if (pos < accumulated_len + table_line[i].display_length - 1)
+                else
                 {
-                    /* perform split operation and shrink lhs of right side */
-                    exec(table_command{ pt_cmd::split_delete{ .line = line,
-                                                              .original_entry_index = i,
-                                                              .l_boundary_pos = pos - accumulated_len,
-                                                              .r_boundary_pos = pos + 1 - accumulated_len } });
-                    new_command_issued = true;
+                    /* delete first char from pt entry by shrinking lhs of entry */
+                    exec(table_command{ pt_cmd::shrink_lhs{ .line = line,
+                                                            .entry_index = i,
+                                                            .display_amt = 1,
+                                                            .byte_amt = entry_first_char_len(entry) } });
                 }
-                
-                accumulated_len += table_line[i].display_length;
             }
+            else if (pos_in_entry + 1 == entry.display_length)
+            {
+                /* delete last char from pt entry by shrinking rhs of entry */
+                exec(table_command{ pt_cmd::shrink_rhs{ .line = line,
+                                                        .entry_index = i,
+                                                        .display_amt = 1,
+                                                        .byte_amt = entry_last_char_len(entry) } });
+            }
+            else
+            {
+                /* perform split operation and shrink lhs of right side */
+                exec(table_command{ pt_cmd::split_delete{ .line = line,
+                                                          .original_entry_index = i,
+                                                          .l_boundary_pos = pos_in_entry,
+                                                          .r_boundary_pos = pos_in_entry + 1 } });
+            }
+            
+            new_command_issued = true;
         }
         
         token_.acquire(pt_cmd_type::deletion_c, line, pos);
@@ -1122,6 +1054,69 @@ namespace treenote::core
     }
     
     
+    bool tree_string::insert_lines(std::size_t line, std::size_t pos, const std::span<const extended_piece_table_entry> ext_lines,
+                                   std::size_t& end_line, std::size_t& end_pos)
+    {
+        set_no_longer_current();
+        clear_hist_if_needed();
+        const std::size_t hist_size{ piece_table_hist_.size() };
+        
+        for (std::size_t i{ 0 }; i < ext_lines.size(); ++i)
+        {
+            if (i != 0 and make_line_break(line, pos))
+            {
+                ++line;
+                pos = 0;
+            }
+            
+            std::size_t cursor_inc_amt{ 0 };
+            insert_str(line, pos, ext_lines[i], cursor_inc_amt);
+            pos += cursor_inc_amt;
+        }
+        
+        end_line = line;
+        end_pos = pos;
+        set_no_longer_current();
+        combine_hist_since(hist_size);
+        
+        return piece_table_hist_.size() > hist_size;
+    }
+    
+    bool tree_string::replace(const std::span<const replacement> edits)
+    {
+        set_no_longer_current();
+        clear_hist_if_needed();
+        const std::size_t hist_size{ piece_table_hist_.size() };
+        
+        /* the edits are made from last to first, so that the position of each is unaffected by those made before it */
+        
+        std::vector<const replacement*> ordered{};
+        ordered.reserve(edits.size());
+        
+        for (const auto& edit : edits)
+            ordered.push_back(&edit);
+        
+        std::ranges::sort(ordered, std::ranges::greater{}, [](const replacement* r) { return std::pair{ r->line, r->pos }; });
+        
+        for (const auto* edit : ordered)
+        {
+            for (std::size_t i{ 0 }; i < edit->len; ++i)
+                delete_char_current(edit->line, edit->pos);
+            
+            if (edit->inserted.first.display_length > 0)
+            {
+                std::size_t cursor_inc_amt{ 0 };
+                insert_str(edit->line, edit->pos, edit->inserted, cursor_inc_amt);
+            }
+        }
+        
+        set_no_longer_current();
+        combine_hist_since(hist_size);
+        
+        return piece_table_hist_.size() > hist_size;
+    }
+    
+    
     /* Public string indexing functions */
     
     std::string tree_string::to_str(const std::size_t line) const
@@ -1134,7 +1129,8 @@ namespace treenote::core
                 throw std::runtime_error("tree_string::to_str(): non-empty tree_string must have an associated note_buffer");
         }
         
-        auto result{ buffer_ptr_->to_str_view(piece_table_vec_.at(line)) };
+        std::vector<std::string_view> result{};
+        append_str_view(line, result);
 //        return { std::from_range, result | std::views::join };
         
         // std::string constructor with std::from_range_t hasn't been implemented in GCC yet
@@ -1143,6 +1139,85 @@ namespace treenote::core
 
     }
     
+    void tree_string::append_str_view(const std::size_t line, std::vector<std::string_view>& result) const
+    {
+        /* like to_str, but appends views of the line to result instead of copying it */
+        
+        if (not buffer_ptr_)
+        {
+            if (piece_table_vec_.at(line).empty())
+                return;
+            else
+                throw std::runtime_error("tree_string::append_str_view(): non-empty tree_string must have an associated note_buffer");
+        }
+        
+        piece_table_vec_.at(line).for_each([&](const piece_table_entry& entry) {
+            buffer_ptr_->append_str_view(entry, result);
+            return true;
+        });
+    }
+    
+    void tree_string::append_str_view(const std::size_t line, const buffer::reader& reader, std::vector<std::string_view>& result) const
+    {
+        /* like append_str_view, but reads through a reader so that it can be used while the buffer is appended to */
+        
+        if (piece_table_vec_.at(line).empty())
+            return;
+        
+        if (not buffer_ptr_ or buffer_ptr_ != reader.source())
+            throw std::logic_error("tree_string::append_str_view(): reader must be made from the associated note_buffer");
+        
+        piece_table_vec_.at(line).for_each([&](const piece_table_entry& entry) {
+            reader.append_str_view(entry, result);
+            return true;
+        });
+    }
+    
+    void tree_string::find_all(const std::size_t line, const std::string_view text, std::string& scratch,
+                               std::vector<std::size_t>& result) const
+    {
+        if (text.empty() or not buffer_ptr_)
+            return;
+        
+        std::span<const char> data{};
+        std::size_t span_count{ 0 };
+        
+        piece_table_vec_.at(line).for_each([&](const piece_table_entry& entry) {
+            for (const auto span: buffer_ptr_->spans(entry))
+            {
+                if (++span_count == 1)
+                {
+                    data = span;
+                    continue;
+                }
+                
+                if (span_count == 2)
+                    scratch.assign(std::ranges::begin(data), std::ranges::end(data));
+                
+                scratch.append(std::ranges::begin(span), std::ranges::end(span));
+            }
+            return true;
+        });
+        
+        if (span_count > 1)
+            data = scratch;
+        
+        /* convert byte offsets to positions by counting the chars between consecutive occurrences */
+        
+        std::size_t counted_bytes{ 0 };
+        std::size_t counted_pos{ 0 };
+        
+        for (auto i{ line_scan::find_substr(data, text, 0) }; i != data.size(); i = line_scan::find_substr(data, text, i + 1))
+        {
+            counted_pos += static_cast<std::size_t>(std::ranges::count_if(data.subspan(counted_bytes, i - counted_bytes), [](const char c) {
+                return (c & utf8::mask_cont) != utf8::test_cont;
+            }));
+            
+            counted_bytes = i;
+            result.push_back(counted_pos);
+        }
+    }
+    
     std::string tree_string::to_substr(const std::size_t line, const std::size_t pos, const std::size_t len) const
     {
         if (not buffer_ptr_)
@@ -1153,7 +1228,29 @@ namespace treenote::core
                 throw std::runtime_error("tree_string::to_substr(): non-empty tree_string must have an associated note_buffer");
         }
         
-        auto result{ buffer_ptr_->to_substr_view(piece_table_vec_.at(line), pos, len) };
+        const auto& table_line{ piece_table_vec_.at(line) };
+        std::vector<std::string_view> result{};
+        
+        /* seek directly to the entry containing pos, then extract entries until we have len characters in total */
+        if (const auto start{ table_line.find(pos) }; start and len > 0)
+        {
+            std::size_t remaining{ len };
+            std::size_t pos_in_entry{ start->second };
+            
+            table_line.for_each(start->first, [&](const piece_table_entry& entry) {
+                const std::size_t extracted{ std::min(remaining, entry.display_length - pos_in_entry) };
+                
+                if (pos_in_entry == 0 and extracted == entry.display_length)
+                    buffer_ptr_->append_str_view(entry, result);
+                else
+                    buffer_ptr_->append_substr_view(entry, pos_in_entry, extracted, result);
+                
+                remaining -= extracted;
+                pos_in_entry = 0;
+                return remaining > 0;
+            });
+        }
+        
         return result | std::views::join | std::ranges::to<std::string>();
     }
     
@@ -1162,8 +1259,7 @@ namespace treenote::core
     std::size_t tree_string::line_length(const std::size_t line) const
     {
         if (line < piece_table_vec_.size())
-            return std::transform_reduce(std::ranges::cbegin(piece_table_vec_[line]), std::ranges::cend(piece_table_vec_[line]),
-                                         0uz, std::plus{}, [](const piece_table_entry& te){ return te.display_length; });
+            return piece_table_vec_[line].display_length();
         else
             return 0;
     }
@@ -1201,13 +1297,172 @@ namespace treenote::core
         }, cmd.get());
     }
     
+    /* Buffer compaction functions */
+    
+    std::vector<std::size_t> tree_string::coalescable_lines() const
+    {
+        /* history refers to entries by their index within a line, so lines can only be rewritten if there is none */
+        
+        std::vector<std::size_t> result{};
+        
+        if (buffer_ptr_ and piece_table_hist_.empty())
+        {
+            for (std::size_t line{ 0 }; line < piece_table_vec_.size(); ++line)
+                if (piece_table_vec_[line].size() > 1)
+                    result.push_back(line);
+        }
+        
+        return result;
+    }
+    
+    void tree_string::coalesce_line(buffer& buf, const std::size_t line)
+    {
+        if (buffer_ptr_ != &buf or not piece_table_hist_.empty())
+            throw std::logic_error("tree_string::coalesce_line(): line cannot be coalesced");
+        
+        const auto [entry, _]{ buf.append(to_str(line)) };
+        
+        piece_tree coalesced{};
+        coalesced.push_back(entry);
+        piece_table_vec_.at(line) = std::move(coalesced);
+    }
+    
+    void tree_string::collect_line_ranges(const std::size_t line, std::vector<buffer::live_range>& result) const
+    {
+        piece_table_vec_.at(line).for_each([&](const piece_table_entry& entry) {
+            result.push_back({ .start_index = entry.start_index, .byte_length = entry.byte_length });
+            return true;
+        });
+    }
+    
+    void tree_string::collect_live_ranges(std::vector<buffer::live_range>& result)
+    {
+        /* every state in the history must be reproducible, so the history is rewound and then replayed, and the entries
+         * of each line changed along the way are collected; all commands are then undone again back to the current one */
+        
+        if (not buffer_ptr_)
+            return;
+        
+        const auto collect_line{ [&, this](const std::size_t line) {
+            if (line < piece_table_vec_.size())
+                collect_line_ranges(line, result);
+        } };
+        
+        const auto collect_all{ [&, this] {
+            for (std::size_t line{ 0 }; line < piece_table_vec_.size(); ++line)
+                collect_line(line);
+        } };
+        
+        collect_all();
+        
+        if (piece_table_hist_.empty())
+            return;
+        
+        const std::uint64_t stamp{ stamp_ };
+        
+        for (std::size_t pos{ piece_table_hist_pos_ }; pos > 0; --pos)
+            invoke_reverse(piece_table_hist_[pos - 1]);
+        
+        collect_all();
+        
+        for (const auto& tc : piece_table_hist_)
+        {
+            detail::for_each_leaf_cmd(tc, [&, this](const table_command& c) {
+                invoke(c);
+                detail::for_each_changed_line(c, collect_line);
+            });
+        }
+        
+        for (std::size_t pos{ piece_table_hist_.size() }; pos > piece_table_hist_pos_; --pos)
+            invoke_reverse(piece_table_hist_[pos - 1]);
+        
+        /* the text is as it was, so it keeps its stamp */
+        stamp_ = stamp;
+    }
+    
+    void tree_string::relocate(const buffer::relocation& reloc)
+    {
+        for (auto& table_line : piece_table_vec_)
+            table_line.remap_start_indices(reloc);
+        
+        for (auto& tc : piece_table_hist_)
+            detail::relocate_cmd(tc, reloc);
+    }
+    
+    
+    /* History memory functions */
+    
+    void tree_string::discard_history_through(const std::uint64_t serial)
+    {
+        /* note: if the most recent command is discarded, the history is empty, so it cannot be extended by further input */
+        
+        const auto it{ std::ranges::upper_bound(piece_table_hist_serials_, serial) };
+        const auto count{ std::min(static_cast<std::size_t>(it - std::ranges::begin(piece_table_hist_serials_)), piece_table_hist_pos_) };
+        
+        if (count > 0)
+            drop_oldest_hist(count);
+    }
+    
+    std::size_t tree_string::memory_usage() const
+    {
+        std::size_t result{ history_memory_since(0) };
+        
+        for (const auto& table_line : piece_table_vec_)
+        {
+            result += sizeof(piece_tree);
+            
+            table_line.for_each([&](const piece_table_entry& entry) {
+                result += sizeof(piece_table_entry) + entry.byte_length;
+                return true;
+            });
+        }
+        
+        return result;
+    }
+    
+    std::size_t tree_string::history_memory_since(const std::uint64_t serial) const
+    {
+        std::size_t result{ 0 };
+        
+        for (std::size_t i{ piece_table_hist_serials_.size() }; i > 0 and piece_table_hist_serials_[i - 1] > serial; --i)
+            result += detail::command_memory(piece_table_hist_[i - 1]);
+        
+        return result;
+    }
+    
+    
     /* Private member functions */
     
+    void tree_string::combine_hist_since(const std::size_t hist_size)
+    {
+        /* combines the commands issued since the history held hist_size commands into one (they have already been
+         * executed), so that they are undone and redone together                                                  */
+        
+        if (piece_table_hist_.size() <= hist_size + 1)
+            return;
+        
+        pt_cmd::multi_cmd multi{};
+        multi.commands.reserve(piece_table_hist_.size() - hist_size);
+        std::ranges::move(piece_table_hist_ | std::views::drop(hist_size), std::back_inserter(multi.commands));
+        
+        const std::uint64_t serial{ piece_table_hist_serials_.back() };
+        
+        piece_table_hist_.erase(std::ranges::begin(piece_table_hist_) + static_cast<std::ptrdiff_t>(hist_size),
+                                std::ranges::end(piece_table_hist_));
+        piece_table_hist_serials_.resize(hist_size);
+        
+        piece_table_hist_.push_back(std::move(multi));
+        piece_table_hist_serials_.push_back(serial);
+        piece_table_hist_pos_ = piece_table_hist_.size();
+    }
+    
     void tree_string::invoke(const table_command& tc)
     {
         using namespace detail;
         using namespace pt_cmd;
         
+        restamp();
+        
         if (not buffer_ptr_)
         {
             const bool success{ std::visit(overload{
@@ -1240,9 +1495,9 @@ namespace treenote::core
         std::visit(overload{
             [&, this](const split_insert& c) { split_entry_and_insert(piece_table_vec_, buffer_ptr_, c.line, c.original_entry_index, c.pos_in_entry, c.inserted); },
             [&, this](const split_delete& c) { split_entry_remove_inside(piece_table_vec_, buffer_ptr_, c.line, c.original_entry_index, c.l_boundary_pos, c.r_boundary_pos); },
-            [&, this](const grow_rhs& c) { grow_entry_rhs(get_entry(piece_table_vec_, c.line, c.entry_index), c.display_amt, c.byte_amt); },
-            [&, this](const shrink_rhs& c) { shrink_entry_rhs(get_entry(piece_table_vec_, c.line, c.entry_index), c.display_amt, c.byte_amt); },
-            [&, this](const shrink_lhs& c) { shrink_entry_lhs(get_entry(piece_table_vec_, c.line, c.entry_index), c.display_amt, c.byte_amt); },
+            [&, this](const grow_rhs& c) { update_entry(piece_table_vec_, c.line, c.entry_index, grow_entry_rhs, c.display_amt, c.byte_amt); },
+            [&, this](const shrink_rhs& c) { update_entry(piece_table_vec_, c.line, c.entry_index, shrink_entry_rhs, c.display_amt, c.byte_amt); },
+            [&, this](const shrink_lhs& c) { update_entry(piece_table_vec_, c.line, c.entry_index, shrink_entry_lhs, c.display_amt, c.byte_amt); },
             [&, this](const insert_entry& c) { insert_entry_naive(piece_table_vec_, c.line, c.entry_index, c.inserted); },
             [&, this](const delete_entry& c) { delete_entry_and_merge(piece_table_vec_, c.line, c.entry_index); },
             [&, this](const line_break& c) { split_lines(piece_table_vec_, buffer_ptr_, c.line_before, c.pos_before); },
@@ -1256,6 +1511,8 @@ namespace treenote::core
         using namespace detail;
         using namespace pt_cmd;
         
+        restamp();
+        
         if (not buffer_ptr_)
         {
             const bool success{ std::visit(overload{
@@ -1284,9 +1541,9 @@ namespace treenote::core
         std::visit(overload{
                 [&, this](const split_insert& c) { undo_split_entry_and_insert(piece_table_vec_, c.line, c.original_entry_index); },
                 [&, this](const split_delete& c) { undo_split_entry_remove_inside(piece_table_vec_, c.line, c.original_entry_index, c.r_boundary_pos); },
-                [&, this](const grow_rhs& c) { shrink_entry_rhs(get_entry(piece_table_vec_, c.line, c.entry_index), c.display_amt, c.byte_amt); },
-                [&, this](const shrink_rhs& c) { grow_entry_rhs(get_entry(piece_table_vec_, c.line, c.entry_index), c.display_amt, c.byte_amt); },
-                [&, this](const shrink_lhs& c) { unshrink_entry_lhs(get_entry(piece_table_vec_, c.line, c.entry_index), c.display_amt, c.byte_amt); },
+                [&, this](const grow_rhs& c) { update_entry(piece_table_vec_, c.line, c.entry_index, shrink_entry_rhs, c.display_amt, c.byte_amt); },
+                [&, this](const shrink_rhs& c) { update_entry(piece_table_vec_, c.line, c.entry_index, grow_entry_rhs, c.display_amt, c.byte_amt); },
+                [&, this](const shrink_lhs& c) { update_entry(piece_table_vec_, c.line, c.entry_index, unshrink_entry_lhs, c.display_amt, c.byte_amt); },
                 [&, this](const insert_entry& c) { delete_entry_and_merge(piece_table_vec_, c.line, c.entry_index); },
                 [&, this](const delete_entry& c) { undo_delete_entry_and_merge(piece_table_vec_, buffer_ptr_, c.line, c.entry_index, c.deleted, c.merge_pos_in_prev); },
                 [&, this](const line_break& c) { join_lines(piece_table_vec_, c.line_before); },
@@ -1305,6 +1562,8 @@ namespace treenote::core
             piece_table_hist_.erase(std::ranges::begin(piece_table_hist_) + static_cast<std::ptrdiff_t>(piece_table_hist_pos_),
                                     std::ranges::end(piece_table_hist_));
             piece_table_hist_.shrink_to_fit();
+            piece_table_hist_serials_.resize(piece_table_hist_pos_);
+            piece_table_hist_serials_.shrink_to_fit();
         }
         else if (piece_table_hist_pos_ == piece_table_hist_.size())
         {
@@ -1313,11 +1572,7 @@ namespace treenote::core
             if (piece_table_hist_pos_ == detail::max_hist_size_)
             {
                 /* piece_table_hist_ is too big, reduce size of piece_table_hist_ by 50% */
-                std::vector<table_command> tmp{};
-                auto range{ piece_table_hist_ | std::views::drop(piece_table_hist_pos_ / 2) };
-                tmp.reserve(std::ranges::size(range));
-                std::ranges::move(range, std::back_inserter(tmp));
-                piece_table_hist_ = std::move(tmp);
+                drop_oldest_hist(piece_table_hist_pos_ / 2);
             }
         }
         else
@@ -1326,34 +1581,24 @@ namespace treenote::core
         }
     }
     
-    std::string tree_string::index_of_char_within_entry(const piece_table_entry& entry, const std::size_t pos_in_entry) const
+    void tree_string::drop_oldest_hist(const std::size_t count)
     {
-        if (pos_in_entry >= entry.display_length)
-            throw std::invalid_argument("tree_string::index_of_char_within_entry: pos_in_entry is larger than entry.display_length");
-        
-        if (entry_has_no_mb_char(entry))
-        {
-            /* trivial case: no multibyte characters */
-            return { buffer_ptr_->at(entry.start_index + pos_in_entry) };
-        }
-        
-        auto buf_begin{ std::ranges::cbegin(*buffer_ptr_) + static_cast<std::ptrdiff_t>(entry.start_index) };
-        const auto buf_end{ buf_begin + static_cast<std::ptrdiff_t>(entry.byte_length) };
-        
-        std::string tmp{};
-        
-        for (std::size_t i{ 0 }; i <= pos_in_entry; ++i)
-            utf8::str_it_get_ext(buf_begin, buf_end, tmp);
+        /* assume: count <= piece_table_hist_pos_ */
         
-        if (tmp.empty())
-            throw std::runtime_error("tree_string::index_of_char_within_entry: cannot index buffer");
+        std::vector<table_command> tmp{};
+        auto range{ piece_table_hist_ | std::views::drop(count) };
+        tmp.reserve(std::ranges::size(range));
+        std::ranges::move(range, std::back_inserter(tmp));
+        piece_table_hist_ = std::move(tmp);
         
-        return tmp;
+        piece_table_hist_serials_.erase(std::ranges::begin(piece_table_hist_serials_),
+                                        std::ranges::begin(piece_table_hist_serials_) + static_cast<std::ptrdiff_t>(count));
+        piece_table_hist_pos_ -= count;
     }
     
     bool tree_string::empty() const noexcept
     {
-        return piece_table_hist_.empty() and std::ranges::all_of(piece_table_vec_, [](const piece_table_line& l) { return l.empty(); });
+        return piece_table_hist_.empty() and std::ranges::all_of(piece_table_vec_, [](const piece_tree& l) { return l.empty(); });
     }
     
     
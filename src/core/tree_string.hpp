@@ -20,10 +20,15 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <span>
 #include <string>
+#include <string_view>
 #include <vector>
 
 #include "buffer.hpp"
+#include "piece_tree.hpp"
 #include "table.hpp"
 #include "tree_cmd.hpp"
 
@@ -40,6 +45,7 @@ namespace treenote::core
         explicit tree_string(const extended_piece_table_entry& input); // TODO: recheck
         void add_line(const extended_piece_table_entry& more_input);
         [[nodiscard]] tree_string make_copy() const;
+        [[nodiscard]] tree_string make_copy_with_history() const;
     
         tree_string(const tree_string&) = delete;
         tree_string(tree_string&&) = default;
@@ -55,6 +61,25 @@ namespace treenote::core
         bool make_line_break(std::size_t upper_line, std::size_t upper_line_pos);
         bool make_line_join(std::size_t upper_line);
         
+        /* inserts each of ext_lines at pos with a line break between each, as a single command (which is never merged
+         * with another); sets end_line and end_pos to the position after the inserted text, and returns as above     */
+        
+        bool insert_lines(std::size_t line, std::size_t pos, std::span<const extended_piece_table_entry> ext_lines,
+                          std::size_t& end_line, std::size_t& end_pos);
+        
+        /* replaces the len chars at (line, pos) by inserted for each of edits, as a single command (never merged with
+         * another); edits must not overlap, and inserted must not contain newlines; returns as above                */
+        
+        struct replacement
+        {
+            std::size_t                 line;
+            std::size_t                 pos;
+            std::size_t                 len;
+            extended_piece_table_entry  inserted;
+        };
+        
+        bool replace(std::span<const replacement> edits);
+        
         int undo();
         int redo();
         
@@ -62,13 +87,49 @@ namespace treenote::core
         [[nodiscard]] std::size_t line_length(std::size_t line) const;
         
         [[nodiscard]] std::string to_str(std::size_t line) const;
+        void append_str_view(std::size_t line, std::vector<std::string_view>& result) const;
+        void append_str_view(std::size_t line, const buffer::reader& reader, std::vector<std::string_view>& result) const;
         [[nodiscard]] std::string to_substr(std::size_t line, std::size_t pos, std::size_t len) const;
         
+        /* appends the pos of every occurrence of text in line to result, in order; the line is searched where it lies in
+         * the buffer if it is held in one span of it, and is otherwise gathered into scratch (which is reused) first */
+        
+        void find_all(std::size_t line, std::string_view text, std::string& scratch, std::vector<std::size_t>& result) const;
+        
         void set_no_longer_current();
         
         [[nodiscard]] cmd_names get_current_cmd_name() const;
         
         [[nodiscard]] bool empty() const noexcept;
+        
+        /* Buffer compaction (see buffer::compact):                                                                     */
+        /* coalescable_lines returns the lines made up of several entries if there is no history, and coalesce_line
+         * copies such a line to a single new entry; collect_live_ranges appends the range of every entry this refers to
+         * now or after any undo or redo; and relocate updates every entry (in the history too) after compaction         */
+        
+        [[nodiscard]] std::vector<std::size_t> coalescable_lines() const;
+        void coalesce_line(buffer& buf, std::size_t line);
+        void collect_line_ranges(std::size_t line, std::vector<buffer::live_range>& result) const;
+        void collect_live_ranges(std::vector<buffer::live_range>& result);
+        void relocate(const buffer::relocation& reloc);
+        
+        /* History memory: each command in the history is numbered in the order in which commands were made (by any
+         * tree_string); discard_history_through discards the commands numbered at most serial which have been done */
+        
+        [[nodiscard]] static std::uint64_t last_serial() noexcept;
+        void discard_history_through(std::uint64_t serial);
+        
+        /* Content stamps: the stamp of a tree_string identifies its text, and is replaced by a new one (from a counter
+         * shared by every tree_string) whenever the text changes; copies keep the stamp of the original, and strings
+         * which have been empty since they were made have the stamp 0 (see text_index)                              */
+        
+        [[nodiscard]] std::uint64_t stamp() const noexcept;
+        [[nodiscard]] static std::uint64_t last_stamp() noexcept;
+        
+        /* Estimates of memory use (beyond the object itself), including the text in the buffer for entries and history */
+        
+        [[nodiscard]] std::size_t memory_usage() const;
+        [[nodiscard]] std::size_t history_memory_since(std::uint64_t serial) const;
 
 //        [[nodiscard]] std::string debug_get_table_entry_string(std::size_t line) const;
 //        [[nodiscard]] const std::string& debug_get_buffer() const;
@@ -76,22 +137,29 @@ namespace treenote::core
     private:
         
         void clear_hist_if_needed();
+        void drop_oldest_hist(std::size_t count);
         void exec(table_command&& tc);
+        void combine_hist_since(std::size_t hist_size);
         
         void invoke(const table_command& tc);
         void invoke_reverse(const table_command& tc);
+        void restamp() noexcept;
         
-        [[nodiscard]] std::string index_of_char_within_entry(const piece_table_entry& entry, std::size_t pos_in_entry) const;
         [[nodiscard]] std::size_t entry_last_char_len(const piece_table_entry& entry) const;
         [[nodiscard]] std::size_t entry_first_char_len(const piece_table_entry& entry) const;
         
-        piece_table_t                                               piece_table_vec_;
+        std::vector<piece_tree>                                     piece_table_vec_;
         
         std::vector<table_command>                                  piece_table_hist_;
+        std::vector<std::uint64_t>                                  piece_table_hist_serials_;  /* parallel to piece_table_hist_ */
         std::size_t                                                 piece_table_hist_pos_{ 0 };
         
         const buffer*                                          buffer_ptr_; /* non owning, can be null */
         tree_string_token                                           token_;
+        std::uint64_t                                               stamp_{ 0 };
+        
+        inline static std::uint64_t                                 serial_counter_{ 0 };
+        inline static std::atomic<std::uint64_t>                    stamp_counter_{ 0 };   /* strings are made by parse jobs too */
     };
     
     
@@ -133,10 +201,31 @@ namespace treenote::core
     {
         clear_hist_if_needed();
         piece_table_hist_.push_back(std::move(tc));
+        piece_table_hist_serials_.push_back(++serial_counter_);
         invoke(piece_table_hist_.back());
         ++piece_table_hist_pos_;
     }
     
+    inline std::uint64_t tree_string::last_serial() noexcept
+    {
+        return serial_counter_;
+    }
+    
+    inline std::uint64_t tree_string::stamp() const noexcept
+    {
+        return stamp_;
+    }
+    
+    inline std::uint64_t tree_string::last_stamp() noexcept
+    {
+        return stamp_counter_.load(std::memory_order_relaxed);
+    }
+    
+    inline void tree_string::restamp() noexcept
+    {
+        stamp_ = stamp_counter_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    
     inline std::size_t tree_string::line_count() const noexcept
     {
         return piece_table_vec_.size();
@@ -149,17 +238,11 @@ namespace treenote::core
     
     inline std::size_t tree_string::entry_last_char_len(const piece_table_entry& entry) const
     {
-        if (entry_has_no_mb_char(entry))
-            return 1;
-        else
-            return index_of_char_within_entry(entry, entry.display_length - 1).size();
+        return entry.byte_length - buffer_ptr_->byte_offset_of_char(entry, entry.display_length - 1);
     }
 
     inline std::size_t tree_string::entry_first_char_len(const piece_table_entry& entry) const
     {
-        if (entry_has_no_mb_char(entry))
-            return 1;
-        else
-            return index_of_char_within_entry(entry, 0).size();
+        return buffer_ptr_->byte_offset_of_char(entry, 1);
     }
 }
@@ -103,7 +103,7 @@ namespace treenote::tui::key
         /* WARNING: This function must only be called after initscr() is called */
         input_t extended_key(const char* definition)
         {
-            static int key_code_generator{ 0 };
+            static int key_code_generator{ KEY_MAX + 1 };   /* codes up to KEY_MAX are reserved by ncurses */
             auto keycode{ key_defined(definition) };
             
             if (keycode <= 0)
@@ -248,6 +248,18 @@ namespace treenote::tui::key
         }
         
     }
+    
+    input_t paste_begin()
+    {
+        static const input_t keycode{ extended_key("\x1b[200~") };
+        return keycode;
+    }
+    
+    input_t paste_end()
+    {
+        static const input_t keycode{ extended_key("\x1b[201~") };
+        return keycode;
+    }
 }       
         
 namespace treenote::tui
@@ -275,6 +287,13 @@ namespace treenote::tui
         k.map_[actions::cursor_pos]         = { ctrl('c'), f(11) };
         k.map_[actions::go_to]              = { ctrl('_'), alt('g') };
         
+        k.map_[actions::search_forward]     = { ctrl('w'), f(6) };
+        k.map_[actions::search_backward]    = { ctrl('q') };
+        k.map_[actions::find_next]          = { alt('w') };
+        k.map_[actions::find_previous]      = { alt('q') };
+        k.map_[actions::replace]            = { ctrl('\\'), f(14) };
+        k.map_[actions::replace_subtree]    = { alt('%') };
+        
         k.map_[actions::indent_node]        = { ctrl('I') , get(spc::tab) };
         k.map_[actions::unindent_node]      = { alt('I') , get(spc::shift | spc::tab) };
         
@@ -320,6 +339,10 @@ namespace treenote::tui
         k.map_[actions::node_child]         = { get(spc::shift | spc::right), };
         k.map_[actions::node_prev]          = { get(spc::shift | spc::up),    };
         k.map_[actions::node_next]          = { get(spc::shift | spc::down),  };
+        
+        k.map_[actions::fold_node]          = { alt(','), alt('<') };
+        k.map_[actions::unfold_node]        = { alt('.'), alt('>') };
+        k.map_[actions::toggle_fold]        = { alt('z') };
 
         k.map_[actions::newline]            = { ctrl('m'), get(spc::enter) };
         k.map_[actions::backspace]          = { ctrl('h'), get(spc::backspace) };
@@ -407,6 +430,21 @@ namespace treenote::tui
         return result;
     }
     
+    keymap::map_t keymap::make_search_editor_keymap() const
+    {
+        map_t result;
+        
+        const std::vector a_vec{ actions::newline, actions::backspace, actions::delete_char,
+                                 actions::cursor_left, actions::cursor_right, actions::prompt_cancel };
+        
+        for (const auto& action: a_vec)
+            for (const auto key: map_.at(action))
+                if (key != key::hide_keys)
+                    result[key] = action;
+        
+        return result;
+    }
+    
     namespace key
     {
         namespace
@@ -626,6 +664,9 @@ namespace treenote::tui
         bar.entries.emplace_back(actions::write_tree, strings::action_write);
         bar.entries.emplace_back(actions::save_file, strings::action_save);
         
+        bar.entries.emplace_back(actions::search_forward, strings::action_where_is);
+        bar.entries.emplace_back(actions::search_backward, strings::action_where_was);
+        
         bar.entries.emplace_back(actions::cut_node, strings::action_cut);
         bar.entries.emplace_back(actions::paste_node, strings::action_paste);
         
@@ -691,6 +732,15 @@ namespace treenote::tui
         
         return bar;
     }
+    
+    detail::help_bar_content keymap::make_search_editor_help_bar()
+    {
+        detail::help_bar_content bar;
+        
+        bar.entries.emplace_back(actions::prompt_cancel, strings::action_cancel);
+        
+        return bar;
+    }
      
     keymap::bindings_t keymap::make_key_bindings() const
     {
@@ -65,6 +65,11 @@ namespace treenote::tui
         
         [[nodiscard]] std::string name_of(wint_t first, wint_t second);
         [[nodiscard]] std::string name_of(input_t key);
+        
+        /* Keys sent by the terminal before and after pasted text while bracketed paste is enabled */
+        /* WARNING: these must only be called after initscr() is called */
+        [[nodiscard]] input_t paste_begin();
+        [[nodiscard]] input_t paste_end();
     }
     
     enum class actions : std::int8_t
@@ -95,6 +100,13 @@ namespace treenote::tui
         
         cursor_pos,
         go_to,
+        
+        search_forward,
+        search_backward,
+        find_next,
+        find_previous,
+        replace,
+        replace_subtree,
 
         indent_node,
         unindent_node,
@@ -147,6 +159,12 @@ namespace treenote::tui
         node_next,
         node_prev,
         
+        /* Folding */
+        
+        fold_node,
+        unfold_node,
+        toggle_fold,
+        
         /* Line-based input related */
         
         newline,
@@ -188,12 +206,14 @@ namespace treenote::tui
         [[nodiscard]] map_t make_help_screen_keymap() const;
         [[nodiscard]] map_t make_filename_editor_keymap() const;
         [[nodiscard]] map_t make_goto_editor_keymap() const;
+        [[nodiscard]] map_t make_search_editor_keymap() const;
         
         [[nodiscard]] static detail::help_bar_content make_editor_help_bar();
         [[nodiscard]] static detail::help_bar_content make_quit_prompt_help_bar();
         [[nodiscard]] static detail::help_bar_content make_help_screen_help_bar();
         [[nodiscard]] static detail::help_bar_content make_filename_editor_help_bar();
         [[nodiscard]] static detail::help_bar_content make_goto_editor_help_bar();
+        [[nodiscard]] static detail::help_bar_content make_search_editor_help_bar();
         
         [[nodiscard]] bindings_t make_key_bindings() const;
         
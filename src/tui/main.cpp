@@ -18,9 +18,12 @@
 // along with Treenote.  If not, see <https://www.gnu.org/licenses/>.
 
 
+#include <charconv>
 #include <deque>
 #include <iostream>
+#include <limits>
 #include <string>
+#include <string_view>
 
 #include "window.hpp"
 
@@ -29,12 +32,95 @@ int main(const int argc, const char* argv[])
     using namespace treenote::tui;
     
     std::deque<std::string> args{ argv + 1 , argc + argv };
+    unsigned int load_jobs{ 1 };
+    std::size_t history_budget{ treenote::core::operation_stack::default_memory_budget };
+    bool lazy_load{ false };
+    bool text_index{ false };
+    bool paste_as_nodes{ false };
+    
+    /* extracts the value of option `name` at args[i] (given as either `name value` or `name=value`); if `name` is the
+     * last argument, value is left empty (which is not a valid value for any option) */
+    const auto extract_option{ [&](const std::size_t i, const std::string_view name, std::string& value) {
+        if (args[i] == name and i + 1 < args.size())
+        {
+            value = args[i + 1];
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i), args.begin() + static_cast<std::ptrdiff_t>(i + 2));
+            return true;
+        }
+        else if (args[i] == name)
+        {
+            value.clear();
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i));
+            return true;
+        }
+        else if (args[i].starts_with(name) and args[i].size() > name.size() and args[i][name.size()] == '=')
+        {
+            value = args[i].substr(name.size() + 1);
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i));
+            return true;
+        }
+        
+        return false;
+    } };
+    
+    /* extract options; all remaining arguments are treated as file names */
+    for (std::size_t i{ 0 }; i < args.size();)
+    {
+        std::string value{};
+        
+        if (extract_option(i, "--jobs", value))
+        {
+            const auto [ptr, ec]{ std::from_chars(value.data(), value.data() + value.size(), load_jobs) };
+            
+            if (ec != std::errc{} or ptr != value.data() + value.size() or load_jobs == 0)
+            {
+                std::cerr << strings::invalid_jobs(value).str_view() << '\n';
+                return 1;
+            }
+        }
+        else if (extract_option(i, "--history-budget", value))
+        {
+            /* given in MiB */
+            std::size_t mib{ 0 };
+            const auto [ptr, ec]{ std::from_chars(value.data(), value.data() + value.size(), mib) };
+            
+            if (ec != std::errc{} or ptr != value.data() + value.size() or mib == 0 or mib > (std::numeric_limits<std::size_t>::max() >> 20))
+            {
+                std::cerr << strings::invalid_budget(value).str_view() << '\n';
+                return 1;
+            }
+            
+            history_budget = mib << 20;
+        }
+        else if (args[i] == "--lazy")
+        {
+            /* materialize the nodes of each file only as they are needed (for large files) */
+            lazy_load = true;
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        else if (args[i] == "--index")
+        {
+            /* index the text of each node to speed up searches (see core/text_index.hpp) */
+            text_index = true;
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        else if (args[i] == "--paste-nodes")
+        {
+            /* paste text with line breaks as new nodes (nested by indentation) instead of into the current node */
+            paste_as_nodes = true;
+            args.erase(args.begin() + static_cast<std::ptrdiff_t>(i));
+        }
+        else
+        {
+            ++i;
+        }
+    }
 
     int rv{ 0 };
     
     {
         window win{ window::create() };
-        rv = win(args);
+        rv = win(args, load_jobs, history_budget, lazy_load, paste_as_nodes, text_index);
     }
     
     if (rv != 0)
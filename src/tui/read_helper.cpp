@@ -97,15 +97,42 @@ namespace treenote::tui
         return (input_ == KEY_MOUSE);
     }
     
-    /* Reads another char, blocking until a char is read */
-    void char_read_helper::extract_char()
+    /* this should be checked first if extract_char may return on timeout */
+    bool char_read_helper::is_timeout() const noexcept
+    {
+        return (input_info_ == ERR);
+    }
+    
+    /* this should be checked before is_command is checked */
+    bool char_read_helper::is_paste() const
+    {
+        return (input_info_ == KEY_CODE_YES and input_ == key::paste_begin());
+    }
+    
+    /* Checks whether a key has been pressed without waiting for one; such a key is kept, and returned by the next call
+     * to extract_char (so this may be used to give up on slow work once there is more input to act on) */
+    bool char_read_helper::input_pending()
+    {
+        if (carry_over_)
+            return true;
+        
+        begin_fast_extract();
+        force_extract_char();
+        end_fast_extract();
+        
+        carry_over_ = (input_info_ != ERR);
+        return carry_over_;
+    }
+    
+    /* Reads another char, blocking until a char is read (or until the read times out, if return_on_timeout is set) */
+    void char_read_helper::extract_char(const bool return_on_timeout)
     {
         /* do not get new keycode if another key has been got but not acted on */
         if (carry_over_)
             carry_over_ = false;
         else do
             force_extract_char();
-        while (not global_signal_status and input_info_ == ERR);
+        while (not global_signal_status and not return_on_timeout and input_info_ == ERR);
     }
     
     void char_read_helper::extract_second_char()
@@ -151,6 +178,41 @@ namespace treenote::tui
         end_fast_extract();
     }
     
+    /* Extracts the text sent between the start and end of a bracketed paste as one block, in which line breaks are
+     * represented by '\n' and tabs are kept, but other control characters are dropped. This stops early if no more
+     * text arrives before the read times out, so a missing end of paste cannot leave the editor waiting for it.
+     * NOTE: This should only be called after extracting the start of a paste (see is_paste). */
+    void char_read_helper::extract_paste(std::string& pasted)
+    {
+        bool after_cr{ false };
+        
+        for (bool loop{ true }; loop;)
+        {
+            force_extract_char();
+            
+            if (input_info_ == ERR)
+            {
+                loop = false;
+            }
+            else if (input_info_ == KEY_CODE_YES)
+            {
+                /* keys other than the end of the paste (e.g. KEY_ENTER) are not expected within it, and are ignored */
+                loop = (input_ != key::paste_end());
+            }
+            else if (input_ == '\r' or (input_ == '\n' and not after_cr))
+            {
+                /* a line break may be sent as '\r', '\n' or "\r\n" */
+                pasted.push_back('\n');
+            }
+            else if (input_ == '\t' or (input_ >= ' ' and input_ != key_delete))
+            {
+                append_wint_to_string(pasted, input_);
+            }
+            
+            after_cr = (input_info_ == OK and input_ == '\r');
+        }
+    }
+    
     actions char_read_helper::get_action(const keymap::map_t& keymap) const noexcept
     {
         actions action{};
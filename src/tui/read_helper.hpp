@@ -38,9 +38,13 @@ namespace treenote::tui
         [[nodiscard]] bool is_resize() const noexcept;
         [[nodiscard]] bool is_command() const noexcept;
         [[nodiscard]] bool is_mouse() const noexcept;
-        void extract_char();
+        [[nodiscard]] bool is_timeout() const noexcept;
+        [[nodiscard]] bool is_paste() const;
+        [[nodiscard]] bool input_pending();
+        void extract_char(bool return_on_timeout = false);
         void extract_second_char();
         void extract_more_readable_chars(std::string& inserted);
+        void extract_paste(std::string& pasted);
         
         [[nodiscard]] actions get_action(const keymap::map_t& keymap) const noexcept;
         [[nodiscard]] std::size_t extract_multiple_of_same_action(actions target, const keymap::map_t& keymap);
@@ -49,6 +53,7 @@ namespace treenote::tui
     
     private:
         static constexpr wint_t key_escape{ 0x1b };
+        static constexpr wint_t key_delete{ 0x7f };
         void force_extract_char();
         
         wint_t input_{ 0 };
@@ -113,6 +113,11 @@ namespace treenote::tui::strings
     inline const text_string close_prompt           { "Save modified buffer?" };
     inline const text_string file_prompt            { "File Name to Write"};
     inline const text_string goto_prompt            { "Enter node, line, column"};
+    inline const text_string search_prompt          { "Search" };
+    inline const text_string search_backward_prompt { "Search [Backwards]" };
+    inline const text_string replace_prompt         { "Search (to replace) [Regexp]" };
+    inline const text_string replace_sub_prompt     { "Search (to replace) [Regexp] [Subtree]" };
+    inline const text_string replace_with_prompt    { "Replace with" };
     inline const text_string modified               { "Modified" };
     inline const text_string empty_file             { "New Tree" };
     inline const text_string nothing_undo           { "Nothing to undo" };
@@ -137,14 +142,26 @@ namespace treenote::tui::strings
     inline const text_string redo_line_br           { "Redid line break" };
     inline const text_string undo_line_jn           { "Undid line join" };
     inline const text_string redo_line_jn           { "Redid line join" };
+    inline const text_string undo_replace           { "Undid replacement" };
+    inline const text_string redo_replace           { "Redid replacement" };
     inline const text_string cut_error              { "Nothing was cut" };
     inline const text_string copy_error             { "Nothing was copied" };
     inline const text_string paste_error            { "Node cut buffer is empty" };
+    inline const text_string nothing_paste          { "Nothing to paste" };
+    inline const text_string nothing_fold           { "Nothing to fold" };
+    inline const text_string nothing_unfold         { "Nothing to unfold" };
     inline const text_string new_file_msg           { "New file" };
     inline const text_string cancelled              { "Cancelled" };
     inline const text_string invalid_location       { "Invalid tree location" };
+    inline const text_string no_search_pattern      { "No current search pattern" };
+    inline const text_string only_occurrence        { "This is the only occurrence" };
+    inline const text_fstring<1> not_found          { "\"{}\" not found" };
+    inline const text_string invalid_regex          { "Invalid regular expression" };
+    inline const text_fstring<1> replaced           { "Replaced {} occurrences" };
     inline const text_fstring<2> read_success       { "Loaded {} nodes from {} lines" };
+    inline const text_fstring<1> journal_recovered  { "Recovered {} unsaved changes from the journal" };
     inline const text_fstring<2> write_success      { "Wrote {} nodes to {} lines" };
+    inline const text_fstring<1> write_in_progress  { "Writing... ({} KiB)" };
     inline const text_fstring<1> file_is_unwrit     { "File {} is unwritable" };
     inline const text_fstring<2> error_reading      { "Error reading {}: {}" };
     inline const text_fstring<2> error_writing      { "Error writing {}: {}" };
@@ -153,10 +170,12 @@ namespace treenote::tui::strings
     inline const text_string invalid_file           { "Invalid file" };
     inline const text_string permission_denied      { "Permission denied" };
     inline const text_string unknown_error          { "Unknown error" };
-    inline const text_fstring<5> cursor_pos_msg     { "node: {} line_no: {}/{} col: {}/{}" };
+    inline const text_fstring<6> cursor_pos_msg     { "node: {} line_no: {}/{} col: {}/{} history: {} KiB" };
     inline const text_fstring<1> unbound_key        { "Unbound key: {} " };
     inline const text_fstring<1> received           { "Received {}" };
     inline const text_fstring<1> tree_autosave      { "Tree written to {}" };
+    inline const text_fstring<1> invalid_jobs       { "Invalid number of jobs: {}" };
+    inline const text_fstring<1> invalid_budget     { "Invalid history budget (MiB): {}" };
     inline const text_string action_yes             { "Yes" };
     inline const text_string action_no              { "No" };
     inline const text_string action_cancel          { "Cancel" };
@@ -173,6 +192,8 @@ namespace treenote::tui::strings
     inline const text_string action_refresh         { "Refresh" };
     inline const text_string action_location        { "Location" };
     inline const text_string action_go_to           { "Go To" };
+    inline const text_string action_where_is        { "Where Is" };
+    inline const text_string action_where_was       { "Where Was" };
     inline const text_string action_insert_node     { "New Node" };
     inline const text_string action_insert_child    { "New Child" };
     inline const text_string action_delete_node     { "Del Node" };
@@ -196,6 +217,13 @@ namespace treenote::tui::strings
             { actions::cursor_pos,      "Display the position of the cursor" },
             { actions::go_to,           "Go to position in tree" },
             {},
+            { actions::search_forward,  "Search forward for a string" },
+            { actions::search_backward, "Search backward for a string" },
+            { actions::find_next,       "Search next occurrence forward" },
+            { actions::find_previous,   "Search next occurrence backward" },
+            { actions::replace,         "Replace a regular expression throughout the tree" },
+            { actions::replace_subtree, "Replace a regular expression in current tree node and its children" },
+            {},
             { actions::undo,            "Undo the last operation " },
             { actions::redo,            "Redo the last done operation" },
             {},
@@ -216,6 +244,10 @@ namespace treenote::tui::strings
             { actions::node_prev,       "Go to next tree node" },
             { actions::node_next,       "Go to previous tree node" },
             {},
+            { actions::fold_node,       "Fold current tree node (or its parent) to hide its children" },
+            { actions::unfold_node,     "Unfold current tree node to show its children" },
+            { actions::toggle_fold,     "Fold or unfold current tree node" },
+            {},
             { actions::scroll_up,       "Scroll up one line without moving the cursor" },
             { actions::scroll_down,     "Scroll down one line without moving the cursor" },
             { actions::page_up,         "Scroll up one page" },
@@ -20,6 +20,8 @@
 #include "window.hpp"
 
 #include <algorithm>
+#include <cstdlib>
+#include <functional>
 #include <stdexcept>
 #include <utility>
 
@@ -72,13 +74,22 @@ namespace treenote::tui::detail
         {
             for (bool exit{ false }; not exit;)
             {
-                crh_.extract_char();
+                /* while a file is being saved in the background, wake up periodically to show its progress; also wake up
+                 * if the buffer is due to be compacted, so that this is done while no input is being received            */
+                crh_.extract_char(win_->current_file_.save_in_progress() or win_->current_file_.compaction_due());
                 
                 if (global_signal_status)
                     return;
 
                 /* act on input */
-                if (crh_.is_resize())
+                if (crh_.is_timeout())
+                {
+                    /* no input was received */
+                    
+                    if (win_->current_file_.compaction_due())
+                        static_cast<void>(win_->current_file_.compact_buffer());
+                }
+                else if (crh_.is_resize())
                 {
                     /* update overall window size information */
 
@@ -100,6 +111,16 @@ namespace treenote::tui::detail
                         }
                     }
                 }
+                else if (crh_.is_paste())
+                {
+                    /* text has been pasted: send it onwards as one block (or discard it, if there is no input handler) */
+                    
+                    std::string pasted{};
+                    crh_.extract_paste(pasted);
+                    
+                    if constexpr (std::invocable<F2, std::string&>)
+                        std::invoke(input_handler, pasted);
+                }
                 else if (std::invocable<F2> or crh_.is_command())
                 {
                     /* command key sent: execute instruction */
@@ -116,6 +137,7 @@ namespace treenote::tui::detail
                     std::invoke(input_handler, inserted);
                 }
                 
+                win_->update_save_status();
                 std::invoke(common);
             }
             
@@ -151,6 +173,7 @@ namespace treenote::tui
         timeout(100);
         
         intrflush(stdscr, false);
+        idlok(stdscr, true);    // allow doupdate() to scroll the terminal
         keypad(stdscr, true);
         meta(stdscr, true);
         use_extended_names(true);
@@ -173,6 +196,11 @@ namespace treenote::tui
         mousemask(BUTTON1_RELEASED | BUTTON4_PRESSED | BUTTON5_PRESSED | REPORT_MOUSE_POSITION, nullptr);
         mouseinterval(0);
         
+        /* the keys sent around pasted text must be defined before any input is read */
+        static_cast<void>(key::paste_begin());
+        static_cast<void>(key::paste_end());
+        detail::set_bracketed_paste(true);
+        
         std::signal(SIGHUP, signal_handler);
         std::signal(SIGTERM, signal_handler);
         std::signal(SIGQUIT, signal_handler);
@@ -202,7 +230,7 @@ namespace treenote::tui
         
         if (not current_filename_.empty())
         {
-            auto [load_msg, load_info]{ current_file_.load_file(current_filename_) };
+            auto [load_msg, load_info]{ current_file_.load_file(current_filename_, load_jobs_, lazy_load_) };
             
             switch (load_msg)
             {
@@ -231,6 +259,9 @@ namespace treenote::tui
                     status_msg_.set_warning(strings::error_reading(current_filename_.string(), strings::unknown_error.str_view()));
                     break;
             }
+            
+            if (const auto recovered{ current_file_.recovered_edits() }; recovered > 0)
+                status_msg_.set_warning(strings::journal_recovered(recovered));
         }
         else
         {
@@ -239,13 +270,17 @@ namespace treenote::tui
         }
     }
     
-    /* returns true if successful and false otherwise */
-    bool window::tree_save(const bool prompt)
+    /* returns true if successful (or if the save was started, unless wait is set) and false otherwise */
+    bool window::tree_save(const bool prompt, const bool wait)
     {
         using detail::redraw_mask;
         using detail::status_bar_mode;
         using file_msg = core::editor::file_msg;
         
+        /* finish any earlier save first, so that its result is not lost */
+        
+        static_cast<void>(await_save());
+        
         /* get filename if necessary */
         
         if (prompt or current_filename_.empty())
@@ -349,7 +384,7 @@ namespace treenote::tui
                         {
                             /* copied from draw_status */
                             
-                            const auto& file_prompt{ (status_mode_ == status_bar_mode::prompt_filename) ? strings::file_prompt : strings::goto_prompt };
+                            const auto& file_prompt{ detail::prompt_text(status_mode_) };
                             
                             int cursor_display_x{ std::saturate_cast<int>(prompt_info_.cursor_pos) };
                             int start_of_line_index{ 0 };
@@ -389,12 +424,27 @@ namespace treenote::tui
             current_filename_ = prompt_info_.text;
         }
         
-        /* now we actually save the file */
+        /* now we actually save the file; this continues in the background */
         
-        auto [save_msg, save_info]{ current_file_.save_file(current_filename_) };
-        bool success{ false };
+        if (const auto save_msg{ current_file_.save_file_async(current_filename_) }; save_msg != file_msg::none)
+            return show_save_result({ save_msg, {} });
         
-        /* then we display stats / warnings */
+        status_msg_.set_message(strings::write_in_progress(0));
+        
+        if (wait)
+            return await_save().value_or(false);
+        
+        return true;
+    }
+    
+    /* displays stats / warnings for a finished save; returns true if it was successful and false otherwise */
+    bool window::show_save_result(const core::editor::return_t& result)
+    {
+        using detail::redraw_mask;
+        using file_msg = core::editor::file_msg;
+        
+        const auto& [save_msg, save_info]{ result };
+        bool success{ false };
         
         switch (save_msg)
         {
@@ -419,15 +469,51 @@ namespace treenote::tui
                 break;
         }
         
+        screen_redraw_.add_mask(redraw_mask::RD_TOP); /* modified status may have changed */
         return success;
     }
     
+    /* shows the progress of a background save, or its result once it has finished */
+    void window::update_save_status()
+    {
+        if (not current_file_.save_in_progress())
+            return;
+        
+        if (const auto result{ current_file_.poll_save() })
+            show_save_result(*result);
+        else
+            status_msg_.set_message(strings::write_in_progress(current_file_.save_bytes_written() / 1024));
+    }
+    
+    /* blocks until a background save has finished, showing its progress; returns whether it succeeded, if there was one */
+    std::optional<bool> window::await_save()
+    {
+        if (not current_file_.save_in_progress())
+            return std::nullopt;
+        
+        while (not global_signal_status)
+        {
+            if (const auto result{ current_file_.poll_save() })
+                return show_save_result(*result);
+            
+            status_msg_.set_message(strings::write_in_progress(current_file_.save_bytes_written() / 1024));
+            update_screen();
+            napms(100);
+        }
+        
+        /* (the editor waits for the save to finish in any case) */
+        return show_save_result(*current_file_.wait_for_save());
+    }
+    
     /* returns true if successful (i.e. not cancelled) and false otherwise */
     bool window::tree_close()
     {
         using detail::redraw_mask;
         using detail::status_bar_mode;
         
+        /* whether the file is modified is only known once any save in progress has finished */
+        static_cast<void>(await_save());
+        
         if (current_file_.modified())
         {
             auto saved_help_info{ std::move(help_info_) };
@@ -484,7 +570,7 @@ namespace treenote::tui
             else if (*save)
             {
                 /* save tree; an extra prompt will be given if necessary */
-                return tree_save(false);
+                return tree_save(false, true);
             }
         }
         
@@ -604,7 +690,7 @@ namespace treenote::tui
 
     void window::display_tree_pos()
     {
-        const auto& index{ current_file_.cursor_current_index() };
+        const auto index{ current_file_.cursor_current_index() };
         const auto& line{ current_file_.cursor_current_line() };
         const auto max_x{ current_file_.cursor_max_x() };
         const auto max_lines{ current_file_.cursor_max_line() };
@@ -617,7 +703,8 @@ namespace treenote::tui
         if (std::ranges::size(index) > 0)
             node_idx << core::last_index_of(index) + 1;
         
-        status_msg_.set_message(strings::cursor_pos_msg(node_idx.str(), line + 1, max_lines, current_file_.cursor_x() + 1, max_x + 1));
+        status_msg_.set_message(strings::cursor_pos_msg(node_idx.str(), line + 1, max_lines, current_file_.cursor_x() + 1, max_x + 1,
+                                                        (current_file_.history_memory_usage() + 1023) / 1024));
     }
     
     void window::location_prompt()
@@ -728,7 +815,7 @@ namespace treenote::tui
                     {
                         /* copied from draw_status */
                         
-                        const auto& prompt{ (status_mode_ == status_bar_mode::prompt_filename) ? strings::file_prompt : strings::goto_prompt };
+                        const auto& prompt{ detail::prompt_text(status_mode_) };
                         
                         int cursor_display_x{ std::saturate_cast<int>(prompt_info_.cursor_pos) };
                         int start_of_line_index{ 0 };
@@ -827,6 +914,328 @@ namespace treenote::tui
         update_viewport_center_line();
     }
     
+    void window::search_prompt(const bool backwards)
+    {
+        /* mostly copied from location_prompt */
+        
+        using detail::redraw_mask;
+        using detail::status_bar_mode;
+        
+        auto saved_help_info{ std::move(help_info_) };
+        
+        status_mode_ = backwards ? status_bar_mode::prompt_search_backward : status_bar_mode::prompt_search;
+        help_info_ = keymap::make_search_editor_help_bar();
+        screen_redraw_.add_mask(redraw_mask::RD_STATUS, redraw_mask::RD_HELP);
+        bool cancelled{ false };
+        
+        const core::editor::text_pos origin{ .index = core::make_index_copy_of(current_file_.cursor_current_index()),
+                                             .line = current_file_.cursor_current_line(),
+                                             .col = current_file_.cursor_x() };
+        
+        core::legacy_tree_string line_editor{ "" };
+        
+        prompt_info_.text = line_editor.to_str(0);
+        prompt_info_.cursor_pos = line_editor.line_length(0);
+        update_screen();
+        
+        detail::window_event_loop wel{ *this };
+        
+        /* search from origin whenever the text changes; unless cancellable is false, a search is abandoned once another
+         * key is pressed, as that key is likely to change the text again (and if not, the search is redone after it)  */
+        
+        std::string searched_text{};
+        bool matched{ false };
+        
+        const auto search_from_origin{ [&](const bool cancellable) {
+            if (prompt_info_.text == searched_text)
+                return;
+            
+            const auto found{ current_file_.find_text(prompt_info_.text, origin, backwards, true,
+                                                      [&]{ return cancellable and wel.crh().input_pending(); }) };
+            
+            if (not found and cancellable and wel.crh().input_pending())
+                return;
+            
+            searched_text = prompt_info_.text;
+            matched = found.has_value();
+            
+            if (found)
+                current_file_.cursor_go_to(found->index, found->line, found->col);
+            else
+                current_file_.cursor_go_to(origin.index, origin.line, origin.col);
+            
+            update_viewport_pos();
+            screen_redraw_.add_mask(redraw_mask::RD_CONTENT);
+        } };
+        
+        wel(keymap_.make_search_editor_keymap(),
+            [&](const actions action, bool& exit)
+            {
+                switch (action)
+                {
+                    case actions::newline:
+                        /* finish search */
+                        exit = true;
+                        break;
+                    
+                    case actions::backspace:
+                        if (prompt_info_.cursor_pos > 0)
+                        {
+                            std::size_t cursor_dec_amt{ 0 };
+                            line_editor.delete_char_before(0, prompt_info_.cursor_pos, cursor_dec_amt);
+                            
+                            if (cursor_dec_amt > prompt_info_.cursor_pos)
+                                prompt_info_.cursor_pos = 0;
+                            else
+                                prompt_info_.cursor_pos -= cursor_dec_amt;
+                            
+                            prompt_info_.text = line_editor.to_str(0);
+                            screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                        }
+                        break;
+                    
+                    case actions::delete_char:
+                        if (prompt_info_.cursor_pos < line_editor.line_length(0))
+                        {
+                            line_editor.delete_char_current(0, prompt_info_.cursor_pos);
+                            
+                            prompt_info_.text = line_editor.to_str(0);
+                            screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                        }
+                        break;
+                    
+                    case actions::cursor_left:
+                        if (prompt_info_.cursor_pos > 0)
+                            --prompt_info_.cursor_pos;
+                        
+                        /* redraw only if possible for a horizontal scroll */
+                        if (prompt_info_.text.size() > static_cast<std::size_t>(std::max(0, (sub_win_status_.size().x - 2 - detail::prompt_text(status_mode_).length()))))
+                            screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                        break;
+                    
+                    case actions::cursor_right:
+                        if (prompt_info_.cursor_pos < line_editor.line_length(0))
+                            ++prompt_info_.cursor_pos;
+                        
+                        /* redraw only if possible for a horizontal scroll */
+                        if (prompt_info_.text.size() > static_cast<std::size_t>(std::max(0, (sub_win_status_.size().x - 2 - detail::prompt_text(status_mode_).length()))))
+                            screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                        break;
+                    
+                    case actions::prompt_cancel:
+                        /* cancel search */
+                        exit = true;
+                        cancelled = true;
+                        break;
+                    
+                    default:
+                        break;
+                }
+            },
+            [&](const std::string& input)
+            {
+                std::size_t cursor_inc_amt{ 0 };
+                line_editor.insert_str(0, prompt_info_.cursor_pos, input, cursor_inc_amt);
+                
+                prompt_info_.cursor_pos += cursor_inc_amt;
+                prompt_info_.text = line_editor.to_str(0);
+                screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+            },
+            [&](const MEVENT& /* mouse */) {},
+            [&]
+            {
+                search_from_origin(true);
+                update_screen();
+            }
+        );
+        
+        status_mode_ = status_bar_mode::default_mode;
+        help_info_ = std::move(saved_help_info);
+        screen_redraw_.add_mask(redraw_mask::RD_STATUS, redraw_mask::RD_HELP, redraw_mask::RD_CONTENT);
+        
+        if (cancelled)
+        {
+            current_file_.cursor_go_to(origin.index, origin.line, origin.col);
+            update_viewport_pos();
+            status_msg_.set_message(strings::cancelled);
+            return;
+        }
+        
+        if (prompt_info_.text.empty())
+        {
+            /* search for the previous text again, like nano */
+            search_again(backwards);
+            return;
+        }
+        
+        last_search_ = prompt_info_.text;
+        
+        /* finish any search abandoned for keys pressed just before enter */
+        search_from_origin(false);
+        
+        if (not matched)
+            status_msg_.set_message(strings::not_found(last_search_));
+    }
+    
+    void window::search_again(const bool backwards)
+    {
+        using detail::redraw_mask;
+        
+        if (last_search_.empty())
+        {
+            status_msg_.set_message(strings::no_search_pattern);
+            return;
+        }
+        
+        const core::editor::text_pos from{ .index = core::make_index_copy_of(current_file_.cursor_current_index()),
+                                           .line = current_file_.cursor_current_line(),
+                                           .col = current_file_.cursor_x() };
+        
+        const auto found{ current_file_.find_text(last_search_, from, backwards, false, {}) };
+        
+        if (not found)
+        {
+            status_msg_.set_message(strings::not_found(last_search_));
+            return;
+        }
+        
+        if (found->index == from.index and found->line == from.line and found->col == from.col)
+            status_msg_.set_message(strings::only_occurrence);
+        
+        current_file_.cursor_go_to(found->index, found->line, found->col);
+        screen_redraw_.add_mask(redraw_mask::RD_CONTENT);
+        update_viewport_pos();
+    }
+    
+    void window::replace_prompt(const bool subtree)
+    {
+        /* mostly copied from search_prompt, but asks for the pattern and then the replacement */
+        
+        using detail::redraw_mask;
+        using detail::status_bar_mode;
+        
+        auto saved_help_info{ std::move(help_info_) };
+        help_info_ = keymap::make_search_editor_help_bar();
+        
+        /* returns the text entered at a prompt in mode, or nullopt if the prompt is cancelled */
+        const auto prompt{ [&](const status_bar_mode mode) -> std::optional<std::string> {
+            status_mode_ = mode;
+            screen_redraw_.add_mask(redraw_mask::RD_STATUS, redraw_mask::RD_HELP);
+            bool cancelled{ false };
+            
+            core::legacy_tree_string line_editor{ "" };
+            
+            prompt_info_.text = line_editor.to_str(0);
+            prompt_info_.cursor_pos = line_editor.line_length(0);
+            update_screen();
+            
+            detail::window_event_loop wel{ *this };
+            wel(keymap_.make_search_editor_keymap(),
+                [&](const actions action, bool& exit)
+                {
+                    switch (action)
+                    {
+                        case actions::newline:
+                            exit = true;
+                            break;
+                        
+                        case actions::backspace:
+                            if (prompt_info_.cursor_pos > 0)
+                            {
+                                std::size_t cursor_dec_amt{ 0 };
+                                line_editor.delete_char_before(0, prompt_info_.cursor_pos, cursor_dec_amt);
+                                
+                                if (cursor_dec_amt > prompt_info_.cursor_pos)
+                                    prompt_info_.cursor_pos = 0;
+                                else
+                                    prompt_info_.cursor_pos -= cursor_dec_amt;
+                                
+                                prompt_info_.text = line_editor.to_str(0);
+                                screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                            }
+                            break;
+                        
+                        case actions::delete_char:
+                            if (prompt_info_.cursor_pos < line_editor.line_length(0))
+                            {
+                                line_editor.delete_char_current(0, prompt_info_.cursor_pos);
+                                
+                                prompt_info_.text = line_editor.to_str(0);
+                                screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                            }
+                            break;
+                        
+                        case actions::cursor_left:
+                            if (prompt_info_.cursor_pos > 0)
+                                --prompt_info_.cursor_pos;
+                            
+                            /* redraw only if possible for a horizontal scroll */
+                            if (prompt_info_.text.size() > static_cast<std::size_t>(std::max(0, (sub_win_status_.size().x - 2 - detail::prompt_text(status_mode_).length()))))
+                                screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                            break;
+                        
+                        case actions::cursor_right:
+                            if (prompt_info_.cursor_pos < line_editor.line_length(0))
+                                ++prompt_info_.cursor_pos;
+                            
+                            /* redraw only if possible for a horizontal scroll */
+                            if (prompt_info_.text.size() > static_cast<std::size_t>(std::max(0, (sub_win_status_.size().x - 2 - detail::prompt_text(status_mode_).length()))))
+                                screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                            break;
+                        
+                        case actions::prompt_cancel:
+                            exit = true;
+                            cancelled = true;
+                            break;
+                        
+                        default:
+                            break;
+                    }
+                },
+                [&](const std::string& input)
+                {
+                    std::size_t cursor_inc_amt{ 0 };
+                    line_editor.insert_str(0, prompt_info_.cursor_pos, input, cursor_inc_amt);
+                    
+                    prompt_info_.cursor_pos += cursor_inc_amt;
+                    prompt_info_.text = line_editor.to_str(0);
+                    screen_redraw_.add_mask(redraw_mask::RD_STATUS);
+                },
+                [&](const MEVENT& /* mouse */) {},
+                [&] { update_screen(); }
+            );
+            
+            if (cancelled)
+                return std::nullopt;
+            
+            return prompt_info_.text;
+        } };
+        
+        const auto pattern{ prompt(subtree ? status_bar_mode::prompt_replace_subtree : status_bar_mode::prompt_replace) };
+        const auto replacement{ (pattern and not pattern->empty()) ? prompt(status_bar_mode::prompt_replace_with) : std::nullopt };
+        
+        status_mode_ = status_bar_mode::default_mode;
+        help_info_ = std::move(saved_help_info);
+        screen_redraw_.add_mask(redraw_mask::RD_STATUS, redraw_mask::RD_HELP, redraw_mask::RD_CONTENT);
+        
+        if (not replacement)
+        {
+            status_msg_.set_message(strings::cancelled);
+            return;
+        }
+        
+        const auto count{ current_file_.replace_text(*pattern, *replacement, subtree, load_jobs_) };
+        
+        if (not count)
+            status_msg_.set_message(strings::invalid_regex);
+        else if (*count == 0)
+            status_msg_.set_message(strings::not_found(*pattern));
+        else
+            status_msg_.set_message(strings::replaced(*count));
+        
+        update_viewport_pos();
+    }
+    
     void window::undo()
     {
         using detail::redraw_mask;
@@ -864,6 +1273,9 @@ namespace treenote::tui
             case cmd_names::line_join:
                 status_msg_.set_message(strings::undo_line_jn);
                 break;
+            case cmd_names::replace_text:
+                status_msg_.set_message(strings::undo_replace);
+                break;
             case cmd_names::none:
                 /* don't display a message */
                 break;
@@ -910,6 +1322,9 @@ namespace treenote::tui
             case cmd_names::line_join:
                 status_msg_.set_message(strings::redo_line_jn);
                 break;
+            case cmd_names::replace_text:
+                status_msg_.set_message(strings::redo_replace);
+                break;
             case cmd_names::none:
                 /* don't display a message */
                 break;
@@ -1152,11 +1567,11 @@ namespace treenote::tui
             {
                 wprintw(*sub_win_status_, "%s ", strings::close_prompt.c_str());
             }
-            else if (status_mode_ == status_bar_mode::prompt_filename or status_mode_ == status_bar_mode::prompt_location)
+            else if (detail::is_text_prompt(status_mode_))
             {
                 /* handle long inputs with a scrolling system */
                 
-                const auto& prompt{ (status_mode_ == status_bar_mode::prompt_filename) ? strings::file_prompt : strings::goto_prompt };
+                const auto& prompt{ detail::prompt_text(status_mode_) };
                 
                 int cursor_x{ std::saturate_cast<int>(prompt_info_.cursor_pos) };
                 int start_of_line_index{ 0 };
@@ -1299,6 +1714,8 @@ namespace treenote::tui
         
         if (/* entry.index.size() == 1  and */ entry.line_no != 0)
             mvwprintw(*sub_win_sidebar_, display_line, 0, " ↳");
+        else if (core::editor::get_entry_folded(entry))
+            mvwprintw(*sub_win_sidebar_, display_line, 0, " ▸");
         else
             mvwprintw(*sub_win_sidebar_, display_line, 0, "  ");
     }
@@ -1336,7 +1753,7 @@ namespace treenote::tui
         else
         {
             /* disregard first n characters of prefix */
-            std::string line_prefix{ core::make_line_string_default(current_file_.get_entry_prefix(entry)) };
+            std::string line_prefix{ current_file_.get_entry_prefix(entry) };
             core::utf8::drop_first_n_chars(line_prefix, start_of_line_index);
             const std::size_t content_length{ sub_win_content_.size().x + start_of_line_index - prefix_length };
             const std::string line_content{ core::editor::get_entry_content(entry, 0, content_length) };
@@ -1372,7 +1789,7 @@ namespace treenote::tui
         using detail::color_type;
         
         const std::size_t prefix_length{ core::editor::get_entry_prefix_length(entry) * 4 };
-        const std::string line_prefix{ core::make_line_string_default(current_file_.get_entry_prefix(entry)) };
+        const std::string& line_prefix{ current_file_.get_entry_prefix(entry) };
         const std::size_t line_length{ core::editor::get_entry_line_length(entry) };
         const std::string line_content{ core::editor::get_entry_content(entry, 0, sub_win_content_.size().x - prefix_length) };
         
@@ -1391,8 +1808,67 @@ namespace treenote::tui
             draw_sidebar_line(display_line, entry);
     }
     
+    /* Returns a value identifying what draw_content_non_current_line_no_wrap() puts on the
+     * row for entry, so that rows which are already on screen are not redrawn. The value is
+     * always odd, leaving even values free for blank_row_fingerprint and unknown_row_fingerprint */
+    std::size_t window::row_fingerprint(const tce& entry) const
+    {
+        const std::size_t prefix_length{ core::editor::get_entry_prefix_length(entry) * 4 };
+        const std::size_t line_length{ core::editor::get_entry_line_length(entry) };
+        const std::string line_content{ core::editor::get_entry_content(entry, 0, sub_win_content_.size().x - prefix_length) };
+        
+        const bool overflows{ std::saturate_cast<int>(line_length + prefix_length) > sub_win_content_.size().x };
+        const std::size_t sidebar{ (entry.line_no != 0) ? 1uz : (core::editor::get_entry_folded(entry) ? 2uz : 0uz) };
+        
+        const std::size_t result{ std::hash<std::string_view>{}(current_file_.get_entry_prefix(entry))
+                                  ^ (std::hash<std::string_view>{}(line_content) * 0x9e3779b97f4a7c15)
+                                  ^ (sidebar << 2 | static_cast<std::size_t>(overflows) << 1) };
+        return result | 1;
+    }
+    
+    /* Moves the rows of the content and sidebar windows up by lines (or down, if negative),
+     * along with their fingerprints. Since idlok() is set, doupdate() can then scroll the
+     * terminal instead of redrawing every row after the viewport moves vertically.        */
+    void window::scroll_content(const std::ptrdiff_t lines)
+    {
+        const std::ptrdiff_t height{ std::ssize(row_fingerprints_) };
+        
+        if (lines == 0)
+            return;
+        
+        if (std::abs(lines) >= height)
+        {
+            row_fingerprints_.assign(row_fingerprints_.size(), unknown_row_fingerprint);
+            return;
+        }
+        
+        /* scrollok() is only enabled while scrolling, since otherwise writing
+         * to the bottom right corner of the window would scroll it as well   */
+        for (detail::sub_window* win : { &sub_win_content_, &sub_win_sidebar_ })
+        {
+            if (not *win)
+                continue;
+            
+            scrollok(**win, true);
+            wscrl(**win, std::saturate_cast<int>(lines));
+            scrollok(**win, false);
+        }
+        
+        if (lines > 0)
+        {
+            std::shift_left(row_fingerprints_.begin(), row_fingerprints_.end(), lines);
+            std::fill(row_fingerprints_.end() - lines, row_fingerprints_.end(), blank_row_fingerprint);
+        }
+        else
+        {
+            std::shift_right(row_fingerprints_.begin(), row_fingerprints_.end(), -lines);
+            std::fill(row_fingerprints_.begin(), row_fingerprints_.begin() - lines, blank_row_fingerprint);
+        }
+    }
+    
     /* Called via window::update_window();
-     * doupdate() must be called after calling this function. */
+     * doupdate() must be called after calling this function.
+     * Only rows whose fingerprint has changed since they were last drawn are redrawn. */
     void window::draw_content_no_wrap(coord& default_cursor_pos)
     {
         using detail::status_bar_mode;
@@ -1401,38 +1877,76 @@ namespace treenote::tui
         if (not sub_win_content_)
             return;
         
-        wclear(*sub_win_content_);
-        sub_win_content_.set_default_color(color_type::standard, term_has_color_);
+        const int height{ sub_win_content_.size().y };
         
-        if (sub_win_sidebar_)
+        if (std::ssize(row_fingerprints_) != height)
         {
-            wclear(*sub_win_sidebar_);
-            sub_win_sidebar_.set_default_color(color_type::standard, term_has_color_);
-            sub_win_sidebar_.set_color(color_type::inverse, term_has_color_);
+            /* nothing on screen is known: start again from blank windows */
+            werase(*sub_win_content_);
+            sub_win_content_.set_default_color(color_type::standard, term_has_color_);
+            
+            if (sub_win_sidebar_)
+            {
+                werase(*sub_win_sidebar_);
+                sub_win_sidebar_.set_default_color(color_type::standard, term_has_color_);
+                sub_win_sidebar_.set_color(color_type::inverse, term_has_color_);
+            }
+            
+            row_fingerprints_.assign(height, blank_row_fingerprint);
+        }
+        else
+        {
+            scroll_content(std::saturate_cast<std::ptrdiff_t>(line_start_y_) - std::saturate_cast<std::ptrdiff_t>(drawn_line_start_));
         }
         
-
+        drawn_line_start_ = line_start_y_;
+        
+        const auto clear_row{ [&](const int display_line) {
+            wmove(*sub_win_content_, display_line, 0);
+            wclrtoeol(*sub_win_content_);
+            
+            if (sub_win_sidebar_)
+            {
+                wmove(*sub_win_sidebar_, display_line, 0);
+                wclrtoeol(*sub_win_sidebar_);
+            }
+        } };
+        
         int display_line{ 0 };
-        auto lc{ current_file_.get_lc_range(line_start_y_, sub_win_content_.size().y) };
+        auto lc{ current_file_.get_lc_range(line_start_y_, height) };
         
         for (const auto& entry: lc)
         {
             if (display_line == default_cursor_pos.y and status_mode_ == status_bar_mode::default_mode)
+            {
+                /* the current line depends on the cursor, so it is always redrawn */
+                clear_row(display_line);
                 draw_content_current_line_no_wrap(display_line, entry, default_cursor_pos.x, true);
-            else
+                row_fingerprints_[display_line] = unknown_row_fingerprint;
+            }
+            else if (const std::size_t fingerprint{ row_fingerprint(entry) }; fingerprint != row_fingerprints_[display_line])
+            {
+                clear_row(display_line);
                 draw_content_non_current_line_no_wrap(display_line, entry, true);
+                row_fingerprints_[display_line] = fingerprint;
+            }
             
             ++display_line;
         }
         
-        touchline(*sub_win_content_, 0, sub_win_content_.size().y);
+        for (; display_line < height; ++display_line)
+        {
+            if (row_fingerprints_[display_line] != blank_row_fingerprint)
+            {
+                clear_row(display_line);
+                row_fingerprints_[display_line] = blank_row_fingerprint;
+            }
+        }
+        
         wnoutrefresh(*sub_win_content_);
         
         if (sub_win_sidebar_)
-        {
-            touchline(*sub_win_sidebar_, 0, sub_win_content_.size().y);
             wnoutrefresh(*sub_win_sidebar_);
-        }
     }
     
     /* Called via window::update_window();
@@ -1463,6 +1977,9 @@ namespace treenote::tui
         draw_content_current_line_no_wrap(default_cursor_pos.y, *(std::ranges::begin(lc) + default_cursor_pos.y), default_cursor_pos.x, false);
         touchline(*sub_win_content_, default_cursor_pos.y, 1);
         
+        if (default_cursor_pos.y < std::ssize(row_fingerprints_))
+            row_fingerprints_[default_cursor_pos.y] = unknown_row_fingerprint;
+        
         /* assume that the screen position has not moved, since if it has, redraw_mask::RD_CONTENT
          * will have been set, so this function should not have been called in the first place      */
         if (previous_cursor_y != default_cursor_pos.y)
@@ -1471,6 +1988,9 @@ namespace treenote::tui
             wclrtoeol(*sub_win_content_);
             draw_content_non_current_line_no_wrap(previous_cursor_y, *(std::ranges::begin(lc) + previous_cursor_y), false);
             touchline(*sub_win_content_, previous_cursor_y, 1);
+            
+            if (previous_cursor_y < std::ssize(row_fingerprints_))
+                row_fingerprints_[previous_cursor_y] = unknown_row_fingerprint;
         }
         
         wnoutrefresh(*sub_win_content_);
@@ -1488,6 +2008,7 @@ namespace treenote::tui
         
         wclear(*sub_win_content_);
         sub_win_content_.set_default_color(color_type::standard, term_has_color_);
+        row_fingerprints_.clear();
 
         // TODO: add (and draw) introduction text for the help screen
         
@@ -1558,11 +2079,11 @@ namespace treenote::tui
         {
             move(sub_win_status_.pos().y, std::min(sub_win_status_.pos().x + strings::close_prompt.length() + 1, sub_win_status_.size().x - 1));
         }
-        else if (status_mode_ == status_bar_mode::prompt_filename or status_mode_ == status_bar_mode::prompt_location)
+        else if (detail::is_text_prompt(status_mode_))
         {
             /* handle long filenames with a scrolling system */
             
-            const auto& prompt{ (status_mode_ == status_bar_mode::prompt_filename) ? strings::file_prompt : strings::goto_prompt };
+            const auto& prompt{ detail::prompt_text(status_mode_) };
             int cursor_x{ std::saturate_cast<int>(prompt_info_.cursor_pos) };
             
             const int line_start_pos{ std::max(std::min(prompt.length() + 2, sub_win_status_.size().x - 4), 2) };
@@ -1593,7 +2114,10 @@ namespace treenote::tui
                           .x = std::saturate_cast<int>(current_file_.cursor_x() + current_file_.cursor_current_indent_lvl() * 4) };
         
         if (screen_redraw_.has_mask(redraw_mask::RD_ALL))
+        {
             clear();
+            row_fingerprints_.clear();
+        }
         
         if (screen_redraw_.has_mask(redraw_mask::RD_TOP))
             draw_top();
@@ -1775,10 +2299,17 @@ namespace treenote::tui
 
     /* Main function for main_window */
     
-    int window::operator()(std::deque<std::string>& filenames)
+    int window::operator()(std::deque<std::string>& filenames, const unsigned int load_jobs, const std::size_t history_budget,
+                           const bool lazy_load, const bool paste_as_nodes, const bool text_index)
     {
         using detail::redraw_mask;
         
+        load_jobs_ = load_jobs;
+        lazy_load_ = lazy_load;
+        paste_as_nodes_ = paste_as_nodes;
+        current_file_.set_history_budget(history_budget);
+        current_file_.set_indexing(text_index);
+        
         const auto editor_keymap{ keymap_.make_editor_keymap() };
         
         do
@@ -1811,8 +2342,10 @@ namespace treenote::tui
                             tree_save(false);
                             break;
                         case actions::suspend:
+                            detail::set_bracketed_paste(false);
                             endwin();
                             std::raise(SIGSTOP);
+                            detail::set_bracketed_paste(true);
                             screen_redraw_.set_all();
                             break;
                             
@@ -1822,6 +2355,25 @@ namespace treenote::tui
                         case actions::go_to:
                             location_prompt();
                             break;
+                        
+                        case actions::search_forward:
+                            search_prompt(false);
+                            break;
+                        case actions::search_backward:
+                            search_prompt(true);
+                            break;
+                        case actions::find_next:
+                            search_again(false);
+                            break;
+                        case actions::find_previous:
+                            search_again(true);
+                            break;
+                        case actions::replace:
+                            replace_prompt(false);
+                            break;
+                        case actions::replace_subtree:
+                            replace_prompt(true);
+                            break;
                             
                         case actions::cut_node:
                             if (current_file_.node_cut() != 0)
@@ -2019,6 +2571,27 @@ namespace treenote::tui
                             current_file_.cursor_nd_next();
                             update_viewport_pos(current_file_.cursor_max_line());
                             break;
+                        
+                        /* Folding: */
+                        
+                        case actions::fold_node:
+                            if (current_file_.node_fold() != 0)
+                                status_msg_.set_message(strings::nothing_fold);
+                            screen_redraw_.add_mask(redraw_mask::RD_CONTENT);
+                            update_viewport_pos();
+                            break;
+                        case actions::unfold_node:
+                            if (current_file_.node_unfold() != 0)
+                                status_msg_.set_message(strings::nothing_unfold);
+                            screen_redraw_.add_mask(redraw_mask::RD_CONTENT);
+                            update_viewport_pos();
+                            break;
+                        case actions::toggle_fold:
+                            if (current_file_.node_toggle_fold() != 0)
+                                status_msg_.set_message(strings::nothing_fold);
+                            screen_redraw_.add_mask(redraw_mask::RD_CONTENT);
+                            update_viewport_pos();
+                            break;
                             
                         /* Line input keys */
                         
@@ -2059,7 +2632,26 @@ namespace treenote::tui
                 },
                 [&](const std::string& inserted)
                 {
-                    current_file_.line_insert_text(inserted);
+                    if (not inserted.contains('\n'))
+                    {
+                        current_file_.line_insert_text(inserted);
+                    }
+                    else
+                    {
+                        /* text with line breaks can only have been pasted */
+                        if (paste_as_nodes_)
+                        {
+                            if (current_file_.node_paste_text(inserted) != 0)
+                                status_msg_.set_message(strings::nothing_paste);
+                        }
+                        else
+                        {
+                            current_file_.line_insert_block(inserted);
+                        }
+                        
+                        screen_redraw_.add_mask(redraw_mask::RD_CONTENT);
+                        update_viewport_pos();
+                    }
                 },
                 [&](const MEVENT& mouse)
                 {
@@ -26,6 +26,7 @@
 #include <locale>
 #include <string>
 #include <string_view>
+#include <vector>
 
 #include "../core/editor.hpp"
 
@@ -50,7 +51,9 @@ namespace treenote::tui
         window& operator=(window&&) = delete;
         ~window() = default;
         
-        int operator()(std::deque<std::string>& filenames);
+        int operator()(std::deque<std::string>& filenames, unsigned int load_jobs = 1,
+                       std::size_t history_budget = core::operation_stack::default_memory_budget, bool lazy_load = false,
+                       bool paste_as_nodes = false, bool text_index = false);
         
         inline static std::filesystem::path                     autosave_path{};
         inline static std::optional<core::editor::file_msg>       autosave_msg{};
@@ -61,12 +64,18 @@ namespace treenote::tui
         window();
     
         void tree_open();
-        bool tree_save(bool prompt);
+        bool tree_save(bool prompt, bool wait = false);
         [[nodiscard]] bool tree_close();
+        bool show_save_result(const core::editor::return_t& result);
+        void update_save_status();
+        std::optional<bool> await_save();
         
         void help_screen();
         void display_tree_pos();
         void location_prompt();
+        void search_prompt(bool backwards);
+        void search_again(bool backwards);
+        void replace_prompt(bool subtree);
         
         void undo();
         void redo();
@@ -80,6 +89,8 @@ namespace treenote::tui
         void draw_sidebar_line(int display_line, const tce& entry);
         void draw_content_current_line_no_wrap(int display_line, const tce& entry, int& cursor_x, bool draw_sidebar);
         void draw_content_non_current_line_no_wrap(int display_line, const tce& entry, bool draw_sidebar);
+        [[nodiscard]] std::size_t row_fingerprint(const tce& entry) const;
+        void scroll_content(std::ptrdiff_t lines);
         void draw_content_no_wrap(coord& default_cursor_pos);
         void draw_content_selective_no_wrap(coord& default_cursor_pos);
         void draw_content_help_mode_no_wrap(const keymap::bindings_t& bindings);
@@ -98,11 +109,21 @@ namespace treenote::tui
         std::locale                 new_locale_{ "" };
         std::filesystem::path       current_filename_{ "" };
         core::editor                current_file_;
+        unsigned int                load_jobs_{ 1 };
+        bool                        lazy_load_{ false };
+        bool                        paste_as_nodes_{ false };
+        std::string                 last_search_{};
         coord                       screen_dimensions_{ .y = 0, .x = 0 };
         
         std::size_t                 line_start_y_{ 0 };
         int                         previous_cursor_y{ 0 };
         
+        static constexpr std::size_t blank_row_fingerprint{ 0 };
+        static constexpr std::size_t unknown_row_fingerprint{ 2 };
+        
+        std::vector<std::size_t>    row_fingerprints_;
+        std::size_t                 drawn_line_start_{ 0 };
+        
         unsigned char               help_height_{ 2 };
         unsigned char               sidebar_width_{ 2 };
         bool                        term_has_color_ { false };
@@ -22,6 +22,8 @@
 
 #include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <utility>
 #include <variant>
 
 #include <curses.h>
@@ -54,15 +56,61 @@ namespace treenote::tui::detail
         default_mode,
         prompt_close,
         prompt_filename,
-        prompt_location
+        prompt_location,
+        prompt_search,
+        prompt_search_backward,
+        prompt_replace,
+        prompt_replace_subtree,
+        prompt_replace_with
     };
+    
+    /* The prompts in which a line of text is entered, and the text shown before it */
+    
+    inline bool is_text_prompt(const status_bar_mode mode) noexcept
+    {
+        return mode == status_bar_mode::prompt_filename or mode == status_bar_mode::prompt_location
+               or mode == status_bar_mode::prompt_search or mode == status_bar_mode::prompt_search_backward
+               or mode == status_bar_mode::prompt_replace or mode == status_bar_mode::prompt_replace_subtree
+               or mode == status_bar_mode::prompt_replace_with;
+    }
+    
+    inline const strings::text_string& prompt_text(const status_bar_mode mode)
+    {
+        switch (mode)
+        {
+            case status_bar_mode::prompt_filename:
+                return strings::file_prompt;
+            case status_bar_mode::prompt_location:
+                return strings::goto_prompt;
+            case status_bar_mode::prompt_search:
+                return strings::search_prompt;
+            case status_bar_mode::prompt_search_backward:
+                return strings::search_backward_prompt;
+            case status_bar_mode::prompt_replace:
+                return strings::replace_prompt;
+            case status_bar_mode::prompt_replace_subtree:
+                return strings::replace_sub_prompt;
+            case status_bar_mode::prompt_replace_with:
+                return strings::replace_with_prompt;
+            default:
+                std::unreachable();
+        }
+    }
 
+    /* Bracketed paste: while enabled, the terminal sends key::paste_begin() and key::paste_end() around pasted text */
+    
+    inline void set_bracketed_paste(const bool enabled)
+    {
+        putp(enabled ? "\x1b[?2004h" : "\x1b[?2004l");
+        std::fflush(stdout);
+    }
+    
     /* Provides a way of calling endwin() after sub_windows are destroyed  */
 
     struct defer_endwin
     {
         defer_endwin() = default;
-        ~defer_endwin() { endwin(); }
+        ~defer_endwin() { set_bracketed_paste(false); endwin(); }
         
         defer_endwin(const defer_endwin&) = delete;
         defer_endwin(defer_endwin&&) = delete;